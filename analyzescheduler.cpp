@@ -0,0 +1,254 @@
+#include <fstream>
+#include <unordered_map>
+
+#include "analyzescheduler.h"
+#include "busyhandler.h"
+#include "logger.h"
+#include "sqlitewrap.h"
+
+
+namespace
+{
+    const char* const stat4_copy = "sqlitewrap_stat4";
+
+    double elapsed_ms(std::chrono::steady_clock::time_point since)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+    }
+
+    bool table_exists(sqlite3* handle, const char* name, const char* schema = "sqlite_master")
+    {
+        std::string sql = std::string("SELECT 1 FROM ") + schema + " WHERE type = 'table' AND name = ?;";
+        sqlite3_stmt* statement = nullptr;
+        bool found = sqlite3_prepare_v2(handle, sql.c_str(), -1, &statement, nullptr) == SQLITE_OK
+                     && sqlite3_bind_text(statement, 1, name, -1, SQLITE_STATIC) == SQLITE_OK
+                     && sqlite3_step(statement) == SQLITE_ROW;
+        sqlite3_finalize(statement);
+        return found;
+    }
+
+    // one INSERT statement per row, values written by quote()
+    bool write_inserts(sqlite3* handle, const char* select, std::ofstream& out)
+    {
+        sqlite3_stmt* statement = nullptr;
+        if (sqlite3_prepare_v2(handle, select, -1, &statement, nullptr) != SQLITE_OK) return false;
+
+        int rc;
+        while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+            out << reinterpret_cast<const char*>(sqlite3_column_text(statement, 0)) << "\n";
+
+        sqlite3_finalize(statement);
+        return rc == SQLITE_DONE;
+    }
+}
+
+
+AnalyzeScheduler::AnalyzeScheduler(SqliteWrap &db)
+    : _db(db)
+{
+}
+
+
+AnalyzeScheduler::~AnalyzeScheduler()
+{
+    stop();
+}
+
+
+bool AnalyzeScheduler::start(const AnalyzeOptions &options)
+{
+    if (!_db.get_handle()) return error("start", "Database not connected.");
+
+    _options = options;
+    _last_run = std::chrono::steady_clock::now();
+    _metrics = AnalyzeMetrics();
+    _running = true;
+
+    _db.set_optimize_on_close(options.on_close ? options.analysis_limit : -1);
+
+    return true;
+}
+
+
+void AnalyzeScheduler::stop()
+{
+    if (!_running) return;
+
+    _db.set_optimize_on_close(-1);
+    _running = false;
+}
+
+
+bool AnalyzeScheduler::optimize()
+{
+    sqlite3* handle = _db.get_handle();
+    if (!handle) return error("optimize", "Database not connected.");
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::string sql = "PRAGMA analysis_limit = " + std::to_string(_options.analysis_limit) + "; PRAGMA optimize;";
+    if (sqlite3_exec(handle, sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) return error("optimize", sqlite3_errmsg(handle));
+
+    _last_run = std::chrono::steady_clock::now();
+    _metrics.runs++;
+    _metrics.last_duration_ms = elapsed_ms(start);
+    _metrics.total_duration_ms += _metrics.last_duration_ms;
+
+    compare_plans();
+
+    return true;
+}
+
+
+bool AnalyzeScheduler::optimize_if_due()
+{
+    if (!_running) return error("optimize_if_due", "Scheduler not started.");
+
+    sqlite3* handle = _db.get_handle();
+    if (!handle) return error("optimize_if_due", "Database not connected.");
+
+    // ANALYZE takes the write lock : never inside a transaction of the application
+    if (!sqlite3_get_autocommit(handle) || elapsed_ms(_last_run) < _options.interval_ms) return true;
+
+    return optimize();
+}
+
+
+bool AnalyzeScheduler::watch(const std::string &sql)
+{
+    std::string plan;
+    if (!query_plan(sql, plan)) return false;
+
+    _watched[BusyHandler::digest(sql)] = { sql, plan };
+    return true;
+}
+
+
+void AnalyzeScheduler::unwatch(const std::string &sql)
+{
+    _watched.erase(BusyHandler::digest(sql));
+}
+
+
+std::vector<PlanChange> AnalyzeScheduler::take_plan_changes()
+{
+    std::vector<PlanChange> changes;
+    changes.swap(_plan_changes);
+    return changes;
+}
+
+
+bool AnalyzeScheduler::export_stats(const std::string &pathfile)
+{
+    sqlite3* handle = _db.get_handle();
+    if (!handle) return error("export_stats", "Database not connected.");
+
+    std::ofstream out(pathfile, std::ios::out | std::ios::trunc);
+    if (!out.is_open()) return error("export_stats", "Unable to open " + pathfile);
+
+    // same separator as get_database_schema() : one sqlite3_exec() per block.
+    // ANALYZE sqlite_schema creates the statistics tables, the last one loads the rows
+    // into the planner.
+    out << "@@@sql@@@\nANALYZE sqlite_schema;\nDELETE FROM sqlite_stat1;\n";
+
+    bool ok = !table_exists(handle, "sqlite_stat1")
+              || write_inserts(handle, "SELECT 'INSERT INTO sqlite_stat1(tbl, idx, stat) VALUES (' || quote(tbl) || ', ' || quote(idx) || ', ' || quote(stat) || ');' FROM sqlite_stat1;", out);
+
+    // sqlite_stat4 cannot be created by a statement (reserved name) and only exists when the
+    // target is built with SQLITE_ENABLE_STAT4 : its rows go to a temporary table, that
+    // import_stats() copies when the target has sqlite_stat4
+    if (ok && table_exists(handle, "sqlite_stat4"))
+    {
+        out << "CREATE TEMP TABLE IF NOT EXISTS " << stat4_copy << "(tbl, idx, neq, nlt, ndlt, sample);\nDELETE FROM temp." << stat4_copy << ";\n";
+        std::string select = std::string("SELECT 'INSERT INTO temp.") + stat4_copy + "(tbl, idx, neq, nlt, ndlt, sample) VALUES (' || quote(tbl) || ', ' || quote(idx) || ', ' "
+                             "|| quote(neq) || ', ' || quote(nlt) || ', ' || quote(ndlt) || ', ' || quote(sample) || ');' FROM sqlite_stat4;";
+        ok = write_inserts(handle, select.c_str(), out);
+    }
+
+    out << "@@@sql@@@\nANALYZE sqlite_schema;\n";
+
+    if (!ok) return error("export_stats", sqlite3_errmsg(handle));
+    if (!out.good()) return error("export_stats", "Write error on " + pathfile);
+
+    return true;
+}
+
+
+bool AnalyzeScheduler::import_stats(const std::string &pathfile)
+{
+    if (!_db.get_handle()) return error("import_stats", "Database not connected.");
+    if (!_db.execute_sql_file(pathfile)) return error("import_stats", "Cannot run " + pathfile);
+
+    sqlite3* handle = _db.get_handle();
+    if (table_exists(handle, stat4_copy, "sqlite_temp_master"))
+    {
+        std::string sql = table_exists(handle, "sqlite_stat4")
+                          ? std::string("DELETE FROM sqlite_stat4; INSERT INTO sqlite_stat4 SELECT * FROM temp.") + stat4_copy + "; ANALYZE sqlite_schema; "
+                          : std::string();
+        sql += std::string("DROP TABLE temp.") + stat4_copy + ";";
+
+        if (sqlite3_exec(handle, sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) return error("import_stats", sqlite3_errmsg(handle));
+    }
+
+    compare_plans();
+    return true;
+}
+
+
+bool AnalyzeScheduler::query_plan(const std::string &sql, std::string &plan)
+{
+    sqlite3* handle = _db.get_handle();
+    if (!handle) return error("query_plan", "Database not connected.");
+
+    plan.clear();
+
+    std::string explain = "EXPLAIN QUERY PLAN " + sql;
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(handle, explain.c_str(), -1, &statement, nullptr) != SQLITE_OK)
+    {
+        std::string message = sqlite3_errmsg(handle);
+        sqlite3_finalize(statement);
+        return error("query_plan", message);
+    }
+
+    // columns : id, parent, notused, detail; indented by depth in the plan tree
+    std::unordered_map<int, int> depth;
+    int rc;
+    while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+    {
+        int id = sqlite3_column_int(statement, 0);
+        int parent = sqlite3_column_int(statement, 1);
+        int level = depth.count(parent) ? depth[parent] + 1 : 0;
+        depth[id] = level;
+
+        if (!plan.empty()) plan += '\n';
+        plan.append(static_cast<size_t>(level) * 2, ' ');
+        plan += reinterpret_cast<const char*>(sqlite3_column_text(statement, 3));
+    }
+    sqlite3_finalize(statement);
+
+    if (rc != SQLITE_DONE) return error("query_plan", sqlite3_errmsg(handle));
+    return true;
+}
+
+
+void AnalyzeScheduler::compare_plans()
+{
+    for (auto& [digest, watched] : _watched)
+    {
+        std::string plan;
+        if (!query_plan(watched.first, plan) || plan == watched.second) continue;
+
+        _plan_changes.push_back({ digest, watched.second, plan });
+        _metrics.plan_changes++;
+        watched.second = plan;
+    }
+}
+
+
+bool AnalyzeScheduler::error(const char *function, const std::string &message)
+{
+    _last_error = message;
+    SQLITEWRAP_LOG_ERROR("AnalyzeScheduler::" << function << "(...) - Error: " << message);
+    return false;
+}
@@ -0,0 +1,101 @@
+#ifndef ANALYZESCHEDULER_H
+#define ANALYZESCHEDULER_H
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+class SqliteWrap;
+
+struct AnalyzeOptions
+{
+    int analysis_limit = 400;            // rows examined per index by ANALYZE, 0 : all
+    int interval_ms = 3600000;           // optimize_if_due() : at most once per interval
+    bool on_close = true;                // PRAGMA optimize in SqliteWrap::disconnect()
+};
+
+struct AnalyzeMetrics
+{
+    unsigned long long runs = 0;         // PRAGMA optimize run by the scheduler
+    double last_duration_ms = 0;
+    double total_duration_ms = 0;
+    unsigned long long plan_changes = 0;
+};
+
+// Query plan of a watched statement that changed after new statistics
+struct PlanChange
+{
+    std::string digest;                  // BusyHandler::digest() of the statement
+    std::string before;                  // EXPLAIN QUERY PLAN, one line per step
+    std::string after;
+};
+
+// Keeps the planner statistics (sqlite_stat1, sqlite_stat4) current : PRAGMA optimize,
+// with analysis_limit so that ANALYZE stays cheap on large tables, when the connection
+// closes and at most once per interval on long-lived connections. PRAGMA optimize only
+// analyzes the tables whose statistics the queries of this connection found missing or
+// stale, it usually does nothing.
+//
+//     AnalyzeScheduler analyze(db);
+//     analyze.start();
+//     analyze.watch("SELECT * FROM person WHERE name = ?");
+//     ...
+//     analyze.optimize_if_due();        // e.g. from an idle timer, outside transactions
+//     for (const PlanChange& change : analyze.take_plan_changes()) ...
+//
+// After every run the plans of the watched (hot) statements are compared with their
+// previous plan : the changes are kept until take_plan_changes().
+//
+// export_stats() writes the statistics as a script for SqliteWrap::execute_sql_file() :
+// a database restored from get_database_schema() + data starts with the plans of the
+// original instead of none.
+class SQLITEWRAP_EXPORT AnalyzeScheduler
+{
+public:
+    explicit AnalyzeScheduler(SqliteWrap& db);
+    ~AnalyzeScheduler();
+
+    AnalyzeScheduler(const AnalyzeScheduler&) = delete;
+    AnalyzeScheduler& operator=(const AnalyzeScheduler&) = delete;
+
+    bool start(const AnalyzeOptions& options = AnalyzeOptions());
+    void stop();                         // also removes the run on close
+    bool is_running() const { return _running; }
+
+    bool optimize();                     // now
+    bool optimize_if_due();
+
+    bool watch(const std::string& sql);
+    void unwatch(const std::string& sql);
+    std::vector<PlanChange> take_plan_changes();
+
+    bool export_stats(const std::string& pathfile);
+    // execute_sql_file(), then the planner reloads them. sqlite_stat4 rows are only imported
+    // here (not by execute_sql_file() alone) and only when the target has sqlite_stat4
+    bool import_stats(const std::string& pathfile);
+
+private:
+    SqliteWrap& _db;
+    AnalyzeOptions _options;
+    bool _running = false;
+    std::chrono::steady_clock::time_point _last_run;
+    std::map<std::string, std::pair<std::string, std::string>> _watched;   // digest -> sql, plan
+    std::vector<PlanChange> _plan_changes;
+    AnalyzeMetrics _metrics;
+    std::string _last_error;
+
+    bool query_plan(const std::string& sql, std::string& plan);
+    void compare_plans();
+    bool error(const char* function, const std::string& message);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+    const AnalyzeMetrics& get_metrics() const { return _metrics; }
+};
+
+#endif // ANALYZESCHEDULER_H
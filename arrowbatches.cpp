@@ -0,0 +1,332 @@
+#include <cstring>
+#include <string>
+
+#include "arrowbatches.h"
+#include "schemacache.h"
+
+
+namespace
+{
+    enum class ArrowType { Int64, Float64, Utf8, Binary };
+
+    const char* format(ArrowType type)
+    {
+        switch (type)
+        {
+        case ArrowType::Int64: return "l";
+        case ArrowType::Float64: return "g";
+        case ArrowType::Utf8: return "u";
+        default: return "z";
+        }
+    }
+
+    // the value buffers of a column, private data of its array
+    struct ColumnData
+    {
+        ArrowType type = ArrowType::Utf8;
+        std::vector<uint8_t> validity;
+        std::vector<int64_t> integers;
+        std::vector<double> reals;
+        std::vector<int32_t> offsets;
+        std::vector<char> bytes;
+        int64_t null_count = 0;
+        const void* buffers[3] = {};
+    };
+
+    // private data of a batch : the column arrays
+    struct BatchData
+    {
+        std::vector<ArrowArray> columns;
+        std::vector<ArrowArray*> children;
+        const void* buffers[1] = {};
+    };
+
+    // private data of the struct schema
+    struct SchemaData
+    {
+        std::vector<ArrowSchema> columns;
+        std::vector<ArrowSchema*> children;
+    };
+
+    const char empty_bytes[1] = {};
+
+    void release_column(ArrowArray* array)
+    {
+        delete static_cast<ColumnData*>(array->private_data);
+        array->release = nullptr;
+    }
+
+    void release_batch(ArrowArray* array)
+    {
+        // columns moved out by the consumer have no release any more
+        for (int64_t i = 0; i < array->n_children; i++)
+            if (array->children[i]->release) array->children[i]->release(array->children[i]);
+
+        delete static_cast<BatchData*>(array->private_data);
+        array->release = nullptr;
+    }
+
+    void release_column_schema(ArrowSchema* schema)
+    {
+        delete static_cast<std::string*>(schema->private_data);
+        schema->release = nullptr;
+    }
+
+    void release_schema(ArrowSchema* schema)
+    {
+        for (int64_t i = 0; i < schema->n_children; i++)
+            if (schema->children[i]->release) schema->children[i]->release(schema->children[i]);
+
+        delete static_cast<SchemaData*>(schema->private_data);
+        schema->release = nullptr;
+    }
+
+    ArrowArray empty_array()
+    {
+        ArrowArray array;
+        std::memset(&array, 0, sizeof(array));
+        return array;
+    }
+
+    // declared type, else the storage class of the first value. A number without a
+    // declared INTEGER / REAL type is float64 : a later REAL must not be truncated into int64
+    ArrowType column_type(sqlite3_stmt* statement, int column, bool has_row)
+    {
+        const char* declared = sqlite3_column_decltype(statement, column);
+        if (declared && *declared)
+        {
+            switch (SchemaCache::affinity(declared))
+            {
+            case ColumnAffinity::Integer: return ArrowType::Int64;
+            case ColumnAffinity::Real:
+            case ColumnAffinity::Numeric: return ArrowType::Float64;
+            case ColumnAffinity::Text: return ArrowType::Utf8;
+            case ColumnAffinity::Blob: return ArrowType::Binary;
+            default: break;
+            }
+        }
+
+        switch (has_row ? sqlite3_column_type(statement, column) : SQLITE_NULL)
+        {
+        case SQLITE_INTEGER:
+        case SQLITE_FLOAT: return ArrowType::Float64;
+        case SQLITE_BLOB: return ArrowType::Binary;
+        default: return ArrowType::Utf8;
+        }
+    }
+
+    ColumnData* new_column(ArrowType type, int batch_rows)
+    {
+        ColumnData* column = new ColumnData;
+        column->type = type;
+        column->validity.reserve(static_cast<size_t>(batch_rows + 7) / 8);
+
+        if (type == ArrowType::Int64) column->integers.reserve(static_cast<size_t>(batch_rows));
+        else if (type == ArrowType::Float64) column->reals.reserve(static_cast<size_t>(batch_rows));
+        else
+        {
+            column->offsets.reserve(static_cast<size_t>(batch_rows) + 1);
+            column->offsets.push_back(0);
+        }
+
+        return column;
+    }
+
+    void append_value(ColumnData& column, sqlite3_stmt* statement, int index, int64_t row)
+    {
+        if (row % 8 == 0) column.validity.push_back(0);
+
+        bool null = sqlite3_column_type(statement, index) == SQLITE_NULL;
+        if (null) column.null_count++;
+        else column.validity.back() |= static_cast<uint8_t>(1 << (row % 8));
+
+        switch (column.type)
+        {
+        case ArrowType::Int64:
+            column.integers.push_back(null ? 0 : sqlite3_column_int64(statement, index));
+            break;
+        case ArrowType::Float64:
+            column.reals.push_back(null ? 0.0 : sqlite3_column_double(statement, index));
+            break;
+        default:
+        {
+            if (!null)
+            {
+                // text first : sqlite3_column_bytes must follow the conversion
+                const char* data = column.type == ArrowType::Utf8
+                    ? reinterpret_cast<const char*>(sqlite3_column_text(statement, index))
+                    : static_cast<const char*>(sqlite3_column_blob(statement, index));
+                int size = sqlite3_column_bytes(statement, index);
+                if (data) column.bytes.insert(column.bytes.end(), data, data + size);
+            }
+            column.offsets.push_back(static_cast<int32_t>(column.bytes.size()));
+            break;
+        }
+        }
+    }
+
+    ArrowArray column_array(ColumnData* column, int64_t length)
+    {
+        ArrowArray array = empty_array();
+        array.length = length;
+        array.null_count = column->null_count;
+
+        if (column->null_count == 0) column->validity = std::vector<uint8_t>();
+        column->buffers[0] = column->null_count ? column->validity.data() : nullptr;
+
+        switch (column->type)
+        {
+        case ArrowType::Int64:
+            column->buffers[1] = column->integers.data();
+            array.n_buffers = 2;
+            break;
+        case ArrowType::Float64:
+            column->buffers[1] = column->reals.data();
+            array.n_buffers = 2;
+            break;
+        default:
+            column->buffers[1] = column->offsets.data();
+            column->buffers[2] = column->bytes.empty() ? empty_bytes : column->bytes.data();
+            array.n_buffers = 3;
+            break;
+        }
+
+        array.buffers = column->buffers;
+        array.release = release_column;
+        array.private_data = column;
+        return array;
+    }
+
+    ArrowArray batch_array(std::vector<ColumnData*>& columns, int64_t length)
+    {
+        BatchData* batch = new BatchData;
+        batch->columns.reserve(columns.size());
+        for (ColumnData* column : columns) batch->columns.push_back(column_array(column, length));
+        for (ArrowArray& column : batch->columns) batch->children.push_back(&column);
+        columns.clear();
+
+        ArrowArray array = empty_array();
+        array.length = length;
+        array.n_buffers = 1;
+        array.n_children = static_cast<int64_t>(batch->children.size());
+        array.buffers = batch->buffers;
+        array.children = batch->children.empty() ? nullptr : batch->children.data();
+        array.release = release_batch;
+        array.private_data = batch;
+        return array;
+    }
+
+    void make_schema(ArrowSchema& schema, sqlite3_stmt* statement, const std::vector<ArrowType>& types)
+    {
+        SchemaData* data = new SchemaData;
+        data->columns.resize(types.size());
+
+        for (size_t i = 0; i < types.size(); i++)
+        {
+            const char* name = sqlite3_column_name(statement, static_cast<int>(i));
+            std::string* owned_name = new std::string(name ? name : "");
+
+            ArrowSchema& column = data->columns[i];
+            std::memset(&column, 0, sizeof(column));
+            column.format = format(types[i]);
+            column.name = owned_name->c_str();
+            column.flags = ARROW_FLAG_NULLABLE;
+            column.release = release_column_schema;
+            column.private_data = owned_name;
+
+            data->children.push_back(&column);
+        }
+
+        std::memset(&schema, 0, sizeof(schema));
+        schema.format = "+s";
+        schema.name = "";
+        schema.n_children = static_cast<int64_t>(types.size());
+        schema.children = data->children.empty() ? nullptr : data->children.data();
+        schema.release = release_schema;
+        schema.private_data = data;
+    }
+}
+
+
+ArrowBatches::ArrowBatches()
+{
+    std::memset(&_schema, 0, sizeof(_schema));
+}
+
+
+ArrowBatches::~ArrowBatches()
+{
+    clear();
+}
+
+
+void ArrowBatches::clear()
+{
+    for (ArrowArray& batch : _batches)
+        if (batch.release) batch.release(&batch);
+    _batches.clear();
+
+    if (_schema.release) _schema.release(&_schema);
+    std::memset(&_schema, 0, sizeof(_schema));
+
+    _row_count = 0;
+}
+
+
+bool ArrowBatches::read(sqlite3_stmt *statement, int batch_rows)
+{
+    clear();
+
+    if (batch_rows < 1) batch_rows = 1;
+
+    // a utf8 / binary batch ends early before its offsets could overflow int32
+    constexpr size_t max_batch_bytes = size_t(1) << 30;
+
+    int column_count = sqlite3_column_count(statement);
+    std::vector<ArrowType> types;
+    std::vector<ColumnData*> columns;
+    int64_t length = 0;
+
+    int rc;
+    while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+    {
+        if (types.empty() && column_count > 0)
+            for (int i = 0; i < column_count; i++) types.push_back(column_type(statement, i, true));
+
+        if (columns.empty())
+            for (ArrowType type : types) columns.push_back(new_column(type, batch_rows));
+
+        bool full = length + 1 == batch_rows;
+        for (int i = 0; i < column_count; i++)
+        {
+            append_value(*columns[i], statement, i, length);
+            full = full || columns[i]->bytes.size() >= max_batch_bytes;
+        }
+
+        length++;
+        _row_count++;
+
+        if (full)
+        {
+            _batches.push_back(batch_array(columns, length));
+            length = 0;
+        }
+    }
+
+    if (rc != SQLITE_DONE)
+    {
+        for (ColumnData* column : columns) delete column;
+        clear();
+        return false;
+    }
+
+    if (length > 0) _batches.push_back(batch_array(columns, length));
+
+    // no row : declared types only
+    if (types.size() != static_cast<size_t>(column_count))
+        for (int i = 0; i < column_count; i++) types.push_back(column_type(statement, i, false));
+
+    make_schema(_schema, statement, types);
+
+    return true;
+}
@@ -0,0 +1,102 @@
+#ifndef ARROWBATCHES_H
+#define ARROWBATCHES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+// Apache Arrow C Data Interface (https://arrow.apache.org/docs/format/CDataInterface.html),
+// a stable ABI : these definitions are the ones of the specification.
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema
+{
+    // Array type description
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowSchema*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+struct ArrowArray
+{
+    // Array data description
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowArray*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
+
+// Result of a query as Arrow record batches : a struct schema ("+s", one child per
+// result column) and struct arrays of at most batch_rows rows.
+//
+// Column types come from the declared type of the column (INTEGER -> int64, REAL and
+// NUMERIC -> float64, TEXT -> utf8, BLOB -> binary); expressions and untyped columns take
+// the type of their value in the first row (INTEGER or REAL -> float64, BLOB -> binary,
+// TEXT or NULL -> utf8). Values of another storage class are converted the way
+// sqlite3_column_* converts them.
+//
+// Columns are written directly into their Arrow buffers (values, int32 offsets, validity
+// bitmap when there are NULLs). Every array and schema owns its buffers and frees them
+// in its release callback : a consumer takes them over without copy by moving the
+// structure (e.g. pyarrow.RecordBatch._import_from_c(address, schema)), which sets
+// release to nullptr here. What was not moved is released with the ArrowBatches.
+//
+//     ArrowBatches batches;
+//     db.query_arrow("SELECT * FROM person;", 65536, batches);
+//     for (size_t i = 0; i < batches.get_batch_count(); i++) consume(batches.get_batch(i), batches.get_schema());
+class SQLITEWRAP_EXPORT ArrowBatches
+{
+public:
+    ArrowBatches();
+    ~ArrowBatches();
+
+    ArrowBatches(const ArrowBatches&) = delete;
+    ArrowBatches& operator=(const ArrowBatches&) = delete;
+
+    void clear();
+
+    // steps the statement to the end; false (results cleared) if a step failed
+    bool read(sqlite3_stmt* statement, int batch_rows);
+
+private:
+    ArrowSchema _schema;
+    std::vector<ArrowArray> _batches;
+    sqlite3_int64 _row_count = 0;
+
+public:
+    // getter : the structures stay at these addresses until clear() / read()
+    ArrowSchema* get_schema() { return &_schema; }
+    size_t get_batch_count() const { return _batches.size(); }
+    ArrowArray* get_batch(size_t index) { return &_batches[index]; }
+    sqlite3_int64 get_row_count() const { return _row_count; }
+};
+
+#endif // ARROWBATCHES_H
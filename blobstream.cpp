@@ -0,0 +1,195 @@
+#include <algorithm>
+
+#include "blobstream.h"
+#include "logger.h"
+#include "sqlitewrap.h"
+
+
+BlobStream::BlobStream(SqliteWrap &db) : _wrap(db) {}
+
+
+BlobStream::~BlobStream()
+{
+    if (_blob) sqlite3_blob_close(_blob);
+}
+
+
+bool BlobStream::set_error(const char *function, const std::string &message)
+{
+    SQLITEWRAP_LOG_ERROR("BlobStream::" << function << "(...) - Error: " << message);
+    _last_error = message;
+    return false;
+}
+
+
+bool BlobStream::open(const std::string &table, const std::string &column, sqlite3_int64 rowid, bool writable)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return set_error("open", "Database not connected.");
+
+    if (_blob) close();
+
+    int rc = sqlite3_blob_open(db, "main", table.c_str(), column.c_str(), rowid, writable ? 1 : 0, &_blob);
+
+    if (rc != SQLITE_OK)
+    {
+        // the handle is allocated even on failure
+        sqlite3_blob_close(_blob);
+        _blob = nullptr;
+        return set_error("open", sqlite3_errmsg(db));
+    }
+
+    _rowid = rowid;
+    return true;
+}
+
+
+bool BlobStream::reopen(sqlite3_int64 rowid)
+{
+    if (!_blob) return set_error("reopen", "Blob not open.");
+
+    int rc = sqlite3_blob_reopen(_blob, rowid);
+
+    if (rc != SQLITE_OK)
+    {
+        // after a failed reopen the handle is aborted, only close() is allowed
+        sqlite3_blob_close(_blob);
+        _blob = nullptr;
+        return set_error("reopen", sqlite3_errmsg(_wrap.get_handle()));
+    }
+
+    _rowid = rowid;
+    return true;
+}
+
+
+bool BlobStream::close()
+{
+    if (!_blob) return true;
+
+    int rc = sqlite3_blob_close(_blob);
+    _blob = nullptr;
+
+    if (rc != SQLITE_OK) return set_error("close", sqlite3_errstr(rc));
+
+    return true;
+}
+
+
+int BlobStream::size() const
+{
+    return _blob ? sqlite3_blob_bytes(_blob) : -1;
+}
+
+
+bool BlobStream::read(void *buffer, int count, int offset)
+{
+    if (!_blob) return set_error("read", "Blob not open.");
+
+    int rc = sqlite3_blob_read(_blob, buffer, count, offset);
+    if (rc != SQLITE_OK) return set_error("read", sqlite3_errstr(rc));
+
+    return true;
+}
+
+
+bool BlobStream::write(const void *buffer, int count, int offset)
+{
+    if (!_blob) return set_error("write", "Blob not open.");
+
+    // sqlite3_blob_write cannot change the blob size : see preallocate()
+    int rc = sqlite3_blob_write(_blob, buffer, count, offset);
+    if (rc != SQLITE_OK) return set_error("write", sqlite3_errstr(rc));
+
+    return true;
+}
+
+
+bool BlobStream::read_chunks(void *user_param, BlobChunkCallback callback, int chunk_size)
+{
+    if (!_blob) return set_error("read_chunks", "Blob not open.");
+    if (chunk_size <= 0) return set_error("read_chunks", "Invalid chunk size.");
+
+    int total = sqlite3_blob_bytes(_blob);
+    std::vector<char> chunk(static_cast<size_t>(std::min(chunk_size, std::max(total, 1))));
+
+    for (int offset = 0; offset < total; offset += chunk_size)
+    {
+        int count = std::min(chunk_size, total - offset);
+        if (!read(chunk.data(), count, offset)) return false;
+        if (!callback(user_param, _rowid, chunk.data(), count, offset)) return true;
+    }
+
+    return true;
+}
+
+
+bool BlobStream::read_rows(const std::vector<sqlite3_int64> &rowids, void *user_param, BlobChunkCallback callback, int chunk_size)
+{
+    if (!_blob) return set_error("read_rows", "Blob not open.");
+    if (chunk_size <= 0) return set_error("read_rows", "Invalid chunk size.");
+
+    std::vector<char> chunk(static_cast<size_t>(chunk_size));
+
+    for (sqlite3_int64 rowid : rowids)
+    {
+        if (rowid != _rowid && !reopen(rowid)) return false;
+
+        int total = sqlite3_blob_bytes(_blob);
+        for (int offset = 0; offset < total; offset += chunk_size)
+        {
+            int count = std::min(chunk_size, total - offset);
+            if (!read(chunk.data(), count, offset)) return false;
+            if (!callback(user_param, _rowid, chunk.data(), count, offset)) return true;
+        }
+    }
+
+    return true;
+}
+
+
+bool BlobStream::preallocate(const std::string &table, const std::string &column, sqlite3_int64 rowid, sqlite3_int64 size)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return set_error("preallocate", "Database not connected.");
+
+    std::string sql = "UPDATE " + table + " SET " + column + " = zeroblob(?) WHERE rowid = ?;";
+
+    sqlite3_stmt *statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK)
+        return set_error("preallocate", sqlite3_errmsg(db));
+
+    sqlite3_bind_int64(statement, 1, size);
+    sqlite3_bind_int64(statement, 2, rowid);
+
+    int rc = sqlite3_step(statement);
+    sqlite3_finalize(statement);
+
+    if (rc != SQLITE_DONE) return set_error("preallocate", sqlite3_errmsg(db));
+    if (sqlite3_changes(db) == 0) return set_error("preallocate", "No row with rowid " + std::to_string(rowid));
+
+    return true;
+}
+
+
+bool BlobStream::insert_zeroblob(const std::string &table, const std::string &column, sqlite3_int64 size, sqlite3_int64 &rowid)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return set_error("insert_zeroblob", "Database not connected.");
+
+    std::string sql = "INSERT INTO " + table + " (" + column + ") VALUES (zeroblob(?));";
+
+    sqlite3_stmt *statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK)
+        return set_error("insert_zeroblob", sqlite3_errmsg(db));
+
+    sqlite3_bind_int64(statement, 1, size);
+
+    int rc = sqlite3_step(statement);
+    sqlite3_finalize(statement);
+
+    if (rc != SQLITE_DONE) return set_error("insert_zeroblob", sqlite3_errmsg(db));
+
+    rowid = sqlite3_last_insert_rowid(db);
+    return true;
+}
@@ -0,0 +1,62 @@
+#ifndef BLOBSTREAM_H
+#define BLOBSTREAM_H
+
+#include <string>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+class SqliteWrap;
+
+// Called for every chunk read from a blob; return false to stop the iteration.
+using BlobChunkCallback = bool (*)(void* user_param, sqlite3_int64 rowid, const char* data, int size, int offset);
+
+// Incremental BLOB I/O (sqlite3_blob_*) : blobs are read and written in chunks
+// directly into caller buffers, without going through sqlite3_column_text.
+class SQLITEWRAP_EXPORT BlobStream
+{
+public:
+    explicit BlobStream(SqliteWrap& db);
+    ~BlobStream();
+
+    BlobStream(const BlobStream&) = delete;
+    BlobStream& operator=(const BlobStream&) = delete;
+
+    bool is_open() const { return _blob != nullptr; }
+
+    bool open(const std::string& table, const std::string& column, sqlite3_int64 rowid, bool writable = false);
+    bool reopen(sqlite3_int64 rowid);           // move the open handle to another row of the same table
+    bool close();
+
+    int size() const;
+    sqlite3_int64 rowid() const { return _rowid; }
+
+    bool read(void* buffer, int count, int offset);
+    bool write(const void* buffer, int count, int offset);
+
+    // read the whole blob of the current row, chunk by chunk, into a single reusable buffer
+    bool read_chunks(void* user_param, BlobChunkCallback callback, int chunk_size = default_chunk_size);
+    // same for many rows of the same table, reusing the blob handle with sqlite3_blob_reopen
+    bool read_rows(const std::vector<sqlite3_int64>& rowids, void* user_param, BlobChunkCallback callback, int chunk_size = default_chunk_size);
+
+    // zeroblob preallocation : the blob must have its final size before being written incrementally
+    bool preallocate(const std::string& table, const std::string& column, sqlite3_int64 rowid, sqlite3_int64 size);
+    bool insert_zeroblob(const std::string& table, const std::string& column, sqlite3_int64 size, sqlite3_int64& rowid);
+
+    static constexpr int default_chunk_size = 64 * 1024;
+
+private:
+    SqliteWrap& _wrap;
+    sqlite3_blob* _blob = nullptr;
+    sqlite3_int64 _rowid = 0;
+    std::string _last_error;
+
+    bool set_error(const char* function, const std::string& message);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+};
+
+#endif // BLOBSTREAM_H
@@ -0,0 +1,201 @@
+
+#include "bulkinsert.h"
+#include "logger.h"
+#include "sqlitewrap.h"
+
+
+BulkInsert::BulkInsert(SqliteWrap &db) : _wrap(db) {}
+
+
+BulkInsert::~BulkInsert()
+{
+    if (_statement) abort();
+}
+
+
+bool BulkInsert::begin(const std::string &table, const std::vector<std::string> &columns, const BulkInsertOptions &options)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return error("begin", "Database not connected.");
+    if (_statement) return error("begin", "A bulk insert is already in progress.");
+
+    _table = table;
+    _options = options;
+    if (_options.batch_rows == 0) _options.batch_rows = 1;
+    _rows = 0;
+    _batch = 0;
+
+    if (_options.fast_pragmas)
+    {
+        if (!read_pragma("synchronous", _synchronous) || !read_pragma("cache_size", _cache_size)) return false;
+        if (!execute("begin", "PRAGMA synchronous = OFF; PRAGMA cache_size = -" + std::to_string(_options.cache_size_kib) + ";"))
+        {
+            end(nullptr);
+            return false;
+        }
+    }
+
+    _own_transaction = sqlite3_get_autocommit(db) != 0;
+    if (!execute("begin", _own_transaction ? "BEGIN;" : "SAVEPOINT sqlitewrap_bulk;"))
+    {
+        end(nullptr);
+        return false;
+    }
+
+    if (!set_columns(columns))
+    {
+        end(_own_transaction ? "ROLLBACK;" : "ROLLBACK TO sqlitewrap_bulk; RELEASE sqlitewrap_bulk;");
+        return false;
+    }
+
+    return true;
+}
+
+
+bool BulkInsert::set_columns(const std::vector<std::string> &columns)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return error("set_columns", "Database not connected.");
+    if (columns.empty()) return error("set_columns", "No column to insert.");
+
+    std::string sql = "INSERT ";
+    if (!_options.conflict.empty()) sql += "OR " + _options.conflict + " ";
+    sql += "INTO " + SqliteWrap::quote_identifier(_table) + " (";
+
+    std::string values;
+    for (size_t i = 0; i < columns.size(); i++)
+    {
+        sql += (i ? ", " : "") + SqliteWrap::quote_identifier(columns[i]);
+        values += i ? ", ?" : "?";
+    }
+    sql += ") VALUES (" + values + ");";
+
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v3(db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &statement, nullptr) != SQLITE_OK)
+    {
+        sqlite3_finalize(statement);
+        return error("set_columns", sqlite3_errmsg(db));
+    }
+
+    sqlite3_finalize(_statement);
+    _statement = statement;
+
+    return true;
+}
+
+
+bool BulkInsert::insert_row()
+{
+    if (!_statement) return error("insert_row", "No bulk insert in progress.");
+
+    int rc = sqlite3_step(_statement);
+    sqlite3_reset(_statement);
+    sqlite3_clear_bindings(_statement);
+
+    if (rc != SQLITE_DONE) return error("insert_row", sqlite3_errmsg(_wrap.get_handle()));
+
+    _rows++;
+
+    if (_own_transaction && ++_batch >= _options.batch_rows)
+    {
+        _batch = 0;
+        if (!execute("insert_row", "COMMIT; BEGIN;")) return false;
+    }
+
+    return true;
+}
+
+
+bool BulkInsert::finish()
+{
+    if (!_statement) return error("finish", "No bulk insert in progress.");
+
+    sqlite3_finalize(_statement);
+    _statement = nullptr;
+
+    if (!execute("finish", _own_transaction ? "COMMIT;" : "RELEASE sqlitewrap_bulk;"))
+    {
+        end(_own_transaction ? "ROLLBACK;" : "ROLLBACK TO sqlitewrap_bulk; RELEASE sqlitewrap_bulk;");
+        return false;
+    }
+
+    end(nullptr);
+    return true;
+}
+
+
+bool BulkInsert::abort()
+{
+    if (!_statement) return error("abort", "No bulk insert in progress.");
+
+    end(_own_transaction ? "ROLLBACK;" : "ROLLBACK TO sqlitewrap_bulk; RELEASE sqlitewrap_bulk;");
+    return true;
+}
+
+
+void BulkInsert::end(const char *sql)
+{
+    sqlite3* db = _wrap.get_handle();
+
+    sqlite3_finalize(_statement);
+    _statement = nullptr;
+
+    if (!db) return;
+
+    if (sql) sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
+
+    if (_options.fast_pragmas && !_synchronous.empty())
+    {
+        std::string restore = "PRAGMA synchronous = " + _synchronous + "; PRAGMA cache_size = " + _cache_size + ";";
+        sqlite3_exec(db, restore.c_str(), nullptr, nullptr, nullptr);
+        _synchronous.clear();
+        _cache_size.clear();
+    }
+}
+
+
+bool BulkInsert::execute(const char *function, const std::string &sql)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return error(function, "Database not connected.");
+
+    char* errorMessage = nullptr;
+    int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errorMessage);
+
+    if (rc != SQLITE_OK)
+    {
+        error(function, errorMessage ? errorMessage : sqlite3_errstr(rc));
+        sqlite3_free(errorMessage);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool BulkInsert::read_pragma(const char *pragma, std::string &value)
+{
+    sqlite3* db = _wrap.get_handle();
+    std::string sql = std::string("PRAGMA ") + pragma + ";";
+
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK || sqlite3_step(statement) != SQLITE_ROW)
+    {
+        error("begin", sqlite3_errmsg(db));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    value = std::to_string(sqlite3_column_int64(statement, 0));
+    sqlite3_finalize(statement);
+
+    return true;
+}
+
+
+bool BulkInsert::error(const char *function, const std::string &message)
+{
+    _last_error = message;
+    SQLITEWRAP_LOG_ERROR("BulkInsert::" << function << "(...) - Error: " << message);
+    return false;
+}
@@ -0,0 +1,81 @@
+#ifndef BULKINSERT_H
+#define BULKINSERT_H
+
+#include <string>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+class SqliteWrap;
+
+struct BulkInsertOptions
+{
+    size_t batch_rows = 100000;          // rows per transaction
+    bool fast_pragmas = true;            // synchronous = OFF and a large page cache during the load, restored by finish()
+    int cache_size_kib = 256 * 1024;
+    std::string conflict;                // "" (ABORT), "IGNORE" or "REPLACE"
+};
+
+// Load path of the importers : one prepared INSERT bound and stepped per row, committed
+// every batch_rows rows. Inside a transaction opened by the caller the rows go into a
+// savepoint instead, committed with the caller's transaction.
+//
+//     BulkInsert insert(db);
+//     insert.begin("person", { "firstname", "lastname" });
+//     for (...) { insert.bind_text(0, first, size); insert.bind_text(1, last, size); insert.insert_row(); }
+//     insert.finish();
+//
+// Values are bound without copy : they must stay valid until insert_row(). Columns not
+// bound for a row are NULL. A failed row stops the load; abort() rolls back the batch
+// in progress (committed batches stay).
+class SQLITEWRAP_EXPORT BulkInsert
+{
+public:
+    explicit BulkInsert(SqliteWrap& db);
+    ~BulkInsert();
+
+    BulkInsert(const BulkInsert&) = delete;
+    BulkInsert& operator=(const BulkInsert&) = delete;
+
+    bool begin(const std::string& table, const std::vector<std::string>& columns, const BulkInsertOptions& options = BulkInsertOptions());
+    bool set_columns(const std::vector<std::string>& columns);      // new column list, same transaction
+    bool is_active() const { return _statement != nullptr; }
+
+    // column : 0-based position in the column list
+    void bind_null(int column) { sqlite3_bind_null(_statement, column + 1); }
+    void bind_int64(int column, sqlite3_int64 value) { sqlite3_bind_int64(_statement, column + 1, value); }
+    void bind_double(int column, double value) { sqlite3_bind_double(_statement, column + 1, value); }
+    void bind_text(int column, const char* data, size_t size) { sqlite3_bind_text64(_statement, column + 1, data, size, SQLITE_STATIC, SQLITE_UTF8); }
+    void bind_blob(int column, const void* data, size_t size) { sqlite3_bind_blob64(_statement, column + 1, data, size, SQLITE_STATIC); }
+
+    bool insert_row();
+    bool finish();                       // commit, restore the pragmas
+    bool abort();
+
+private:
+    SqliteWrap& _wrap;
+    sqlite3_stmt* _statement = nullptr;
+    std::string _table;
+    BulkInsertOptions _options;
+
+    bool _own_transaction = false;       // BEGIN / COMMIT per batch, else a savepoint in the caller's transaction
+    sqlite3_int64 _rows = 0;
+    size_t _batch = 0;
+
+    std::string _synchronous;
+    std::string _cache_size;
+    std::string _last_error;
+
+    bool execute(const char* function, const std::string& sql);
+    bool read_pragma(const char* pragma, std::string& value);
+    void end(const char* sql);
+    bool error(const char* function, const std::string& message);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+    sqlite3_int64 get_row_count() const { return _rows; }
+};
+
+#endif // BULKINSERT_H
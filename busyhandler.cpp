@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <cctype>
+#include <thread>
+
+#include "busyhandler.h"
+
+
+namespace
+{
+    const char* const unscoped = "(unscoped)";
+
+    double elapsed_ms(std::chrono::steady_clock::time_point since, std::chrono::steady_clock::time_point now)
+    {
+        return std::chrono::duration<double, std::milli>(now - since).count();
+    }
+
+    bool is_word(char c)
+    {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$' || static_cast<unsigned char>(c) >= 0x80;
+    }
+
+    void add_wait(BusyStats& stats, double wait_ms)
+    {
+        stats.waits++;
+        stats.wait_ms += wait_ms;
+        stats.max_wait_ms = std::max(stats.max_wait_ms, wait_ms);
+
+        const auto& bounds = BusyHandler::histogram_bounds_ms;
+        size_t bucket = static_cast<size_t>(std::lower_bound(bounds.begin(), bounds.end(), wait_ms) - bounds.begin());
+        stats.histogram[bucket]++;
+    }
+}
+
+
+BusyHandler::BusyHandler(const BusyOptions &options)
+    : _options(options), _random(std::random_device()())
+{
+}
+
+
+BusyHandler::Scope::Scope(BusyHandler *handler, const std::string &sql)
+{
+    if (!handler || handler->_sql) return;
+
+    _handler = handler;
+    _handler->_sql = &sql;
+    _handler->_start = Clock::now();
+    _handler->_wait_ms = 0;
+    _handler->_episode_ms = 0;
+    _handler->_retries = 0;
+    _handler->_waited = false;
+    _handler->_timed_out = false;
+}
+
+
+BusyHandler::Scope::~Scope()
+{
+    if (_handler) _handler->end_operation();
+}
+
+
+void BusyHandler::end_operation()
+{
+    double time_ms = elapsed_ms(_start, Clock::now());
+    double wait_ms = _wait_ms + _episode_ms;
+
+    // the digest is only worked out for the operations that waited
+    std::string key = _waited ? digest(*_sql) : std::string();
+    _sql = nullptr;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _totals.statements++;
+    _totals.time_ms += time_ms;
+
+    if (_waited)
+    {
+        _totals.waits++;
+        _totals.retries += _retries;
+        _totals.wait_ms += wait_ms;
+        if (_timed_out) _totals.timeouts++;
+
+        BusyStats& stats = _stats[key];
+        add_wait(stats, wait_ms);
+        stats.retries += _retries;
+        if (_timed_out) stats.timeouts++;
+    }
+}
+
+
+int BusyHandler::callback(void *user_param, int count)
+{
+    BusyHandler& handler = *static_cast<BusyHandler*>(user_param);
+    const BusyOptions& options = handler._options;
+    Clock::time_point now = Clock::now();
+
+    // count restarts at 0 for every lock the operation waits for
+    if (count == 0)
+    {
+        handler._wait_start = now;
+        handler._waited = true;
+
+        if (handler._sql) handler._wait_ms += handler._episode_ms;
+        else
+        {
+            // no operation to add the waits of : each one gets the whole deadline
+            handler._wait_ms = 0;
+
+            std::lock_guard<std::mutex> lock(handler._mutex);
+            handler._stats[unscoped].waits++;
+        }
+        handler._episode_ms = 0;
+    }
+
+    double waited = handler._wait_ms + elapsed_ms(handler._wait_start, now);
+    double remaining = handler.deadline_ms() - waited;
+
+    if (remaining <= 0)
+    {
+        handler._episode_ms = elapsed_ms(handler._wait_start, now);
+        handler._timed_out = true;
+
+        if (!handler._sql)
+        {
+            std::lock_guard<std::mutex> lock(handler._mutex);
+            handler._stats[unscoped].timeouts++;
+        }
+        return 0;
+    }
+
+    // full jitter : uniform in [0, min(max delay, initial delay * 2^count)]
+    double cap_us = std::min(static_cast<double>(options.max_delay_ms) * 1000.0,
+                             static_cast<double>(options.initial_delay_us) * static_cast<double>(1ull << std::min(count, 30)));
+    double delay_us = std::uniform_real_distribution<double>(0.0, std::max(cap_us, 1.0))(handler._random);
+    delay_us = std::min(delay_us, remaining * 1000.0);
+
+    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long long>(delay_us)));
+
+    // the attempt after the last sleep gets the lock : the wait ends here
+    handler._episode_ms = elapsed_ms(handler._wait_start, Clock::now());
+    handler._retries++;
+
+    if (!handler._sql)
+    {
+        std::lock_guard<std::mutex> lock(handler._mutex);
+        BusyStats& stats = handler._stats[unscoped];
+        stats.retries++;
+        stats.wait_ms += delay_us / 1000.0;
+        stats.max_wait_ms = std::max(stats.max_wait_ms, handler._episode_ms);
+    }
+
+    return 1;
+}
+
+
+std::string BusyHandler::digest(const std::string &sql)
+{
+    std::string result;
+    result.reserve(std::min<size_t>(sql.size(), 256));
+
+    size_t size = sql.size();
+    size_t i = 0;
+    bool blank = false;
+
+    auto append = [&](char c)
+    {
+        if (blank && !result.empty()) result += ' ';
+        blank = false;
+        result += c;
+    };
+
+    while (i < size)
+    {
+        char c = sql[i];
+
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            blank = true;
+            i++;
+        }
+        else if (c == '-' && i + 1 < size && sql[i + 1] == '-')
+        {
+            while (i < size && sql[i] != '\n') i++;
+            blank = true;
+        }
+        else if (c == '/' && i + 1 < size && sql[i + 1] == '*')
+        {
+            size_t close = sql.find("*/", i + 2);
+            i = close == std::string::npos ? size : close + 2;
+            blank = true;
+        }
+        else if (c == '\'' || ((c == 'x' || c == 'X') && i + 1 < size && sql[i + 1] == '\'' && (i == 0 || !is_word(sql[i - 1]))))
+        {
+            // string or blob literal, '' escapes a quote
+            i += c == '\'' ? 1 : 2;
+            while (i < size)
+            {
+                if (sql[i] == '\'' && (i + 1 >= size || sql[i + 1] != '\'')) break;
+                i += sql[i] == '\'' ? 2 : 1;
+            }
+            i++;
+            append('?');
+        }
+        else if (c == '"' || c == '`' || c == '[')
+        {
+            // quoted identifier, kept as written
+            char close = c == '[' ? ']' : c;
+            size_t start = i++;
+            while (i < size)
+            {
+                if (sql[i] == close && (close == ']' || i + 1 >= size || sql[i + 1] != close)) break;
+                i += sql[i] == close ? 2 : 1;
+            }
+            i = std::min(i + 1, size);
+            append(sql[start]);
+            result.append(sql, start + 1, i - start - 1);
+        }
+        else if (std::isdigit(static_cast<unsigned char>(c)) || (c == '.' && i + 1 < size && std::isdigit(static_cast<unsigned char>(sql[i + 1]))))
+        {
+            // number : digits, hex, fraction, exponent
+            while (i < size && (is_word(sql[i]) || sql[i] == '.'
+                                || ((sql[i] == '+' || sql[i] == '-') && (sql[i - 1] == 'e' || sql[i - 1] == 'E'))))
+                i++;
+            append('?');
+        }
+        else if (is_word(c))
+        {
+            append(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+            for (i++; i < size && is_word(sql[i]); i++)
+                result += static_cast<char>(std::tolower(static_cast<unsigned char>(sql[i])));
+        }
+        else
+        {
+            // parameters (?1, :name ...) are kept, so are operators
+            if (c != ';') append(c);
+            i++;
+            if (c == '?') while (i < size && std::isdigit(static_cast<unsigned char>(sql[i]))) result += sql[i++];
+        }
+    }
+
+    return result;
+}
+
+
+BusyOperation BusyHandler::operation(const std::string &sql)
+{
+    size_t start = 0;
+    while (start < sql.size() && !std::isalpha(static_cast<unsigned char>(sql[start]))) start++;
+    size_t end = start;
+    while (end < sql.size() && std::isalpha(static_cast<unsigned char>(sql[end]))) end++;
+
+    std::string keyword;
+    for (size_t i = start; i < end; i++) keyword += static_cast<char>(std::toupper(static_cast<unsigned char>(sql[i])));
+
+    if (keyword == "SELECT" || keyword == "WITH" || keyword == "PRAGMA" || keyword == "EXPLAIN" || keyword == "VALUES")
+        return BusyOperation::Read;
+    if (keyword == "BEGIN" || keyword == "COMMIT" || keyword == "END" || keyword == "ROLLBACK" || keyword == "SAVEPOINT" || keyword == "RELEASE")
+        return BusyOperation::Transaction;
+    return keyword.empty() ? BusyOperation::Other : BusyOperation::Write;
+}
+
+
+int BusyHandler::deadline_ms() const
+{
+    if (!_sql) return _options.other_deadline_ms;
+
+    switch (operation(*_sql))
+    {
+    case BusyOperation::Read: return _options.read_deadline_ms;
+    case BusyOperation::Write: return _options.write_deadline_ms;
+    case BusyOperation::Transaction: return _options.transaction_deadline_ms;
+    case BusyOperation::Other: break;
+    }
+    return _options.other_deadline_ms;
+}
+
+
+void BusyHandler::reset_stats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats.clear();
+    _totals = BusyTotals();
+}
+
+
+std::map<std::string, BusyStats> BusyHandler::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+
+BusyTotals BusyHandler::get_totals() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _totals;
+}
@@ -0,0 +1,118 @@
+#ifndef BUSYHANDLER_H
+#define BUSYHANDLER_H
+
+#include <array>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+enum class BusyOperation { Read, Write, Transaction, Other };
+
+// lock-wait budget of one operation (all its waits), per kind of statement
+struct BusyOptions
+{
+    int read_deadline_ms = 2000;         // SELECT, WITH, PRAGMA, EXPLAIN, VALUES
+    int write_deadline_ms = 5000;        // INSERT, UPDATE, DELETE, DDL ...
+    int transaction_deadline_ms = 10000; // BEGIN, COMMIT, END, ROLLBACK, SAVEPOINT, RELEASE
+    int other_deadline_ms = 5000;        // statements run on the handle outside SqliteWrap calls
+    int initial_delay_us = 200;          // backoff : random sleep in [0, initial * 2^retry], ...
+    int max_delay_ms = 50;               // ... at most this long
+};
+
+// waits of the operations of one statement digest
+struct BusyStats
+{
+    unsigned long long waits = 0;        // operations that waited for a lock
+    unsigned long long retries = 0;
+    unsigned long long timeouts = 0;     // gave up at the deadline (SQLITE_BUSY returned)
+    double wait_ms = 0;
+    double max_wait_ms = 0;
+    std::array<unsigned long long, 12> histogram {};   // wait per operation, bounds in histogram_bounds_ms
+};
+
+// all operations run through SqliteWrap : lock waits against the total time
+struct BusyTotals
+{
+    unsigned long long statements = 0;
+    unsigned long long waits = 0;
+    unsigned long long retries = 0;
+    unsigned long long timeouts = 0;
+    double time_ms = 0;
+    double wait_ms = 0;
+};
+
+// sqlite3_busy_handler with jittered exponential backoff (full jitter : concurrent
+// waiters do not retry in lockstep) and a deadline per operation, by kind of statement.
+// Installed by SqliteWrap::enable_busy_handler().
+//
+// Lock waits are counted per statement digest : the SQL with literals replaced by ?,
+// lower case, blanks collapsed ("select * from person where id = ?"). SqliteWrap calls
+// open a Scope naming their statement; waits of statements run on the handle directly
+// (helper classes) go under "(unscoped)", without histogram.
+class SQLITEWRAP_EXPORT BusyHandler
+{
+public:
+    explicit BusyHandler(const BusyOptions& options = BusyOptions());
+
+    BusyHandler(const BusyHandler&) = delete;
+    BusyHandler& operator=(const BusyHandler&) = delete;
+
+    // the operation the connection runs; nested scopes belong to the outer one
+    class Scope
+    {
+    public:
+        Scope(BusyHandler* handler, const std::string& sql);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        BusyHandler* _handler = nullptr;
+    };
+
+    void set_options(const BusyOptions& options) { _options = options; }
+    void reset_stats();
+
+    static int callback(void* user_param, int count);       // for sqlite3_busy_handler
+    static std::string digest(const std::string& sql);
+    static BusyOperation operation(const std::string& sql);
+
+    static constexpr std::array<double, 11> histogram_bounds_ms { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000 };
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    BusyOptions _options;
+    std::minstd_rand _random;
+
+    // current operation : the connection runs one at a time
+    const std::string* _sql = nullptr;
+    Clock::time_point _start;
+    Clock::time_point _wait_start;
+    double _wait_ms = 0;                 // earlier waits of the operation
+    double _episode_ms = 0;              // current wait
+    unsigned long long _retries = 0;
+    bool _waited = false;
+    bool _timed_out = false;
+
+    mutable std::mutex _mutex;           // statistics, read from other threads
+    std::map<std::string, BusyStats> _stats;
+    BusyTotals _totals;
+
+    int deadline_ms() const;
+    void end_operation();
+
+public:
+    // getter
+    std::map<std::string, BusyStats> get_stats() const;
+    BusyTotals get_totals() const;
+    const BusyOptions& get_options() const { return _options; }
+};
+
+#endif // BUSYHANDLER_H
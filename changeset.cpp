@@ -0,0 +1,460 @@
+#include <cstdio>
+#include <cstring>
+
+#include "changeset.h"
+#include "logger.h"
+#include "outputsink.h"
+#include "sqlitewrap.h"
+
+
+namespace
+{
+    const char frame_magic[4] = { 'S', 'W', 'C', 'S' };
+
+    void put_u32(unsigned char* out, unsigned long value)
+    {
+        for (int i = 0; i < 4; i++) out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+
+    void put_u64(unsigned char* out, unsigned long long value)
+    {
+        for (int i = 0; i < 8; i++) out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+
+    unsigned long get_u32(const unsigned char* in)
+    {
+        unsigned long value = 0;
+        for (int i = 3; i >= 0; i--) value = (value << 8) | in[i];
+        return value;
+    }
+
+    unsigned long long get_u64(const unsigned char* in)
+    {
+        unsigned long long value = 0;
+        for (int i = 7; i >= 0; i--) value = (value << 8) | in[i];
+        return value;
+    }
+
+    bool exec(sqlite3* handle, const char* sql)
+    {
+        return sqlite3_exec(handle, sql, nullptr, nullptr, nullptr) == SQLITE_OK;
+    }
+}
+
+
+ChangesetCapture::ChangesetCapture(SqliteWrap &db)
+    : _db(db)
+{
+}
+
+
+ChangesetCapture::~ChangesetCapture()
+{
+    stop();
+}
+
+
+bool ChangesetCapture::start(const std::vector<std::string> &tables, OutputSink &sink, const CaptureOptions &options)
+{
+#ifdef SQLITE_ENABLE_SESSION
+    stop();
+
+    _handle = _db.get_handle();
+    if (!_handle) return error("start", "Database not connected.");
+    if (!sink.is_open()) return error("start", "The sink is not open.");
+
+    _tables = tables;
+    _sink = &sink;
+    _options = options;
+    _metrics = CaptureMetrics();
+    _last_flush = std::chrono::steady_clock::now();
+
+    _session = open_session();
+    if (!_session)
+    {
+        _handle = nullptr;
+        _sink = nullptr;
+        return false;
+    }
+
+    return true;
+#else
+    (void)tables;
+    (void)sink;
+    (void)options;
+    return error("start", "SQLite is built without SQLITE_ENABLE_SESSION.");
+#endif
+}
+
+
+void ChangesetCapture::stop()
+{
+#ifdef SQLITE_ENABLE_SESSION
+    if (_session) sqlite3session_delete(_session);
+#endif
+    _session = nullptr;
+    _handle = nullptr;
+    _sink = nullptr;
+}
+
+
+bool ChangesetCapture::flush()
+{
+#ifdef SQLITE_ENABLE_SESSION
+    if (!_session) return error("flush", "Capture not started.");
+    if (!sqlite3_get_autocommit(_handle)) return error("flush", "A transaction is open : flush after its commit.");
+
+    _last_flush = std::chrono::steady_clock::now();
+
+    if (sqlite3session_isempty(_session))
+    {
+        _metrics.empty++;
+        return true;
+    }
+
+    int size = 0;
+    void* data = nullptr;
+    int rc = _options.patchset ? sqlite3session_patchset(_session, &size, &data)
+                               : sqlite3session_changeset(_session, &size, &data);
+    if (rc != SQLITE_OK)
+    {
+        sqlite3_free(data);
+        return error("flush", sqlite3_errstr(rc));
+    }
+
+    // changes cancelling out (insert then delete) leave an empty changeset
+    if (size == 0)
+    {
+        sqlite3_free(data);
+        _metrics.empty++;
+        return true;
+    }
+
+    // a new session : the next changeset only holds what follows. On failure the current
+    // one is kept and the changes are sent again with the next flush
+    sqlite3_session* next = open_session();
+    if (!next)
+    {
+        sqlite3_free(data);
+        return false;
+    }
+
+    unsigned char header[frame_header_size] = {};
+    std::memcpy(header, frame_magic, sizeof(frame_magic));
+    header[4] = _options.patchset ? 1 : 0;
+    put_u64(header + 8, _options.sequence + 1);
+    put_u32(header + 16, static_cast<unsigned long>(size));
+
+    bool ok = _sink->append(reinterpret_cast<const char*>(header), sizeof(header))
+              && _sink->append(static_cast<const char*>(data), static_cast<size_t>(size))
+              && _sink->flush();
+    sqlite3_free(data);
+
+    if (!ok)
+    {
+        sqlite3session_delete(next);
+        return error("flush", _sink->get_last_error());
+    }
+
+    sqlite3session_delete(_session);
+    _session = next;
+
+    _options.sequence++;
+    _metrics.changesets++;
+    _metrics.bytes += static_cast<unsigned long long>(size);
+
+    return true;
+#else
+    return error("flush", "SQLite is built without SQLITE_ENABLE_SESSION.");
+#endif
+}
+
+
+bool ChangesetCapture::flush_if_due()
+{
+    auto elapsed = std::chrono::steady_clock::now() - _last_flush;
+    if (_session && elapsed < std::chrono::milliseconds(_options.interval_ms)) return true;
+
+    return flush();
+}
+
+
+sqlite3_session* ChangesetCapture::open_session()
+{
+#ifdef SQLITE_ENABLE_SESSION
+    sqlite3_session* session = nullptr;
+    int rc = sqlite3session_create(_handle, "main", &session);
+    if (rc != SQLITE_OK)
+    {
+        error("open_session", sqlite3_errstr(rc));
+        return nullptr;
+    }
+
+    if (_tables.empty()) rc = sqlite3session_attach(session, nullptr);
+    for (size_t i = 0; i < _tables.size() && rc == SQLITE_OK; i++) rc = sqlite3session_attach(session, _tables[i].c_str());
+
+    if (rc != SQLITE_OK)
+    {
+        sqlite3session_delete(session);
+        error("open_session", sqlite3_errstr(rc));
+        return nullptr;
+    }
+
+    return session;
+#else
+    return nullptr;
+#endif
+}
+
+
+bool ChangesetCapture::error(const char *function, const std::string &message)
+{
+    _last_error = message;
+    SQLITEWRAP_LOG_ERROR("ChangesetCapture::" << function << "(...) - Error: " << message);
+    return false;
+}
+
+
+ChangesetReplica::ChangesetReplica(SqliteWrap &db)
+    : _db(db)
+{
+}
+
+
+bool ChangesetReplica::apply(const void *data, int size, ConflictPolicy policy)
+{
+    sqlite3* handle = _db.get_handle();
+    if (!handle) return error("apply", "Database not connected.");
+
+    _policy = policy;
+    return apply_changeset(handle, data, size);
+}
+
+
+bool ChangesetReplica::apply_frames(const void *data, size_t size, ConflictPolicy policy, size_t &consumed)
+{
+    consumed = 0;
+    if (!_db.get_handle()) return error("apply_frames", "Database not connected.");
+
+    _policy = policy;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+    while (size - consumed >= ChangesetCapture::frame_header_size)
+    {
+        const unsigned char* frame = bytes + consumed;
+        if (std::memcmp(frame, frame_magic, sizeof(frame_magic)) != 0) return error("apply_frames", "Not a changeset frame.");
+
+        size_t frame_size = ChangesetCapture::frame_header_size + get_u32(frame + 16);
+        if (size - consumed < frame_size) break;
+
+        if (!apply_frame(frame)) return false;
+        consumed += frame_size;
+    }
+
+    return true;
+}
+
+
+bool ChangesetReplica::apply_file(const std::string &path, ConflictPolicy policy)
+{
+    if (!_db.get_handle()) return error("apply_file", "Database not connected.");
+
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) return error("apply_file", "Cannot open " + path);
+
+    _policy = policy;
+    std::vector<unsigned char> frame(ChangesetCapture::frame_header_size);
+    bool ok = true;
+
+    // frame by frame : the log may be much larger than memory
+    while (ok)
+    {
+        size_t read = std::fread(frame.data(), 1, ChangesetCapture::frame_header_size, file);
+        if (read == 0) break;
+        if (read < ChangesetCapture::frame_header_size || std::memcmp(frame.data(), frame_magic, sizeof(frame_magic)) != 0)
+        {
+            ok = error("apply_file", "Truncated or invalid frame in " + path);
+            break;
+        }
+
+        size_t size = get_u32(frame.data() + 16);
+        frame.resize(ChangesetCapture::frame_header_size + size);
+        if (std::fread(frame.data() + ChangesetCapture::frame_header_size, 1, size, file) != size)
+        {
+            ok = error("apply_file", "Truncated frame in " + path);
+            break;
+        }
+
+        ok = apply_frame(frame.data());
+    }
+
+    std::fclose(file);
+    return ok;
+}
+
+
+bool ChangesetReplica::get_sequence(unsigned long long &sequence)
+{
+    sqlite3* handle = _db.get_handle();
+    if (!handle) return error("get_sequence", "Database not connected.");
+
+    return read_sequence(handle, sequence);
+}
+
+
+bool ChangesetReplica::set_sequence(unsigned long long sequence)
+{
+    sqlite3* handle = _db.get_handle();
+    if (!handle) return error("set_sequence", "Database not connected.");
+
+    return write_sequence(handle, sequence);
+}
+
+
+bool ChangesetReplica::apply_frame(const unsigned char *frame)
+{
+    sqlite3* handle = _db.get_handle();
+    unsigned long long sequence = get_u64(frame + 8);
+    int size = static_cast<int>(get_u32(frame + 16));
+
+    // the changeset and its sequence number commit together
+    if (!exec(handle, "BEGIN IMMEDIATE;")) return error("apply_frame", sqlite3_errmsg(handle));
+
+    unsigned long long applied = 0;
+    if (!read_sequence(handle, applied))
+    {
+        exec(handle, "ROLLBACK;");
+        return false;
+    }
+
+    if (sequence <= applied)
+    {
+        exec(handle, "ROLLBACK;");
+        _metrics.duplicates++;
+        return true;
+    }
+
+    if (sequence != applied + 1)
+    {
+        exec(handle, "ROLLBACK;");
+        return error("apply_frame", "Missing changesets " + std::to_string(applied + 1) + " to " + std::to_string(sequence - 1) + ".");
+    }
+
+    if (!apply_changeset(handle, frame + ChangesetCapture::frame_header_size, size) || !write_sequence(handle, sequence))
+    {
+        exec(handle, "ROLLBACK;");
+        return false;
+    }
+
+    if (!exec(handle, "COMMIT;"))
+    {
+        std::string message = sqlite3_errmsg(handle);
+        exec(handle, "ROLLBACK;");
+        return error("apply_frame", message);
+    }
+
+    return true;
+}
+
+
+bool ChangesetReplica::apply_changeset(sqlite3 *handle, const void *data, int size)
+{
+#ifdef SQLITE_ENABLE_SESSION
+    // runs in its own savepoint : an aborted changeset leaves nothing behind
+    int rc = sqlite3changeset_apply(handle, size, const_cast<void*>(data), nullptr, &ChangesetReplica::conflict, this);
+    if (rc != SQLITE_OK) return error("apply_changeset", rc == SQLITE_ABORT ? "Conflict, changeset rolled back." : sqlite3_errmsg(handle));
+
+    _metrics.changesets++;
+    return true;
+#else
+    (void)handle;
+    (void)data;
+    (void)size;
+    return error("apply_changeset", "SQLite is built without SQLITE_ENABLE_SESSION.");
+#endif
+}
+
+
+int ChangesetReplica::conflict(void *user_param, int type, sqlite3_changeset_iter *)
+{
+#ifdef SQLITE_ENABLE_SESSION
+    ChangesetReplica* replica = static_cast<ChangesetReplica*>(user_param);
+    ReplicaMetrics& metrics = replica->_metrics;
+
+    // REPLACE is only valid for DATA and CONFLICT
+    bool replaceable = false;
+    switch (type)
+    {
+    case SQLITE_CHANGESET_DATA: metrics.data++; replaceable = true; break;
+    case SQLITE_CHANGESET_CONFLICT: metrics.conflict++; replaceable = true; break;
+    case SQLITE_CHANGESET_NOTFOUND: metrics.not_found++; break;
+    case SQLITE_CHANGESET_CONSTRAINT: metrics.constraint++; break;
+    case SQLITE_CHANGESET_FOREIGN_KEY: metrics.foreign_key++; break;
+    }
+
+    if (replica->_policy == ConflictPolicy::Abort) return SQLITE_CHANGESET_ABORT;
+
+    if (replica->_policy == ConflictPolicy::Replace && replaceable)
+    {
+        metrics.replaced++;
+        return SQLITE_CHANGESET_REPLACE;
+    }
+
+    metrics.omitted++;
+    return SQLITE_CHANGESET_OMIT;
+#else
+    (void)user_param;
+    (void)type;
+    return 0;
+#endif
+}
+
+
+bool ChangesetReplica::read_sequence(sqlite3 *handle, unsigned long long &sequence)
+{
+    sequence = 0;
+
+    sqlite3_stmt* statement = nullptr;
+    int rc = sqlite3_prepare_v2(handle, "SELECT sequence FROM sqlitewrap_replica WHERE id = 1;", -1, &statement, nullptr);
+
+    // no table yet : nothing applied
+    if (rc != SQLITE_OK)
+    {
+        sqlite3_finalize(statement);
+        return true;
+    }
+
+    rc = sqlite3_step(statement);
+    if (rc == SQLITE_ROW) sequence = static_cast<unsigned long long>(sqlite3_column_int64(statement, 0));
+    sqlite3_finalize(statement);
+
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) return error("read_sequence", sqlite3_errmsg(handle));
+    return true;
+}
+
+
+bool ChangesetReplica::write_sequence(sqlite3 *handle, unsigned long long sequence)
+{
+    if (!exec(handle, "CREATE TABLE IF NOT EXISTS sqlitewrap_replica(id INTEGER PRIMARY KEY CHECK (id = 1), sequence INTEGER NOT NULL);"))
+        return error("write_sequence", sqlite3_errmsg(handle));
+
+    sqlite3_stmt* statement = nullptr;
+    int rc = sqlite3_prepare_v2(handle, "INSERT OR REPLACE INTO sqlitewrap_replica(id, sequence) VALUES (1, ?);", -1, &statement, nullptr);
+    if (rc == SQLITE_OK)
+    {
+        sqlite3_bind_int64(statement, 1, static_cast<sqlite3_int64>(sequence));
+        rc = sqlite3_step(statement);
+    }
+    sqlite3_finalize(statement);
+
+    if (rc != SQLITE_DONE) return error("write_sequence", sqlite3_errmsg(handle));
+    return true;
+}
+
+
+bool ChangesetReplica::error(const char *function, const std::string &message)
+{
+    _last_error = message;
+    SQLITEWRAP_LOG_ERROR("ChangesetReplica::" << function << "(...) - Error: " << message);
+    return false;
+}
@@ -0,0 +1,157 @@
+#ifndef CHANGESET_H
+#define CHANGESET_H
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+class OutputSink;
+class SqliteWrap;
+struct sqlite3_session;                  // declared by sqlite3.h with SQLITE_ENABLE_SESSION only
+struct sqlite3_changeset_iter;
+
+struct CaptureOptions
+{
+    bool patchset = false;               // smaller : no old values, UPDATE / DELETE conflicts are not detected on the replica
+    int interval_ms = 0;                 // flush_if_due() : at most one changeset per interval, 0 : at every call
+    unsigned long long sequence = 0;     // of the last changeset sent, the next one is sequence + 1
+};
+
+struct CaptureMetrics
+{
+    unsigned long long changesets = 0;   // frames written
+    unsigned long long bytes = 0;        // changeset bytes, without the frame headers
+    unsigned long long empty = 0;        // flushes with no change
+};
+
+// On the replica, for a change that does not apply as recorded
+enum class ConflictPolicy
+{
+    Abort,                               // the whole changeset is rolled back, apply fails
+    Omit,                                // the conflicting change is skipped, the replica row is kept
+    Replace                              // the changeset wins : the replica row is overwritten
+};
+
+struct ReplicaMetrics
+{
+    unsigned long long changesets = 0;   // applied
+    unsigned long long duplicates = 0;   // frames already applied, skipped
+    unsigned long long data = 0;         // conflicts : row found with other values (UPDATE / DELETE)
+    unsigned long long not_found = 0;    //   row to UPDATE / DELETE missing, always skipped
+    unsigned long long conflict = 0;     //   primary key already there (INSERT)
+    unsigned long long constraint = 0;   //   other constraint, skipped or aborted
+    unsigned long long foreign_key = 0;  //   foreign keys left broken (count)
+    unsigned long long omitted = 0;      // conflicting changes skipped
+    unsigned long long replaced = 0;     // conflicting changes forced
+};
+
+// Change capture for incremental replication, with the session extension : the changes
+// of the chosen tables (all tables when none is given; tables without PRIMARY KEY are
+// ignored by sessions) are collected as the connection writes, then flush() writes them
+// as one changeset to an OutputSink (file or callback) and starts collecting again.
+//
+//     ChangesetCapture capture(db);
+//     capture.start({ "person", "address" }, sink);
+//     db.execute_sql("BEGIN; ... COMMIT;");
+//     capture.flush();                  // one changeset per transaction
+//
+// Or flush_if_due() after the commits : one changeset per interval_ms. Flushes only run
+// outside of transactions, so a changeset never holds uncommitted changes. Changes made
+// by other connections are not seen. Call stop() before closing the connection.
+//
+// Stream format : a frame per changeset, little endian
+//     "SWCS" | u8 kind (0 changeset, 1 patchset) | 3 x 0 | u64 sequence | u32 size | size bytes
+//
+// ChangesetReplica applies the frames in sequence order with sqlite3changeset_apply(),
+// each in one transaction that also records the sequence (table sqlitewrap_replica) :
+// frames already applied are skipped, a missing frame stops the stream.
+//
+//     ChangesetReplica replica(copy);
+//     replica.apply_file("changes.log", ConflictPolicy::Replace);
+//
+// Needs SQLITE_ENABLE_SESSION and SQLITE_ENABLE_PREUPDATE_HOOK : without them every
+// call fails.
+class SQLITEWRAP_EXPORT ChangesetCapture
+{
+public:
+    explicit ChangesetCapture(SqliteWrap& db);
+    ~ChangesetCapture();
+
+    ChangesetCapture(const ChangesetCapture&) = delete;
+    ChangesetCapture& operator=(const ChangesetCapture&) = delete;
+
+    // sink is not owned, it must stay open until stop()
+    bool start(const std::vector<std::string>& tables, OutputSink& sink, const CaptureOptions& options = CaptureOptions());
+    void stop();                         // changes not flushed are dropped
+    bool is_running() const { return _session != nullptr; }
+
+    bool flush();
+    bool flush_if_due();
+
+    static constexpr size_t frame_header_size = 20;
+
+private:
+    SqliteWrap& _db;
+    sqlite3* _handle = nullptr;
+    sqlite3_session* _session = nullptr;
+    std::vector<std::string> _tables;
+    OutputSink* _sink = nullptr;
+    CaptureOptions _options;
+    CaptureMetrics _metrics;
+    std::chrono::steady_clock::time_point _last_flush;
+    std::string _last_error;
+
+    sqlite3_session* open_session();
+    bool error(const char* function, const std::string& message);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+    const CaptureMetrics& get_metrics() const { return _metrics; }
+    unsigned long long get_sequence() const { return _options.sequence; }   // of the last changeset written
+};
+
+
+class SQLITEWRAP_EXPORT ChangesetReplica
+{
+public:
+    explicit ChangesetReplica(SqliteWrap& db);
+
+    // one changeset or patchset, not framed, in its own transaction
+    bool apply(const void* data, int size, ConflictPolicy policy);
+
+    // frames in memory; consumed : bytes of the complete frames handled (a partial
+    // frame at the end waits for more data)
+    bool apply_frames(const void* data, size_t size, ConflictPolicy policy, size_t& consumed);
+    // frames of a file written by ChangesetCapture
+    bool apply_file(const std::string& path, ConflictPolicy policy);
+
+    // of the last frame applied, 0 : none. Set it on a replica seeded with a copy of the
+    // database file : the sequence of the capture when the copy was made
+    bool get_sequence(unsigned long long& sequence);
+    bool set_sequence(unsigned long long sequence);
+
+private:
+    SqliteWrap& _db;
+    ReplicaMetrics _metrics;
+    ConflictPolicy _policy = ConflictPolicy::Abort;
+    std::string _last_error;
+
+    bool apply_frame(const unsigned char* frame);
+    bool apply_changeset(sqlite3* handle, const void* data, int size);
+    bool read_sequence(sqlite3* handle, unsigned long long& sequence);
+    bool write_sequence(sqlite3* handle, unsigned long long sequence);
+    static int conflict(void* user_param, int type, sqlite3_changeset_iter* iterator);
+    bool error(const char* function, const std::string& message);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+    const ReplicaMetrics& get_metrics() const { return _metrics; }
+};
+
+#endif // CHANGESET_H
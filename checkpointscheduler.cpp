@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+#include "checkpointscheduler.h"
+#include "logger.h"
+#include "sqlitewrap.h"
+
+
+namespace
+{
+    long long now_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+
+CheckpointScheduler::CheckpointScheduler(SqliteWrap &db)
+    : _db(db)
+{
+}
+
+
+CheckpointScheduler::~CheckpointScheduler()
+{
+    stop();
+}
+
+
+bool CheckpointScheduler::start(const CheckpointOptions &options)
+{
+    stop();
+
+    sqlite3* handle = _db.get_handle();
+    if (!handle) return error("start", "Database not connected.");
+
+    const char* filename = sqlite3_db_filename(handle, "main");
+    if (!filename || !*filename) return error("start", "The checkpoints need a database file.");
+
+    bool wal = false;
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(handle, "PRAGMA journal_mode;", -1, &statement, nullptr) == SQLITE_OK && sqlite3_step(statement) == SQLITE_ROW)
+        wal = sqlite3_stricmp(reinterpret_cast<const char*>(sqlite3_column_text(statement, 0)), "wal") == 0;
+    sqlite3_finalize(statement);
+    if (!wal) return error("start", "The database is not in WAL mode.");
+
+    if (sqlite3_open_v2(filename, &_checkpointer, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK)
+    {
+        std::string message = _checkpointer ? sqlite3_errmsg(_checkpointer) : "Out of memory.";
+        sqlite3_close(_checkpointer);
+        _checkpointer = nullptr;
+        return error("start", message);
+    }
+
+    // a connection only finds the WAL at its first read; before, checkpoints do nothing
+    if (sqlite3_exec(_checkpointer, "SELECT count(*) FROM sqlite_master;", nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+        std::string message = sqlite3_errmsg(_checkpointer);
+        sqlite3_close(_checkpointer);
+        _checkpointer = nullptr;
+        return error("start", message);
+    }
+
+    _handle = handle;
+    _wal_path = std::string(filename) + "-wal";
+    _options = options;
+    _wal_frames = 0;
+    _wal_restarted = false;
+    _last_commit = now_ms();
+    _stop = false;
+    _backfilled = 0;
+    _retry_at = 0;
+    _metrics = CheckpointMetrics();
+
+    // replaces the automatic checkpoint of the connection
+    sqlite3_wal_hook(_handle, wal_hook, this);
+
+    _thread = std::thread(&CheckpointScheduler::run, this);
+    return true;
+}
+
+
+void CheckpointScheduler::stop()
+{
+    if (_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _signal.notify_all();
+        _thread.join();
+    }
+
+    if (_handle)
+    {
+        sqlite3_wal_autocheckpoint(_handle, 1000);
+        _handle = nullptr;
+    }
+
+    std::lock_guard<std::mutex> connection(_connection_mutex);
+    sqlite3_close(_checkpointer);
+    _checkpointer = nullptr;
+}
+
+
+bool CheckpointScheduler::checkpoint(CheckpointMode mode)
+{
+    if (!is_running()) return error("checkpoint", "Scheduler not started.");
+
+    return run_checkpoint(mode);
+}
+
+
+bool CheckpointScheduler::get_metrics(CheckpointMetrics &metrics)
+{
+    if (!is_running()) return error("get_metrics", "Scheduler not started.");
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        metrics = _metrics;
+    }
+    metrics.wal_frames = _wal_frames;
+
+    std::error_code ignored;
+    auto size = std::filesystem::file_size(_wal_path, ignored);
+    metrics.wal_bytes = ignored ? 0 : static_cast<long long>(size);
+
+    return true;
+}
+
+
+int CheckpointScheduler::wal_hook(void *user_param, sqlite3 *, const char *database, int frames)
+{
+    // runs in the commit of the writer : record, never checkpoint here
+    CheckpointScheduler* scheduler = static_cast<CheckpointScheduler*>(user_param);
+    if (std::strcmp(database, "main") != 0) return SQLITE_OK;
+
+    int previous = scheduler->_wal_frames.exchange(frames);
+    if (frames < previous) scheduler->_wal_restarted = true;
+    scheduler->_last_commit = now_ms();
+
+    // size thresholds do not wait for the next tick
+    const CheckpointOptions& options = scheduler->_options;
+    if ((previous < options.restart_frames && frames >= options.restart_frames)
+        || (previous < options.truncate_frames && frames >= options.truncate_frames))
+        scheduler->_signal.notify_one();
+
+    return SQLITE_OK;
+}
+
+
+void CheckpointScheduler::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    const auto tick = std::chrono::milliseconds(std::max(_options.idle_ms / 4, 1));
+
+    while (!_stop)
+    {
+        _signal.wait_for(lock, tick);
+        if (_stop) break;
+
+        // the writer started the WAL over : nothing of it is copied yet
+        if (_wal_restarted.exchange(false)) _backfilled = 0;
+
+        long long now = now_ms();
+        int frames = _wal_frames;
+
+        CheckpointMode mode;
+        if (frames >= _options.truncate_frames) mode = CheckpointMode::Truncate;
+        else if (frames >= _options.restart_frames) mode = CheckpointMode::Restart;
+        else if (frames - _backfilled >= _options.passive_frames && now - _last_commit >= _options.idle_ms) mode = CheckpointMode::Passive;
+        else continue;
+
+        if (now < _retry_at) continue;
+
+        lock.unlock();
+        bool complete = run_checkpoint(mode);
+        lock.lock();
+
+        // readers still use the WAL : do not retry at every tick
+        if (!complete) _retry_at = now_ms() + _options.retry_ms;
+    }
+}
+
+
+bool CheckpointScheduler::run_checkpoint(CheckpointMode mode)
+{
+    std::lock_guard<std::mutex> connection(_connection_mutex);
+    if (!_checkpointer) return false;
+
+    auto start = std::chrono::steady_clock::now();
+    int log_frames = -1;
+    int backfilled = -1;
+
+    // RESTART / TRUNCATE hold the writer lock : copy first without it, so writers only
+    // wait for the reset of the WAL. Only TRUNCATE waits for readers.
+    if (mode != CheckpointMode::Passive) sqlite3_wal_checkpoint_v2(_checkpointer, "main", SQLITE_CHECKPOINT_PASSIVE, nullptr, nullptr);
+    sqlite3_busy_timeout(_checkpointer, mode == CheckpointMode::Restart ? 0 : _options.busy_timeout_ms);
+
+    int rc = sqlite3_wal_checkpoint_v2(_checkpointer, "main", static_cast<int>(mode), &log_frames, &backfilled);
+    double duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _metrics.last_duration_ms = duration;
+    _metrics.max_duration_ms = std::max(_metrics.max_duration_ms, duration);
+    _metrics.total_duration_ms += duration;
+
+    switch (mode)
+    {
+    case CheckpointMode::Passive: _metrics.passive++; break;
+    case CheckpointMode::Full: _metrics.full++; break;
+    case CheckpointMode::Restart: _metrics.restart++; break;
+    case CheckpointMode::Truncate: _metrics.truncate++; break;
+    }
+
+    if (rc == SQLITE_BUSY) _metrics.busy++;
+    else if (rc != SQLITE_OK || log_frames < 0)
+    {
+        error("run_checkpoint", rc != SQLITE_OK ? sqlite3_errmsg(_checkpointer) : "The database is not in WAL mode.");
+        return false;
+    }
+    _last_error.clear();
+
+    // a busy checkpoint may still have copied frames
+    if (backfilled >= 0)
+    {
+        int copied = std::max(0, backfilled - _backfilled);
+        _metrics.frames_backfilled += static_cast<unsigned long long>(copied);
+        _metrics.last_frames_backfilled = copied;
+        _backfilled = backfilled;
+    }
+
+    if (rc == SQLITE_BUSY) return false;
+
+    // the next commit starts the WAL over
+    if (mode == CheckpointMode::Restart || mode == CheckpointMode::Truncate)
+    {
+        _wal_frames = 0;
+        _backfilled = 0;
+    }
+
+    return log_frames == backfilled;
+}
+
+
+bool CheckpointScheduler::error(const char *function, const std::string &message)
+{
+    _last_error = message;
+    SQLITEWRAP_LOG_ERROR("CheckpointScheduler::" << function << "(...) - Error: " << message);
+    return false;
+}
@@ -0,0 +1,115 @@
+#ifndef CHECKPOINTSCHEDULER_H
+#define CHECKPOINTSCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+class SqliteWrap;
+
+enum class CheckpointMode
+{
+    Passive = SQLITE_CHECKPOINT_PASSIVE,     // copies what it can, never waits
+    Full = SQLITE_CHECKPOINT_FULL,           // waits for writers, copies everything
+    Restart = SQLITE_CHECKPOINT_RESTART,     // + waits for readers : the next writer restarts the WAL
+    Truncate = SQLITE_CHECKPOINT_TRUNCATE    // + truncates the WAL file
+};
+
+struct CheckpointOptions
+{
+    int passive_frames = 1000;           // frames not yet copied before a PASSIVE checkpoint ...
+    int idle_ms = 100;                   // ... once no transaction committed for this long
+    int restart_frames = 20000;          // WAL size (frames) escalating to RESTART, even while busy
+    int truncate_frames = 100000;        // WAL size (frames) escalating to TRUNCATE
+    int busy_timeout_ms = 1000;          // TRUNCATE (and manual FULL) : wait for readers and writers
+    int retry_ms = 1000;                 // after a checkpoint that could not complete
+};
+
+struct CheckpointMetrics
+{
+    int wal_frames = 0;                  // frames in the WAL at the last commit
+    long long wal_bytes = 0;             // size of the -wal file
+    unsigned long long passive = 0;      // checkpoints run, per mode
+    unsigned long long full = 0;
+    unsigned long long restart = 0;
+    unsigned long long truncate = 0;
+    unsigned long long busy = 0;         // checkpoints that gave up (readers or writers)
+    unsigned long long frames_backfilled = 0;   // copied to the database, all checkpoints
+    int last_frames_backfilled = 0;
+    double last_duration_ms = 0;
+    double max_duration_ms = 0;
+    double total_duration_ms = 0;
+};
+
+// Background WAL checkpoints for a connection in WAL mode : the commits of the writer no
+// longer run the checkpoints (the automatic checkpoint is replaced by a sqlite3_wal_hook
+// that only records the WAL size), a thread runs them on its own connection instead.
+//
+// PASSIVE when enough frames wait and the writer has been idle for idle_ms; RESTART
+// then TRUNCATE when the WAL grows past the size thresholds anyway (readers keep it from
+// being reused). Both copy the frames with a PASSIVE checkpoint first, then take the
+// writer lock for the reset only : RESTART gives up at once if readers still use the
+// WAL, TRUNCATE waits up to busy_timeout_ms for them.
+//
+//     CheckpointScheduler scheduler(db);
+//     scheduler.start();
+//     ...
+//     scheduler.stop();                // before closing the connection
+//
+// Commits of other connections are not seen : they keep their own checkpoints.
+class SQLITEWRAP_EXPORT CheckpointScheduler
+{
+public:
+    explicit CheckpointScheduler(SqliteWrap& db);
+    ~CheckpointScheduler();
+
+    CheckpointScheduler(const CheckpointScheduler&) = delete;
+    CheckpointScheduler& operator=(const CheckpointScheduler&) = delete;
+
+    bool start(const CheckpointOptions& options = CheckpointOptions());
+    void stop();                         // restores the automatic checkpoint (1000 pages)
+    bool is_running() const { return _thread.joinable(); }
+
+    // on the background connection, now
+    bool checkpoint(CheckpointMode mode);
+
+    bool get_metrics(CheckpointMetrics& metrics);
+
+private:
+    SqliteWrap& _db;
+    sqlite3* _handle = nullptr;          // connection of the hook
+    sqlite3* _checkpointer = nullptr;    // background connection
+    std::string _wal_path;
+    CheckpointOptions _options;
+
+    // written by the hook (writer thread)
+    std::atomic<int> _wal_frames { 0 };
+    std::atomic<bool> _wal_restarted { false };
+    std::atomic<long long> _last_commit { 0 };   // steady clock, ms
+
+    std::thread _thread;
+    std::mutex _connection_mutex;        // the background connection
+    std::mutex _mutex;                   // metrics, _backfilled, _stop
+    std::condition_variable _signal;
+    bool _stop = false;
+    int _backfilled = 0;                 // frames of the current WAL already copied
+    long long _retry_at = 0;
+    CheckpointMetrics _metrics;
+    std::string _last_error;
+
+    static int wal_hook(void* user_param, sqlite3* db, const char* database, int frames);
+    void run();
+    bool run_checkpoint(CheckpointMode mode);    // false : incomplete or failed
+    bool error(const char* function, const std::string& message);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+};
+
+#endif // CHECKPOINTSCHEDULER_H
@@ -0,0 +1,830 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CSV_SSE2
+#endif
+
+#include "csv.h"
+#include "logger.h"
+#include "outputsink.h"
+#include "schemacache.h"
+#include "sqlitewrap.h"
+
+
+namespace
+{
+    // ---- read-only mapping of the whole file
+
+    class MappedFile
+    {
+    public:
+        ~MappedFile() { close(); }
+
+        bool open(const std::string& path, std::string& error)
+        {
+#ifdef _WIN32
+            _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (_file == INVALID_HANDLE_VALUE)
+            {
+                error = "Cannot open " + path;
+                return false;
+            }
+
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(_file, &size))
+            {
+                error = "Cannot read the size of " + path;
+                return false;
+            }
+            _size = static_cast<size_t>(size.QuadPart);
+            if (_size == 0) return true;
+
+            _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (_mapping) _data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+            if (!_data)
+            {
+                error = "Cannot map " + path;
+                return false;
+            }
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                error = "Cannot open " + path + ": " + std::strerror(errno);
+                return false;
+            }
+
+            struct stat status;
+            if (fstat(fd, &status) != 0)
+            {
+                error = "Cannot read the size of " + path + ": " + std::strerror(errno);
+                ::close(fd);
+                return false;
+            }
+            _size = static_cast<size_t>(status.st_size);
+
+            if (_size > 0)
+            {
+                void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED)
+                {
+                    error = "Cannot map " + path + ": " + std::strerror(errno);
+                    ::close(fd);
+                    return false;
+                }
+                _data = static_cast<const char*>(data);
+#ifdef MADV_SEQUENTIAL
+                madvise(data, _size, MADV_SEQUENTIAL);
+#endif
+            }
+
+            ::close(fd);
+#endif
+            return true;
+        }
+
+        void close()
+        {
+#ifdef _WIN32
+            if (_data) UnmapViewOfFile(_data);
+            if (_mapping) CloseHandle(_mapping);
+            if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+            _mapping = nullptr;
+            _file = INVALID_HANDLE_VALUE;
+#else
+            if (_data) munmap(const_cast<char*>(_data), _size);
+#endif
+            _data = nullptr;
+            _size = 0;
+        }
+
+        const char* data() const { return _data; }
+        size_t size() const { return _size; }
+
+    private:
+        const char* _data = nullptr;
+        size_t _size = 0;
+#ifdef _WIN32
+        HANDLE _file = INVALID_HANDLE_VALUE;
+        HANDLE _mapping = nullptr;
+#endif
+    };
+
+
+    // ---- byte search, 16 bytes at a time
+
+#ifdef CSV_SSE2
+    inline int first_bit(unsigned int mask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+#endif
+
+    // first delimiter, quote or line break byte at or after p, end if none
+    const char* find_special(const char* p, const char* end, char delimiter, char quote)
+    {
+#ifdef CSV_SSE2
+        const __m128i delimiters = _mm_set1_epi8(delimiter);
+        const __m128i quotes = _mm_set1_epi8(quote);
+        const __m128i newlines = _mm_set1_epi8('\n');
+        const __m128i returns = _mm_set1_epi8('\r');
+
+        for (; end - p >= 16; p += 16)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i match = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, delimiters), _mm_cmpeq_epi8(bytes, quotes)),
+                                         _mm_or_si128(_mm_cmpeq_epi8(bytes, newlines), _mm_cmpeq_epi8(bytes, returns)));
+            unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(match));
+            if (mask) return p + first_bit(mask);
+        }
+#endif
+        for (; p < end; p++)
+            if (*p == delimiter || *p == quote || *p == '\n' || *p == '\r') return p;
+        return end;
+    }
+
+    // first quote or '\n' at or after p, end if none
+    const char* find_quote_or_newline(const char* p, const char* end, char quote)
+    {
+#ifdef CSV_SSE2
+        const __m128i quotes = _mm_set1_epi8(quote);
+        const __m128i newlines = _mm_set1_epi8('\n');
+
+        for (; end - p >= 16; p += 16)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, quotes), _mm_cmpeq_epi8(bytes, newlines))));
+            if (mask) return p + first_bit(mask);
+        }
+#endif
+        for (; p < end; p++)
+            if (*p == quote || *p == '\n') return p;
+        return end;
+    }
+
+    size_t count_byte(const char* p, const char* end, char c)
+    {
+        size_t count = 0;
+#ifdef CSV_SSE2
+        const __m128i value = _mm_set1_epi8(c);
+        for (; end - p >= 16; p += 16)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, value)));
+            while (mask)
+            {
+                mask &= mask - 1;
+                count++;
+            }
+        }
+#endif
+        for (; p < end; p++) count += *p == c;
+        return count;
+    }
+
+
+    // ---- record boundaries
+
+    // a line break ends a record when the number of quotes before it is even
+    struct ChunkScan
+    {
+        size_t quotes = 0;
+        const char* first_even = nullptr;    // first '\n' after an even number of quotes of the chunk
+        const char* first_odd = nullptr;     // after an odd number
+    };
+
+    ChunkScan scan_chunk(const char* p, const char* end, char quote)
+    {
+        ChunkScan scan;
+        while ((p = find_quote_or_newline(p, end, quote)) < end)
+        {
+            if (*p == quote) scan.quotes++;
+            else
+            {
+                const char*& first = scan.quotes % 2 ? scan.first_odd : scan.first_even;
+                if (!first) first = p;
+                if (scan.first_even && scan.first_odd)
+                {
+                    scan.quotes += count_byte(p + 1, end, quote);
+                    break;
+                }
+            }
+            p++;
+        }
+        return scan;
+    }
+
+
+    // ---- parsing
+
+    enum class FieldType : unsigned char { Null, Integer, Real, Text, Arena };
+
+    struct Field
+    {
+        FieldType type = FieldType::Null;
+        size_t size = 0;
+        union
+        {
+            sqlite3_int64 integer;
+            double real;
+            const char* text;                // in the mapping
+            size_t offset;                   // in the chunk arena (unescaped quoted field)
+        };
+
+        Field() : integer(0) {}
+    };
+
+    struct Chunk
+    {
+        const char* begin = nullptr;
+        const char* end = nullptr;
+        std::vector<Field> fields;           // records x field_count
+        std::string arena;
+        size_t records = 0;
+        std::string error;                   // "record n of the chunk : message"
+        bool done = false;
+    };
+
+    struct Layout
+    {
+        char delimiter;
+        char quote;
+        bool empty_as_null;
+        size_t field_count;
+        std::vector<unsigned char> numeric; // per field : convert to a number when possible
+    };
+
+    bool to_number(const char* text, size_t size, Field& field)
+    {
+        if (size == 0) return false;
+        char c = text[0];
+        if (!(c == '-' || c == '.' || (c >= '0' && c <= '9'))) return false;
+
+        sqlite3_int64 integer;
+        auto result = std::from_chars(text, text + size, integer);
+        if (result.ec == std::errc() && result.ptr == text + size)
+        {
+            field.type = FieldType::Integer;
+            field.integer = integer;
+            return true;
+        }
+
+        double real;
+        auto real_result = std::from_chars(text, text + size, real);
+        if (real_result.ec == std::errc() && real_result.ptr == text + size)
+        {
+            field.type = FieldType::Real;
+            field.real = real;
+            return true;
+        }
+
+        return false;
+    }
+
+    // one record from p; returns the start of the next record, nullptr on error
+    const char* parse_record(const char* p, const char* end, const Layout& layout, std::vector<Field>& fields, std::string& arena,
+                             size_t& field_count, std::string& error)
+    {
+        field_count = 0;
+
+        for (;;)
+        {
+            Field field;
+
+            if (p < end && *p == layout.quote)
+            {
+                const char* start = p + 1;
+                const char* quote = static_cast<const char*>(std::memchr(start, layout.quote, static_cast<size_t>(end - start)));
+                if (!quote)
+                {
+                    error = "unterminated quoted field";
+                    return nullptr;
+                }
+
+                if (quote + 1 < end && quote[1] == layout.quote)
+                {
+                    // doubled quotes : the only fields copied
+                    size_t offset = arena.size();
+                    for (;;)
+                    {
+                        arena.append(start, static_cast<size_t>(quote - start) + 1);
+                        start = quote + 2;
+                        quote = static_cast<const char*>(std::memchr(start, layout.quote, static_cast<size_t>(end - start)));
+                        if (!quote)
+                        {
+                            error = "unterminated quoted field";
+                            return nullptr;
+                        }
+                        if (!(quote + 1 < end && quote[1] == layout.quote)) break;
+                    }
+                    arena.append(start, static_cast<size_t>(quote - start));
+
+                    field.type = FieldType::Arena;
+                    field.offset = offset;
+                    field.size = arena.size() - offset;
+                }
+                else
+                {
+                    field.type = FieldType::Text;
+                    field.text = start;
+                    field.size = static_cast<size_t>(quote - start);
+                }
+                p = quote + 1;
+            }
+            else
+            {
+                // a quote inside an unquoted field is an error (RFC 4180) : the record boundaries
+                // are found by quote parity, a stray quote would shift them for the rest of the file
+                const char* stop = find_special(p, end, layout.delimiter, layout.quote);
+                if (stop < end && *stop == layout.quote)
+                {
+                    error = "quote inside an unquoted field";
+                    return nullptr;
+                }
+
+                if (stop > p || !layout.empty_as_null)
+                {
+                    field.type = FieldType::Text;
+                    field.text = p;
+                    field.size = static_cast<size_t>(stop - p);
+                }
+                p = stop;
+            }
+
+            if (field_count < layout.numeric.size() && layout.numeric[field_count] && field.type != FieldType::Null)
+            {
+                const char* text = field.type == FieldType::Arena ? arena.data() + field.offset : field.text;
+                to_number(text, field.size, field);
+            }
+
+            fields.push_back(field);
+            field_count++;
+
+            if (p >= end) return end;
+            if (*p == layout.delimiter)
+            {
+                p++;
+                continue;
+            }
+            if (*p == '\n') return p + 1;
+            if (*p == '\r')
+            {
+                p++;
+                return p < end && *p == '\n' ? p + 1 : p;
+            }
+
+            error = "unexpected character after a quoted field";
+            return nullptr;
+        }
+    }
+
+    const char* skip_blank_lines(const char* p, const char* end)
+    {
+        while (p < end && (*p == '\n' || *p == '\r')) p++;
+        return p;
+    }
+
+    void parse_chunk(Chunk& chunk, const Layout& layout)
+    {
+        const char* p = skip_blank_lines(chunk.begin, chunk.end);
+        size_t field_count;
+
+        chunk.fields.reserve(static_cast<size_t>(chunk.end - chunk.begin) / 16);
+
+        while (p < chunk.end)
+        {
+            std::string error;
+            p = parse_record(p, chunk.end, layout, chunk.fields, chunk.arena, field_count, error);
+            chunk.records++;
+
+            if (!p || field_count != layout.field_count)
+            {
+                if (p) error = std::to_string(field_count) + " fields, " + std::to_string(layout.field_count) + " expected";
+                chunk.error = error;
+                return;
+            }
+
+            p = skip_blank_lines(p, chunk.end);
+        }
+    }
+
+    bool fail(const std::string& message)
+    {
+        SQLITEWRAP_LOG_ERROR("Csv::import_csv(...) - Error: " << message);
+        return false;
+    }
+
+    // export
+
+    template <typename T>
+    bool write_number(OutputSink& sink, T value)
+    {
+        constexpr size_t room = 32;
+        char* out = sink.reserve(room);
+        if (!out) return false;
+
+        auto result = std::to_chars(out, out + room, value);
+        sink.commit(static_cast<size_t>(result.ptr - out));
+        return true;
+    }
+
+    // quoted only when needed, an empty string as "" (an empty field is NULL)
+    bool write_field(OutputSink& sink, const char* data, size_t size, char delimiter, char quote)
+    {
+        const char* end = data + size;
+        if (size != 0 && find_special(data, end, delimiter, quote) == end) return sink.append(data, size);
+
+        if (!sink.append(quote)) return false;
+
+        const char* p = data;
+        while (const char* q = static_cast<const char*>(std::memchr(p, quote, static_cast<size_t>(end - p))))
+        {
+            if (!sink.append(p, static_cast<size_t>(q - p + 1)) || !sink.append(quote)) return false;
+            p = q + 1;
+        }
+
+        return sink.append(p, static_cast<size_t>(end - p)) && sink.append(quote);
+    }
+
+    bool export_error(const std::string& message)
+    {
+        SQLITEWRAP_LOG_ERROR("Csv::export_csv(...) - Error: " << message);
+        return false;
+    }
+}
+
+
+bool Csv::import_csv(SqliteWrap &db, const std::string &path, const std::string &table, const CsvOptions &options, sqlite3_int64 *rows)
+{
+    if (rows) *rows = 0;
+
+    if (!db.get_handle()) return fail("Database not connected.");
+    if (options.delimiter == options.quote || options.delimiter == '\n' || options.delimiter == '\r')
+        return fail("Invalid delimiter.");
+
+    const TableInfo* info = db.get_schema_cache()->find_table(table);
+    if (!info || info->type != "table") return fail("No such table: " + table);
+
+    MappedFile file;
+    std::string error;
+    if (!file.open(path, error)) return fail(error);
+
+    const char* data = file.data();
+    const char* end = data + file.size();
+
+    // field -> table column
+    std::vector<int> field_columns;
+    Layout layout { options.delimiter, options.quote, options.empty_as_null, 0, {} };
+
+    const char* start = skip_blank_lines(data, end);
+    if (options.header)
+    {
+        if (start == end) return true;
+
+        std::vector<Field> fields;
+        std::string arena;
+        size_t field_count;
+        Layout header { options.delimiter, options.quote, false, 0, {} };
+
+        start = parse_record(start, end, header, fields, arena, field_count, error);
+        if (!start) return fail("Header: " + error);
+
+        for (const Field& field : fields)
+        {
+            std::string name = field.type == FieldType::Arena ? arena.substr(field.offset, field.size) : std::string(field.text, field.size);
+            field_columns.push_back(info->column_index(name));
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < info->columns.size(); i++)
+            if (info->columns[i].hidden == 0) field_columns.push_back(static_cast<int>(i));
+    }
+
+    // statement columns, in field order; header columns unknown to the table are skipped
+    std::vector<std::string> names;
+    std::vector<int> positions;
+    for (int column : field_columns)
+    {
+        positions.push_back(column < 0 ? -1 : static_cast<int>(names.size()));
+        if (column >= 0) names.push_back(info->columns[column].name);
+
+        ColumnAffinity affinity = column < 0 ? ColumnAffinity::Blob : info->columns[column].affinity;
+        layout.numeric.push_back(affinity == ColumnAffinity::Integer || affinity == ColumnAffinity::Real || affinity == ColumnAffinity::Numeric);
+    }
+    layout.field_count = field_columns.size();
+    if (names.empty()) return fail("No column of table " + table + " in the file.");
+
+    unsigned int cores = std::thread::hardware_concurrency();
+    unsigned int threads = options.threads ? options.threads : (cores > 1 ? cores - 1 : 1);
+    size_t chunk_size = std::max<size_t>(options.chunk_size, 64 * 1024);
+
+    // record boundaries : quote parity of each nominal chunk in parallel, then a prefix pass
+    size_t nominal_count = (static_cast<size_t>(end - start) + chunk_size - 1) / chunk_size;
+    std::vector<ChunkScan> scans(nominal_count);
+    {
+        std::atomic<size_t> next { 0 };
+        auto scan = [&]()
+        {
+            for (size_t i; (i = next++) < nominal_count;)
+            {
+                const char* begin = start + i * chunk_size;
+                scans[i] = scan_chunk(begin, std::min(begin + chunk_size, end), options.quote);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int t = 1; t < threads && t < nominal_count; t++) workers.emplace_back(scan);
+        scan();
+        for (std::thread& worker : workers) worker.join();
+    }
+
+    std::vector<Chunk> chunks;
+    bool in_quotes = false;
+    const char* chunk_begin = start;
+    for (size_t i = 0; i < nominal_count; i++)
+    {
+        // the first nominal chunk starts at a record; later ones start after their first record end
+        if (i > 0)
+        {
+            const char* first_end = in_quotes ? scans[i].first_odd : scans[i].first_even;
+            if (first_end)
+            {
+                chunks.emplace_back();
+                chunks.back().begin = chunk_begin;
+                chunks.back().end = first_end + 1;
+                chunk_begin = first_end + 1;
+            }
+        }
+        if (scans[i].quotes % 2) in_quotes = !in_quotes;
+    }
+    if (chunk_begin < end)
+    {
+        chunks.emplace_back();
+        chunks.back().begin = chunk_begin;
+        chunks.back().end = end;
+    }
+
+    BulkInsert insert(db);
+    if (!chunks.empty() && !insert.begin(info->name, names, options.insert)) return false;
+
+    // workers parse ahead of the writer, at most window chunks kept in memory
+    std::mutex mutex;
+    std::condition_variable parsed, consumed_signal;
+    size_t next = 0, consumed = 0;
+    bool stop = false;
+    const size_t window = threads * 2;
+
+    auto work = [&]()
+    {
+        for (;;)
+        {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                consumed_signal.wait(lock, [&] { return stop || next >= chunks.size() || next < consumed + window; });
+                if (stop || next >= chunks.size()) return;
+                i = next++;
+            }
+
+            parse_chunk(chunks[i], layout);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                chunks[i].done = true;
+            }
+            parsed.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < threads && t < chunks.size(); t++) workers.emplace_back(work);
+
+    sqlite3_int64 record_base = options.header ? 1 : 0;
+    bool ok = true;
+
+    for (size_t i = 0; ok && i < chunks.size(); i++)
+    {
+        Chunk& chunk = chunks[i];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            parsed.wait(lock, [&] { return chunk.done; });
+        }
+
+        // rows parsed before an error are inserted, then the error is reported
+        size_t complete = chunk.error.empty() ? chunk.records : chunk.records - 1;
+        const Field* field = chunk.fields.data();
+
+        for (size_t record = 0; record < complete; record++)
+        {
+            for (size_t f = 0; f < layout.field_count; f++, field++)
+            {
+                int position = positions[f];
+                if (position < 0) continue;
+
+                switch (field->type)
+                {
+                case FieldType::Integer: insert.bind_int64(position, field->integer); break;
+                case FieldType::Real: insert.bind_double(position, field->real); break;
+                case FieldType::Text: insert.bind_text(position, field->text, field->size); break;
+                case FieldType::Arena: insert.bind_text(position, chunk.arena.data() + field->offset, field->size); break;
+                case FieldType::Null: break;
+                }
+            }
+
+            if (!insert.insert_row())
+            {
+                error = "Record " + std::to_string(record_base + static_cast<sqlite3_int64>(record) + 1) + ": " + insert.get_last_error();
+                ok = false;
+                break;
+            }
+        }
+
+        if (ok && !chunk.error.empty())
+        {
+            error = "Record " + std::to_string(record_base + static_cast<sqlite3_int64>(chunk.records)) + ": " + chunk.error;
+            ok = false;
+        }
+
+        record_base += static_cast<sqlite3_int64>(chunk.records);
+        std::vector<Field>().swap(chunk.fields);
+        std::string().swap(chunk.arena);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            consumed = i + 1;
+            if (!ok) stop = true;
+        }
+        consumed_signal.notify_all();
+    }
+
+    for (std::thread& worker : workers) worker.join();
+
+    if (!ok)
+    {
+        if (insert.is_active()) insert.abort();
+        return fail(error);
+    }
+
+    if (insert.is_active() && !insert.finish()) return false;
+
+    if (rows) *rows = insert.get_row_count();
+
+    return true;
+}
+
+
+bool Csv::export_csv(SqliteWrap &db, const std::string &sql, const std::vector<SqlValue> &params, OutputSink &sink, const CsvOptions &options, sqlite3_int64 *rows)
+{
+    if (rows) *rows = 0;
+
+    sqlite3* handle = db.get_handle();
+    if (!handle) return export_error("Database not connected.");
+
+    if (options.delimiter == options.quote || options.delimiter == '\n' || options.delimiter == '\r' || options.quote == '\n' || options.quote == '\r')
+        return export_error("Invalid delimiter or quote.");
+
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(handle, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK || !SqliteWrap::bind_values(statement, params))
+    {
+        std::string message = sqlite3_errmsg(handle);
+        sqlite3_finalize(statement);
+        return export_error(message);
+    }
+
+    const char delimiter = options.delimiter;
+    const char quote = options.quote;
+    const char* newline = options.crlf ? "\r\n" : "\n";
+    const size_t newline_size = options.crlf ? 2 : 1;
+
+    int column_count = sqlite3_column_count(statement);
+    bool ok = true;
+
+    if (options.header && column_count > 0)
+    {
+        for (int i = 0; ok && i < column_count; i++)
+        {
+            const char* name = sqlite3_column_name(statement, i);
+            ok = (i == 0 || sink.append(delimiter)) && write_field(sink, name, std::strlen(name), delimiter, quote);
+        }
+        ok = ok && sink.append(newline, newline_size);
+    }
+
+    sqlite3_int64 count = 0;
+
+    int rc = SQLITE_DONE;
+    while (ok && (rc = sqlite3_step(statement)) == SQLITE_ROW)
+    {
+        for (int i = 0; ok && i < column_count; i++)
+        {
+            if (i != 0 && !(ok = sink.append(delimiter))) break;
+
+            switch (sqlite3_column_type(statement, i))
+            {
+            case SQLITE_INTEGER:
+                ok = write_number(sink, static_cast<long long>(sqlite3_column_int64(statement, i)));
+                break;
+            case SQLITE_FLOAT:
+                ok = write_number(sink, sqlite3_column_double(statement, i));
+                break;
+            case SQLITE_TEXT:
+            {
+                const char* text = reinterpret_cast<const char*>(sqlite3_column_text(statement, i));
+                ok = write_field(sink, text, static_cast<size_t>(sqlite3_column_bytes(statement, i)), delimiter, quote);
+                break;
+            }
+            case SQLITE_BLOB:
+            {
+                const char* data = static_cast<const char*>(sqlite3_column_blob(statement, i));
+                ok = write_field(sink, data, static_cast<size_t>(sqlite3_column_bytes(statement, i)), delimiter, quote);
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        if (ok) ok = sink.append(newline, newline_size);
+        if (ok) count++;
+    }
+
+    if (rows) *rows = count;
+
+    if (!ok)
+    {
+        sqlite3_finalize(statement);
+        return export_error(sink.get_last_error());
+    }
+
+    if (rc != SQLITE_DONE)
+    {
+        std::string message = sqlite3_errmsg(handle);
+        sqlite3_finalize(statement);
+        return export_error(message);
+    }
+
+    sqlite3_finalize(statement);
+
+    return true;
+}
+
+
+bool Csv::export_csv(SqliteWrap &db, const std::string &table_or_query, const std::string &path, const CsvOptions &options, sqlite3_int64 *rows)
+{
+    if (rows) *rows = 0;
+
+    if (!db.get_handle()) return export_error("Database not connected.");
+
+    std::string sql = table_or_query;
+    const TableInfo* info = db.get_schema_cache()->find_table(table_or_query);
+    if (info && (info->type == "table" || info->type == "view")) sql = "SELECT * FROM " + SqliteWrap::quote_identifier(info->name) + ";";
+
+    // written next to the file, which is replaced only once the export succeeded : a bad
+    // query or a failed step leaves it untouched
+    const std::string temp_path = path + ".tmp";
+
+    OutputSink sink;
+    if (!sink.open(temp_path, options.background_writer)) return export_error(sink.get_last_error());
+
+    bool ok = export_csv(db, sql, {}, sink, options, rows);
+
+    // the writer thread may still fail on the last buffer
+    if (!sink.close() && ok) ok = export_error(sink.get_last_error());
+
+    std::error_code error;
+    if (ok)
+    {
+        std::filesystem::rename(temp_path, path, error);
+        if (error) ok = export_error("Cannot rename " + temp_path + " to " + path + ": " + error.message());
+    }
+
+    if (!ok) std::filesystem::remove(temp_path, error);
+
+    return ok;
+}
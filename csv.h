@@ -0,0 +1,61 @@
+#ifndef CSV_H
+#define CSV_H
+
+#include <string>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "bulkinsert.h"
+#include "sqlitewrap.h"
+
+class OutputSink;
+
+struct CsvOptions
+{
+    char delimiter = ',';
+    char quote = '"';
+    bool header = true;                  // first record : column names, else the table columns in order
+    bool empty_as_null = true;           // unquoted empty field -> NULL ("" stays an empty string)
+    unsigned int threads = 0;            // parsing workers, 0 : one per core but one (the writer)
+    size_t chunk_size = 8 << 20;         // bytes parsed per task
+    BulkInsertOptions insert;
+
+    // export only
+    bool crlf = false;                   // records end with "\r\n" instead of "\n"
+    bool background_writer = false;      // path overload : format and write in parallel
+};
+
+// CSV files (RFC 4180 : quoted fields may hold delimiters, doubled quotes and line breaks).
+//
+// import_csv : the file is memory-mapped and cut into chunks at record boundaries (a
+// parallel pass counts quotes, so a line break inside a quoted field never splits a
+// chunk). Workers parse the chunks (SIMD search of the delimiter, quote and line break
+// bytes) and convert the fields of INTEGER / REAL / NUMERIC columns to numbers; the
+// calling thread inserts the rows in file order through BulkInsert. Text fields are
+// bound straight from the mapping, only quoted fields with doubled quotes are copied.
+// A quote inside an unquoted field (5'10") is an error, whatever the chunk size : quote it
+// ("5'10""").
+//
+// export_csv : rows are formatted in place in the sink buffer, numbers with to_chars.
+// Fields are quoted only when they hold the delimiter, the quote or a line break; NULL
+// is an empty field and an empty string "", so import_csv reads both back. BLOB values
+// are written as raw bytes. The header holds the column names. The path overload takes
+// a table or view name (exported whole) or a query, and replaces the file only when the
+// export succeeded (written to path + ".tmp", then renamed).
+//
+//     CsvOptions options;
+//     options.background_writer = true;
+//     Csv::export_csv(db, "person", "person.csv", options);
+class SQLITEWRAP_EXPORT Csv
+{
+public:
+    static bool export_csv(SqliteWrap& db, const std::string& sql, const std::vector<SqlValue>& params, OutputSink& sink,
+                           const CsvOptions& options = CsvOptions(), sqlite3_int64* rows = nullptr);
+    static bool export_csv(SqliteWrap& db, const std::string& table_or_query, const std::string& path,
+                           const CsvOptions& options = CsvOptions(), sqlite3_int64* rows = nullptr);
+
+    static bool import_csv(SqliteWrap& db, const std::string& path, const std::string& table,
+                           const CsvOptions& options = CsvOptions(), sqlite3_int64* rows = nullptr);
+};
+
+#endif // CSV_H
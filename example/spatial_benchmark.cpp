@@ -0,0 +1,170 @@
+// Window and nearest-neighbour latency of the R*Tree index against the plain WHERE scan
+// and a B-tree index on (lat, lon).
+//
+//     spatial_benchmark [points] [queries]
+//
+// Points are spread over France-sized coordinates, windows are about 10 km wide.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "spatialindex.h"
+#include "sqlitewrap.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ms(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static bool execute(sqlite3* db, const std::string& sql)
+{
+    char* error = nullptr;
+    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK)
+    {
+        std::cerr << "Error: " << sql << " : " << (error ? error : "") << std::endl;
+        sqlite3_free(error);
+        return false;
+    }
+    return true;
+}
+
+// rows returned by a prepared window statement, ?1..?4 = min lon, max lon, min lat, max lat
+static size_t run_window(sqlite3_stmt* statement, const BoundingBox& box)
+{
+    size_t rows = 0;
+    sqlite3_bind_double(statement, 1, box.min_x);
+    sqlite3_bind_double(statement, 2, box.max_x);
+    sqlite3_bind_double(statement, 3, box.min_y);
+    sqlite3_bind_double(statement, 4, box.max_y);
+    while (sqlite3_step(statement) == SQLITE_ROW) rows++;
+    sqlite3_reset(statement);
+    return rows;
+}
+
+int main(int argc, char* argv[])
+{
+    const int count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    const int queries = argc > 2 ? std::atoi(argv[2]) : 200;
+    const size_t k = 10;
+    const double half_size = 0.05;
+
+    const std::string path = "spatial_benchmark.db";
+    std::remove(path.c_str());
+
+    SqliteWrap db;
+    if (!db.create_db(path)) return 1;
+    sqlite3* handle = db.get_handle();
+
+    if (!execute(handle, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;") ||
+        !execute(handle, "CREATE TABLE place(id INTEGER PRIMARY KEY, name TEXT, lon REAL, lat REAL);"))
+        return 1;
+
+    // the index triggers are in place during the load : insert cost includes index maintenance
+    SpatialIndex index(db, "place", SpatialColumns::point("lon", "lat"));
+    if (!index.create()) return 1;
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<double> lon(-5.0, 8.0), lat(42.0, 51.0);
+
+    sqlite3_stmt* insert = nullptr;
+    sqlite3_prepare_v2(handle, "INSERT INTO place(name, lon, lat) VALUES (?, ?, ?);", -1, &insert, nullptr);
+
+    auto start = Clock::now();
+    execute(handle, "BEGIN;");
+    for (int i = 0; i < count; i++)
+    {
+        std::string name = "place " + std::to_string(i);
+        sqlite3_bind_text(insert, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_double(insert, 2, lon(random));
+        sqlite3_bind_double(insert, 3, lat(random));
+        sqlite3_step(insert);
+        sqlite3_reset(insert);
+    }
+    execute(handle, "COMMIT;");
+    sqlite3_finalize(insert);
+    std::cout << count << " points inserted with the R*Tree triggers : " << elapsed_ms(start) << " ms" << std::endl;
+
+    std::vector<BoundingBox> windows;
+    for (int q = 0; q < queries; q++)
+    {
+        double x = lon(random), y = lat(random);
+        windows.push_back({ x - half_size, x + half_size, y - half_size, y + half_size });
+    }
+
+    const char* where = "lon >= ?1 AND lon <= ?2 AND lat >= ?3 AND lat <= ?4";
+
+    // window : plain scan, B-tree (lat, lon), R*Tree
+    sqlite3_stmt* scan = nullptr;
+    sqlite3_prepare_v2(handle, ("SELECT id FROM place NOT INDEXED WHERE " + std::string(where) + ";").c_str(), -1, &scan, nullptr);
+
+    size_t expected = 0;
+    start = Clock::now();
+    for (const BoundingBox& box : windows) expected += run_window(scan, box);
+    std::cout << "window scan    : " << elapsed_ms(start) / queries << " ms/query, " << expected << " rows" << std::endl;
+    sqlite3_finalize(scan);
+
+    if (!execute(handle, "CREATE INDEX place_lat_lon ON place(lat, lon);")) return 1;
+    sqlite3_stmt* btree = nullptr;
+    sqlite3_prepare_v2(handle, ("SELECT id FROM place INDEXED BY place_lat_lon WHERE " + std::string(where) + ";").c_str(), -1, &btree, nullptr);
+
+    size_t rows = 0;
+    start = Clock::now();
+    for (const BoundingBox& box : windows) rows += run_window(btree, box);
+    std::cout << "window b-tree  : " << elapsed_ms(start) / queries << " ms/query, " << rows << " rows" << std::endl;
+    sqlite3_finalize(btree);
+
+    rows = 0;
+    std::vector<sqlite3_int64> rowids;
+    start = Clock::now();
+    for (const BoundingBox& box : windows)
+    {
+        if (!index.window(box, rowids)) return 1;
+        rows += rowids.size();
+    }
+    std::cout << "window r*tree  : " << elapsed_ms(start) / queries << " ms/query, " << rows << " rows" << std::endl;
+
+    // k nearest : ORDER BY distance scan against the growing R*Tree window
+    sqlite3_stmt* nearest_scan = nullptr;
+    sqlite3_prepare_v2(handle, ("SELECT id FROM place ORDER BY (lon - ?1) * (lon - ?1) + (lat - ?2) * (lat - ?2) LIMIT " +
+                                std::to_string(k) + ";").c_str(), -1, &nearest_scan, nullptr);
+
+    std::vector<std::vector<sqlite3_int64>> truth;
+    int nearest_queries = queries / 10 > 0 ? queries / 10 : 1;
+    start = Clock::now();
+    for (int q = 0; q < nearest_queries; q++)
+    {
+        const BoundingBox& box = windows[q];
+        sqlite3_bind_double(nearest_scan, 1, (box.min_x + box.max_x) / 2);
+        sqlite3_bind_double(nearest_scan, 2, (box.min_y + box.max_y) / 2);
+        truth.emplace_back();
+        while (sqlite3_step(nearest_scan) == SQLITE_ROW) truth.back().push_back(sqlite3_column_int64(nearest_scan, 0));
+        sqlite3_reset(nearest_scan);
+    }
+    std::cout << "nearest scan   : " << elapsed_ms(start) / nearest_queries << " ms/query" << std::endl;
+    sqlite3_finalize(nearest_scan);
+
+    size_t same = 0;
+    std::vector<SpatialHit> hits;
+    start = Clock::now();
+    for (int q = 0; q < queries; q++)
+    {
+        const BoundingBox& box = windows[q];
+        if (!index.nearest((box.min_x + box.max_x) / 2, (box.min_y + box.max_y) / 2, k, hits)) return 1;
+
+        if (q < nearest_queries)
+            for (size_t i = 0; i < hits.size() && i < truth[q].size(); i++) same += hits[i].rowid == truth[q][i];
+    }
+    std::cout << "nearest r*tree : " << elapsed_ms(start) / queries << " ms/query, "
+              << same << "/" << nearest_queries * k << " identical to the scan" << std::endl;
+
+    index.release();
+    db.disconnect();
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,169 @@
+// Recall and latency of the vec_ivf index against the exact ORDER BY vec_l2(...) LIMIT k scan.
+//
+//     vector_benchmark [vectors] [dimension] [lists] [queries]
+//
+// The vectors are drawn around random cluster centres (embeddings are clustered, uniform
+// noise would make any IVF index look bad) and stored both in a plain table and in the index.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "sqlitewrap.h"
+#include "vectorfunctions.h"
+#include "vectorindex.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ms(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static bool execute(sqlite3* db, const std::string& sql)
+{
+    char* error = nullptr;
+    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK)
+    {
+        std::cerr << "Error: " << sql << " : " << (error ? error : "") << std::endl;
+        sqlite3_free(error);
+        return false;
+    }
+    return true;
+}
+
+// rowids returned by a prepared top-k statement for one query vector
+static std::vector<sqlite3_int64> top_k(sqlite3_stmt* statement, const std::vector<float>& query)
+{
+    std::vector<sqlite3_int64> result;
+    sqlite3_bind_blob(statement, 1, query.data(), static_cast<int>(query.size() * sizeof(float)), SQLITE_STATIC);
+    while (sqlite3_step(statement) == SQLITE_ROW) result.push_back(sqlite3_column_int64(statement, 0));
+    sqlite3_reset(statement);
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    const int count = argc > 1 ? std::atoi(argv[1]) : 200000;
+    const int dimension = argc > 2 ? std::atoi(argv[2]) : 128;
+    const int lists = argc > 3 ? std::atoi(argv[3]) : 512;
+    const int queries = argc > 4 ? std::atoi(argv[4]) : 100;
+    const int k = 10;
+    const int clusters = 1000;
+
+    const std::string path = "vector_benchmark.db";
+    std::remove(path.c_str());
+
+    SqliteWrap db;
+    if (!db.create_db(path)) return 1;
+    sqlite3* handle = db.get_handle();
+
+    if (!VectorFunctions::register_functions(db) || !VectorIndex::register_module(db)) return 1;
+    std::cout << "kernel : " << VectorFunctions::get_kernel_name() << std::endl;
+
+    std::mt19937 random(42);
+    std::normal_distribution<float> normal;
+    std::vector<float> centres(static_cast<size_t>(clusters) * dimension);
+    for (float& value : centres) value = normal(random) * 4.0f;
+
+    auto make_vector = [&](std::vector<float>& vector)
+    {
+        const float* centre = &centres[(random() % clusters) * dimension];
+        for (int d = 0; d < dimension; d++) vector[d] = centre[d] + normal(random);
+    };
+
+    // load : plain table and index, in one transaction (the index trains itself on the way)
+    std::string options = "dim=" + std::to_string(dimension) + ", lists=" + std::to_string(lists);
+    if (!execute(handle, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;") ||
+        !execute(handle, "CREATE TABLE items(id INTEGER PRIMARY KEY, embedding BLOB);") ||
+        !execute(handle, "CREATE VIRTUAL TABLE items_index USING vec_ivf(" + options + ");"))
+        return 1;
+
+    sqlite3_stmt* insert_item = nullptr;
+    sqlite3_stmt* insert_index = nullptr;
+    sqlite3_prepare_v2(handle, "INSERT INTO items(id, embedding) VALUES (?, ?);", -1, &insert_item, nullptr);
+    sqlite3_prepare_v2(handle, "INSERT INTO items_index(rowid, vector) VALUES (?, ?);", -1, &insert_index, nullptr);
+
+    std::vector<float> vector(dimension);
+    double item_ms = 0, index_ms = 0;
+
+    execute(handle, "BEGIN;");
+    for (int id = 1; id <= count; id++)
+    {
+        make_vector(vector);
+
+        auto start = Clock::now();
+        sqlite3_bind_int(insert_item, 1, id);
+        sqlite3_bind_blob(insert_item, 2, vector.data(), dimension * sizeof(float), SQLITE_STATIC);
+        sqlite3_step(insert_item);
+        sqlite3_reset(insert_item);
+        item_ms += elapsed_ms(start);
+
+        start = Clock::now();
+        sqlite3_bind_int(insert_index, 1, id);
+        sqlite3_bind_blob(insert_index, 2, vector.data(), dimension * sizeof(float), SQLITE_STATIC);
+        if (sqlite3_step(insert_index) != SQLITE_DONE)
+        {
+            std::cerr << "Error: " << sqlite3_errmsg(handle) << std::endl;
+            return 1;
+        }
+        sqlite3_reset(insert_index);
+        index_ms += elapsed_ms(start);
+    }
+    execute(handle, "COMMIT;");
+
+    sqlite3_finalize(insert_item);
+    sqlite3_finalize(insert_index);
+
+    std::cout << count << " vectors of " << dimension << " floats, " << lists << " lists" << std::endl;
+    std::cout << "insert : table " << item_ms << " ms, index " << index_ms << " ms (training included)" << std::endl;
+
+    // queries : exact results first, then the index with a growing number of probed lists
+    std::vector<std::vector<float>> query_vectors(queries, std::vector<float>(dimension));
+    for (auto& query : query_vectors) make_vector(query);
+
+    sqlite3_stmt* exact = nullptr;
+    sqlite3_prepare_v2(handle, ("SELECT id FROM items ORDER BY vec_l2(embedding, ?) LIMIT " + std::to_string(k) + ";").c_str(), -1, &exact, nullptr);
+
+    std::vector<std::set<sqlite3_int64>> truth;
+    auto start = Clock::now();
+    for (const auto& query : query_vectors)
+    {
+        std::vector<sqlite3_int64> result = top_k(exact, query);
+        truth.emplace_back(result.begin(), result.end());
+    }
+    std::cout << "brute force    : " << elapsed_ms(start) / queries << " ms/query, recall@" << k << " 1.000" << std::endl;
+    sqlite3_finalize(exact);
+
+    for (int probes : { 1, 4, 16, 64 })
+    {
+        if (probes > lists) break;
+
+        sqlite3_stmt* approximate = nullptr;
+        std::string sql = "SELECT rowid FROM items_index WHERE items_index MATCH ? AND k = " + std::to_string(k) +
+                          " AND probes = " + std::to_string(probes) + ";";
+        sqlite3_prepare_v2(handle, sql.c_str(), -1, &approximate, nullptr);
+
+        size_t found = 0;
+        start = Clock::now();
+        std::vector<std::vector<sqlite3_int64>> results;
+        for (const auto& query : query_vectors) results.push_back(top_k(approximate, query));
+        double ms = elapsed_ms(start) / queries;
+
+        for (int q = 0; q < queries; q++)
+            for (sqlite3_int64 rowid : results[q]) found += truth[q].count(rowid);
+
+        std::cout << "ivf probes=" << probes << (probes < 10 ? "  " : " ") << " : " << ms << " ms/query, recall@" << k << " "
+                  << static_cast<double>(found) / (static_cast<double>(queries) * k) << std::endl;
+        sqlite3_finalize(approximate);
+    }
+
+    db.disconnect();
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,346 @@
+
+#include "fulltextindex.h"
+#include "logger.h"
+#include "schemacache.h"
+#include "sqlitewrap.h"
+
+
+FullTextIndex::FullTextIndex(SqliteWrap &db, const std::string &table, const std::string &index)
+    : _wrap(db), _table(table), _index(index.empty() ? table + "_fts" : index)
+{
+}
+
+
+bool FullTextIndex::create(const std::vector<std::string> &columns, const FullTextOptions &options)
+{
+    if (!_wrap.get_handle()) return error("create", "Database not connected.");
+    if (columns.empty()) return error("create", "No column to index.");
+
+    SchemaCache* schema = _wrap.get_schema_cache();
+    const TableInfo* table = schema->find_table(_table);
+    if (!table || table->type != "table") return error("create", "No such table: " + _table);
+    if (table->without_rowid) return error("create", "Table " + _table + " has no rowid, it cannot be the content of an index.");
+
+    for (const std::string& column : columns)
+        if (!table->find_column(column)) return error("create", "No such column: " + _table + "." + column);
+
+    bool found = schema->find_table(_index) != nullptr;
+
+    std::string index = SqliteWrap::quote_identifier(_index);
+    std::string quoted_table = SqliteWrap::quote_identifier(_table);
+
+    std::string column_list, new_values, old_values, changed = "old.rowid IS NOT new.rowid";
+    for (const std::string& column : columns)
+    {
+        std::string quoted = SqliteWrap::quote_identifier(column);
+        column_list += ", " + quoted;
+        new_values += ", new." + quoted;
+        old_values += ", old." + quoted;
+        changed += " OR old." + quoted + " IS NOT new." + quoted;
+    }
+
+    std::string arguments = column_list.substr(2) +
+                            ", content=" + SqliteWrap::quote_literal(_table) +
+                            ", content_rowid='rowid'" +
+                            ", tokenize=" + SqliteWrap::quote_literal(tokenizer_arguments(options.tokenizer));
+
+    if (!options.prefix.empty())
+    {
+        std::string prefix;
+        for (int length : options.prefix) prefix += (prefix.empty() ? "" : " ") + std::to_string(length);
+        arguments += ", prefix=" + SqliteWrap::quote_literal(prefix);
+    }
+
+    // the external content 'delete' command needs the values as they were indexed
+    std::string insert = "INSERT INTO " + index + "(rowid" + column_list + ") VALUES (new.rowid" + new_values + ");";
+    std::string remove = "INSERT INTO " + index + "(" + index + ", rowid" + column_list + ") VALUES ('delete', old.rowid" + old_values + ");";
+
+    std::string sql =
+        "SAVEPOINT sqlitewrap_fts;"
+        "CREATE VIRTUAL TABLE IF NOT EXISTS " + index + " USING fts5(" + arguments + ");"
+        "CREATE TRIGGER IF NOT EXISTS " + SqliteWrap::quote_identifier(_index + "_ai") +
+        " AFTER INSERT ON " + quoted_table + " BEGIN " + insert + " END;"
+        "CREATE TRIGGER IF NOT EXISTS " + SqliteWrap::quote_identifier(_index + "_ad") +
+        " AFTER DELETE ON " + quoted_table + " BEGIN " + remove + " END;"
+        "CREATE TRIGGER IF NOT EXISTS " + SqliteWrap::quote_identifier(_index + "_au") +
+        " AFTER UPDATE ON " + quoted_table + " WHEN " + changed + " BEGIN " + remove + " " + insert + " END;";
+
+    if (options.automerge >= 0)
+        sql += "INSERT INTO " + index + "(" + index + ", rank) VALUES ('automerge', " + std::to_string(options.automerge) + ");";
+
+    if (!found)
+        sql += "INSERT INTO " + index + "(" + index + ") VALUES ('rebuild');";
+
+    sql += "RELEASE sqlitewrap_fts;";
+
+    return execute_script("create", sql);
+}
+
+
+bool FullTextIndex::drop()
+{
+    std::string sql =
+        "SAVEPOINT sqlitewrap_fts;"
+        "DROP TRIGGER IF EXISTS " + SqliteWrap::quote_identifier(_index + "_ai") + ";"
+        "DROP TRIGGER IF EXISTS " + SqliteWrap::quote_identifier(_index + "_ad") + ";"
+        "DROP TRIGGER IF EXISTS " + SqliteWrap::quote_identifier(_index + "_au") + ";"
+        "DROP TABLE IF EXISTS " + SqliteWrap::quote_identifier(_index) + ";"
+        "RELEASE sqlitewrap_fts;";
+
+    return execute_script("drop", sql);
+}
+
+
+bool FullTextIndex::exists(bool &found)
+{
+    if (!_wrap.get_handle()) return error("exists", "Database not connected.");
+
+    found = _wrap.get_schema_cache()->find_table(_index) != nullptr;
+    return true;
+}
+
+
+bool FullTextIndex::rebuild()
+{
+    return command("rebuild", "rebuild", "");
+}
+
+
+bool FullTextIndex::optimize()
+{
+    return command("optimize", "optimize", "");
+}
+
+
+bool FullTextIndex::merge(int pages)
+{
+    return command("merge", "merge", std::to_string(pages));
+}
+
+
+bool FullTextIndex::set_automerge(int segments)
+{
+    return command("set_automerge", "automerge", std::to_string(segments));
+}
+
+
+bool FullTextIndex::set_rank(const std::vector<double> &weights)
+{
+    std::string rank = "bm25(";
+    for (size_t i = 0; i < weights.size(); i++) rank += (i ? ", " : "") + std::to_string(weights[i]);
+    rank += ")";
+
+    return command("set_rank", "rank", rank);
+}
+
+
+bool FullTextIndex::integrity_check()
+{
+    // rank = 1 : also compares the index with the content table
+    return command("integrity_check", "integrity-check", "1");
+}
+
+
+bool FullTextIndex::search(const std::string &query, std::vector<FullTextHit> &hits, const FullTextSearch &options)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return error("search", "Database not connected.");
+
+    std::string index = SqliteWrap::quote_identifier(_index);
+
+    // ORDER BY rank LIMIT n lets FTS5 keep only the n best rows instead of sorting every match
+    std::string sql = "SELECT rowid, rank, ";
+    sql += options.snippet_tokens > 0
+        ? "snippet(" + index + ", " + std::to_string(options.snippet_column) + ", ?1, ?2, ?3, " + std::to_string(options.snippet_tokens) + "), "
+        : "NULL, ";
+    sql += options.highlight_column >= 0
+        ? "highlight(" + index + ", " + std::to_string(options.highlight_column) + ", ?1, ?2) "
+        : "NULL ";
+    sql += "FROM " + index + " WHERE " + index + " MATCH ?4 ORDER BY rank LIMIT ?5 OFFSET ?6;";
+
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK)
+    {
+        error("search", sqlite3_errmsg(db));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    // numbered parameters : ?1..?3 may be unused, binding them is harmless
+    sqlite3_bind_text(statement, 1, options.open.c_str(), static_cast<int>(options.open.size()), SQLITE_STATIC);
+    sqlite3_bind_text(statement, 2, options.close.c_str(), static_cast<int>(options.close.size()), SQLITE_STATIC);
+    sqlite3_bind_text(statement, 3, options.ellipsis.c_str(), static_cast<int>(options.ellipsis.size()), SQLITE_STATIC);
+    sqlite3_bind_text(statement, 4, query.c_str(), static_cast<int>(query.size()), SQLITE_STATIC);
+    sqlite3_bind_int(statement, 5, options.limit);
+    sqlite3_bind_int(statement, 6, options.offset);
+
+    hits.clear();
+
+    int rc;
+    while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+    {
+        FullTextHit hit;
+        hit.rowid = sqlite3_column_int64(statement, 0);
+        hit.rank = sqlite3_column_double(statement, 1);
+
+        const unsigned char* text = sqlite3_column_text(statement, 2);
+        if (text) hit.snippet.assign(reinterpret_cast<const char*>(text), static_cast<size_t>(sqlite3_column_bytes(statement, 2)));
+
+        text = sqlite3_column_text(statement, 3);
+        if (text) hit.highlight.assign(reinterpret_cast<const char*>(text), static_cast<size_t>(sqlite3_column_bytes(statement, 3)));
+
+        hits.push_back(std::move(hit));
+    }
+
+    if (rc != SQLITE_DONE)
+    {
+        error("search", sqlite3_errmsg(db));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    sqlite3_finalize(statement);
+
+    return true;
+}
+
+
+bool FullTextIndex::search_rows(const std::string &query, const FullTextSearch &options, void *user_param, bool (*callback)(void *, char **, int))
+{
+    std::string index = SqliteWrap::quote_identifier(_index);
+
+    // the best rowids first, then one lookup per row in the content table
+    std::string sql =
+        "SELECT c.* FROM (SELECT rowid, rank FROM " + index + " WHERE " + index + " MATCH ? ORDER BY rank LIMIT ? OFFSET ?) AS m "
+        "JOIN " + SqliteWrap::quote_identifier(_table) + " AS c ON c.rowid = m.rowid ORDER BY m.rank;";
+
+    if (!_wrap.query_sync(sql, { query, static_cast<sqlite3_int64>(options.limit), static_cast<sqlite3_int64>(options.offset) }, user_param, callback))
+    {
+        _last_error = _wrap.get_last_error();
+        return false;
+    }
+
+    return true;
+}
+
+
+bool FullTextIndex::count(const std::string &query, sqlite3_int64 &count)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return error("count", "Database not connected.");
+
+    std::string index = SqliteWrap::quote_identifier(_index);
+    std::string sql = "SELECT count(*) FROM " + index + " WHERE " + index + " MATCH ?;";
+
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK)
+    {
+        error("count", sqlite3_errmsg(db));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    sqlite3_bind_text(statement, 1, query.c_str(), static_cast<int>(query.size()), SQLITE_STATIC);
+
+    if (sqlite3_step(statement) != SQLITE_ROW)
+    {
+        error("count", sqlite3_errmsg(db));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    count = sqlite3_column_int64(statement, 0);
+    sqlite3_finalize(statement);
+
+    return true;
+}
+
+
+std::string FullTextIndex::phrase(const std::string &text)
+{
+    std::string result = "\"";
+    for (char c : text)
+    {
+        if (c == '"') result += '"';
+        result += c;
+    }
+    result += '"';
+
+    return result;
+}
+
+
+bool FullTextIndex::command(const char *function, const std::string &command, const std::string &value)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return error(function, "Database not connected.");
+
+    std::string index = SqliteWrap::quote_identifier(_index);
+    std::string sql = "INSERT INTO " + index + "(" + index + ", rank) VALUES (?, ?);";
+
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK)
+    {
+        error(function, sqlite3_errmsg(db));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    sqlite3_bind_text(statement, 1, command.c_str(), static_cast<int>(command.size()), SQLITE_STATIC);
+    if (value.empty()) sqlite3_bind_null(statement, 2);
+    else sqlite3_bind_text(statement, 2, value.c_str(), static_cast<int>(value.size()), SQLITE_STATIC);
+
+    if (sqlite3_step(statement) != SQLITE_DONE)
+    {
+        error(function, sqlite3_errmsg(db));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    sqlite3_finalize(statement);
+
+    return true;
+}
+
+
+bool FullTextIndex::execute_script(const char *function, const std::string &sql)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return error(function, "Database not connected.");
+
+    char* errorMessage = nullptr;
+    int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errorMessage);
+
+    if (rc != SQLITE_OK)
+    {
+        error(function, errorMessage ? errorMessage : sqlite3_errstr(rc));
+        sqlite3_free(errorMessage);
+        sqlite3_exec(db, "ROLLBACK TO sqlitewrap_fts; RELEASE sqlitewrap_fts;", nullptr, nullptr, nullptr);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool FullTextIndex::error(const char *function, const std::string &message)
+{
+    _last_error = message;
+    SQLITEWRAP_LOG_ERROR("FullTextIndex::" << function << "(...) - Error: " << message);
+    return false;
+}
+
+
+const char *FullTextIndex::tokenizer_arguments(FullTextTokenizer tokenizer)
+{
+    switch (tokenizer)
+    {
+    case FullTextTokenizer::Porter:
+        return "porter unicode61 remove_diacritics 2";
+    case FullTextTokenizer::Trigram:
+        return "trigram";
+    case FullTextTokenizer::Unicode61:
+    default:
+        return "unicode61 remove_diacritics 2";
+    }
+}
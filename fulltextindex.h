@@ -0,0 +1,104 @@
+#ifndef FULLTEXTINDEX_H
+#define FULLTEXTINDEX_H
+
+#include <string>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+class SqliteWrap;
+
+enum class FullTextTokenizer
+{
+    Unicode61,                           // words, case and diacritics folded
+    Porter,                              // unicode61 words reduced to their english stem
+    Trigram                              // any substring of 3 characters or more, replaces LIKE '%term%'
+};
+
+struct FullTextOptions
+{
+    FullTextTokenizer tokenizer = FullTextTokenizer::Unicode61;
+    std::vector<int> prefix;             // prefix index lengths, e.g. { 2, 3 } for fast "ab*" queries (not with trigram)
+    int automerge = -1;                  // 0 disables, 2..16 segments merged together, -1 keeps the default (4)
+};
+
+struct FullTextSearch
+{
+    int limit = 20;
+    int offset = 0;
+
+    int snippet_column = -1;             // -1 : best matching column
+    int snippet_tokens = 16;             // 1..64 tokens, 0 : no snippet
+    int highlight_column = -1;           // full text of one column with the matches marked, -1 : no highlight
+    std::string open = "<b>";
+    std::string close = "</b>";
+    std::string ellipsis = "...";
+};
+
+struct FullTextHit
+{
+    sqlite3_int64 rowid = 0;             // rowid of the content table row
+    double rank = 0;                     // bm25 : the lower, the better
+    std::string snippet;
+    std::string highlight;
+};
+
+// FTS5 index over the text columns of an existing table (external content : the text
+// is not stored twice). AFTER INSERT / UPDATE / DELETE triggers keep the index in sync
+// with the table, whichever connection writes it.
+//
+//     FullTextIndex index(db, "article");              // index table "article_fts"
+//     index.create({ "title", "body" });               // builds the index from the existing rows
+//     index.search("sqlite AND (index OR wrap*)", hits);
+//
+// The query uses the FTS5 syntax (https://sqlite.org/fts5.html#full_text_query_syntax);
+// phrase() turns user input into a literal phrase. With the trigram tokenizer a phrase
+// matches any substring, which is what LIKE '%term%' did with a full scan.
+// The content table must be a rowid table; its rowid must not be changed by VACUUM
+// (use an INTEGER PRIMARY KEY).
+class SQLITEWRAP_EXPORT FullTextIndex
+{
+public:
+    FullTextIndex(SqliteWrap& db, const std::string& table, const std::string& index = "");
+
+    // creates the index and its triggers if missing; a new index is filled from the table
+    bool create(const std::vector<std::string>& columns, const FullTextOptions& options = FullTextOptions());
+    bool drop();
+    bool exists(bool& found);
+
+    // maintenance
+    bool rebuild();                      // rebuilds the whole index from the content table
+    bool optimize();                     // merges every segment into one (slow, fastest queries after)
+    bool merge(int pages);               // incremental merge work, for idle time
+    bool set_automerge(int segments);
+    bool set_rank(const std::vector<double>& weights);      // per column bm25 weights, persistent
+    bool integrity_check();              // index against content table
+
+    // ranked search, best first
+    bool search(const std::string& query, std::vector<FullTextHit>& hits, const FullTextSearch& options = FullTextSearch());
+    // content table rows of the best matches, best first
+    bool search_rows(const std::string& query, const FullTextSearch& options, void* user_param, bool (*callback)(void*, char**, int));
+    bool count(const std::string& query, sqlite3_int64& count);
+
+    static std::string phrase(const std::string& text);     // "text" with quotes doubled
+
+private:
+    SqliteWrap& _wrap;
+    std::string _table;
+    std::string _index;
+    std::string _last_error;
+
+    bool command(const char* function, const std::string& command, const std::string& value);
+    bool execute_script(const char* function, const std::string& sql);
+    bool error(const char* function, const std::string& message);
+    static const char* tokenizer_arguments(FullTextTokenizer tokenizer);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+    const std::string& get_table() const { return _table; }
+    const std::string& get_index() const { return _index; }
+};
+
+#endif // FULLTEXTINDEX_H
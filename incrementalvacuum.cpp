@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <chrono>
+
+#include "incrementalvacuum.h"
+#include "logger.h"
+#include "sqlitewrap.h"
+
+
+namespace
+{
+    double elapsed_ms(std::chrono::steady_clock::time_point since)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+    }
+}
+
+
+IncrementalVacuum::IncrementalVacuum(SqliteWrap &db)
+    : _db(db)
+{
+}
+
+
+bool IncrementalVacuum::stats(VacuumStats &stats)
+{
+    sqlite3* handle = _db.get_handle();
+    if (!handle) return error("stats", "Database not connected.");
+
+    sqlite3_int64 auto_vacuum = 0;
+    if (!pragma_value(handle, "PRAGMA auto_vacuum;", auto_vacuum)
+        || !pragma_value(handle, "PRAGMA page_size;", stats.page_size)
+        || !pragma_value(handle, "PRAGMA page_count;", stats.page_count)
+        || !pragma_value(handle, "PRAGMA freelist_count;", stats.freelist_count))
+        return false;
+
+    stats.auto_vacuum = static_cast<AutoVacuum>(auto_vacuum);
+    stats.free_ratio = stats.page_count > 0 ? static_cast<double>(stats.freelist_count) / static_cast<double>(stats.page_count) : 0;
+
+    return true;
+}
+
+
+bool IncrementalVacuum::run(const VacuumOptions &options, VacuumResult &result)
+{
+    result = VacuumResult();
+    auto start = std::chrono::steady_clock::now();
+
+    sqlite3* handle = _db.get_handle();
+    if (!handle) return error("run", "Database not connected.");
+    if (!sqlite3_get_autocommit(handle)) return error("run", "A transaction is open : every slice must commit on its own.");
+
+    VacuumStats current;
+    if (!stats(current)) return false;
+    if (current.auto_vacuum != AutoVacuum::Incremental) return error("run", "The database is not in auto_vacuum = INCREMENTAL mode.");
+
+    sqlite3_int64 free_pages = current.freelist_count;
+    if (free_pages == 0 || free_pages < options.min_free_pages)
+    {
+        result.complete = true;
+        result.duration_ms = elapsed_ms(start);
+        return true;
+    }
+
+    if (_slice_pages <= 0) _slice_pages = std::max(options.initial_pages, 1);
+
+    while (free_pages > 0 && elapsed_ms(start) < options.budget_ms)
+    {
+        sqlite3_int64 pages = std::min<sqlite3_int64>(_slice_pages, free_pages);
+        std::string sql = "PRAGMA incremental_vacuum(" + std::to_string(pages) + ");";
+
+        auto slice_start = std::chrono::steady_clock::now();
+        int rc = sqlite3_exec(handle, sql.c_str(), nullptr, nullptr, nullptr);
+        double slice_ms = elapsed_ms(slice_start);
+
+        if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+        {
+            result.busy = true;
+            break;
+        }
+        if (rc != SQLITE_OK) return error("run", sqlite3_errmsg(handle));
+
+        sqlite3_int64 remaining = 0;
+        if (!pragma_value(handle, "PRAGMA freelist_count;", remaining)) return false;
+
+        result.pages_freed += free_pages - remaining;
+        result.slices++;
+
+        // next slice sized for slice_ms, from this one (only a full slice measures the rate)
+        if (pages == _slice_pages && slice_ms > 0)
+        {
+            double scale = std::clamp(options.slice_ms / slice_ms, 0.5, 2.0);
+            _slice_pages = std::clamp(static_cast<int>(_slice_pages * scale), 8, 1 << 20);
+        }
+
+        // no progress : nothing left that can be moved
+        if (remaining >= free_pages) break;
+        free_pages = remaining;
+    }
+
+    result.complete = free_pages == 0;
+    result.duration_ms = elapsed_ms(start);
+
+    return true;
+}
+
+
+bool IncrementalVacuum::convert()
+{
+    sqlite3* handle = _db.get_handle();
+    if (!handle) return error("convert", "Database not connected.");
+
+    // the new mode is only written to the file by a VACUUM
+    if (sqlite3_exec(handle, "PRAGMA auto_vacuum = INCREMENTAL; VACUUM;", nullptr, nullptr, nullptr) != SQLITE_OK)
+        return error("convert", sqlite3_errmsg(handle));
+
+    return true;
+}
+
+
+bool IncrementalVacuum::pragma_value(sqlite3 *handle, const char *sql, sqlite3_int64 &value)
+{
+    sqlite3_stmt* statement = nullptr;
+    int rc = sqlite3_prepare_v2(handle, sql, -1, &statement, nullptr);
+    if (rc == SQLITE_OK) rc = sqlite3_step(statement);
+    if (rc == SQLITE_ROW) value = sqlite3_column_int64(statement, 0);
+    sqlite3_finalize(statement);
+
+    if (rc != SQLITE_ROW) return error("pragma_value", sqlite3_errmsg(handle));
+    return true;
+}
+
+
+bool IncrementalVacuum::error(const char *function, const std::string &message)
+{
+    _last_error = message;
+    SQLITEWRAP_LOG_ERROR("IncrementalVacuum::" << function << "(...) - Error: " << message);
+    return false;
+}
@@ -0,0 +1,76 @@
+#ifndef INCREMENTALVACUUM_H
+#define INCREMENTALVACUUM_H
+
+#include <string>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+class SqliteWrap;
+
+enum class AutoVacuum { None = 0, Full = 1, Incremental = 2 };
+
+struct VacuumStats
+{
+    AutoVacuum auto_vacuum = AutoVacuum::None;
+    sqlite3_int64 page_size = 0;
+    sqlite3_int64 page_count = 0;        // size of the file, in pages
+    sqlite3_int64 freelist_count = 0;    // unused pages, given back by the incremental vacuum
+    double free_ratio = 0;               // freelist_count / page_count
+};
+
+struct VacuumOptions
+{
+    int budget_ms = 50;                  // run() stops after this long
+    int slice_ms = 5;                    // one transaction : writers wait at most about this long
+    int initial_pages = 64;              // pages of the first slice, then adjusted to slice_ms
+    sqlite3_int64 min_free_pages = 0;    // run() does nothing below this freelist size
+};
+
+struct VacuumResult
+{
+    sqlite3_int64 pages_freed = 0;       // freelist pages removed from the file
+    int slices = 0;
+    double duration_ms = 0;
+    bool busy = false;                   // stopped : another connection holds the write lock
+    bool complete = false;               // freelist empty (or below min_free_pages)
+};
+
+// Gives the pages freed by deletes back to the file system, without the downtime of a
+// full VACUUM : the database needs auto_vacuum = INCREMENTAL (SqliteWrap::create_db(name,
+// true), or convert() once), then run() calls PRAGMA incremental_vacuum(N) in short
+// transactions until the time budget is spent. N follows the measured duration of the
+// slices so that each one holds the write lock for about slice_ms : writes of other
+// connections go in between.
+//
+//     IncrementalVacuum vacuum(db);
+//     VacuumResult result;
+//     vacuum.run(options, result);      // e.g. from an idle timer, between writes
+//
+// Run it outside of transactions. A busy database stops run() with result.busy set
+// (not an error) : try again later.
+class SQLITEWRAP_EXPORT IncrementalVacuum
+{
+public:
+    explicit IncrementalVacuum(SqliteWrap& db);
+
+    bool stats(VacuumStats& stats);
+    bool run(const VacuumOptions& options, VacuumResult& result);
+
+    // switches an existing database to INCREMENTAL : runs a full VACUUM, once
+    bool convert();
+
+private:
+    SqliteWrap& _db;
+    int _slice_pages = 0;                // learnt slice size, kept between runs
+    std::string _last_error;
+
+    bool pragma_value(sqlite3* handle, const char* sql, sqlite3_int64& value);
+    bool error(const char* function, const std::string& message);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+};
+
+#endif // INCREMENTALVACUUM_H
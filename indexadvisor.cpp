@@ -0,0 +1,927 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <set>
+#include <unordered_map>
+
+#include "indexadvisor.h"
+#include "busyhandler.h"
+#include "logger.h"
+#include "schemacache.h"
+
+
+namespace
+{
+    // what the planner could use on one table, recorded by the collector xBestIndex
+    struct Scan
+    {
+        std::string table;
+        std::vector<int> equal;
+        std::vector<std::pair<int, std::string>> constants;    // column, term on a constant : " = 'open'", " IS NULL"
+        std::vector<int> range;
+        std::vector<int> not_null;
+        std::vector<std::pair<int, bool>> order_by;             // column, descending
+        sqlite3_uint64 used = 0;                                // columns read, bit 63 : 63 and above
+
+        bool empty() const { return equal.empty() && range.empty() && not_null.empty() && order_by.empty(); }
+
+        bool operator==(const Scan& other) const
+        {
+            return table == other.table && equal == other.equal && constants == other.constants && range == other.range
+                   && not_null == other.not_null && order_by == other.order_by && used == other.used;
+        }
+    };
+
+    struct Collector
+    {
+        std::unordered_map<std::string, std::string> declarations;     // table -> CREATE TABLE x(...)
+        std::vector<Scan> scans;                                       // of the statement being prepared
+    };
+
+    struct CollectorTable : sqlite3_vtab
+    {
+        CollectorTable() : sqlite3_vtab() {}
+
+        Collector* collector = nullptr;
+        std::string name;
+    };
+
+    std::string sql_literal(sqlite3_value* value)
+    {
+        switch (sqlite3_value_type(value))
+        {
+        case SQLITE_INTEGER:
+            return std::to_string(sqlite3_value_int64(value));
+        case SQLITE_FLOAT:
+        {
+            char* text = sqlite3_mprintf("%!.17g", sqlite3_value_double(value));
+            std::string literal = text ? text : "";
+            sqlite3_free(text);
+            return literal;
+        }
+        case SQLITE_TEXT:
+            return SqliteWrap::quote_literal(reinterpret_cast<const char*>(sqlite3_value_text(value)));
+        default:
+            return std::string();        // NULL (never equal), blobs : no partial index
+        }
+    }
+
+    void add_unique(std::vector<int>& columns, int column)
+    {
+        if (std::find(columns.begin(), columns.end(), column) == columns.end()) columns.push_back(column);
+    }
+
+    int collector_connect(sqlite3* db, void* aux, int, const char* const* argv, sqlite3_vtab** vtab, char** error)
+    {
+        Collector* collector = static_cast<Collector*>(aux);
+        auto found = collector->declarations.find(argv[2]);
+        if (found == collector->declarations.end())
+        {
+            *error = sqlite3_mprintf("unknown table %s", argv[2]);
+            return SQLITE_ERROR;
+        }
+
+        int rc = sqlite3_declare_vtab(db, found->second.c_str());
+        if (rc != SQLITE_OK) return rc;
+
+        CollectorTable* table = new CollectorTable();
+        table->collector = collector;
+        table->name = argv[2];
+        *vtab = table;
+        return SQLITE_OK;
+    }
+
+    int collector_disconnect(sqlite3_vtab* vtab)
+    {
+        delete static_cast<CollectorTable*>(vtab);
+        return SQLITE_OK;
+    }
+
+    int collector_best_index(sqlite3_vtab* vtab, sqlite3_index_info* info)
+    {
+        CollectorTable* table = static_cast<CollectorTable*>(vtab);
+
+        Scan scan;
+        scan.table = table->name;
+        scan.used = info->colUsed;
+
+        for (int i = 0; i < info->nConstraint; i++)
+        {
+            const auto& constraint = info->aConstraint[i];
+            if (!constraint.usable || constraint.iColumn < 0) continue;
+
+            sqlite3_value* value = nullptr;
+            switch (constraint.op)
+            {
+            case SQLITE_INDEX_CONSTRAINT_EQ:
+            case SQLITE_INDEX_CONSTRAINT_IS:
+                add_unique(scan.equal, constraint.iColumn);
+                // a constant written in the statement, not a parameter : the term a partial index can name
+                if (sqlite3_vtab_rhs_value(info, i, &value) == SQLITE_OK && value)
+                {
+                    std::string literal = sql_literal(value);
+                    if (!literal.empty()) scan.constants.emplace_back(constraint.iColumn, (constraint.op == SQLITE_INDEX_CONSTRAINT_EQ ? " = " : " IS ") + literal);
+                }
+                break;
+            case SQLITE_INDEX_CONSTRAINT_ISNULL:
+                add_unique(scan.equal, constraint.iColumn);
+                scan.constants.emplace_back(constraint.iColumn, " IS NULL");
+                break;
+            case SQLITE_INDEX_CONSTRAINT_GT:
+            case SQLITE_INDEX_CONSTRAINT_GE:
+            case SQLITE_INDEX_CONSTRAINT_LT:
+            case SQLITE_INDEX_CONSTRAINT_LE:
+                add_unique(scan.range, constraint.iColumn);
+                break;
+            case SQLITE_INDEX_CONSTRAINT_ISNOTNULL:
+                add_unique(scan.not_null, constraint.iColumn);
+                break;
+            default:
+                break;
+            }
+        }
+
+        for (int i = 0; i < info->nOrderBy; i++)
+        {
+            if (info->aOrderBy[i].iColumn < 0)
+            {
+                scan.order_by.clear();
+                break;
+            }
+            scan.order_by.emplace_back(info->aOrderBy[i].iColumn, info->aOrderBy[i].desc != 0);
+        }
+
+        // xBestIndex runs for every join order the planner tries : record each shape once
+        std::vector<Scan>& scans = table->collector->scans;
+        if (!scan.empty() && std::find(scans.begin(), scans.end(), scan) == scans.end()) scans.push_back(scan);
+
+        // as expensive whatever is used : the planner goes on trying the other ways
+        info->estimatedCost = 1e12;
+        info->estimatedRows = 1000000;
+        return SQLITE_OK;
+    }
+
+    // statements are only prepared, never run
+    int collector_open(sqlite3_vtab*, sqlite3_vtab_cursor** cursor)
+    {
+        *cursor = new sqlite3_vtab_cursor();
+        return SQLITE_OK;
+    }
+
+    int collector_close(sqlite3_vtab_cursor* cursor)
+    {
+        delete cursor;
+        return SQLITE_OK;
+    }
+
+    int collector_filter(sqlite3_vtab_cursor*, int, const char*, int, sqlite3_value**) { return SQLITE_OK; }
+    int collector_next(sqlite3_vtab_cursor*) { return SQLITE_OK; }
+    int collector_eof(sqlite3_vtab_cursor*) { return 1; }
+
+    int collector_column(sqlite3_vtab_cursor*, sqlite3_context* context, int)
+    {
+        sqlite3_result_null(context);
+        return SQLITE_OK;
+    }
+
+    int collector_rowid(sqlite3_vtab_cursor*, sqlite3_int64* rowid)
+    {
+        *rowid = 0;
+        return SQLITE_OK;
+    }
+
+    sqlite3_module make_collector_module()
+    {
+        sqlite3_module module {};
+        module.xCreate = collector_connect;
+        module.xConnect = collector_connect;
+        module.xBestIndex = collector_best_index;
+        module.xDisconnect = collector_disconnect;
+        module.xDestroy = collector_disconnect;
+        module.xOpen = collector_open;
+        module.xClose = collector_close;
+        module.xFilter = collector_filter;
+        module.xNext = collector_next;
+        module.xEof = collector_eof;
+        module.xColumn = collector_column;
+        module.xRowid = collector_rowid;
+        return module;
+    }
+
+    sqlite3_module collector_module = make_collector_module();
+
+
+    // table of the real database
+    struct AdvisedTable
+    {
+        const TableInfo* info = nullptr;
+        std::vector<std::string> columns;    // columns of the collector table, in order
+        int rowid_column = -1;               // INTEGER PRIMARY KEY : never a candidate
+        double rows = 0;
+    };
+
+    struct IndexStats
+    {
+        std::string table;
+        double rows = 0;
+        std::vector<double> per_key;         // rows per value of the first 1, 2 ... columns
+    };
+
+    struct Candidate
+    {
+        std::string table;
+        std::vector<std::pair<std::string, bool>> columns;      // name, descending
+        std::string where;
+        bool covering = false;
+        bool partial = false;
+
+        std::string key() const
+        {
+            std::string key = table + '(';
+            for (const auto& column : columns) key += column.first + (column.second ? " DESC," : ",");
+            return key + ')' + where;
+        }
+    };
+
+    // a workload statement, once prepared on both copies of the schema
+    struct Prepared
+    {
+        std::string digest;
+        const std::string* sql = nullptr;
+        const std::vector<SqlValue>* params = nullptr;
+        double weight = 0;
+        std::vector<Scan> scans;
+        std::set<std::string> tables;        // lower case
+        double default_rows = 0;             // for aliases in plans : largest table of the statement
+        double cost = 0;                     // on the current schema
+    };
+
+    std::string lower(std::string text)
+    {
+        for (char& c : text) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return text;
+    }
+
+    bool starts_with(const std::string& text, const char* prefix)
+    {
+        return text.compare(0, std::char_traits<char>::length(prefix), prefix) == 0;
+    }
+
+    bool exec(sqlite3* db, const std::string& sql)
+    {
+        return sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+    }
+
+    bool query_value(sqlite3* db, const std::string& sql, double& value)
+    {
+        sqlite3_stmt* statement = nullptr;
+        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr);
+        if (rc == SQLITE_OK) rc = sqlite3_step(statement);
+        if (rc == SQLITE_ROW) value = sqlite3_column_double(statement, 0);
+        sqlite3_finalize(statement);
+        return rc == SQLITE_ROW;
+    }
+
+    bool query_plan(sqlite3* db, const std::string& sql, const std::vector<SqlValue>& params, std::vector<std::string>& plan, std::string& message)
+    {
+        plan.clear();
+
+        std::string explain = "EXPLAIN QUERY PLAN " + sql;
+        sqlite3_stmt* statement = nullptr;
+        if (sqlite3_prepare_v2(db, explain.c_str(), -1, &statement, nullptr) != SQLITE_OK || !SqliteWrap::bind_values(statement, params))
+        {
+            message = sqlite3_errmsg(db);
+            sqlite3_finalize(statement);
+            return false;
+        }
+
+        int rc;
+        while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+            plan.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(statement, 3)));
+        sqlite3_finalize(statement);
+
+        if (rc != SQLITE_DONE)
+        {
+            message = sqlite3_errmsg(db);
+            return false;
+        }
+        return true;
+    }
+
+    // name of the table or index after "SCAN " / "SEARCH " / "INDEX "
+    std::string word_after(const std::string& line, size_t position)
+    {
+        size_t end = line.find(' ', position);
+        return line.substr(position, end == std::string::npos ? std::string::npos : end - position);
+    }
+
+
+    class Workspace
+    {
+    public:
+        Workspace(sqlite3* real, const AdvisorOptions& options) : real(real), options(options) {}
+        ~Workspace()
+        {
+            sqlite3_close(whatif);
+            sqlite3_close(planner);
+        }
+
+        sqlite3* real;
+        sqlite3* whatif = nullptr;           // the schema with the candidate under test, estimated statistics
+        sqlite3* planner = nullptr;          // the schema as collector virtual tables
+        AdvisorOptions options;
+        Collector collector;
+        std::unordered_map<std::string, AdvisedTable> tables;          // lower case name
+        std::unordered_map<std::string, IndexStats> index_stats;       // whatif indexes, lower case name
+        std::unordered_map<std::string, std::string> primary_keys;     // WITHOUT ROWID table -> its index
+        std::unordered_map<std::string, IndexStats> stat_cache;        // table|columns|where
+
+        const AdvisedTable* find_table(const std::string& name) const
+        {
+            auto found = tables.find(lower(name));
+            return found == tables.end() ? nullptr : &found->second;
+        }
+
+        // rows per value of the column prefixes, from the first sample_rows rows of the real table
+        const IndexStats& estimate(const std::string& table, const std::vector<std::string>& columns, const std::string& where)
+        {
+            std::string key = table + '|' + where;
+            for (const std::string& column : columns) key += '|' + column;
+
+            auto found = stat_cache.find(key);
+            if (found != stat_cache.end()) return found->second;
+
+            IndexStats& stats = stat_cache[key];
+            stats.table = table;
+            const AdvisedTable* advised = find_table(table);
+            double total = advised ? advised->rows : 0;
+
+            std::string list;
+            for (size_t i = 0; i < columns.size() && !columns[i].empty(); i++) list += (i ? ", " : "") + SqliteWrap::quote_identifier(columns[i]);
+            if (list.empty())
+            {
+                stats.rows = total;
+                return stats;
+            }
+
+            std::string sample = "SELECT " + list + " FROM (SELECT * FROM " + SqliteWrap::quote_identifier(table) + " LIMIT " + std::to_string(options.sample_rows) + ")";
+            if (!where.empty()) sample += " WHERE " + where;
+
+            double scanned = std::min(total, static_cast<double>(options.sample_rows));
+            double sampled = 0;
+            query_value(real, "SELECT count(*) FROM (" + sample + ")", sampled);
+            stats.rows = where.empty() || scanned <= 0 ? total : total * sampled / scanned;
+
+            std::string prefix;
+            double previous = std::max(stats.rows, 1.0);
+            for (size_t i = 0; i < columns.size() && !columns[i].empty(); i++)
+            {
+                prefix += (i ? ", " : "") + SqliteWrap::quote_identifier(columns[i]);
+
+                double distinct = 0;
+                query_value(real, "SELECT count(*) FROM (SELECT DISTINCT " + prefix + " FROM (" + sample + "))", distinct);
+
+                // few values : the sample has seen them all, they share the whole table.
+                // Many : the sample ratio holds (close to 1 row per value)
+                double per_key = 1;
+                if (distinct > 0) per_key = distinct * 10 <= sampled ? stats.rows / distinct : sampled / distinct;
+
+                per_key = std::clamp(per_key, 1.0, previous);
+                stats.per_key.push_back(per_key);
+                previous = per_key;
+            }
+
+            return stats;
+        }
+
+        // sqlite_stat1 of whatif : every table and index, then loaded by the planner
+        bool write_stats()
+        {
+            if (!exec(whatif, "DELETE FROM sqlite_stat1;")) return false;
+
+            sqlite3_stmt* insert = nullptr;
+            if (sqlite3_prepare_v2(whatif, "INSERT INTO sqlite_stat1(tbl, idx, stat) VALUES (?, ?, ?);", -1, &insert, nullptr) != SQLITE_OK) return false;
+
+            auto add = [&](const std::string& table, const std::string* index, const std::string& stat)
+            {
+                sqlite3_bind_text(insert, 1, table.c_str(), -1, SQLITE_TRANSIENT);
+                if (index) sqlite3_bind_text(insert, 2, index->c_str(), -1, SQLITE_TRANSIENT);
+                else sqlite3_bind_null(insert, 2);
+                sqlite3_bind_text(insert, 3, stat.c_str(), -1, SQLITE_TRANSIENT);
+                sqlite3_step(insert);
+                sqlite3_reset(insert);
+            };
+
+            for (const auto& [name, table] : tables)
+                if (table.info->type == "table") add(table.info->name, nullptr, std::to_string(std::llround(std::max(table.rows, 1.0))));
+
+            for (const auto& [name, stats] : index_stats)
+            {
+                std::string stat = std::to_string(std::llround(std::max(stats.rows, 1.0)));
+                for (double per_key : stats.per_key) stat += ' ' + std::to_string(std::llround(per_key));
+                add(stats.table, &name, stat);
+            }
+
+            sqlite3_finalize(insert);
+            return exec(whatif, "ANALYZE sqlite_schema;");
+        }
+
+        // estimated rows read, nested loops multiplied, plus sorts
+        double plan_cost(const std::vector<std::string>& plan, double default_rows) const
+        {
+            double cost = 0;
+            double loops = 1;
+
+            for (const std::string& line : plan)
+            {
+                if (starts_with(line, "USE TEMP B-TREE"))
+                {
+                    cost += loops * std::log2(loops + 1);
+                    continue;
+                }
+
+                bool scan = starts_with(line, "SCAN ");
+                if (!scan && !starts_with(line, "SEARCH ")) continue;
+
+                std::string name = word_after(line, scan ? 5 : 7);
+                const AdvisedTable* table = find_table(name);
+                double rows = std::max(table ? table->rows : default_rows, 1.0);
+
+                // an index built for the statement : read the table once, then lookups
+                if (line.find("AUTOMATIC") != std::string::npos)
+                {
+                    cost += rows + loops * 10;
+                    loops *= 10;
+                    continue;
+                }
+
+                const IndexStats* index = nullptr;
+                size_t position = line.find("INDEX ");
+                if (position != std::string::npos)
+                {
+                    auto found = index_stats.find(lower(word_after(line, position + 6)));
+                    if (found != index_stats.end()) index = &found->second;
+                }
+                else if (line.find("USING PRIMARY KEY") != std::string::npos)
+                {
+                    auto key = primary_keys.find(lower(name));
+                    auto found = key == primary_keys.end() ? index_stats.end() : index_stats.find(key->second);
+                    if (found != index_stats.end()) index = &found->second;
+                }
+
+                bool rowid = line.find("INTEGER PRIMARY KEY") != std::string::npos;
+                bool covering = rowid || line.find("COVERING INDEX") != std::string::npos || line.find("USING PRIMARY KEY") != std::string::npos;
+
+                // terms of the search : "(a=? AND b>? AND b<?)", skip-scan "(ANY(a) AND b=?)"
+                int equal = 0;
+                int range = 0;
+                int skipped = 0;
+                size_t open = line.find(" (");
+                for (size_t start = open == std::string::npos ? std::string::npos : open + 2; start != std::string::npos && start < line.size(); )
+                {
+                    size_t end = line.find(" AND ", start);
+                    std::string term = line.substr(start, end == std::string::npos ? line.size() - 1 - start : end - start);
+                    if (starts_with(term, "ANY(")) skipped++;
+                    if (term.find('>') != std::string::npos || term.find('<') != std::string::npos) range++;
+                    else equal++;
+                    start = end == std::string::npos ? end : end + 5;
+                }
+
+                double read;
+                if (scan) read = index ? std::max(index->rows, 1.0) : rows;
+                else
+                {
+                    if (rowid) read = equal ? 1 : rows;
+                    else if (index && equal && !index->per_key.empty()) read = index->per_key[std::min<size_t>(equal, index->per_key.size()) - 1];
+                    else read = index ? std::max(index->rows, 1.0) : rows / 10;
+
+                    // SQLite's own guesses for ranges without STAT4
+                    if (range) read /= range >= 2 ? 64 : 4;
+                    read = std::max(read, 1.0);
+
+                    // a skip-scan searches once per value of the skipped column
+                    if (skipped && index && !index->per_key.empty()) read *= index->rows / index->per_key[0];
+                }
+
+                // a row found through a non covering index is read again from the table
+                cost += loops * (scan ? 0 : std::log2(rows + 1)) + loops * read * (covering || (scan && !index) ? 1 : 2);
+                loops *= read;
+            }
+
+            return cost;
+        }
+    };
+
+    std::string index_name(const Candidate& candidate)
+    {
+        std::string name = candidate.table;
+        for (const auto& column : candidate.columns) name += '_' + column.first;
+        if (candidate.partial) name += "_partial";
+
+        // plain identifiers : the name is found as is in the plans
+        for (char& c : name)
+            if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') c = '_';
+        if (name.size() > 48) name.resize(48);
+        return lower(name);
+    }
+
+    std::string index_sql(const Candidate& candidate, const std::string& name)
+    {
+        std::string sql = "CREATE INDEX " + SqliteWrap::quote_identifier(name) + " ON " + SqliteWrap::quote_identifier(candidate.table) + " (";
+        for (size_t i = 0; i < candidate.columns.size(); i++)
+            sql += (i ? ", " : "") + SqliteWrap::quote_identifier(candidate.columns[i].first) + (candidate.columns[i].second ? " DESC" : "");
+        sql += ")";
+        if (!candidate.where.empty()) sql += " WHERE " + candidate.where;
+        return sql + ";";
+    }
+
+    void add_candidate(std::vector<Candidate>& candidates, std::set<std::string>& keys, const Candidate& candidate)
+    {
+        if (!candidate.columns.empty() && keys.insert(candidate.key()).second) candidates.push_back(candidate);
+    }
+
+    // (equalities, range), (equalities, ORDER BY), both covering, partial on constants
+    void generate(Workspace& workspace, const Scan& scan, std::vector<Candidate>& candidates, std::set<std::string>& keys)
+    {
+        const AdvisedTable* table = workspace.find_table(scan.table);
+        if (!table || table->info->type != "table") return;         // no index on a virtual table
+
+        const int rowid = table->rowid_column;
+        auto contains = [](const std::vector<std::pair<std::string, bool>>& columns, const std::string& name)
+        {
+            return std::any_of(columns.begin(), columns.end(), [&](const auto& column) { return column.first == name; });
+        };
+
+        Candidate base;
+        base.table = table->info->name;
+        for (int column : scan.equal)
+            if (column != rowid) base.columns.emplace_back(table->columns[column], false);
+        const size_t equal_count = base.columns.size();
+
+        std::vector<Candidate> keyed;
+
+        Candidate searched = base;
+        for (int column : scan.range)
+        {
+            if (column == rowid || contains(searched.columns, table->columns[column])) continue;
+            searched.columns.emplace_back(table->columns[column], false);
+            break;
+        }
+        keyed.push_back(searched);
+
+        // the rowid ends every index : ORDER BY ..., rowid is served too
+        Candidate ordered = base;
+        for (const auto& [column, descending] : scan.order_by)
+        {
+            if (column == rowid) break;
+            if (!contains(ordered.columns, table->columns[column])) ordered.columns.emplace_back(table->columns[column], descending);
+        }
+        if (ordered.columns.size() > equal_count) keyed.push_back(ordered);
+
+        for (const Candidate& candidate : keyed)
+        {
+            add_candidate(candidates, keys, candidate);
+
+            // covering : the other columns the statement reads, while the index stays narrow
+            if (candidate.columns.empty() || (scan.used & (1ull << 63))) continue;
+
+            Candidate covering = candidate;
+            covering.covering = true;
+            for (size_t column = 0; column < table->columns.size() && column < 63; column++)
+            {
+                if (!(scan.used & (1ull << column)) || static_cast<int>(column) == rowid || contains(covering.columns, table->columns[column])) continue;
+                covering.columns.emplace_back(table->columns[column], false);
+            }
+            // every column : a copy of the table, not an index
+            size_t table_columns = table->columns.size() - (rowid >= 0 ? 1 : 0);
+            if (covering.columns.size() > candidate.columns.size() && covering.columns.size() < table_columns
+                && covering.columns.size() <= static_cast<size_t>(workspace.options.max_index_columns))
+                add_candidate(candidates, keys, covering);
+        }
+
+        // partial : a constant on a column of few values, the index only holds its rows
+        auto partial = [&](int column, const std::string& where)
+        {
+            for (const Candidate& key : keyed)
+            {
+                Candidate candidate = key;
+                candidate.partial = true;
+                candidate.where = where;
+                candidate.columns.erase(std::remove_if(candidate.columns.begin(), candidate.columns.end(),
+                                                       [&](const auto& entry) { return entry.first == table->columns[column]; }), candidate.columns.end());
+                if (candidate.columns.empty()) candidate.columns.emplace_back(table->columns[column], false);
+                add_candidate(candidates, keys, candidate);
+            }
+        };
+
+        for (const auto& [column, term] : scan.constants)
+        {
+            if (column == rowid) continue;
+            const IndexStats& stats = workspace.estimate(table->info->name, { table->columns[column] }, "");
+            if (stats.per_key.empty() || stats.rows / stats.per_key[0] > workspace.options.low_cardinality) continue;
+            partial(column, SqliteWrap::quote_identifier(table->columns[column]) + term);
+        }
+
+        for (int column : scan.not_null)
+        {
+            if (column == rowid) continue;
+            std::string quoted = SqliteWrap::quote_identifier(table->columns[column]);
+            double nulls = 0;
+            double sampled = 0;
+            std::string sample = "(SELECT " + quoted + " FROM " + SqliteWrap::quote_identifier(table->info->name) + " LIMIT " + std::to_string(workspace.options.sample_rows) + ")";
+            query_value(workspace.real, "SELECT count(*) - count(" + quoted + ") FROM " + sample, nulls);
+            query_value(workspace.real, "SELECT count(*) FROM " + sample, sampled);
+            if (sampled > 0 && nulls * 2 >= sampled) partial(column, quoted + " IS NOT NULL");
+        }
+    }
+}
+
+
+IndexAdvisor::IndexAdvisor(SqliteWrap &db)
+    : _db(db)
+{
+}
+
+
+void IndexAdvisor::add(const std::string &sql, const std::vector<SqlValue> &params, double weight)
+{
+    Statement& statement = _workload[BusyHandler::digest(sql)];
+    if (statement.sql.empty())
+    {
+        statement.sql = sql;
+        statement.params = params;
+    }
+    statement.weight += weight;
+}
+
+
+void IndexAdvisor::clear()
+{
+    _workload.clear();
+    _issues.clear();
+    _proposals.clear();
+    _skipped.clear();
+}
+
+
+bool IndexAdvisor::analyze(const AdvisorOptions &options)
+{
+    _issues.clear();
+    _proposals.clear();
+    _skipped.clear();
+
+    sqlite3* real = _db.get_handle();
+    if (!real) return error("analyze", "Database not connected.");
+
+    SchemaCache* schema = _db.get_schema_cache();
+    std::vector<std::string> names;
+    if (!schema->get_table_list(names)) return error("analyze", "Cannot read the schema.");
+
+    Workspace workspace(real, options);
+
+    if (sqlite3_open(":memory:", &workspace.whatif) != SQLITE_OK || sqlite3_open(":memory:", &workspace.planner) != SQLITE_OK)
+        return error("analyze", "Cannot open the in-memory databases.");
+
+    SqlArray::register_module(workspace.whatif);
+    SqlArray::register_module(workspace.planner);
+    if (sqlite3_create_module_v2(workspace.planner, "sqlitewrap_advisor", &collector_module, &workspace.collector, nullptr) != SQLITE_OK)
+        return error("analyze", sqlite3_errmsg(workspace.planner));
+
+    // tables : columns and exact sizes
+    for (const std::string& name : names)
+    {
+        const TableInfo* info = schema->find_table(name);
+        if (!info || info->type == "view" || starts_with(lower(name), "sqlite_")) continue;
+
+        AdvisedTable table;
+        table.info = info;
+
+        // hidden columns of virtual tables are declared too : FTS5 "tbl MATCH ?" names one
+        std::string declaration;
+        for (const ColumnInfo& column : info->columns)
+        {
+            if (column.primary_key == 1 && info->primary_key.size() == 1 && !info->without_rowid && info->type == "table"
+                && lower(column.declared_type) == "integer")
+                table.rowid_column = static_cast<int>(table.columns.size());
+
+            declaration += (table.columns.empty() ? "" : ", ") + SqliteWrap::quote_identifier(column.name) + " " + column.declared_type
+                           + (column.hidden == 1 ? " HIDDEN" : "");
+            table.columns.push_back(column.name);
+        }
+
+        if (info->type == "table") query_value(real, "SELECT count(*) FROM " + SqliteWrap::quote_identifier(name) + ";", table.rows);
+
+        workspace.collector.declarations[name] = "CREATE TABLE x(" + declaration + ");";
+        workspace.tables[lower(name)] = table;
+    }
+
+    // whatif : the schema as created (virtual tables create their own shadow tables first)
+    {
+        sqlite3_stmt* statement = nullptr;
+        if (sqlite3_prepare_v2(real, "SELECT sql FROM sqlite_master WHERE type IN ('table', 'view', 'index') AND sql IS NOT NULL "
+                                     "AND name NOT LIKE 'sqlite\\_%' ESCAPE '\\' ORDER BY rowid;", -1, &statement, nullptr) != SQLITE_OK)
+            return error("analyze", sqlite3_errmsg(real));
+
+        while (sqlite3_step(statement) == SQLITE_ROW)
+            exec(workspace.whatif, reinterpret_cast<const char*>(sqlite3_column_text(statement, 0)));
+        sqlite3_finalize(statement);
+    }
+
+    // planner : a collector virtual table per table, the views over them
+    for (const auto& [key, table] : workspace.tables)
+        if (!exec(workspace.planner, "CREATE VIRTUAL TABLE " + SqliteWrap::quote_identifier(table.info->name) + " USING sqlitewrap_advisor;"))
+            return error("analyze", sqlite3_errmsg(workspace.planner));
+
+    for (const std::string& name : names)
+    {
+        const TableInfo* info = schema->find_table(name);
+        if (info && info->type == "view") exec(workspace.planner, info->sql);
+    }
+
+    // statistics of the existing indexes (automatic ones included)
+    {
+        sqlite3_stmt* statement = nullptr;
+        sqlite3_prepare_v2(workspace.whatif, "SELECT m.name, m.tbl_name, i.name FROM sqlite_master m, pragma_index_info(m.name) i "
+                                             "WHERE m.type = 'index' ORDER BY m.name, i.seqno;", -1, &statement, nullptr);
+
+        std::unordered_map<std::string, std::pair<std::string, std::vector<std::string>>> indexes;
+        while (sqlite3_step(statement) == SQLITE_ROW)
+        {
+            auto& index = indexes[reinterpret_cast<const char*>(sqlite3_column_text(statement, 0))];
+            index.first = reinterpret_cast<const char*>(sqlite3_column_text(statement, 1));
+            const unsigned char* column = sqlite3_column_text(statement, 2);
+            index.second.push_back(column ? reinterpret_cast<const char*>(column) : "");     // expression, rowid
+        }
+        sqlite3_finalize(statement);
+
+        for (const auto& [name, index] : indexes)
+        {
+            workspace.index_stats[lower(name)] = workspace.estimate(index.first, index.second, "");
+            if (starts_with(name, "sqlite_autoindex_"))
+            {
+                const AdvisedTable* table = workspace.find_table(index.first);
+                if (table && table->info->without_rowid && !table->info->primary_key.empty() && index.second.front() == table->info->primary_key.front())
+                    workspace.primary_keys[lower(index.first)] = lower(name);
+            }
+        }
+    }
+
+    if (!exec(workspace.whatif, "ANALYZE sqlite_schema;") || !workspace.write_stats())
+        return error("analyze", sqlite3_errmsg(workspace.whatif));
+
+    // the workload : issues on the real database, shapes on the planner, costs on whatif
+    std::vector<Prepared> prepared;
+    for (const auto& [digest, statement] : _workload)
+    {
+        std::vector<std::string> plan;
+        std::string message;
+        if (!query_plan(real, statement.sql, statement.params, plan, message))
+        {
+            _skipped.emplace_back(digest, message);
+            continue;
+        }
+
+        Prepared entry;
+        entry.digest = digest;
+        entry.sql = &statement.sql;
+        entry.params = &statement.params;
+        entry.weight = statement.weight;
+
+        workspace.collector.scans.clear();
+        sqlite3_stmt* shape = nullptr;
+        int rc = sqlite3_prepare_v2(workspace.planner, statement.sql.c_str(), -1, &shape, nullptr);
+        sqlite3_finalize(shape);
+        if (rc != SQLITE_OK)
+        {
+            _skipped.emplace_back(digest, sqlite3_errmsg(workspace.planner));
+            continue;
+        }
+        entry.scans = workspace.collector.scans;
+
+        for (const Scan& scan : entry.scans)
+        {
+            entry.tables.insert(lower(scan.table));
+            const AdvisedTable* table = workspace.find_table(scan.table);
+            if (table) entry.default_rows = std::max(entry.default_rows, table->rows);
+        }
+
+        for (const std::string& line : plan)
+        {
+            if (starts_with(line, "USE TEMP B-TREE")) _issues.push_back({ digest, line, 0, statement.weight });
+            else if (starts_with(line, "SCAN "))
+            {
+                const AdvisedTable* table = workspace.find_table(word_after(line, 5));
+                double rows = table ? table->rows : entry.default_rows;
+                if (rows >= options.large_table_rows) _issues.push_back({ digest, line, static_cast<sqlite3_int64>(rows), statement.weight });
+            }
+        }
+
+        std::vector<std::string> whatif_plan;
+        if (!query_plan(workspace.whatif, statement.sql, statement.params, whatif_plan, message))
+        {
+            _skipped.emplace_back(digest, message);
+            continue;
+        }
+        entry.cost = workspace.plan_cost(whatif_plan, entry.default_rows);
+
+        prepared.push_back(std::move(entry));
+    }
+
+    std::vector<Candidate> candidates;
+    std::set<std::string> keys;
+    for (const Prepared& entry : prepared)
+        for (const Scan& scan : entry.scans) generate(workspace, scan, candidates, keys);
+
+    // each candidate alone on whatif : the statements of its table are planned again
+    std::set<std::string> used_names;
+    for (const Candidate& candidate : candidates)
+    {
+        std::string name = index_name(candidate);
+        for (int suffix = 2; used_names.count(name) || workspace.index_stats.count(name); suffix++)
+            name = index_name(candidate) + '_' + std::to_string(suffix);
+
+        std::string sql = index_sql(candidate, name);
+        if (!exec(workspace.whatif, sql)) continue;
+
+        std::vector<std::string> columns;
+        for (const auto& column : candidate.columns) columns.push_back(column.first);
+        workspace.index_stats[name] = workspace.estimate(candidate.table, columns, candidate.where);
+
+        IndexProposal proposal;
+        proposal.table = candidate.table;
+        proposal.sql = sql;
+        proposal.covering = candidate.covering;
+        proposal.partial = candidate.partial;
+
+        if (workspace.write_stats())
+        {
+            for (const Prepared& entry : prepared)
+            {
+                if (!entry.tables.count(lower(candidate.table))) continue;
+
+                std::vector<std::string> plan;
+                std::string message;
+                if (!query_plan(workspace.whatif, *entry.sql, *entry.params, plan, message)) continue;
+
+                bool uses = std::any_of(plan.begin(), plan.end(), [&](const std::string& line)
+                {
+                    size_t position = line.find("INDEX " + name);
+                    size_t end = position + 6 + name.size();
+                    return position != std::string::npos && (end == line.size() || line[end] == ' ');
+                });
+                double cost = workspace.plan_cost(plan, entry.default_rows);
+                if (!uses || cost >= entry.cost) continue;
+
+                proposal.digests.push_back(entry.digest);
+                proposal.cost_before += entry.weight * entry.cost;
+                proposal.cost_after += entry.weight * cost;
+            }
+        }
+
+        exec(workspace.whatif, "DROP INDEX " + SqliteWrap::quote_identifier(name) + ";");
+        workspace.index_stats.erase(name);
+
+        if (proposal.digests.empty()) continue;
+
+        used_names.insert(name);
+        proposal.benefit = proposal.cost_before - proposal.cost_after;
+        _proposals.push_back(std::move(proposal));
+    }
+
+    std::stable_sort(_proposals.begin(), _proposals.end(), [](const IndexProposal& a, const IndexProposal& b) { return a.benefit > b.benefit; });
+    if (_proposals.size() > options.max_proposals) _proposals.resize(options.max_proposals);
+
+    std::stable_sort(_issues.begin(), _issues.end(), [](const PlanIssue& a, const PlanIssue& b)
+    {
+        return a.weight * std::max<double>(static_cast<double>(a.rows), 1) > b.weight * std::max<double>(static_cast<double>(b.rows), 1);
+    });
+
+    return true;
+}
+
+
+bool IndexAdvisor::export_proposals(const std::string &pathfile)
+{
+    std::ofstream out(pathfile, std::ios::out | std::ios::trunc);
+    if (!out.is_open()) return error("export_proposals", "Unable to open " + pathfile);
+
+    // same separator as get_database_schema()
+    for (const IndexProposal& proposal : _proposals)
+    {
+        out << "@@@sql@@@\n-- estimated rows read " << std::llround(proposal.cost_before) << " -> " << std::llround(proposal.cost_after) << " :";
+        for (const std::string& digest : proposal.digests) out << "\n--   " << digest;
+        out << "\n" << proposal.sql << "\n";
+    }
+
+    if (!out.good()) return error("export_proposals", "Write error on " + pathfile);
+    return true;
+}
+
+
+bool IndexAdvisor::error(const char *function, const std::string &message)
+{
+    _last_error = message;
+    SQLITEWRAP_LOG_ERROR("IndexAdvisor::" << function << "(...) - Error: " << message);
+    return false;
+}
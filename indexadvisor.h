@@ -0,0 +1,104 @@
+#ifndef INDEXADVISOR_H
+#define INDEXADVISOR_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlitewrap.h"
+
+struct AdvisorOptions
+{
+    sqlite3_int64 large_table_rows = 10000;  // SCAN of smaller tables is not reported
+    sqlite3_int64 sample_rows = 100000;      // rows read per table and index to estimate selectivity
+    int max_index_columns = 6;               // wider covering indexes are not proposed
+    int low_cardinality = 32;                // distinct values at most : partial index on a constant
+    size_t max_proposals = 10;
+};
+
+// In the plan of a workload statement on the current schema
+struct PlanIssue
+{
+    std::string digest;
+    std::string detail;                      // "SCAN person", "USE TEMP B-TREE FOR ORDER BY"
+    sqlite3_int64 rows = 0;                  // of the scanned table, 0 for a sort
+    double weight = 0;                       // of the statement
+};
+
+struct IndexProposal
+{
+    std::string table;
+    std::string sql;                         // CREATE INDEX ...
+    bool covering = false;                   // holds every column the statements read
+    bool partial = false;
+    std::vector<std::string> digests;        // statements whose plan uses the index
+    double cost_before = 0;                  // estimated rows read by these statements, times their weight
+    double cost_after = 0;
+    double benefit = 0;                      // cost_before - cost_after, proposals are sorted on it
+};
+
+// Index advisor for a recorded workload, in the manner of the sqlite expert extension :
+//
+// - issues : EXPLAIN QUERY PLAN of every statement on the database; SCAN of tables of
+//   large_table_rows rows or more and temporary b-trees (ORDER BY, GROUP BY, DISTINCT).
+// - candidates : the statements are prepared on an in-memory copy of the schema where
+//   every table is a virtual table (with the hidden columns of virtual tables, FTS5 MATCH
+//   on the table name included); its xBestIndex records the columns the planner could
+//   use (equality, range, ORDER BY, columns read, constants). Candidates are
+//   (equalities, range), (equalities, ORDER BY), the same with the columns read appended
+//   (covering), and partial indexes on constants of low-cardinality columns.
+// - benefit : each candidate is created alone on a second in-memory copy of the schema,
+//   with sqlite_stat1 rows estimated from a sample of the real data (no data is copied).
+//   A cost model over the plans (rows read, lookups, sorts, nested loops) gives the cost
+//   of the statements before and after.
+//
+//     IndexAdvisor advisor(db);
+//     advisor.add("SELECT * FROM person WHERE name = ? ORDER BY age", { std::string("Ada") }, 120);
+//     advisor.analyze();
+//     for (const IndexProposal& proposal : advisor.get_proposals()) ...
+//
+// Estimates only : check a proposal with EXPLAIN QUERY PLAN and timings before keeping it.
+// Statements using functions or modules not registered on every connection are skipped.
+class SQLITEWRAP_EXPORT IndexAdvisor
+{
+public:
+    explicit IndexAdvisor(SqliteWrap& db);
+
+    // workload : statements with sample parameters, weight e.g. executions per hour.
+    // Statements of the same digest (BusyHandler::digest) are merged, their weights added
+    void add(const std::string& sql, const std::vector<SqlValue>& params = {}, double weight = 1);
+    void clear();
+
+    bool analyze(const AdvisorOptions& options = AdvisorOptions());
+
+    // proposals as a script for SqliteWrap::execute_sql_file()
+    bool export_proposals(const std::string& pathfile);
+
+private:
+    struct Statement
+    {
+        std::string sql;
+        std::vector<SqlValue> params;
+        double weight = 0;
+    };
+
+    SqliteWrap& _db;
+    std::map<std::string, Statement> _workload;     // by digest
+    std::vector<PlanIssue> _issues;
+    std::vector<IndexProposal> _proposals;
+    std::vector<std::pair<std::string, std::string>> _skipped;     // digest, error
+    std::string _last_error;
+
+    bool error(const char* function, const std::string& message);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+    size_t get_workload_size() const { return _workload.size(); }
+    const std::vector<PlanIssue>& get_issues() const { return _issues; }
+    const std::vector<IndexProposal>& get_proposals() const { return _proposals; }
+    const std::vector<std::pair<std::string, std::string>>& get_skipped() const { return _skipped; }
+};
+
+#endif // INDEXADVISOR_H
@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "logger.h"
+
+
+namespace
+{
+    constexpr size_t slot_text = 512;    // bytes of a line in the ring buffer
+
+    // Bounded queue of D. Vyukov : the sequence of a slot tells whether it is free for the
+    // producer of position pos (sequence == pos) or written for the consumer (pos + 1)
+    struct Slot
+    {
+        std::atomic<size_t> sequence { 0 };
+        LogLevel level = LogLevel::Off;
+        size_t size = 0;
+        char text[slot_text];
+    };
+
+    struct State
+    {
+        std::atomic<int> level { static_cast<int>(LogLevel::Off) };
+
+        std::mutex sink_mutex;           // one sink call at a time, set_sink()
+        void* user_param = nullptr;
+        LogSinkCallback callback = Logger::console_sink;
+
+        std::atomic<unsigned long long> messages { 0 };
+        std::atomic<unsigned long long> dropped { 0 };
+        std::atomic<unsigned long long> truncated { 0 };
+
+        std::mutex async_mutex;          // start_async(), stop_async()
+        std::atomic<bool> async { false };
+        std::atomic<int> writers { 0 };  // producers between the test of async and the end of push()
+        std::unique_ptr<Slot[]> slots;
+        size_t mask = 0;
+        std::atomic<size_t> enqueue_pos { 0 };
+        std::atomic<size_t> dequeue_pos { 0 };
+
+        std::thread consumer;
+        std::atomic<bool> stopping { false };
+        std::atomic<bool> sleeping { false };
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+
+        ~State() { stop(); }
+
+        void deliver(LogLevel line_level, const char* text, size_t size)
+        {
+            std::lock_guard<std::mutex> lock(sink_mutex);
+            if (!callback) return;
+
+            callback(user_param, line_level, text, size);
+            messages.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        bool push(LogLevel line_level, const std::string& message)
+        {
+            size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            Slot* slot;
+            for (;;)
+            {
+                slot = &slots[pos & mask];
+                size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+                if (diff == 0)
+                {
+                    if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                }
+                else if (diff < 0) return false;     // full : the consumer has not freed this slot yet
+                else pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+
+            slot->level = line_level;
+            slot->size = std::min(message.size(), slot_text);
+            std::memcpy(slot->text, message.data(), slot->size);
+            if (message.size() > slot_text)
+            {
+                std::memcpy(slot->text + slot_text - 3, "...", 3);
+                truncated.fetch_add(1, std::memory_order_relaxed);
+            }
+            slot->sequence.store(pos + 1, std::memory_order_release);
+
+            if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false)) wake.notify_one();
+            return true;
+        }
+
+        // consumer thread only
+        size_t drain()
+        {
+            size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+            size_t count = 0;
+            for (;;)
+            {
+                Slot& slot = slots[pos & mask];
+                if (slot.sequence.load(std::memory_order_acquire) != pos + 1) break;
+
+                deliver(slot.level, slot.text, slot.size);
+                slot.sequence.store(pos + mask + 1, std::memory_order_release);
+                dequeue_pos.store(++pos, std::memory_order_release);
+                count++;
+            }
+            return count;
+        }
+
+        void run()
+        {
+            for (;;)
+            {
+                if (drain() > 0) continue;
+                if (stopping.load()) break;
+
+                // the timeout covers a producer that saw sleeping false just before it was set
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                sleeping.store(true);
+                if (slots[dequeue_pos.load(std::memory_order_relaxed) & mask].sequence.load(std::memory_order_acquire)
+                    == dequeue_pos.load(std::memory_order_relaxed) + 1)
+                {
+                    sleeping.store(false);
+                    continue;
+                }
+                wake.wait_for(lock, std::chrono::milliseconds(100));
+                sleeping.store(false);
+            }
+        }
+
+        void stop()
+        {
+            std::lock_guard<std::mutex> lock(async_mutex);
+            if (!consumer.joinable()) return;
+
+            // no new producer after this, wait for the ones already pushing
+            async.store(false);
+            while (writers.load() > 0) std::this_thread::yield();
+
+            stopping.store(true);
+            {
+                std::lock_guard<std::mutex> wake_lock(wake_mutex);
+                wake.notify_one();
+            }
+            consumer.join();     // drains what is left
+            slots.reset();
+        }
+    };
+
+    State& state()
+    {
+        static State instance;
+        return instance;
+    }
+}
+
+
+void Logger::set_level(LogLevel level)
+{
+    state().level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+
+LogLevel Logger::get_level()
+{
+    return static_cast<LogLevel>(state().level.load(std::memory_order_relaxed));
+}
+
+
+bool Logger::is_enabled(LogLevel level)
+{
+    return level != LogLevel::Off && static_cast<int>(level) >= state().level.load(std::memory_order_relaxed);
+}
+
+
+void Logger::set_sink(void *user_param, LogSinkCallback callback)
+{
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.sink_mutex);
+    s.user_param = user_param;
+    s.callback = callback;
+}
+
+
+void Logger::console_sink(void *, LogLevel level, const char *message, size_t size)
+{
+    // one write : std::cerr is unit-buffered, every << would flush
+    std::string line;
+    line.reserve(size + 12);
+    line += '[';
+    line += level_name(level);
+    line += "] ";
+    line.append(message, size);
+    line += '\n';
+    std::cerr.write(line.data(), static_cast<std::streamsize>(line.size()));
+}
+
+
+bool Logger::start_async(size_t slots)
+{
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.async_mutex);
+    if (s.consumer.joinable()) return false;
+
+    size_t capacity = 2;
+    while (capacity < slots) capacity <<= 1;
+
+    s.slots.reset(new Slot[capacity]);
+    for (size_t i = 0; i < capacity; i++) s.slots[i].sequence.store(i, std::memory_order_relaxed);
+    s.mask = capacity - 1;
+    s.enqueue_pos.store(0);
+    s.dequeue_pos.store(0);
+    s.stopping.store(false);
+    s.sleeping.store(false);
+
+    s.consumer = std::thread([&s]() { s.run(); });
+    s.async.store(true);
+
+    return true;
+}
+
+
+void Logger::stop_async()
+{
+    state().stop();
+}
+
+
+bool Logger::is_async()
+{
+    return state().async.load();
+}
+
+
+void Logger::flush()
+{
+    State& s = state();
+
+    s.writers.fetch_add(1);
+    if (s.async.load())
+    {
+        size_t target = s.enqueue_pos.load();
+        {
+            std::lock_guard<std::mutex> lock(s.wake_mutex);
+            s.wake.notify_one();
+        }
+        while (s.dequeue_pos.load(std::memory_order_acquire) < target)
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    s.writers.fetch_sub(1);
+}
+
+
+void Logger::write(LogLevel level, const std::string &message)
+{
+    if (!is_enabled(level)) return;
+
+    State& s = state();
+
+    s.writers.fetch_add(1);
+    if (s.async.load())
+    {
+        if (!s.push(level, message)) s.dropped.fetch_add(1, std::memory_order_relaxed);
+        s.writers.fetch_sub(1);
+        return;
+    }
+    s.writers.fetch_sub(1);
+
+    s.deliver(level, message.data(), message.size());
+}
+
+
+LoggerMetrics Logger::get_metrics()
+{
+    State& s = state();
+
+    LoggerMetrics metrics;
+    metrics.messages = s.messages.load(std::memory_order_relaxed);
+    metrics.dropped = s.dropped.load(std::memory_order_relaxed);
+    metrics.truncated = s.truncated.load(std::memory_order_relaxed);
+    return metrics;
+}
+
+
+const char *Logger::level_name(LogLevel level)
+{
+    switch (level)
+    {
+    case LogLevel::Trace: return "trace";
+    case LogLevel::Debug: return "debug";
+    case LogLevel::Info: return "info";
+    case LogLevel::Warning: return "warning";
+    case LogLevel::Error: return "error";
+    case LogLevel::Off: break;
+    }
+    return "off";
+}
@@ -0,0 +1,112 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <cstddef>
+#include <sstream>
+#include <string>
+
+#include "SqliteWrap_global.h"
+
+enum class LogLevel
+{
+    Trace = 0,
+    Debug = 1,
+    Info = 2,
+    Warning = 3,
+    Error = 4,
+    Off = 5
+};
+
+// Levels below this one are removed at compile time, their arguments never evaluated.
+// e.g. -DSQLITEWRAP_LOG_MIN_LEVEL=4 in release builds : only errors remain
+#ifndef SQLITEWRAP_LOG_MIN_LEVEL
+#define SQLITEWRAP_LOG_MIN_LEVEL 0
+#endif
+
+// message : the text of one line, without the end of line
+typedef void (*LogSinkCallback)(void* user_param, LogLevel level, const char* message, size_t size);
+
+struct LoggerMetrics
+{
+    unsigned long long messages = 0;     // given to the sink
+    unsigned long long dropped = 0;      // ring buffer full
+    unsigned long long truncated = 0;    // longer than a slot
+};
+
+// Leveled logging of the library, silent by default (level Off) : nothing is formatted
+// below the runtime level, nothing is compiled below SQLITEWRAP_LOG_MIN_LEVEL.
+//
+//     Logger::set_sink(nullptr, Logger::console_sink);      // the default sink, std::cerr
+//     Logger::set_level(LogLevel::Warning);
+//     Logger::start_async();                                 // optional
+//     ...
+//     Logger::stop_async();                                  // drains the ring buffer
+//
+// Synchronous mode calls the sink on the calling thread, under a mutex. Asynchronous
+// mode copies the line into a slot of a bounded lock-free ring buffer (multi-producer,
+// single consumer) drained by a background thread : the calling thread never waits on
+// the sink. When the ring buffer is full the line is dropped and counted, lines longer
+// than a slot are truncated.
+//
+// The sink is called from one thread at a time, never concurrently.
+class SQLITEWRAP_EXPORT Logger
+{
+public:
+    static void set_level(LogLevel level);
+    static LogLevel get_level();
+    static bool is_enabled(LogLevel level);
+
+    // nullptr : no sink, messages are discarded
+    static void set_sink(void* user_param, LogSinkCallback callback);
+    static void console_sink(void* user_param, LogLevel level, const char* message, size_t size);
+
+    // slots : rounded up to a power of 2
+    static bool start_async(size_t slots = 4096);
+    static void stop_async();
+    static bool is_async();
+    static void flush();                 // waits until the ring buffer is empty
+
+    static void write(LogLevel level, const std::string& message);
+
+    static LoggerMetrics get_metrics();
+    static const char* level_name(LogLevel level);
+};
+
+// One log line : formatted on the stack, written on destruction
+class SQLITEWRAP_EXPORT LogLine
+{
+public:
+    explicit LogLine(LogLevel level) : _level(level) {}
+    ~LogLine() { Logger::write(_level, _stream.str()); }
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    template <typename T>
+    LogLine& operator<<(const T& value)
+    {
+        _stream << value;
+        return *this;
+    }
+
+private:
+    LogLevel _level;
+    std::ostringstream _stream;
+};
+
+#define SQLITEWRAP_LOG(level, message)                                                  \
+    do                                                                                  \
+    {                                                                                   \
+        if constexpr (static_cast<int>(level) >= SQLITEWRAP_LOG_MIN_LEVEL)              \
+        {                                                                               \
+            if (Logger::is_enabled(level)) LogLine(level) << message;                   \
+        }                                                                               \
+    } while (false)
+
+#define SQLITEWRAP_LOG_TRACE(message) SQLITEWRAP_LOG(LogLevel::Trace, message)
+#define SQLITEWRAP_LOG_DEBUG(message) SQLITEWRAP_LOG(LogLevel::Debug, message)
+#define SQLITEWRAP_LOG_INFO(message) SQLITEWRAP_LOG(LogLevel::Info, message)
+#define SQLITEWRAP_LOG_WARNING(message) SQLITEWRAP_LOG(LogLevel::Warning, message)
+#define SQLITEWRAP_LOG_ERROR(message) SQLITEWRAP_LOG(LogLevel::Error, message)
+
+#endif // LOGGER_H
@@ -0,0 +1,740 @@
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "ndjson.h"
+#include "logger.h"
+#include "outputsink.h"
+#include "schemacache.h"
+
+
+namespace
+{
+    const char hex_digits[] = "0123456789abcdef";
+    const char base64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    // JSON escape of each byte : 0 copied as is, 'u' written \u00XX, else written \<code>
+    const std::array<char, 256> escape_codes = []
+    {
+        std::array<char, 256> codes {};
+        for (int c = 0; c < 0x20; c++) codes[c] = 'u';
+        codes['"'] = '"';
+        codes['\\'] = '\\';
+        codes['\b'] = 'b';
+        codes['\f'] = 'f';
+        codes['\n'] = 'n';
+        codes['\r'] = 'r';
+        codes['\t'] = 't';
+        return codes;
+    }();
+
+    // value of each base64 character, -1 for any other byte
+    const std::array<signed char, 256> base64_values = []
+    {
+        std::array<signed char, 256> values {};
+        values.fill(-1);
+        for (int i = 0; i < 64; i++) values[static_cast<unsigned char>(base64_alphabet[i])] = static_cast<signed char>(i);
+        return values;
+    }();
+
+
+    // ---- encoder : everything is written in place in the sink buffer
+
+    bool write_string(OutputSink& sink, const char* text, size_t size)
+    {
+        if (!sink.append('"')) return false;
+
+        // runs of plain bytes are copied in one piece, UTF-8 sequences included
+        size_t start = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            char code = escape_codes[c];
+            if (!code) continue;
+
+            if (i > start && !sink.append(text + start, i - start)) return false;
+            start = i + 1;
+
+            char* out = sink.reserve(6);
+            if (!out) return false;
+            out[0] = '\\';
+            if (code == 'u')
+            {
+                out[1] = 'u';
+                out[2] = '0';
+                out[3] = '0';
+                out[4] = hex_digits[c >> 4];
+                out[5] = hex_digits[c & 15];
+                sink.commit(6);
+            }
+            else
+            {
+                out[1] = code;
+                sink.commit(2);
+            }
+        }
+
+        if (size > start && !sink.append(text + start, size - start)) return false;
+        return sink.append('"');
+    }
+
+    bool write_base64(OutputSink& sink, const unsigned char* data, size_t size)
+    {
+        if (!sink.append('"')) return false;
+
+        constexpr size_t chunk = 3 * 4096;
+        while (size > 0)
+        {
+            size_t n = size < chunk ? size : chunk;
+            char* out = sink.reserve((n + 2) / 3 * 4);
+            if (!out) return false;
+
+            char* begin = out;
+            size_t i = 0;
+            for (; i + 3 <= n; i += 3)
+            {
+                unsigned int triple = (unsigned(data[i]) << 16) | (unsigned(data[i + 1]) << 8) | data[i + 2];
+                *out++ = base64_alphabet[triple >> 18];
+                *out++ = base64_alphabet[(triple >> 12) & 63];
+                *out++ = base64_alphabet[(triple >> 6) & 63];
+                *out++ = base64_alphabet[triple & 63];
+            }
+            if (i < n)
+            {
+                unsigned int triple = unsigned(data[i]) << 16;
+                if (i + 1 < n) triple |= unsigned(data[i + 1]) << 8;
+                *out++ = base64_alphabet[triple >> 18];
+                *out++ = base64_alphabet[(triple >> 12) & 63];
+                *out++ = i + 1 < n ? base64_alphabet[(triple >> 6) & 63] : '=';
+                *out++ = '=';
+            }
+
+            sink.commit(static_cast<size_t>(out - begin));
+            data += n;
+            size -= n;
+        }
+
+        return sink.append('"');
+    }
+
+    template <typename T>
+    bool write_number(OutputSink& sink, T value)
+    {
+        constexpr size_t room = 32;
+        char* out = sink.reserve(room);
+        if (!out) return false;
+
+        auto result = std::to_chars(out, out + room, value);
+        sink.commit(static_cast<size_t>(result.ptr - out));
+        return true;
+    }
+
+    // "name": with its separator, encoded once per export
+    std::string encode_key(const char* name, bool first)
+    {
+        std::string key = first ? "{\"" : ",\"";
+        for (const char* p = name; *p; p++)
+        {
+            unsigned char c = static_cast<unsigned char>(*p);
+            char code = escape_codes[c];
+            if (!code) key += *p;
+            else if (code == 'u') key += std::string("\\u00") + hex_digits[c >> 4] + hex_digits[c & 15];
+            else key += std::string("\\") + code;
+        }
+        return key + "\":";
+    }
+
+
+    // ---- scanner
+
+    enum class LineResult { Inserted, Restart, Skipped, Failed };
+
+    struct Importer
+    {
+        Importer(BulkInsert& insert, const std::string& table, const BulkInsertOptions& options)
+            : insert(insert), table(table), options(options) {}
+
+        BulkInsert& insert;
+        std::string table;
+        BulkInsertOptions options;
+
+        std::vector<std::string> columns;              // table columns
+        std::vector<bool> blob_columns;                // declared BLOB : strings are base64
+        std::vector<int> positions;                    // statement position per table column, -1 if not bound
+        std::vector<int> statement_columns;            // table column per statement position
+
+        std::vector<std::pair<std::string, int>> keys; // key -> table column (-1 : not a column), in order of appearance
+        size_t expected_key = 0;                       // rows usually repeat the key order of the previous one
+
+        std::vector<std::string> text_scratch;         // unescaped strings, per statement position
+        std::vector<std::vector<unsigned char>> blob_scratch;
+        std::string key_scratch;
+
+        size_t line_number = 0;
+        std::string error;
+    };
+
+    inline const char* skip_space(const char* p, const char* end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+        return p;
+    }
+
+    // p on the opening quote; sets [start, start + size) and escaped, returns past the closing quote
+    const char* scan_string(const char* p, const char* end, const char*& start, size_t& size, bool& escaped)
+    {
+        start = ++p;
+        const char* quote = static_cast<const char*>(std::memchr(p, '"', static_cast<size_t>(end - p)));
+        if (!quote) return nullptr;
+
+        escaped = std::memchr(p, '\\', static_cast<size_t>(quote - p)) != nullptr;
+        if (!escaped)
+        {
+            size = static_cast<size_t>(quote - p);
+            return quote + 1;
+        }
+
+        for (; p < end; p++)
+        {
+            if (*p == '\\') p++;
+            else if (*p == '"')
+            {
+                size = static_cast<size_t>(p - start);
+                return p + 1;
+            }
+        }
+        return nullptr;
+    }
+
+    void append_utf8(std::string& out, unsigned long code)
+    {
+        if (code < 0x80) out += static_cast<char>(code);
+        else if (code < 0x800)
+        {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000)
+        {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        else
+        {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+    bool read_hex4(const char* p, const char* end, unsigned long& code)
+    {
+        if (end - p < 4) return false;
+        auto result = std::from_chars(p, p + 4, code, 16);
+        return result.ec == std::errc() && result.ptr == p + 4;
+    }
+
+    bool unescape(const char* p, size_t size, std::string& out)
+    {
+        const char* end = p + size;
+        out.clear();
+
+        while (p < end)
+        {
+            const char* backslash = static_cast<const char*>(std::memchr(p, '\\', static_cast<size_t>(end - p)));
+            if (!backslash)
+            {
+                out.append(p, static_cast<size_t>(end - p));
+                break;
+            }
+
+            out.append(p, static_cast<size_t>(backslash - p));
+            p = backslash + 1;
+            if (p >= end) return false;
+
+            switch (*p++)
+            {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u':
+            {
+                unsigned long code;
+                if (!read_hex4(p, end, code)) return false;
+                p += 4;
+
+                // surrogate pair
+                unsigned long low;
+                if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u' &&
+                    read_hex4(p + 2, end, low) && low >= 0xDC00 && low < 0xE000)
+                {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+                append_utf8(out, code);
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool decode_base64(const char* p, size_t size, std::vector<unsigned char>& out)
+    {
+        out.clear();
+        out.reserve(size / 4 * 3);
+
+        unsigned int bits = 0;
+        int count = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            if (p[i] == '=') break;
+            int value = base64_values[static_cast<unsigned char>(p[i])];
+            if (value < 0) return false;
+
+            bits = (bits << 6) | static_cast<unsigned int>(value);
+            if (++count == 4)
+            {
+                out.push_back(static_cast<unsigned char>(bits >> 16));
+                out.push_back(static_cast<unsigned char>(bits >> 8));
+                out.push_back(static_cast<unsigned char>(bits));
+                bits = 0;
+                count = 0;
+            }
+        }
+
+        if (count == 1) return false;
+        if (count >= 2) out.push_back(static_cast<unsigned char>(bits >> (count == 2 ? 4 : 10)));
+        if (count == 3) out.push_back(static_cast<unsigned char>(bits >> 2));
+
+        return true;
+    }
+
+    // end of an object or array starting at p, strings skipped
+    const char* skip_nested(const char* p, const char* end)
+    {
+        int depth = 0;
+        for (; p < end; p++)
+        {
+            if (*p == '"')
+            {
+                const char* start;
+                size_t size;
+                bool escaped;
+                p = scan_string(p, end, start, size, escaped);
+                if (!p) return nullptr;
+                p--;
+            }
+            else if (*p == '{' || *p == '[') depth++;
+            else if ((*p == '}' || *p == ']') && --depth == 0) return p + 1;
+        }
+        return nullptr;
+    }
+
+    bool is_number_char(char c)
+    {
+        return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+    }
+
+    // table column of a key, added to the key cache the first time
+    int resolve_key(Importer& importer, const char* key, size_t size)
+    {
+        auto& keys = importer.keys;
+        auto same = [&](const std::string& known) { return known.size() == size && std::memcmp(known.data(), key, size) == 0; };
+
+        if (importer.expected_key < keys.size() && same(keys[importer.expected_key].first))
+            return keys[importer.expected_key++].second;
+
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            if (same(keys[i].first))
+            {
+                importer.expected_key = i + 1;
+                return keys[i].second;
+            }
+        }
+
+        int column = -1;
+        for (size_t i = 0; i < importer.columns.size(); i++)
+        {
+            if (importer.columns[i].size() == size && sqlite3_strnicmp(importer.columns[i].data(), key, static_cast<int>(size)) == 0)
+            {
+                column = static_cast<int>(i);
+                break;
+            }
+        }
+
+        keys.emplace_back(std::string(key, size), column);
+        importer.expected_key = keys.size();
+        return column;
+    }
+
+    LineResult fail(Importer& importer, const std::string& message)
+    {
+        importer.error = "Line " + std::to_string(importer.line_number) + ": " + message;
+        return LineResult::Failed;
+    }
+
+    LineResult import_line(Importer& importer, const char* p, const char* end)
+    {
+        BulkInsert& insert = importer.insert;
+
+        p = skip_space(p, end);
+        if (p == end) return LineResult::Skipped;
+        if (*p != '{') return fail(importer, "object expected.");
+        p = skip_space(p + 1, end);
+
+        importer.expected_key = 0;
+        bool missing_columns = false;
+        bool active = insert.is_active();
+
+        while (p < end && *p != '}')
+        {
+            // key
+            if (*p != '"') return fail(importer, "key expected.");
+            const char* key;
+            size_t key_size;
+            bool escaped;
+            p = scan_string(p, end, key, key_size, escaped);
+            if (!p) return fail(importer, "unterminated key.");
+            if (escaped)
+            {
+                if (!unescape(key, key_size, importer.key_scratch)) return fail(importer, "invalid escape in key.");
+                key = importer.key_scratch.data();
+                key_size = importer.key_scratch.size();
+            }
+
+            p = skip_space(p, end);
+            if (p == end || *p != ':') return fail(importer, "':' expected.");
+            p = skip_space(p + 1, end);
+            if (p == end) return fail(importer, "value expected.");
+
+            int column = resolve_key(importer, key, key_size);
+            int position = column < 0 ? -1 : importer.positions[column];
+            if (column >= 0 && position < 0)
+            {
+                // a column seen for the first time : the statement is rebuilt, then the line parsed again
+                importer.positions[column] = static_cast<int>(importer.statement_columns.size());
+                importer.statement_columns.push_back(column);
+                missing_columns = true;
+            }
+            bool bind = active && position >= 0 && !missing_columns;
+
+            // value
+            char c = *p;
+            if (c == '"')
+            {
+                const char* text;
+                size_t size;
+                p = scan_string(p, end, text, size, escaped);
+                if (!p) return fail(importer, "unterminated string.");
+
+                if (bind)
+                {
+                    if (escaped)
+                    {
+                        std::string& scratch = importer.text_scratch[position];
+                        if (!unescape(text, size, scratch)) return fail(importer, "invalid escape.");
+                        text = scratch.data();
+                        size = scratch.size();
+                    }
+
+                    if (importer.blob_columns[column])
+                    {
+                        std::vector<unsigned char>& blob = importer.blob_scratch[position];
+                        if (!decode_base64(text, size, blob)) return fail(importer, "invalid base64 for column " + importer.columns[column] + ".");
+                        insert.bind_blob(position, blob.data(), blob.size());
+                    }
+                    else insert.bind_text(position, text, size);
+                }
+            }
+            else if (c == '-' || (c >= '0' && c <= '9'))
+            {
+                const char* start = p;
+                bool integer = true;
+                while (p < end && is_number_char(*p))
+                {
+                    if (*p == '.' || *p == 'e' || *p == 'E') integer = false;
+                    p++;
+                }
+
+                if (bind)
+                {
+                    sqlite3_int64 value;
+                    auto result = std::from_chars(start, p, value);
+                    if (integer && result.ec == std::errc() && result.ptr == p) insert.bind_int64(position, value);
+                    else
+                    {
+                        double real;
+                        auto real_result = std::from_chars(start, p, real);
+                        if (real_result.ec != std::errc() || real_result.ptr != p) return fail(importer, "invalid number.");
+                        insert.bind_double(position, real);
+                    }
+                }
+            }
+            else if (c == '{' || c == '[')
+            {
+                const char* start = p;
+                p = skip_nested(p, end);
+                if (!p) return fail(importer, "unterminated object or array.");
+                if (bind) insert.bind_text(position, start, static_cast<size_t>(p - start));
+            }
+            else if (end - p >= 4 && std::memcmp(p, "true", 4) == 0)
+            {
+                if (bind) insert.bind_int64(position, 1);
+                p += 4;
+            }
+            else if (end - p >= 5 && std::memcmp(p, "false", 5) == 0)
+            {
+                if (bind) insert.bind_int64(position, 0);
+                p += 5;
+            }
+            else if (end - p >= 4 && std::memcmp(p, "null", 4) == 0)
+            {
+                p += 4;
+            }
+            else return fail(importer, "invalid value.");
+
+            p = skip_space(p, end);
+            if (p < end && *p == ',')
+            {
+                p = skip_space(p + 1, end);
+                if (p == end || *p != '"') return fail(importer, "key expected.");
+            }
+            else if (p == end || *p != '}') return fail(importer, "',' or '}' expected.");
+        }
+
+        if (p == end) return fail(importer, "unterminated object.");
+        if (skip_space(p + 1, end) != end) return fail(importer, "unexpected data after object.");
+
+        if (missing_columns)
+        {
+            std::vector<std::string> names;
+            for (int column : importer.statement_columns) names.push_back(importer.columns[column]);
+
+            importer.text_scratch.resize(names.size());
+            importer.blob_scratch.resize(names.size());
+
+            bool ok = active ? insert.set_columns(names) : insert.begin(importer.table, names, importer.options);
+            if (!ok) return fail(importer, insert.get_last_error());
+
+            return LineResult::Restart;
+        }
+
+        if (!active) return fail(importer, "no column of table " + importer.table + ".");
+
+        if (!insert.insert_row()) return fail(importer, insert.get_last_error());
+
+        return LineResult::Inserted;
+    }
+}
+
+
+bool NdJson::export_ndjson(SqliteWrap &db, const std::string &sql, const std::vector<SqlValue> &params, OutputSink &sink, sqlite3_int64 *rows)
+{
+    sqlite3* handle = db.get_handle();
+    if (!handle)
+    {
+        SQLITEWRAP_LOG_ERROR("NdJson::export_ndjson(...) - Error: Database not connected.");
+        return false;
+    }
+
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(handle, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK || !SqliteWrap::bind_values(statement, params))
+    {
+        SQLITEWRAP_LOG_ERROR("NdJson::export_ndjson(...) - Error: " << sqlite3_errmsg(handle));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    int column_count = sqlite3_column_count(statement);
+    std::vector<std::string> keys;
+    for (int i = 0; i < column_count; i++) keys.push_back(encode_key(sqlite3_column_name(statement, i), i == 0));
+
+    sqlite3_int64 count = 0;
+    bool ok = true;
+
+    int rc;
+    while (ok && (rc = sqlite3_step(statement)) == SQLITE_ROW)
+    {
+        if (column_count == 0) ok = sink.append("{", 1);
+
+        for (int i = 0; ok && i < column_count; i++)
+        {
+            ok = sink.append(keys[i].data(), keys[i].size());
+            if (!ok) break;
+
+            switch (sqlite3_column_type(statement, i))
+            {
+            case SQLITE_INTEGER:
+                ok = write_number(sink, static_cast<long long>(sqlite3_column_int64(statement, i)));
+                break;
+            case SQLITE_FLOAT:
+            {
+                double value = sqlite3_column_double(statement, i);
+                ok = std::isfinite(value) ? write_number(sink, value) : sink.append("null", 4);
+                break;
+            }
+            case SQLITE_TEXT:
+            {
+                const char* text = reinterpret_cast<const char*>(sqlite3_column_text(statement, i));
+                ok = write_string(sink, text, static_cast<size_t>(sqlite3_column_bytes(statement, i)));
+                break;
+            }
+            case SQLITE_BLOB:
+            {
+                const unsigned char* data = static_cast<const unsigned char*>(sqlite3_column_blob(statement, i));
+                ok = write_base64(sink, data, static_cast<size_t>(sqlite3_column_bytes(statement, i)));
+                break;
+            }
+            default:
+                ok = sink.append("null", 4);
+                break;
+            }
+        }
+
+        if (ok) ok = sink.append("}\n", 2);
+        if (ok) count++;
+    }
+
+    if (rows) *rows = count;
+
+    if (!ok)
+    {
+        SQLITEWRAP_LOG_ERROR("NdJson::export_ndjson(...) - Error: " << sink.get_last_error());
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    if (rc != SQLITE_DONE)
+    {
+        SQLITEWRAP_LOG_ERROR("NdJson::export_ndjson(...) - Error: " << sqlite3_errmsg(handle));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    sqlite3_finalize(statement);
+
+    return true;
+}
+
+
+bool NdJson::import_ndjson(SqliteWrap &db, const std::string &path, const std::string &table, const BulkInsertOptions &options, sqlite3_int64 *rows)
+{
+    if (rows) *rows = 0;
+
+    if (!db.get_handle())
+    {
+        SQLITEWRAP_LOG_ERROR("NdJson::import_ndjson(...) - Error: Database not connected.");
+        return false;
+    }
+
+    const TableInfo* info = db.get_schema_cache()->find_table(table);
+    if (!info || info->type != "table")
+    {
+        SQLITEWRAP_LOG_ERROR("NdJson::import_ndjson(...) - Error: No such table: " << table);
+        return false;
+    }
+
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        SQLITEWRAP_LOG_ERROR("NdJson::import_ndjson(...) - Error: Cannot open " << path << ": " << std::strerror(errno));
+        return false;
+    }
+
+    BulkInsert insert(db);
+    Importer importer(insert, info->name, options);
+
+    // generated columns cannot be inserted
+    for (const ColumnInfo& column : info->columns)
+    {
+        if (column.hidden != 0) continue;
+
+        std::string type = column.declared_type;
+        for (char& c : type) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+
+        importer.columns.push_back(column.name);
+        importer.blob_columns.push_back(type.find("BLOB") != std::string::npos);
+    }
+    importer.positions.assign(importer.columns.size(), -1);
+
+    std::vector<char> buffer(4 << 20);
+    size_t filled = 0;
+    bool eof = false;
+    bool ok = true;
+
+    while (ok && !eof)
+    {
+        size_t read = std::fread(buffer.data() + filled, 1, buffer.size() - filled, file);
+        if (read < buffer.size() - filled)
+        {
+            if (std::ferror(file))
+            {
+                importer.error = std::strerror(errno);
+                ok = false;
+                break;
+            }
+            eof = true;
+        }
+        filled += read;
+
+        // complete lines, the last one too at the end of the file
+        const char* data = buffer.data();
+        const char* end = data + filled;
+        const char* line = data;
+
+        while (ok)
+        {
+            const char* newline = static_cast<const char*>(std::memchr(line, '\n', static_cast<size_t>(end - line)));
+            if (!newline && !eof) break;
+            const char* line_end = newline ? newline : end;
+
+            importer.line_number++;
+            LineResult result = import_line(importer, line, line_end);
+            if (result == LineResult::Restart) result = import_line(importer, line, line_end);
+            ok = result != LineResult::Failed;
+
+            if (!newline) break;
+            line = newline + 1;
+        }
+
+        // the incomplete last line moves to the front; a line longer than the buffer grows it
+        size_t rest = static_cast<size_t>(end - line);
+        if (!eof)
+        {
+            if (rest == buffer.size()) buffer.resize(buffer.size() * 2);
+            else std::memmove(buffer.data(), line, rest);
+            filled = rest;
+        }
+    }
+
+    std::fclose(file);
+
+    if (!ok)
+    {
+        SQLITEWRAP_LOG_ERROR("NdJson::import_ndjson(...) - Error: " << importer.error);
+        if (insert.is_active()) insert.abort();
+        return false;
+    }
+
+    if (insert.is_active() && !insert.finish()) return false;
+
+    if (rows) *rows = insert.get_row_count();
+
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef NDJSON_H
+#define NDJSON_H
+
+#include <string>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "bulkinsert.h"
+#include "sqlitewrap.h"
+
+class OutputSink;
+
+// Newline-delimited JSON : one object per row, keys are the column names.
+//
+// Export : INTEGER and REAL as JSON numbers (shortest round-trip form, NaN / infinity
+// as null), TEXT as strings, BLOB as base64 strings, NULL as null. Rows are encoded
+// directly into the sink buffer, nothing is allocated per row.
+//
+//     OutputSink sink;
+//     sink.open("person.ndjson");
+//     NdJson::export_ndjson(db, "SELECT * FROM person WHERE age > ?;", { sqlite3_int64(30) }, sink);
+//     sink.close();
+//
+// Import : values are bound to a BulkInsert statement, strings without escapes straight
+// from the read buffer. Strings going to a column declared BLOB are base64-decoded;
+// true / false become 1 / 0, nested objects and arrays are stored as JSON text. Keys
+// that are not columns of the table are ignored, missing keys are NULL.
+class SQLITEWRAP_EXPORT NdJson
+{
+public:
+    static bool export_ndjson(SqliteWrap& db, const std::string& sql, const std::vector<SqlValue>& params, OutputSink& sink,
+                              sqlite3_int64* rows = nullptr);
+
+    static bool import_ndjson(SqliteWrap& db, const std::string& path, const std::string& table,
+                              const BulkInsertOptions& options = BulkInsertOptions(), sqlite3_int64* rows = nullptr);
+};
+
+#endif // NDJSON_H
@@ -0,0 +1,239 @@
+#include <cerrno>
+#include <cstring>
+
+#include "outputsink.h"
+#include "logger.h"
+
+
+OutputSink::OutputSink(size_t buffer_size)
+    : _buffer(new char[buffer_size < 4096 ? 4096 : buffer_size]), _buffer_size(buffer_size < 4096 ? 4096 : buffer_size)
+{
+}
+
+
+OutputSink::~OutputSink()
+{
+    close();
+    delete[] _buffer;
+    delete[] _spare;
+}
+
+
+bool OutputSink::open(const std::string &path, bool background_writer)
+{
+    close();
+
+    _bytes_written = 0;
+    _failed = false;
+    _last_error.clear();
+
+    _file = std::fopen(path.c_str(), "wb");
+    if (!_file) return fail("open", "Cannot open " + path + ": " + std::strerror(errno));
+
+    // the sink buffer is the only buffer
+    std::setvbuf(_file, nullptr, _IONBF, 0);
+
+    start_writer(background_writer);
+    return true;
+}
+
+
+bool OutputSink::open(void *user_param, SinkWriteCallback callback, bool background_writer)
+{
+    close();
+
+    _bytes_written = 0;
+    _failed = false;
+    _last_error.clear();
+
+    _user_param = user_param;
+    _callback = callback;
+
+    start_writer(background_writer);
+    return true;
+}
+
+
+bool OutputSink::close()
+{
+    if (!is_open()) return !_failed;
+
+    bool ok = flush();
+    stop_writer();
+    ok = ok && !_failed;
+
+    if (_file && std::fclose(_file) != 0 && ok) ok = fail("close", std::strerror(errno));
+
+    _file = nullptr;
+    _user_param = nullptr;
+    _callback = nullptr;
+    _used = 0;
+
+    return ok;
+}
+
+
+bool OutputSink::append(const char *data, size_t size)
+{
+    if (_buffer_size - _used >= size)
+    {
+        std::memcpy(_buffer + _used, data, size);
+        _used += size;
+        return true;
+    }
+
+    // larger than the free room : complete the buffer, then write big pieces directly
+    // (through the buffers when a writer thread owns the file)
+    size_t head = _buffer_size - _used;
+    std::memcpy(_buffer + _used, data, head);
+    _used += head;
+    if (!hand_off()) return false;
+
+    data += head;
+    size -= head;
+    if (size >= _buffer_size && !_writer.joinable()) return write(data, size);
+
+    while (size >= _buffer_size)
+    {
+        std::memcpy(_buffer, data, _buffer_size);
+        _used = _buffer_size;
+        if (!hand_off()) return false;
+        data += _buffer_size;
+        size -= _buffer_size;
+    }
+
+    std::memcpy(_buffer, data, size);
+    _used = size;
+    return true;
+}
+
+
+bool OutputSink::flush()
+{
+    if (!hand_off()) return false;
+    if (!_writer.joinable()) return true;
+
+    // written, not only handed to the writer : the counters and the error are settled
+    std::unique_lock<std::mutex> lock(_mutex);
+    _signal.wait(lock, [this] { return _pending == nullptr; });
+
+    return !_failed;
+}
+
+
+bool OutputSink::hand_off()
+{
+    if (!_writer.joinable())
+    {
+        if (_failed) return false;
+        if (_used == 0) return true;
+
+        bool ok = write(_buffer, _used);
+        _used = 0;
+        return ok;
+    }
+
+    if (_used == 0) return true;         // an error of the writer is seen under the lock, by flush()
+
+    // hand the full buffer to the writer once it is done with the previous one
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _signal.wait(lock, [this] { return _pending == nullptr; });
+        if (_failed) return false;
+
+        _pending = _buffer;
+        _pending_size = _used;
+        std::swap(_buffer, _spare);
+    }
+    _signal.notify_all();
+
+    _used = 0;
+    return true;
+}
+
+
+void OutputSink::start_writer(bool background_writer)
+{
+    if (!background_writer) return;
+
+    if (!_spare) _spare = new char[_buffer_size];
+    _pending = nullptr;
+    _stop = false;
+    _writer = std::thread(&OutputSink::write_loop, this);
+}
+
+
+void OutputSink::stop_writer()
+{
+    if (!_writer.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _signal.notify_all();
+    _writer.join();
+}
+
+
+void OutputSink::write_loop()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;)
+    {
+        _signal.wait(lock, [this] { return _pending != nullptr || _stop; });
+        if (!_pending) return;
+
+        const char* data = _pending;
+        size_t size = _pending_size;
+
+        lock.unlock();
+        write(data, size);
+        lock.lock();
+
+        _pending = nullptr;
+        _signal.notify_all();
+    }
+}
+
+
+bool OutputSink::make_room(size_t size)
+{
+    if (size > _buffer_size) return fail("reserve", "Reserved size larger than the buffer.");
+
+    return hand_off();
+}
+
+
+bool OutputSink::write(const char *data, size_t size)
+{
+    if (_failed) return false;
+
+    if (_file)
+    {
+        if (std::fwrite(data, 1, size, _file) != size) return fail("write", std::strerror(errno));
+    }
+    else if (_callback)
+    {
+        if (!_callback(_user_param, data, size))
+        {
+            _last_error = "Stopped by the write callback.";
+            _failed = true;
+            return false;
+        }
+    }
+    else return fail("write", "Sink not open.");
+
+    _bytes_written += size;
+    return true;
+}
+
+
+bool OutputSink::fail(const char *function, const std::string &message)
+{
+    _last_error = message;
+    _failed = true;
+    SQLITEWRAP_LOG_ERROR("OutputSink::" << function << "(...) - Error: " << message);
+    return false;
+}
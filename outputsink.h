@@ -0,0 +1,96 @@
+#ifndef OUTPUTSINK_H
+#define OUTPUTSINK_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "SqliteWrap_global.h"
+
+// Called with every full buffer; return false to stop the export.
+using SinkWriteCallback = bool (*)(void* user_param, const char* data, size_t size);
+
+// Large output buffer of the exporters, flushed to a file or a callback in big writes.
+// Formatters write in place : reserve() room for a few bytes, fill it, commit() what
+// was used. Errors are sticky : once a write failed every call returns false.
+//
+// With a background writer, a full buffer is handed to a writer thread and formatting
+// goes on in a second buffer : formatting and I/O overlap. The callback is then called
+// from the writer thread.
+class SQLITEWRAP_EXPORT OutputSink
+{
+public:
+    explicit OutputSink(size_t buffer_size = default_buffer_size);
+    ~OutputSink();
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    bool open(const std::string& path, bool background_writer = false);    // truncates the file
+    bool open(void* user_param, SinkWriteCallback callback, bool background_writer = false);
+    bool close();                                           // flushes, then closes the file
+    bool is_open() const { return _file || _callback; }
+
+    // nullptr on error; size must not exceed the buffer size
+    char* reserve(size_t size)
+    {
+        if (_buffer_size - _used < size && !make_room(size)) return nullptr;
+        return _buffer + _used;
+    }
+    void commit(size_t size) { _used += size; }
+
+    bool append(const char* data, size_t size);
+    bool append(char c)
+    {
+        char* out = reserve(1);
+        if (!out) return false;
+        *out = c;
+        _used++;
+        return true;
+    }
+
+    bool flush();                                           // returns once the data is written
+
+    static constexpr size_t default_buffer_size = 1 << 20;
+
+private:
+    char* _buffer = nullptr;
+    size_t _buffer_size = 0;
+    size_t _used = 0;
+
+    std::FILE* _file = nullptr;
+    void* _user_param = nullptr;
+    SinkWriteCallback _callback = nullptr;
+
+    // background writer : _pending is written while _buffer fills, then they swap
+    char* _spare = nullptr;
+    const char* _pending = nullptr;
+    size_t _pending_size = 0;
+    bool _stop = false;
+    std::thread _writer;
+    std::mutex _mutex;
+    std::condition_variable _signal;
+
+    unsigned long long _bytes_written = 0;
+    bool _failed = false;
+    std::string _last_error;
+
+    void start_writer(bool background_writer);
+    void stop_writer();
+    void write_loop();
+    bool make_room(size_t size);
+    bool hand_off();                                        // to the writer thread, or written
+    bool write(const char* data, size_t size);
+    bool fail(const char* function, const std::string& message);
+
+public:
+    // getter : when writing in the background, valid after flush() or close()
+    const std::string& get_last_error() const { return _last_error; }
+    unsigned long long get_bytes_written() const { return _bytes_written; }
+    bool failed() const { return _failed; }
+};
+
+#endif // OUTPUTSINK_H
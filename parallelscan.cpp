@@ -0,0 +1,464 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "parallelscan.h"
+#include "logger.h"
+#include "schemacache.h"
+#include "sqlitearray.h"
+
+
+struct ParallelScan::Session
+{
+    std::vector<ScanRange> ranges;
+    std::string sql;                     // range query, range bounds after the condition parameters
+    size_t readers = 0;                  // readers in the read transaction
+    sqlite3_snapshot* snapshot = nullptr;
+};
+
+
+namespace
+{
+    // one range on a prepared range query; row(values, column_count) returns false to stop
+    template <typename Row>
+    bool scan_range(sqlite3_stmt* statement, int bound_index, const ScanRange& range, std::vector<char*>& values, Row&& row, bool& stopped)
+    {
+        sqlite3_reset(statement);
+        sqlite3_bind_int64(statement, bound_index, range.first);
+        sqlite3_bind_int64(statement, bound_index + 1, range.last);
+
+        int column_count = static_cast<int>(values.size());
+
+        int rc;
+        while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+        {
+            for (int i = 0; i < column_count; i++)
+                values[i] = reinterpret_cast<char*>(const_cast<unsigned char*>(sqlite3_column_text(statement, i)));
+
+            if (!row(values.data(), column_count))
+            {
+                stopped = true;
+                return false;
+            }
+        }
+
+        return rc == SQLITE_DONE;
+    }
+
+    // rows of a range read ahead by scan_ordered : values NUL-terminated in one arena
+    struct RangeBuffer
+    {
+        std::string arena;
+        std::vector<ptrdiff_t> offsets;  // -1 : NULL
+        bool done = false;
+        bool ok = true;
+    };
+
+    bool exec(sqlite3* db, const char* sql)
+    {
+        return sqlite3_exec(db, sql, nullptr, nullptr, nullptr) == SQLITE_OK;
+    }
+}
+
+
+ParallelScan::ParallelScan(SqliteWrap &db)
+    : _db(db)
+{
+}
+
+
+ParallelScan::~ParallelScan()
+{
+    release();
+}
+
+
+unsigned int ParallelScan::thread_count(const ParallelScanOptions &options)
+{
+    if (options.threads > 0) return options.threads;
+
+    unsigned int cores = std::thread::hardware_concurrency();
+    return cores > 0 ? cores : 1;
+}
+
+
+bool ParallelScan::split(const std::string &table, const ParallelScanOptions &options, std::vector<ScanRange> &ranges)
+{
+    ranges.clear();
+
+    Session session;
+    if (!begin(table, options, session)) return false;
+
+    ranges = session.ranges;
+    end(session);
+    return true;
+}
+
+
+bool ParallelScan::scan(const std::string &table, const ParallelScanOptions &options, void *user_param, ParallelRowCallback callback)
+{
+    Session session;
+    if (!begin(table, options, session)) return false;
+
+    std::atomic<size_t> next { 0 };
+    std::atomic<bool> stop { false };
+    std::mutex error_mutex;
+    std::string error_message;
+    bool stopped_by_callback = false;
+
+    auto worker = [&](unsigned int index)
+    {
+        sqlite3* reader = _readers[index];
+        sqlite3_stmt* statement = nullptr;
+        if (sqlite3_prepare_v2(reader, session.sql.c_str(), -1, &statement, nullptr) != SQLITE_OK
+            || !SqliteWrap::bind_values(statement, options.params))
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (error_message.empty()) error_message = sqlite3_errmsg(reader);
+            stop = true;
+            sqlite3_finalize(statement);
+            return;
+        }
+
+        std::vector<char*> values(static_cast<size_t>(sqlite3_column_count(statement)));
+        int bound_index = static_cast<int>(options.params.size()) + 1;
+        auto row = [&](char** row_values, int column_count) { return callback(user_param, index, row_values, column_count); };
+
+        size_t range;
+        while (!stop && (range = next++) < session.ranges.size())
+        {
+            bool stopped = false;
+            if (!scan_range(statement, bound_index, session.ranges[range], values, row, stopped))
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (stopped) stopped_by_callback = true;
+                else if (error_message.empty()) error_message = sqlite3_errmsg(reader);
+                stop = true;
+            }
+        }
+
+        sqlite3_finalize(statement);
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < session.readers; i++) threads.emplace_back(worker, i);
+    worker(0);
+    for (std::thread& thread : threads) thread.join();
+
+    end(session);
+
+    if (!error_message.empty()) return error("scan", error_message);
+    return !stopped_by_callback;
+}
+
+
+bool ParallelScan::scan_ordered(const std::string &table, const ParallelScanOptions &options, void *user_param, DeserializeCallback callback)
+{
+    Session session;
+    if (!begin(table, options, session)) return false;
+
+    const size_t range_count = session.ranges.size();
+    const size_t read_ahead = 2 * session.readers;
+
+    std::vector<RangeBuffer> buffers(range_count);
+    std::mutex mutex;
+    std::condition_variable signal;
+    size_t next = 0;
+    size_t delivered = 0;
+    bool stop = false;
+    std::string error_message;
+
+    auto worker = [&](unsigned int index)
+    {
+        sqlite3* reader = _readers[index];
+        sqlite3_stmt* statement = nullptr;
+        bool prepared = sqlite3_prepare_v2(reader, session.sql.c_str(), -1, &statement, nullptr) == SQLITE_OK
+                        && SqliteWrap::bind_values(statement, options.params);
+
+        std::vector<char*> values(prepared ? static_cast<size_t>(sqlite3_column_count(statement)) : 0);
+        int bound_index = static_cast<int>(options.params.size()) + 1;
+
+        for (;;)
+        {
+            size_t range;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                signal.wait(lock, [&] { return stop || next >= range_count || next < delivered + read_ahead; });
+                if (stop || next >= range_count) break;
+                range = next++;
+            }
+
+            RangeBuffer& buffer = buffers[range];
+            auto row = [&buffer](char** row_values, int column_count)
+            {
+                for (int i = 0; i < column_count; i++)
+                {
+                    if (!row_values[i])
+                    {
+                        buffer.offsets.push_back(-1);
+                        continue;
+                    }
+                    buffer.offsets.push_back(static_cast<ptrdiff_t>(buffer.arena.size()));
+                    buffer.arena.append(row_values[i]);
+                    buffer.arena.push_back('\0');
+                }
+                return true;
+            };
+
+            bool stopped = false;
+            bool ok = prepared && scan_range(statement, bound_index, session.ranges[range], values, row, stopped);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            buffer.done = true;
+            buffer.ok = ok;
+            if (!ok && error_message.empty()) error_message = sqlite3_errmsg(reader);
+            signal.notify_all();
+        }
+
+        sqlite3_finalize(statement);
+    };
+
+    int column_count = 0;
+    {
+        sqlite3_stmt* statement = nullptr;
+        if (sqlite3_prepare_v2(_readers[0], session.sql.c_str(), -1, &statement, nullptr) == SQLITE_OK)
+            column_count = sqlite3_column_count(statement);
+        sqlite3_finalize(statement);
+    }
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < session.readers; i++) threads.emplace_back(worker, i);
+
+    // the calling thread delivers the ranges in order
+    bool ok = true;
+    std::vector<char*> values(static_cast<size_t>(column_count));
+
+    for (size_t range = 0; ok && range < range_count; range++)
+    {
+        RangeBuffer buffer;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            signal.wait(lock, [&] { return buffers[range].done; });
+            buffer = std::move(buffers[range]);
+        }
+
+        ok = buffer.ok;
+        for (size_t offset = 0; ok && offset < buffer.offsets.size(); offset += static_cast<size_t>(column_count))
+        {
+            for (int i = 0; i < column_count; i++)
+            {
+                ptrdiff_t value = buffer.offsets[offset + static_cast<size_t>(i)];
+                values[i] = value < 0 ? nullptr : &buffer.arena[static_cast<size_t>(value)];
+            }
+            ok = callback(user_param, values.data(), column_count);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        delivered = range + 1;
+        if (!ok) stop = true;
+        signal.notify_all();
+    }
+
+    for (std::thread& thread : threads) thread.join();
+
+    end(session);
+
+    if (!error_message.empty()) return error("scan_ordered", error_message);
+    return ok;
+}
+
+
+void ParallelScan::release()
+{
+    for (sqlite3* reader : _readers) sqlite3_close(reader);
+    _readers.clear();
+}
+
+
+bool ParallelScan::begin(const std::string &table, const ParallelScanOptions &options, Session &session)
+{
+    sqlite3* db = _db.get_handle();
+    if (!db) return error("begin", "Database not connected.");
+
+    const char* filename = sqlite3_db_filename(db, "main");
+    if (!filename || !*filename) return error("begin", "The readers need a database file.");
+
+    const TableInfo* info = _db.get_schema_cache()->find_table(table);
+    if (!info || info->type != "table") return error("begin", "No such table: " + table);
+    if (info->without_rowid) return error("begin", "WITHOUT ROWID table: " + table);
+
+    if (_path != filename)
+    {
+        release();
+        _path = filename;
+    }
+
+    unsigned int threads = thread_count(options);
+    if (!open_readers(threads)) return false;
+
+    sqlite3* anchor = _readers[0];
+    std::string quoted = SqliteWrap::quote_identifier(info->name);
+
+    bool wal = false;
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(anchor, "PRAGMA journal_mode;", -1, &statement, nullptr) == SQLITE_OK && sqlite3_step(statement) == SQLITE_ROW)
+        wal = sqlite3_stricmp(reinterpret_cast<const char*>(sqlite3_column_text(statement, 0)), "wal") == 0;
+    sqlite3_finalize(statement);
+
+    // the read transaction of the anchor starts with the first read
+    if (!exec(anchor, "BEGIN;")) return error("begin", sqlite3_errmsg(anchor));
+    session.readers = 1;
+
+    sqlite3_int64 first = 0;
+    sqlite3_int64 last = 0;
+    bool empty = true;
+    std::string sql = "SELECT min(rowid), max(rowid) FROM " + quoted + ";";
+    if (sqlite3_prepare_v2(anchor, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK || sqlite3_step(statement) != SQLITE_ROW)
+    {
+        std::string message = sqlite3_errmsg(anchor);
+        sqlite3_finalize(statement);
+        end(session);
+        return error("begin", message);
+    }
+    if (sqlite3_column_type(statement, 0) != SQLITE_NULL)
+    {
+        empty = false;
+        first = sqlite3_column_int64(statement, 0);
+        last = sqlite3_column_int64(statement, 1);
+    }
+    sqlite3_finalize(statement);
+
+    // one reader only when the others cannot share the state of the anchor
+    size_t readers = threads;
+    if (wal)
+    {
+#ifdef SQLITE_ENABLE_SNAPSHOT
+        if (sqlite3_snapshot_get(anchor, "main", &session.snapshot) != SQLITE_OK) readers = 1;
+#else
+        readers = 1;
+#endif
+    }
+
+    // bisection : the range with the widest span of rowids is cut in its middle, bounds
+    // snapped to existing rowids, so rows are spread evenly even across gaps of rowids
+    if (!empty)
+    {
+        session.ranges.push_back({ first, last });
+
+        sqlite3_stmt* next_rowid = nullptr;
+        sqlite3_stmt* previous_rowid = nullptr;
+        std::string next_sql = "SELECT rowid FROM " + quoted + " WHERE rowid >= ? ORDER BY rowid LIMIT 1;";
+        std::string previous_sql = "SELECT rowid FROM " + quoted + " WHERE rowid < ? ORDER BY rowid DESC LIMIT 1;";
+        if (sqlite3_prepare_v2(anchor, next_sql.c_str(), -1, &next_rowid, nullptr) != SQLITE_OK
+            || sqlite3_prepare_v2(anchor, previous_sql.c_str(), -1, &previous_rowid, nullptr) != SQLITE_OK)
+        {
+            std::string message = sqlite3_errmsg(anchor);
+            sqlite3_finalize(next_rowid);
+            sqlite3_finalize(previous_rowid);
+            end(session);
+            return error("begin", message);
+        }
+
+        size_t count = static_cast<size_t>(threads) * std::max(options.ranges_per_thread, 1u);
+        while (session.ranges.size() < count)
+        {
+            auto span = [](const ScanRange& range) { return static_cast<uint64_t>(range.last) - static_cast<uint64_t>(range.first); };
+            auto widest = std::max_element(session.ranges.begin(), session.ranges.end(),
+                                           [&](const ScanRange& a, const ScanRange& b) { return span(a) < span(b); });
+            if (span(*widest) == 0) break;
+
+            // middle > first and <= last : the next rowid exists and is in the range
+            sqlite3_int64 middle = static_cast<sqlite3_int64>(static_cast<uint64_t>(widest->first) + span(*widest) / 2 + 1);
+            sqlite3_bind_int64(next_rowid, 1, middle);
+            if (sqlite3_step(next_rowid) != SQLITE_ROW) break;
+            sqlite3_int64 start = sqlite3_column_int64(next_rowid, 0);
+            sqlite3_reset(next_rowid);
+
+            sqlite3_bind_int64(previous_rowid, 1, start);
+            if (sqlite3_step(previous_rowid) != SQLITE_ROW) break;
+            sqlite3_int64 below = sqlite3_column_int64(previous_rowid, 0);
+            sqlite3_reset(previous_rowid);
+
+            ScanRange upper { start, widest->last };
+            widest->last = below;
+            session.ranges.push_back(upper);
+        }
+
+        sqlite3_finalize(next_rowid);
+        sqlite3_finalize(previous_rowid);
+
+        std::sort(session.ranges.begin(), session.ranges.end(), [](const ScanRange& a, const ScanRange& b) { return a.first < b.first; });
+    }
+
+    readers = std::max<size_t>(1, std::min(readers, session.ranges.size()));
+
+    // the other readers join the state of the anchor
+    for (size_t i = 1; i < readers; i++)
+    {
+        sqlite3* reader = _readers[i];
+        bool ok = exec(reader, "BEGIN;");
+#ifdef SQLITE_ENABLE_SNAPSHOT
+        if (ok && session.snapshot) ok = sqlite3_snapshot_open(reader, "main", session.snapshot) == SQLITE_OK;
+#endif
+        if (!ok)
+        {
+            std::string message = sqlite3_errmsg(reader);
+            exec(reader, "COMMIT;");
+            end(session);
+            return error("begin", message);
+        }
+        session.readers++;
+    }
+
+    session.sql = "SELECT " + (options.columns.empty() ? std::string("*") : options.columns) + " FROM " + quoted + " WHERE ";
+    if (!options.condition.empty()) session.sql += "(" + options.condition + ") AND ";
+    size_t bound_index = options.params.size() + 1;
+    session.sql += "rowid >= ?" + std::to_string(bound_index) + " AND rowid <= ?" + std::to_string(bound_index + 1) + " ORDER BY rowid;";
+
+    return true;
+}
+
+
+void ParallelScan::end(Session &session)
+{
+    for (size_t i = 0; i < session.readers; i++) exec(_readers[i], "COMMIT;");
+    session.readers = 0;
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    if (session.snapshot) sqlite3_snapshot_free(session.snapshot);
+#endif
+    session.snapshot = nullptr;
+}
+
+
+bool ParallelScan::open_readers(size_t count)
+{
+    while (_readers.size() < count)
+    {
+        sqlite3* reader = nullptr;
+        if (sqlite3_open_v2(_path.c_str(), &reader, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK)
+        {
+            std::string message = reader ? sqlite3_errmsg(reader) : "Out of memory.";
+            sqlite3_close(reader);
+            return error("open_readers", message);
+        }
+
+        // conditions may use carray(?)
+        SqlArray::register_module(reader);
+        _readers.push_back(reader);
+    }
+
+    return true;
+}
+
+
+bool ParallelScan::error(const char *function, const std::string &message)
+{
+    _last_error = message;
+    SQLITEWRAP_LOG_ERROR("ParallelScan::" << function << "(...) - Error: " << message);
+    return false;
+}
@@ -0,0 +1,88 @@
+#ifndef PARALLELSCAN_H
+#define PARALLELSCAN_H
+
+#include <string>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlitewrap.h"
+
+// Called from the worker threads, concurrently : worker (0 .. thread count - 1) selects
+// the consumer of the thread, e.g. one accumulator per worker merged after scan().
+// Return false to stop the scan.
+using ParallelRowCallback = bool (*)(void* user_param, unsigned int worker, char** values, int column_count);
+
+struct ParallelScanOptions
+{
+    unsigned int threads = 0;            // reader connections, 0 : one per core
+    unsigned int ranges_per_thread = 4;  // more ranges than threads : a slow range does not hold the others
+    std::string columns = "*";           // select list
+    std::string condition;               // optional WHERE condition, its parameters in params
+    std::vector<SqlValue> params;
+};
+
+struct ScanRange
+{
+    sqlite3_int64 first = 0;             // rowids, inclusive
+    sqlite3_int64 last = 0;
+};
+
+// Parallel scan of a rowid table on read-only connections to the same database file.
+//
+// The rowid span (min / max rowid) is cut into threads * ranges_per_thread ranges by
+// bisection : the widest range is split in its middle and both new bounds are snapped to
+// existing rowids (two b-tree seeks), so gaps of rowids do not leave a thread with most
+// of the rows. Threads take the next range when done.
+//
+// Every reader sees the same data : in WAL mode the readers open the sqlite3_snapshot of
+// the first reader (needs SQLITE_ENABLE_SNAPSHOT; without it the ranges are read on one
+// connection). With a rollback journal the read transaction of the first reader already
+// keeps writers from committing during the scan.
+//
+//     ParallelScan scan(db);
+//     std::vector<Stats> stats(scan.thread_count(options));
+//     scan.scan("event", options, &stats, [](void* p, unsigned int worker, char** values, int) { ... });
+//
+// scan_ordered() hands the rows to one callback on the calling thread, in rowid order;
+// the ranges are read ahead (buffered, at most 2 per thread).
+//
+// The readers are opened on first use and kept : call release() before closing the
+// database (and after a schema change).
+class SQLITEWRAP_EXPORT ParallelScan
+{
+public:
+    explicit ParallelScan(SqliteWrap& db);
+    ~ParallelScan();
+
+    ParallelScan(const ParallelScan&) = delete;
+    ParallelScan& operator=(const ParallelScan&) = delete;
+
+    bool scan(const std::string& table, const ParallelScanOptions& options, void* user_param, ParallelRowCallback callback);
+    bool scan_ordered(const std::string& table, const ParallelScanOptions& options, void* user_param, DeserializeCallback callback);
+
+    // the ranges a scan would read, on the current data
+    bool split(const std::string& table, const ParallelScanOptions& options, std::vector<ScanRange>& ranges);
+
+    static unsigned int thread_count(const ParallelScanOptions& options);
+
+    void release();                      // closes the reader connections
+
+private:
+    SqliteWrap& _db;
+    std::string _path;                   // file of the readers
+    std::vector<sqlite3*> _readers;
+    std::string _last_error;
+
+    struct Session;
+
+    bool begin(const std::string& table, const ParallelScanOptions& options, Session& session);
+    void end(Session& session);
+    bool open_readers(size_t count);
+    bool error(const char* function, const std::string& message);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+};
+
+#endif // PARALLELSCAN_H
@@ -0,0 +1,356 @@
+#include <cstdint>
+#include <cstring>
+
+#include "resultcache.h"
+#include "logger.h"
+#include "schemacache.h"
+
+
+namespace
+{
+    // built-in functions whose result changes between two runs of the same statement
+    const char* const volatile_functions[] =
+    {
+        "random", "randomblob", "changes", "total_changes", "last_insert_rowid",
+        "date", "time", "datetime", "julianday", "unixepoch", "strftime", "timediff",
+        "current_date", "current_time", "current_timestamp"
+    };
+
+    bool is_deterministic(const SqliteWrap* wrap, const char* function)
+    {
+        for (const char* name : volatile_functions)
+            if (sqlite3_stricmp(name, function) == 0) return false;
+
+        return !wrap->is_volatile_function(function);
+    }
+}
+
+
+ResultCache::ResultCache(SqliteWrap &db, size_t max_bytes) : _wrap(db), _max_bytes(max_bytes)
+{
+    _wrap.add_update_listener(this, &ResultCache::on_update);
+}
+
+
+ResultCache::~ResultCache()
+{
+    _wrap.remove_update_listener(this, &ResultCache::on_update);
+    release();
+}
+
+
+std::string ResultCache::make_key(const std::string &sql, const std::vector<SqlValue> &params)
+{
+    // sql, then one type tag + value per parameter, so that 1, 1.0 and '1' differ
+    std::string key = sql;
+    for (const SqlValue& value : params)
+    {
+        key += '\0';
+        key += static_cast<char>('0' + value.index());
+
+        if (std::holds_alternative<sqlite3_int64>(value))
+        {
+            sqlite3_int64 v = std::get<sqlite3_int64>(value);
+            key.append(reinterpret_cast<const char*>(&v), sizeof(v));
+        }
+        else if (std::holds_alternative<double>(value))
+        {
+            double v = std::get<double>(value);
+            key.append(reinterpret_cast<const char*>(&v), sizeof(v));
+        }
+        else if (std::holds_alternative<std::string>(value))
+        {
+            const std::string& v = std::get<std::string>(value);
+            size_t n = v.size();
+            key.append(reinterpret_cast<const char*>(&n), sizeof(n));
+            key += v;
+        }
+        else if (std::holds_alternative<SqlBlob>(value))
+        {
+            const SqlBlob& v = std::get<SqlBlob>(value);
+            size_t n = v.size();
+            key.append(reinterpret_cast<const char*>(&n), sizeof(n));
+            key.append(reinterpret_cast<const char*>(v.data()), n);
+        }
+        else if (std::holds_alternative<SqlArray>(value))
+        {
+            // the array content, not its address : the caller may reuse the buffer
+            const SqlArray& v = std::get<SqlArray>(value);
+            key += static_cast<char>('0' + static_cast<int>(v.type));
+            key.append(reinterpret_cast<const char*>(&v.size), sizeof(v.size));
+
+            if (v.type == SqlArray::Type::Int32) key.append(static_cast<const char*>(v.data), v.size * sizeof(int32_t));
+            else if (v.type == SqlArray::Type::Int64) key.append(static_cast<const char*>(v.data), v.size * sizeof(int64_t));
+            else if (v.type == SqlArray::Type::Double) key.append(static_cast<const char*>(v.data), v.size * sizeof(double));
+            else
+            {
+                for (size_t i = 0; i < v.size; i++)
+                {
+                    std::string_view text = v.type == SqlArray::Type::Text ? static_cast<const std::string_view*>(v.data)[i]
+                                                                           : std::string_view(static_cast<const std::string*>(v.data)[i]);
+                    size_t n = text.size();
+                    key.append(reinterpret_cast<const char*>(&n), sizeof(n));
+                    key.append(text.data(), n);
+                }
+            }
+        }
+    }
+
+    return key;
+}
+
+
+bool ResultCache::validate()
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return false;
+
+    // writes of this connection the update hook did not see (truncate optimization)
+    sqlite3_int64 total_changes = sqlite3_total_changes64(db);
+    if (total_changes - _total_changes > _hook_changes) clear();
+    _total_changes = total_changes;
+    _hook_changes = 0;
+
+    // commits from other connections, and schema changes from any connection
+    auto now = std::chrono::steady_clock::now();
+    if (_check_interval.count() > 0 && _data_version >= 0 && now - _last_check < _check_interval) return true;
+
+    if (!_version_statement)
+    {
+        const char* sql = "SELECT * FROM pragma_data_version, pragma_schema_version;";
+        if (sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &_version_statement, nullptr) != SQLITE_OK)
+        {
+            SQLITEWRAP_LOG_ERROR("ResultCache::validate() - Error: " << sqlite3_errmsg(db));
+            _version_statement = nullptr;
+            return false;
+        }
+    }
+
+    if (sqlite3_step(_version_statement) != SQLITE_ROW)
+    {
+        sqlite3_reset(_version_statement);
+        return false;
+    }
+
+    sqlite3_int64 data_version = sqlite3_column_int64(_version_statement, 0);
+    sqlite3_int64 schema_version = sqlite3_column_int64(_version_statement, 1);
+    sqlite3_reset(_version_statement);
+
+    if (data_version != _data_version || schema_version != _schema_version) clear();
+
+    _data_version = data_version;
+    _schema_version = schema_version;
+    _last_check = now;
+
+    return true;
+}
+
+
+std::shared_ptr<const CachedResult> ResultCache::find(const std::string &key)
+{
+    if (!validate())
+    {
+        _misses++;
+        return nullptr;
+    }
+
+    auto found = _entries.find(key);
+    if (found == _entries.end())
+    {
+        _misses++;
+        return nullptr;
+    }
+
+    _lru.splice(_lru.begin(), _lru, found->second);    // mark as most recently used
+    _hits++;
+
+    return found->second->result;
+}
+
+
+void ResultCache::insert(const std::string &key, CachedResult &&result, const std::unordered_set<std::string> &tables)
+{
+    sqlite3* db = _wrap.get_handle();
+
+    // results read inside an explicit transaction may be rolled back
+    if (!db || !sqlite3_get_autocommit(db)) return;
+    // the versions checked by the find() that missed are the ones the result was read
+    // against : checking again here could pair a newer version with older rows
+    if (_data_version < 0) return;
+
+    result.bytes = key.size() + sizeof(Entry);
+    for (const std::string& column : result.columns) result.bytes += column.size() + sizeof(std::string);
+    for (const std::string& value : result.values) result.bytes += value.size() + sizeof(std::string) + 1;
+
+    if (result.bytes > _max_bytes) return;
+
+    auto found = _entries.find(key);
+    if (found != _entries.end()) erase(found->second);
+
+    _lru.push_front(Entry{key, std::make_shared<const CachedResult>(std::move(result)), std::vector<std::string>(tables.begin(), tables.end())});
+    _entries.emplace(key, _lru.begin());
+    for (const std::string& table : tables) _table_keys[table].insert(key);
+
+    _size_bytes += _lru.front().result->bytes;
+    _last_hook_table.clear();
+
+    evict();
+}
+
+
+void ResultCache::erase(std::list<Entry>::iterator it)
+{
+    for (const std::string& table : it->tables)
+    {
+        auto keys = _table_keys.find(table);
+        if (keys == _table_keys.end()) continue;
+        keys->second.erase(it->key);
+        if (keys->second.empty()) _table_keys.erase(keys);
+    }
+
+    _size_bytes -= it->result->bytes;
+    _entries.erase(it->key);
+    _lru.erase(it);
+}
+
+
+void ResultCache::evict()
+{
+    while (_size_bytes > _max_bytes && !_lru.empty())
+        erase(std::prev(_lru.end()));
+}
+
+
+void ResultCache::invalidate_table(const std::string &table)
+{
+    auto keys = _table_keys.find(table);
+    if (keys == _table_keys.end()) return;
+
+    // copy : erase() modifies the set
+    std::vector<std::string> to_erase(keys->second.begin(), keys->second.end());
+    for (const std::string& key : to_erase)
+    {
+        auto found = _entries.find(key);
+        if (found != _entries.end()) erase(found->second);
+    }
+
+    _invalidations++;
+}
+
+
+void ResultCache::clear()
+{
+    if (!_lru.empty()) _invalidations++;
+
+    _lru.clear();
+    _entries.clear();
+    _table_keys.clear();
+    _size_bytes = 0;
+}
+
+
+void ResultCache::release()
+{
+    clear();
+
+    if (_version_statement)
+    {
+        sqlite3_finalize(_version_statement);
+        _version_statement = nullptr;
+    }
+
+    _data_version = -1;
+    _schema_version = -1;
+    _total_changes = 0;
+    _hook_changes = 0;
+}
+
+
+void ResultCache::set_max_bytes(size_t max_bytes)
+{
+    _max_bytes = max_bytes;
+    evict();
+}
+
+
+int ResultCache::prepare(const std::string &sql, sqlite3_stmt **statement, std::unordered_set<std::string> &tables, bool &cacheable)
+{
+    sqlite3* db = _wrap.get_handle();
+
+    Collector collector { &_wrap, {}, true };
+    sqlite3_set_authorizer(db, &ResultCache::on_authorize, &collector);
+    int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, statement, nullptr);
+    sqlite3_set_authorizer(db, _wrap.get_authorizer(), _wrap.get_authorizer_param());
+
+    tables.clear();
+    cacheable = collector.cacheable && !collector.reads.empty();
+
+    for (const auto& [database, table] : collector.reads)
+    {
+        tables.insert(table);
+
+        // carray() : its content is part of the key; the schema (also read when the first statement
+        // loads it) is covered by the schema_version check
+        if (table == "carray" || table == "sqlite_master" || table == "sqlite_temp_master") continue;
+        if (cacheable && !is_plain_table(database, table)) cacheable = false;
+    }
+
+    return rc;
+}
+
+
+bool ResultCache::is_plain_table(const std::string &database, const std::string &table)
+{
+    if (database == "main")
+    {
+        const TableInfo* info = _wrap.get_schema_cache()->find_table(table);
+        return info && (info->type == "table" || info->type == "shadow");
+    }
+
+    // temp and attached databases : not in the schema cache
+    sqlite3* db = _wrap.get_handle();
+    std::string sql = "SELECT sql FROM " + SqliteWrap::quote_identifier(database) + ".sqlite_master WHERE type = 'table' AND name = ?;";
+
+    sqlite3_stmt* statement = nullptr;
+    bool plain = sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr) == SQLITE_OK
+                 && sqlite3_bind_text(statement, 1, table.c_str(), -1, SQLITE_STATIC) == SQLITE_OK
+                 && sqlite3_step(statement) == SQLITE_ROW
+                 && sqlite3_strnicmp(reinterpret_cast<const char*>(sqlite3_column_text(statement, 0)), "CREATE VIRTUAL", 14) != 0;
+    sqlite3_finalize(statement);
+
+    return plain;
+}
+
+
+void ResultCache::on_update(void *user_param, int, const char *, const char *table, sqlite3_int64)
+{
+    ResultCache* cache = static_cast<ResultCache*>(user_param);
+
+    cache->_hook_changes++;
+
+    // called once per written row : the first row of a table drops its entries, the others are no-ops
+    if (cache->_table_keys.empty()) return;
+    if (cache->_last_hook_table == table) return;
+
+    cache->invalidate_table(table);
+    cache->_last_hook_table = table;
+}
+
+
+int ResultCache::on_authorize(void *user_param, int action, const char *arg1, const char *arg2, const char *database, const char *trigger)
+{
+    Collector* collector = static_cast<Collector*>(user_param);
+
+    if (AuthorizerCallback authorizer = collector->wrap->get_authorizer())
+    {
+        int rc = authorizer(collector->wrap->get_authorizer_param(), action, arg1, arg2, database, trigger);
+        if (rc != SQLITE_OK) return rc;
+    }
+
+    if (action == SQLITE_READ && arg1)
+        collector->reads.emplace(database ? database : "main", arg1);
+    else if (action == SQLITE_FUNCTION && arg2 && !is_deterministic(collector->wrap, arg2))
+        collector->cacheable = false;
+
+    return SQLITE_OK;
+}
@@ -0,0 +1,121 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlitewrap.h"
+
+// Materialized result of a read statement : values are kept row-major,
+// binary safe, with a null flag per value.
+struct CachedResult
+{
+    int column_count = 0;
+    size_t row_count = 0;
+    std::vector<std::string> columns;
+    std::vector<std::string> values;
+    std::vector<char> nulls;
+    size_t bytes = 0;
+};
+
+// LRU cache of query results keyed by SQL + bound parameters, bounded in bytes.
+// Entries are dropped when one of the tables they read is written by this
+// connection (update hook), and all entries are dropped when another connection
+// commits (PRAGMA data_version) or when the schema changes (PRAGMA schema_version).
+class SQLITEWRAP_EXPORT ResultCache
+{
+public:
+    ResultCache(SqliteWrap& db, size_t max_bytes);
+    ~ResultCache();
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    static std::string make_key(const std::string& sql, const std::vector<SqlValue>& params);
+
+    // nullptr on miss; a hit stays valid even if the entry is evicted while in use
+    std::shared_ptr<const CachedResult> find(const std::string& key);
+    void insert(const std::string& key, CachedResult&& result, const std::unordered_set<std::string>& tables);
+
+    // prepare a statement and collect the tables it reads (authorizer). Not cacheable : reads
+    // no table, reads a virtual table (no update hook) or calls a non-deterministic function
+    // (random(), changes(), datetime('now'), functions registered with deterministic = false).
+    // The authorizer of SqliteWrap::set_authorizer() is called first and restored afterwards
+    int prepare(const std::string& sql, sqlite3_stmt** statement, std::unordered_set<std::string>& tables, bool& cacheable);
+
+    void invalidate_table(const std::string& table);
+    void clear();
+    void release();                      // finalize internal statements (before sqlite3_close)
+
+    void set_max_bytes(size_t max_bytes);
+    // interval between two PRAGMA data_version checks : 0 checks on every lookup,
+    // a larger value makes hits a single hash lookup but may serve results up to
+    // that old when other connections write
+    void set_external_check_interval(std::chrono::milliseconds interval) { _check_interval = interval; }
+
+    size_t get_max_bytes() const { return _max_bytes; }
+    size_t get_size_bytes() const { return _size_bytes; }
+    size_t get_entry_count() const { return _entries.size(); }
+    size_t get_hits() const { return _hits; }
+    size_t get_misses() const { return _misses; }
+    size_t get_invalidations() const { return _invalidations; }
+
+private:
+    // filled by the authorizer while a statement is prepared
+    struct Collector
+    {
+        SqliteWrap* wrap;
+        std::set<std::pair<std::string, std::string>> reads;           // database, table
+        bool cacheable;
+    };
+
+    struct Entry
+    {
+        std::string key;
+        std::shared_ptr<const CachedResult> result;
+        std::vector<std::string> tables;
+    };
+
+    SqliteWrap& _wrap;
+    size_t _max_bytes;
+    size_t _size_bytes = 0;
+
+    std::list<Entry> _lru;                                                    // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> _entries;
+    std::unordered_map<std::string, std::unordered_set<std::string>> _table_keys;
+
+    // external change detection
+    sqlite3_stmt* _version_statement = nullptr;
+    sqlite3_int64 _data_version = -1;
+    sqlite3_int64 _schema_version = -1;
+    std::chrono::milliseconds _check_interval {0};
+    std::chrono::steady_clock::time_point _last_check;
+
+    // writes that bypass the update hook (truncate optimization) : detected
+    // when sqlite3_total_changes advances more than the hook has reported
+    sqlite3_int64 _total_changes = 0;
+    sqlite3_int64 _hook_changes = 0;
+    std::string _last_hook_table;
+
+    size_t _hits = 0;
+    size_t _misses = 0;
+    size_t _invalidations = 0;
+
+    bool validate();
+    void erase(std::list<Entry>::iterator it);
+    void evict();
+
+    static void on_update(void* user_param, int operation, const char* database, const char* table, sqlite3_int64 rowid);
+    bool is_plain_table(const std::string& database, const std::string& table);
+
+    static int on_authorize(void* user_param, int action, const char* arg1, const char* arg2, const char* database, const char* trigger);
+};
+
+#endif // RESULTCACHE_H
@@ -0,0 +1,369 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "rowcounter.h"
+#include "logger.h"
+#include "schemacache.h"
+#include "sqlitewrap.h"
+
+
+RowCounter::RowCounter(SqliteWrap &db) : _wrap(db)
+{
+    _wrap.add_update_listener(this, &RowCounter::on_update);
+    _wrap.add_rollback_listener(this, &RowCounter::on_rollback);
+}
+
+
+RowCounter::~RowCounter()
+{
+    _wrap.remove_update_listener(this, &RowCounter::on_update);
+    _wrap.remove_rollback_listener(this, &RowCounter::on_rollback);
+    release();
+}
+
+
+bool RowCounter::track(const std::string &table)
+{
+    if (!_wrap.get_handle())
+    {
+        _last_error = "Database not connected.";
+        SQLITEWRAP_LOG_ERROR("RowCounter::track(...) - Error: " << _last_error);
+        return false;
+    }
+
+    // the update hook reports the name of the schema : "Users" or "main.users" is "users"
+    const TableInfo* info = _wrap.get_schema_cache()->find_table(canonical_name(table));
+    if (!info || info->type != "table")
+    {
+        _last_error = "No such table in main: " + table;
+        SQLITEWRAP_LOG_ERROR("RowCounter::track(...) - Error: " << _last_error);
+        return false;
+    }
+
+    const std::string name = info->name;
+    Tracked& tracked = _tracked[name];
+    tracked.name = name;
+    check_external();
+
+    // count now so that the first count() is O(1) as well
+    sqlite3_int64 rows = 0;
+    if (!count_rows(name, rows))
+    {
+        _tracked.erase(name);
+        _last = nullptr;
+        return false;
+    }
+
+    tracked.count = rows;
+    tracked.valid = true;
+    return true;
+}
+
+
+void RowCounter::untrack(const std::string &table)
+{
+    _tracked.erase(canonical_name(table));
+    _last = nullptr;
+}
+
+
+bool RowCounter::is_tracked(const std::string &table)
+{
+    return !_tracked.empty() && _tracked.count(canonical_name(table)) != 0;
+}
+
+
+bool RowCounter::count(const std::string &table, sqlite3_int64 &count)
+{
+    if (!_wrap.get_handle())
+    {
+        _last_error = "Database not connected.";
+        SQLITEWRAP_LOG_ERROR("RowCounter::count(...) - Error: " << _last_error);
+        return false;
+    }
+
+    check_external();
+
+    const std::string name = canonical_name(table);
+
+    auto found = _tracked.find(name);
+    if (found != _tracked.end())
+    {
+        Tracked& tracked = found->second;
+        if (!tracked.valid)
+        {
+            if (!count_rows(name, tracked.count)) return false;
+            tracked.valid = true;
+        }
+
+        count = tracked.count;
+        return true;
+    }
+
+    bool in_counter_table = false;
+    if (read_counter_table(name, count, in_counter_table) && in_counter_table) return true;
+
+    return count_rows(name, count);
+}
+
+
+bool RowCounter::approximate_count(const std::string &table, sqlite3_int64 &count)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db)
+    {
+        _last_error = "Database not connected.";
+        return false;
+    }
+
+    // the first number of a sqlite_stat1 row is the number of rows of the table
+    const char* sql = "SELECT stat FROM sqlite_stat1 WHERE tbl = ? ORDER BY idx IS NOT NULL LIMIT 1;";
+
+    sqlite3_stmt *statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &statement, nullptr) != SQLITE_OK)
+    {
+        _last_error = "No statistics, run ANALYZE first.";
+        SQLITEWRAP_LOG_ERROR("RowCounter::approximate_count(...) - Error: " << _last_error);
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    sqlite3_bind_text(statement, 1, table.c_str(), -1, SQLITE_STATIC);
+
+    int rc = sqlite3_step(statement);
+    if (rc != SQLITE_ROW)
+    {
+        _last_error = "No statistics for table " + table + ", run ANALYZE first.";
+        SQLITEWRAP_LOG_ERROR("RowCounter::approximate_count(...) - Error: " << _last_error);
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    const char* stat = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
+    count = stat ? std::strtoll(stat, nullptr, 10) : 0;
+    sqlite3_finalize(statement);
+
+    return true;
+}
+
+
+bool RowCounter::install_counter_table(const std::string &table_name)
+{
+    const std::string table = canonical_name(table_name);
+    std::string name = SqliteWrap::quote_literal(table);
+    std::string quoted = SqliteWrap::quote_identifier(table);
+
+    std::string sql =
+        "SAVEPOINT sqlitewrap_rowcount;"
+        "CREATE TABLE IF NOT EXISTS " + std::string(counter_table) + " (name TEXT PRIMARY KEY, n INTEGER NOT NULL);"
+        "INSERT OR REPLACE INTO " + counter_table + " VALUES (" + name + ", (SELECT COUNT(*) FROM " + quoted + "));"
+        "CREATE TRIGGER IF NOT EXISTS " + SqliteWrap::quote_identifier(std::string(counter_table) + "_" + table + "_insert") +
+        " AFTER INSERT ON " + quoted + " BEGIN UPDATE " + counter_table + " SET n = n + 1 WHERE name = " + name + "; END;"
+        "CREATE TRIGGER IF NOT EXISTS " + SqliteWrap::quote_identifier(std::string(counter_table) + "_" + table + "_delete") +
+        " AFTER DELETE ON " + quoted + " BEGIN UPDATE " + counter_table + " SET n = n - 1 WHERE name = " + name + "; END;"
+        "RELEASE sqlitewrap_rowcount;";
+
+    return execute_script("install_counter_table", sql);
+}
+
+
+bool RowCounter::remove_counter_table(const std::string &table_name)
+{
+    const std::string table = canonical_name(table_name);
+
+    std::string sql =
+        "SAVEPOINT sqlitewrap_rowcount;"
+        "DROP TRIGGER IF EXISTS " + SqliteWrap::quote_identifier(std::string(counter_table) + "_" + table + "_insert") + ";"
+        "DROP TRIGGER IF EXISTS " + SqliteWrap::quote_identifier(std::string(counter_table) + "_" + table + "_delete") + ";"
+        "DELETE FROM " + counter_table + " WHERE name = " + SqliteWrap::quote_literal(table) + ";"
+        "RELEASE sqlitewrap_rowcount;";
+
+    return execute_script("remove_counter_table", sql);
+}
+
+
+void RowCounter::release()
+{
+    if (_version_statement)
+    {
+        sqlite3_finalize(_version_statement);
+        _version_statement = nullptr;
+    }
+
+    if (_counter_statement)
+    {
+        sqlite3_finalize(_counter_statement);
+        _counter_statement = nullptr;
+    }
+
+    _data_version = -1;
+    _total_changes = 0;
+    _hook_changes = 0;
+    invalidate_all();
+}
+
+
+void RowCounter::check_external()
+{
+    sqlite3* db = _wrap.get_handle();
+    if (_tracked.empty()) return;
+
+    // writes of this connection the update hook did not see (truncate optimization), or rows
+    // the hook saw that were not kept (statement aborted part way, total_changes adds 0)
+    sqlite3_int64 total_changes = sqlite3_total_changes64(db);
+    if (total_changes - _total_changes != _hook_changes) invalidate_all();
+    _total_changes = total_changes;
+    _hook_changes = 0;
+
+    // commits from other connections
+    if (!_version_statement &&
+        sqlite3_prepare_v3(db, "PRAGMA data_version;", -1, SQLITE_PREPARE_PERSISTENT, &_version_statement, nullptr) != SQLITE_OK)
+    {
+        _version_statement = nullptr;
+        invalidate_all();
+        return;
+    }
+
+    if (sqlite3_step(_version_statement) == SQLITE_ROW)
+    {
+        sqlite3_int64 data_version = sqlite3_column_int64(_version_statement, 0);
+        if (data_version != _data_version) invalidate_all();
+        _data_version = data_version;
+    }
+    else invalidate_all();
+
+    sqlite3_reset(_version_statement);
+}
+
+
+void RowCounter::invalidate_all()
+{
+    for (auto& tracked : _tracked) tracked.second.valid = false;
+}
+
+
+bool RowCounter::count_rows(const std::string &table, sqlite3_int64 &count)
+{
+    sqlite3* db = _wrap.get_handle();
+
+    // a name that is not a table of main : schema.table
+    std::string quoted = SqliteWrap::quote_identifier(table);
+    size_t dot = table.find('.');
+    if (dot != std::string::npos && !_wrap.get_schema_cache()->find_table(table))
+        quoted = SqliteWrap::quote_identifier(table.substr(0, dot)) + "." + SqliteWrap::quote_identifier(table.substr(dot + 1));
+
+    std::string sql = "SELECT COUNT(*) FROM " + quoted + ";";
+
+    sqlite3_stmt *statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK || sqlite3_step(statement) != SQLITE_ROW)
+    {
+        _last_error = sqlite3_errmsg(db);
+        SQLITEWRAP_LOG_ERROR("RowCounter::count_rows(...) - Error: " << _last_error);
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    count = sqlite3_column_int64(statement, 0);
+    sqlite3_finalize(statement);
+
+    return true;
+}
+
+
+bool RowCounter::read_counter_table(const std::string &table, sqlite3_int64 &count, bool &found)
+{
+    sqlite3* db = _wrap.get_handle();
+    found = false;
+
+    if (!_counter_statement)
+    {
+        std::string sql = "SELECT n FROM " + std::string(counter_table) + " WHERE name = ?;";
+        // fails as long as no counter table was installed
+        if (sqlite3_prepare_v3(db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &_counter_statement, nullptr) != SQLITE_OK)
+        {
+            _counter_statement = nullptr;
+            return false;
+        }
+    }
+
+    sqlite3_bind_text(_counter_statement, 1, table.c_str(), static_cast<int>(table.size()), SQLITE_STATIC);
+
+    int rc = sqlite3_step(_counter_statement);
+    if (rc == SQLITE_ROW)
+    {
+        count = sqlite3_column_int64(_counter_statement, 0);
+        found = true;
+    }
+
+    sqlite3_reset(_counter_statement);
+    sqlite3_clear_bindings(_counter_statement);
+
+    return rc == SQLITE_ROW || rc == SQLITE_DONE;
+}
+
+
+bool RowCounter::execute_script(const char *function, const std::string &sql)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db)
+    {
+        _last_error = "Database not connected.";
+        return false;
+    }
+
+    char* errorMessage = nullptr;
+    int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errorMessage);
+
+    if (rc != SQLITE_OK)
+    {
+        _last_error = errorMessage ? errorMessage : sqlite3_errstr(rc);
+        SQLITEWRAP_LOG_ERROR("RowCounter::" << function << "(...) - SQL error: " << _last_error);
+        sqlite3_free(errorMessage);
+        sqlite3_exec(db, "ROLLBACK TO sqlitewrap_rowcount; RELEASE sqlitewrap_rowcount;", nullptr, nullptr, nullptr);
+        return false;
+    }
+
+    return true;
+}
+
+
+void RowCounter::on_update(void *user_param, int operation, const char *database, const char *table, sqlite3_int64)
+{
+    RowCounter* counter = static_cast<RowCounter*>(user_param);
+
+    counter->_hook_changes++;
+
+    // tracked tables are tables of main : a temp table of the same name is another table
+    if (operation == SQLITE_UPDATE || counter->_tracked.empty() || std::strcmp(database, "main") != 0) return;
+
+    // same table as the previous row in the common case
+    Tracked* tracked = counter->_last;
+    if (!tracked || tracked->name != table)
+    {
+        auto found = counter->_tracked.find(table);
+        if (found == counter->_tracked.end()) return;
+        tracked = counter->_last = &found->second;
+    }
+
+    if (operation == SQLITE_INSERT) tracked->count++;
+    else if (operation == SQLITE_DELETE) tracked->count--;
+}
+
+
+std::string RowCounter::canonical_name(const std::string &table)
+{
+    SchemaCache* schema = _wrap.get_schema_cache();
+
+    if (const TableInfo* info = schema->find_table(table)) return info->name;
+
+    if (table.size() > 5 && sqlite3_strnicmp(table.c_str(), "main.", 5) == 0)
+        if (const TableInfo* info = schema->find_table(table.substr(5))) return info->name;
+
+    return table;
+}
+
+
+void RowCounter::on_rollback(void *user_param)
+{
+    static_cast<RowCounter*>(user_param)->invalidate_all();
+}
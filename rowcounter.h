@@ -0,0 +1,85 @@
+#ifndef ROWCOUNTER_H
+#define ROWCOUNTER_H
+
+#include <string>
+#include <unordered_map>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+class SqliteWrap;
+
+// Table row counts without COUNT(*) scans. Table names are resolved as SQLite does :
+// "Users" and "main.users" are the table users of main.
+//
+// - track() : exact count kept in memory, counted once then maintained by the
+//   update hook. Counts are recomputed lazily after a rollback, a commit from
+//   another connection (PRAGMA data_version) or a write the hook did not report
+//   (truncate optimization). Rows deleted by REPLACE conflict resolution and
+//   ROLLBACK TO a savepoint are not reported by SQLite : use a counter table for
+//   tables written that way.
+// - install_counter_table() : exact count stored in the database, maintained by
+//   AFTER INSERT / AFTER DELETE triggers, visible to every connection. REPLACE
+//   deletions need PRAGMA recursive_triggers = ON to fire the delete trigger.
+//   The counter table is a rowid table so that its updates reach the update hook.
+// - approximate_count() : row estimate of the last ANALYZE (sqlite_stat1).
+class SQLITEWRAP_EXPORT RowCounter
+{
+public:
+    explicit RowCounter(SqliteWrap& db);
+    ~RowCounter();
+
+    RowCounter(const RowCounter&) = delete;
+    RowCounter& operator=(const RowCounter&) = delete;
+
+    bool track(const std::string& table);
+    void untrack(const std::string& table);
+    bool is_tracked(const std::string& table);
+
+    bool install_counter_table(const std::string& table);
+    bool remove_counter_table(const std::string& table);
+
+    // tracked count, else counter table, else COUNT(*)
+    bool count(const std::string& table, sqlite3_int64& count);
+    bool approximate_count(const std::string& table, sqlite3_int64& count);
+
+    void release();                      // finalize internal statements (before sqlite3_close)
+
+    static constexpr const char* counter_table = "_sqlitewrap_rowcount";
+
+private:
+    struct Tracked
+    {
+        std::string name;
+        sqlite3_int64 count = 0;
+        bool valid = false;
+    };
+
+    SqliteWrap& _wrap;
+    std::unordered_map<std::string, Tracked> _tracked;
+    Tracked* _last = nullptr;            // last table seen by the hook, avoids a lookup per row
+
+    sqlite3_stmt* _version_statement = nullptr;
+    sqlite3_stmt* _counter_statement = nullptr;
+    sqlite3_int64 _data_version = -1;
+    sqlite3_int64 _total_changes = 0;
+    sqlite3_int64 _hook_changes = 0;
+
+    std::string _last_error;
+
+    void check_external();
+    void invalidate_all();
+    bool count_rows(const std::string& table, sqlite3_int64& count);
+    std::string canonical_name(const std::string& table);     // name in sqlite_master, case and "main." resolved
+    bool read_counter_table(const std::string& table, sqlite3_int64& count, bool& found);
+    bool execute_script(const char* function, const std::string& sql);
+
+    static void on_update(void* user_param, int operation, const char* database, const char* table, sqlite3_int64 rowid);
+    static void on_rollback(void* user_param);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+};
+
+#endif // ROWCOUNTER_H
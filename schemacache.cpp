@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <cctype>
+
+#include "schemacache.h"
+#include "logger.h"
+#include "sqlitewrap.h"
+
+
+namespace
+{
+    // SQLite identifiers are case insensitive (ASCII only)
+    std::string lower(const std::string& name)
+    {
+        std::string result = name;
+        std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return result;
+    }
+
+    std::string column_string(sqlite3_stmt* statement, int column)
+    {
+        const unsigned char* text = sqlite3_column_text(statement, column);
+        return text ? reinterpret_cast<const char*>(text) : "";
+    }
+}
+
+
+int TableInfo::column_index(const std::string &column) const
+{
+    for (size_t i = 0; i < columns.size(); i++)
+        if (sqlite3_stricmp(columns[i].name.c_str(), column.c_str()) == 0) return static_cast<int>(i);
+
+    return -1;
+}
+
+
+const ColumnInfo *TableInfo::find_column(const std::string &column) const
+{
+    int index = column_index(column);
+    return index < 0 ? nullptr : &columns[index];
+}
+
+
+SchemaCache::SchemaCache(SqliteWrap &db) : _wrap(db) {}
+
+
+SchemaCache::~SchemaCache()
+{
+    release();
+}
+
+
+ColumnAffinity SchemaCache::affinity(const std::string &declared_type)
+{
+    // rules of section 3.1 of https://sqlite.org/datatype3.html, in order
+    std::string type = lower(declared_type);
+
+    if (type.find("int") != std::string::npos) return ColumnAffinity::Integer;
+    if (type.find("char") != std::string::npos || type.find("clob") != std::string::npos || type.find("text") != std::string::npos)
+        return ColumnAffinity::Text;
+    if (type.empty() || type.find("blob") != std::string::npos) return ColumnAffinity::Blob;
+    if (type.find("real") != std::string::npos || type.find("floa") != std::string::npos || type.find("doub") != std::string::npos)
+        return ColumnAffinity::Real;
+
+    return ColumnAffinity::Numeric;
+}
+
+
+const TableInfo *SchemaCache::find_table(const std::string &name)
+{
+    if (!check_version()) return nullptr;
+    if (!_listed && !load_list()) return nullptr;
+
+    auto found = _tables.find(lower(name));
+    if (found == _tables.end()) return nullptr;
+
+    Entry& entry = found->second;
+    if (!entry.loaded)
+    {
+        if (!load_table(entry.info)) return nullptr;
+        entry.loaded = true;
+    }
+
+    return &entry.info;
+}
+
+
+bool SchemaCache::get_table_list(std::vector<std::string> &table_list)
+{
+    if (!check_version()) return false;
+    if (!_listed && !load_list()) return false;
+
+    table_list.insert(table_list.end(), _names.begin(), _names.end());
+    return true;
+}
+
+
+void SchemaCache::invalidate()
+{
+    _tables.clear();
+    _names.clear();
+    _index_sql.clear();
+    _listed = false;
+}
+
+
+void SchemaCache::release()
+{
+    invalidate();
+
+    if (_version_statement)
+    {
+        sqlite3_finalize(_version_statement);
+        _version_statement = nullptr;
+    }
+
+    _schema_version = -1;
+}
+
+
+bool SchemaCache::check_version()
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db)
+    {
+        SQLITEWRAP_LOG_ERROR("SchemaCache - Error: Database not connected.");
+        return false;
+    }
+
+    if (!_version_statement &&
+        sqlite3_prepare_v3(db, "PRAGMA schema_version;", -1, SQLITE_PREPARE_PERSISTENT, &_version_statement, nullptr) != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("SchemaCache::check_version() - Error: " << sqlite3_errmsg(db));
+        _version_statement = nullptr;
+        return false;
+    }
+
+    if (sqlite3_step(_version_statement) != SQLITE_ROW)
+    {
+        SQLITEWRAP_LOG_ERROR("SchemaCache::check_version() - Error: " << sqlite3_errmsg(db));
+        sqlite3_reset(_version_statement);
+        return false;
+    }
+
+    sqlite3_int64 version = sqlite3_column_int64(_version_statement, 0);
+    sqlite3_reset(_version_statement);
+
+    if (version != _schema_version)
+    {
+        invalidate();
+        _schema_version = version;
+    }
+
+    return true;
+}
+
+
+bool SchemaCache::load_list()
+{
+    sqlite3* db = _wrap.get_handle();
+
+    const char* sql =
+        "SELECT m.type, m.name, m.sql, t.type, coalesce(t.wr, 0), coalesce(t.strict, 0) "
+        "FROM sqlite_master m LEFT JOIN pragma_table_list t ON t.schema = 'main' AND t.name = m.name "
+        "ORDER BY m.name;";
+
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &statement, nullptr) != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("SchemaCache::load_list() - Error: " << sqlite3_errmsg(db));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    invalidate();
+
+    int rc;
+    while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+    {
+        std::string type = column_string(statement, 0);
+        std::string name = column_string(statement, 1);
+
+        if (type == "index")
+        {
+            _index_sql[name] = column_string(statement, 2);
+            continue;
+        }
+        if (type != "table" && type != "view") continue;
+
+        Entry& entry = _tables[lower(name)];
+        entry.info.name = name;
+        entry.info.sql = column_string(statement, 2);
+        entry.info.type = sqlite3_column_type(statement, 3) == SQLITE_NULL ? type : column_string(statement, 3);
+        entry.info.without_rowid = sqlite3_column_int(statement, 4) != 0;
+        entry.info.strict = sqlite3_column_int(statement, 5) != 0;
+
+        _names.push_back(name);
+    }
+
+    sqlite3_finalize(statement);
+
+    if (rc != SQLITE_DONE)
+    {
+        SQLITEWRAP_LOG_ERROR("SchemaCache::load_list() - Error: " << sqlite3_errmsg(db));
+        invalidate();
+        return false;
+    }
+
+    _listed = true;
+    _reloads++;
+    return true;
+}
+
+
+bool SchemaCache::load_table(TableInfo &info)
+{
+    sqlite3* db = _wrap.get_handle();
+    sqlite3_stmt* statement = nullptr;
+
+    // columns, including hidden and generated ones; of main : a temp table of the same name shadows it otherwise
+    if (sqlite3_prepare_v2(db, "SELECT cid, name, type, \"notnull\", dflt_value, pk, hidden FROM pragma_table_xinfo(?, 'main');", -1, &statement, nullptr) != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("SchemaCache::load_table(...) - Error: " << sqlite3_errmsg(db));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    sqlite3_bind_text(statement, 1, info.name.c_str(), -1, SQLITE_STATIC);
+
+    info.columns.clear();
+    std::vector<std::pair<int, std::string>> primary_key;
+
+    while (sqlite3_step(statement) == SQLITE_ROW)
+    {
+        ColumnInfo column;
+        column.cid = sqlite3_column_int(statement, 0);
+        column.name = column_string(statement, 1);
+        column.declared_type = column_string(statement, 2);
+        column.affinity = affinity(column.declared_type);
+        column.not_null = sqlite3_column_int(statement, 3) != 0;
+        column.has_default = sqlite3_column_type(statement, 4) != SQLITE_NULL;
+        column.default_value = column_string(statement, 4);
+        column.primary_key = sqlite3_column_int(statement, 5);
+        column.hidden = sqlite3_column_int(statement, 6);
+
+        if (column.primary_key > 0) primary_key.emplace_back(column.primary_key, column.name);
+        info.columns.push_back(std::move(column));
+    }
+
+    sqlite3_finalize(statement);
+
+    std::sort(primary_key.begin(), primary_key.end());
+    info.primary_key.clear();
+    for (const auto& key : primary_key) info.primary_key.push_back(key.second);
+
+    // indexes (views have none)
+    info.indexes.clear();
+    if (info.type == "view") return true;
+
+    if (sqlite3_prepare_v2(db, "SELECT name, \"unique\", origin, partial FROM pragma_index_list(?, 'main');", -1, &statement, nullptr) != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("SchemaCache::load_table(...) - Error: " << sqlite3_errmsg(db));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    sqlite3_bind_text(statement, 1, info.name.c_str(), -1, SQLITE_STATIC);
+
+    while (sqlite3_step(statement) == SQLITE_ROW)
+    {
+        IndexInfo index;
+        index.name = column_string(statement, 0);
+        index.table = info.name;
+        index.unique = sqlite3_column_int(statement, 1) != 0;
+        index.origin = column_string(statement, 2);
+        index.partial = sqlite3_column_int(statement, 3) != 0;
+
+        auto sql = _index_sql.find(index.name);
+        if (sql != _index_sql.end()) index.sql = sql->second;
+
+        info.indexes.push_back(std::move(index));
+    }
+
+    sqlite3_finalize(statement);
+
+    if (sqlite3_prepare_v2(db, "SELECT name FROM pragma_index_info(?, 'main') ORDER BY seqno;", -1, &statement, nullptr) != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("SchemaCache::load_table(...) - Error: " << sqlite3_errmsg(db));
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    for (IndexInfo& index : info.indexes)
+    {
+        sqlite3_bind_text(statement, 1, index.name.c_str(), -1, SQLITE_STATIC);
+        while (sqlite3_step(statement) == SQLITE_ROW) index.columns.push_back(column_string(statement, 0));
+        sqlite3_reset(statement);
+    }
+
+    sqlite3_finalize(statement);
+
+    return true;
+}
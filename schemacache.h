@@ -0,0 +1,102 @@
+#ifndef SCHEMACACHE_H
+#define SCHEMACACHE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+class SqliteWrap;
+
+// Column affinity derived from the declared type (https://sqlite.org/datatype3.html)
+enum class ColumnAffinity { Integer, Text, Blob, Real, Numeric };
+
+struct ColumnInfo
+{
+    int cid = 0;
+    std::string name;
+    std::string declared_type;
+    ColumnAffinity affinity = ColumnAffinity::Blob;
+    bool not_null = false;
+    int primary_key = 0;                 // 1-based position in the primary key, 0 if not part of it
+    int hidden = 0;                      // PRAGMA table_xinfo : 1 virtual table hidden, 2/3 generated column
+    bool has_default = false;
+    std::string default_value;
+};
+
+struct IndexInfo
+{
+    std::string name;
+    std::string table;
+    std::string origin;                  // "c" CREATE INDEX, "u" UNIQUE constraint, "pk" PRIMARY KEY
+    bool unique = false;
+    bool partial = false;
+    std::vector<std::string> columns;    // empty name for expression terms
+    std::string sql;
+};
+
+struct TableInfo
+{
+    std::string name;
+    std::string type;                    // "table", "view", "virtual", "shadow"
+    std::string sql;
+    bool without_rowid = false;
+    bool strict = false;
+    std::vector<ColumnInfo> columns;
+    std::vector<std::string> primary_key;
+    std::vector<IndexInfo> indexes;
+
+    int column_index(const std::string& column) const;      // -1 if unknown
+    const ColumnInfo* find_column(const std::string& column) const;
+};
+
+// Per-connection cache of sqlite_master, PRAGMA table_xinfo and the index lists.
+// Every lookup costs one step of a prepared PRAGMA schema_version; the cache is
+// reloaded only when that version changes. Column details are loaded lazily,
+// the first time a table is looked up.
+class SQLITEWRAP_EXPORT SchemaCache
+{
+public:
+    explicit SchemaCache(SqliteWrap& db);
+    ~SchemaCache();
+
+    SchemaCache(const SchemaCache&) = delete;
+    SchemaCache& operator=(const SchemaCache&) = delete;
+
+    // nullptr if the table / view does not exist; valid until the schema changes
+    const TableInfo* find_table(const std::string& name);
+    bool get_table_list(std::vector<std::string>& table_list);      // tables and views, ordered by name
+
+    static ColumnAffinity affinity(const std::string& declared_type);
+
+    void invalidate();
+    void release();                      // finalize internal statements (before sqlite3_close)
+
+    sqlite3_int64 get_schema_version() const { return _schema_version; }
+    size_t get_reload_count() const { return _reloads; }
+
+private:
+    struct Entry
+    {
+        TableInfo info;
+        bool loaded = false;             // columns and indexes
+    };
+
+    SqliteWrap& _wrap;
+    sqlite3_stmt* _version_statement = nullptr;
+    sqlite3_int64 _schema_version = -1;
+    bool _listed = false;
+    size_t _reloads = 0;
+
+    std::unordered_map<std::string, Entry> _tables;
+    std::vector<std::string> _names;                            // tables and views, ordered by name
+    std::unordered_map<std::string, std::string> _index_sql;
+
+    bool check_version();
+    bool load_list();
+    bool load_table(TableInfo& info);
+};
+
+#endif // SCHEMACACHE_H
@@ -0,0 +1,872 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+
+#include "shardeddb.h"
+#include "logger.h"
+
+
+struct ShardedDb::Shard
+{
+    SqliteWrap db;
+    std::string path;
+    std::mutex mutex;                    // one statement / transaction at a time per connection
+    ShardMetrics metrics;
+};
+
+
+namespace
+{
+    // FNV-1a, 64 bits : stable across runs and platforms, the placement of rows depends on it
+    uint64_t hash_bytes(char tag, const void* data, size_t size)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        hash = (hash ^ static_cast<unsigned char>(tag)) * 1099511628211ULL;
+
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) hash = (hash ^ p[i]) * 1099511628211ULL;
+
+        return hash;
+    }
+
+    uint64_t hash_integer(sqlite3_int64 value)
+    {
+        unsigned char bytes[8];
+        for (int i = 0; i < 8; i++) bytes[i] = static_cast<unsigned char>(static_cast<uint64_t>(value) >> (8 * i));
+        return hash_bytes('i', bytes, 8);
+    }
+
+    uint64_t hash_real(double value)
+    {
+        if (std::floor(value) == value && value >= -9223372036854775808.0 && value < 9223372036854775808.0)
+            return hash_integer(static_cast<sqlite3_int64>(value));
+
+        unsigned char bytes[8];
+        uint64_t bits;
+        std::memcpy(&bits, &value, 8);
+        for (int i = 0; i < 8; i++) bytes[i] = static_cast<unsigned char>(bits >> (8 * i));
+        return hash_bytes('r', bytes, 8);
+    }
+
+    // Lamping & Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm"
+    int jump_consistent_hash(uint64_t key, int buckets)
+    {
+        int64_t b = -1;
+        int64_t j = 0;
+        while (j < buckets)
+        {
+            b = j;
+            key = key * 2862933555777941757ULL + 1;
+            j = static_cast<int64_t>((b + 1) * (static_cast<double>(1LL << 31) / static_cast<double>((key >> 33) + 1)));
+        }
+        return static_cast<int>(b);
+    }
+
+    // NULL (and arrays) : shard 0
+    bool hash_value(const SqlValue& value, uint64_t& hash)
+    {
+        if (std::holds_alternative<sqlite3_int64>(value)) hash = hash_integer(std::get<sqlite3_int64>(value));
+        else if (std::holds_alternative<double>(value)) hash = hash_real(std::get<double>(value));
+        else if (std::holds_alternative<std::string>(value))
+        {
+            const std::string& text = std::get<std::string>(value);
+            hash = hash_bytes('t', text.data(), text.size());
+        }
+        else if (std::holds_alternative<SqlBlob>(value))
+        {
+            const SqlBlob& blob = std::get<SqlBlob>(value);
+            hash = hash_bytes('b', blob.data(), blob.size());
+        }
+        else return false;
+
+        return true;
+    }
+
+    bool hash_value(sqlite3_value* value, uint64_t& hash)
+    {
+        switch (sqlite3_value_type(value))
+        {
+        case SQLITE_INTEGER:
+            hash = hash_integer(sqlite3_value_int64(value));
+            break;
+        case SQLITE_FLOAT:
+            hash = hash_real(sqlite3_value_double(value));
+            break;
+        case SQLITE_TEXT:
+        {
+            const unsigned char* text = sqlite3_value_text(value);
+            hash = hash_bytes('t', text, static_cast<size_t>(sqlite3_value_bytes(value)));
+            break;
+        }
+        case SQLITE_BLOB:
+        {
+            const void* blob = sqlite3_value_blob(value);
+            hash = hash_bytes('b', blob, static_cast<size_t>(sqlite3_value_bytes(value)));
+            break;
+        }
+        default:
+            return false;
+        }
+
+        return true;
+    }
+
+    ShardRow read_row(sqlite3_stmt* statement, int column_count)
+    {
+        ShardRow row;
+        row.reserve(static_cast<size_t>(column_count));
+
+        for (int i = 0; i < column_count; i++)
+        {
+            switch (sqlite3_column_type(statement, i))
+            {
+            case SQLITE_INTEGER:
+                row.emplace_back(static_cast<sqlite3_int64>(sqlite3_column_int64(statement, i)));
+                break;
+            case SQLITE_FLOAT:
+                row.emplace_back(sqlite3_column_double(statement, i));
+                break;
+            case SQLITE_TEXT:
+            {
+                const char* text = reinterpret_cast<const char*>(sqlite3_column_text(statement, i));
+                row.emplace_back(std::string(text, static_cast<size_t>(sqlite3_column_bytes(statement, i))));
+                break;
+            }
+            case SQLITE_BLOB:
+            {
+                const unsigned char* data = static_cast<const unsigned char*>(sqlite3_column_blob(statement, i));
+                row.emplace_back(SqlBlob(data, data + sqlite3_column_bytes(statement, i)));
+                break;
+            }
+            default:
+                row.emplace_back(nullptr);
+                break;
+            }
+        }
+
+        return row;
+    }
+
+    // SQLite order : NULL < INTEGER / REAL (numerically) < TEXT < BLOB (memcmp)
+    int storage_rank(const SqlValue& value)
+    {
+        if (std::holds_alternative<sqlite3_int64>(value) || std::holds_alternative<double>(value)) return 1;
+        if (std::holds_alternative<std::string>(value)) return 2;
+        if (std::holds_alternative<SqlBlob>(value)) return 3;
+        return 0;
+    }
+
+    int compare_values(const SqlValue& a, const SqlValue& b)
+    {
+        int rank_a = storage_rank(a);
+        int rank_b = storage_rank(b);
+        if (rank_a != rank_b) return rank_a < rank_b ? -1 : 1;
+
+        switch (rank_a)
+        {
+        case 1:
+        {
+            if (std::holds_alternative<sqlite3_int64>(a) && std::holds_alternative<sqlite3_int64>(b))
+            {
+                sqlite3_int64 x = std::get<sqlite3_int64>(a);
+                sqlite3_int64 y = std::get<sqlite3_int64>(b);
+                return x < y ? -1 : (x > y ? 1 : 0);
+            }
+            double x = std::holds_alternative<double>(a) ? std::get<double>(a) : static_cast<double>(std::get<sqlite3_int64>(a));
+            double y = std::holds_alternative<double>(b) ? std::get<double>(b) : static_cast<double>(std::get<sqlite3_int64>(b));
+            return x < y ? -1 : (x > y ? 1 : 0);
+        }
+        case 2:
+            return std::get<std::string>(a).compare(std::get<std::string>(b));
+        case 3:
+        {
+            const SqlBlob& x = std::get<SqlBlob>(a);
+            const SqlBlob& y = std::get<SqlBlob>(b);
+            size_t size = std::min(x.size(), y.size());
+            int c = size ? std::memcmp(x.data(), y.data(), size) : 0;
+            if (c) return c;
+            return x.size() < y.size() ? -1 : (x.size() > y.size() ? 1 : 0);
+        }
+        default:
+            return 0;
+        }
+    }
+
+    bool exec(sqlite3* db, const std::string& sql, std::string& error)
+    {
+        char* message = nullptr;
+        if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &message) == SQLITE_OK) return true;
+
+        error = message ? message : sqlite3_errmsg(db);
+        sqlite3_free(message);
+        return false;
+    }
+
+    double elapsed_ms(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+
+ShardedDb::ShardedDb()
+{
+}
+
+
+ShardedDb::~ShardedDb()
+{
+    close();
+}
+
+
+bool ShardedDb::open(const std::string &prefix, int shard_count)
+{
+    close();
+
+    if (shard_count < 1) return error("open", "Invalid shard count.");
+
+    _prefix = prefix;
+
+    for (int i = 0; i < shard_count; i++)
+    {
+        if (!open_shard(i, shard_count))
+        {
+            close_shards();
+            return false;
+        }
+    }
+
+    start_pool();
+    return true;
+}
+
+
+bool ShardedDb::close()
+{
+    if (!is_open()) return true;
+
+    stop_pool();
+    close_shards();
+    return true;
+}
+
+
+int ShardedDb::shard_of(const SqlValue &key) const
+{
+    return shard_of(key, get_shard_count());
+}
+
+
+int ShardedDb::shard_of(const SqlValue &key, int shard_count)
+{
+    uint64_t hash;
+    if (shard_count <= 1 || !hash_value(key, hash)) return 0;
+
+    return jump_consistent_hash(hash, shard_count);
+}
+
+
+std::string ShardedDb::shard_path(int shard) const
+{
+    return _prefix + "-" + std::to_string(shard) + ".db";
+}
+
+
+bool ShardedDb::execute_all(const std::string &sql)
+{
+    if (!is_open()) return error("execute_all", "Database not open.");
+
+    return run_all("execute_all", [&](int shard, std::string& message)
+    {
+        Shard& s = *_shards[shard];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto start = std::chrono::steady_clock::now();
+
+        bool ok = exec(s.db.get_handle(), sql, message);
+
+        s.metrics.writes++;
+        s.metrics.busy_ms += elapsed_ms(start);
+        return ok;
+    });
+}
+
+
+bool ShardedDb::execute(const SqlValue &key, const std::string &sql, const std::vector<SqlValue> &params)
+{
+    if (!is_open()) return error("execute", "Database not open.");
+
+    int shard = shard_of(key);
+    std::string message;
+    if (!run(shard, true, sql, params, nullptr, message)) return error("execute", "Shard " + std::to_string(shard) + ": " + message);
+
+    return true;
+}
+
+
+bool ShardedDb::insert(const std::string &table, const std::vector<std::string> &columns, size_t key_column, const std::vector<ShardRow> &rows)
+{
+    if (!is_open()) return error("insert", "Database not open.");
+    if (columns.empty() || key_column >= columns.size()) return error("insert", "Invalid key column.");
+
+    std::vector<std::vector<const ShardRow*>> groups(_shards.size());
+    for (const ShardRow& row : rows)
+    {
+        if (row.size() != columns.size()) return error("insert", "Row size differs from the column count.");
+        groups[static_cast<size_t>(shard_of(row[key_column]))].push_back(&row);
+    }
+
+    std::string sql = "INSERT INTO " + SqliteWrap::quote_identifier(table) + " (";
+    for (size_t i = 0; i < columns.size(); i++) sql += (i ? ", " : "") + SqliteWrap::quote_identifier(columns[i]);
+    sql += ") VALUES (";
+    for (size_t i = 0; i < columns.size(); i++) sql += i ? ", ?" : "?";
+    sql += ");";
+
+    return run_all("insert", [&](int shard, std::string& message)
+    {
+        const std::vector<const ShardRow*>& group = groups[static_cast<size_t>(shard)];
+        if (group.empty()) return true;
+
+        Shard& s = *_shards[shard];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto start = std::chrono::steady_clock::now();
+
+        sqlite3* db = s.db.get_handle();
+        if (!exec(db, "SAVEPOINT sqlitewrap_shard_insert;", message)) return false;
+
+        sqlite3_stmt* statement = nullptr;
+        bool ok = sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr) == SQLITE_OK;
+
+        for (size_t i = 0; ok && i < group.size(); i++)
+        {
+            ok = SqliteWrap::bind_values(statement, *group[i]) && sqlite3_step(statement) == SQLITE_DONE;
+            sqlite3_reset(statement);
+        }
+
+        if (!ok) message = sqlite3_errmsg(db);
+        sqlite3_finalize(statement);
+
+        std::string ignored;
+        if (ok) ok = exec(db, "RELEASE sqlitewrap_shard_insert;", message);
+        else exec(db, "ROLLBACK TO sqlitewrap_shard_insert; RELEASE sqlitewrap_shard_insert;", ignored);
+
+        s.metrics.writes++;
+        if (ok) s.metrics.rows_written += group.size();
+        s.metrics.busy_ms += elapsed_ms(start);
+        return ok;
+    });
+}
+
+
+bool ShardedDb::query(const std::string &sql, const std::vector<SqlValue> &params, std::vector<ShardRow> &rows, const ShardMerge &merge)
+{
+    rows.clear();
+    if (!is_open()) return error("query", "Database not open.");
+
+    std::vector<std::vector<ShardRow>> results(_shards.size());
+    bool ok = run_all("query", [&](int shard, std::string& message)
+    {
+        return run(shard, false, sql, params, &results[static_cast<size_t>(shard)], message);
+    });
+    if (!ok) return false;
+
+    size_t total = 0;
+    for (const auto& result : results) total += result.size();
+    rows.reserve(total);
+    for (auto& result : results) std::move(result.begin(), result.end(), std::back_inserter(rows));
+
+    if (!merge.order_by.empty())
+    {
+        for (const ShardSortKey& key : merge.order_by)
+            if (key.column < 0 || (!rows.empty() && static_cast<size_t>(key.column) >= rows.front().size()))
+            {
+                rows.clear();
+                return error("query", "Invalid sort column " + std::to_string(key.column) + ".");
+            }
+
+        auto less = [&merge](const ShardRow& a, const ShardRow& b)
+        {
+            for (const ShardSortKey& key : merge.order_by)
+            {
+                int c = compare_values(a[static_cast<size_t>(key.column)], b[static_cast<size_t>(key.column)]);
+                if (c) return key.descending ? c > 0 : c < 0;
+            }
+            return false;
+        };
+
+        // only the rows kept by offset / limit need to be in order
+        size_t needed = rows.size();
+        if (merge.limit >= 0) needed = std::min(needed, static_cast<size_t>(std::max<sqlite3_int64>(merge.offset, 0) + merge.limit));
+
+        if (needed < rows.size()) std::partial_sort(rows.begin(), rows.begin() + static_cast<std::ptrdiff_t>(needed), rows.end(), less);
+        else std::sort(rows.begin(), rows.end(), less);
+    }
+
+    size_t offset = static_cast<size_t>(std::max<sqlite3_int64>(merge.offset, 0));
+    if (offset >= rows.size()) rows.clear();
+    else if (offset > 0) rows.erase(rows.begin(), rows.begin() + static_cast<std::ptrdiff_t>(offset));
+
+    if (merge.limit >= 0 && rows.size() > static_cast<size_t>(merge.limit)) rows.resize(static_cast<size_t>(merge.limit));
+
+    return true;
+}
+
+
+bool ShardedDb::query(const SqlValue &key, const std::string &sql, const std::vector<SqlValue> &params, std::vector<ShardRow> &rows)
+{
+    rows.clear();
+    if (!is_open()) return error("query", "Database not open.");
+
+    int shard = shard_of(key);
+    std::string message;
+    if (!run(shard, false, sql, params, &rows, message)) return error("query", "Shard " + std::to_string(shard) + ": " + message);
+
+    return true;
+}
+
+
+bool ShardedDb::count(const std::string &table, const std::string &condition, const std::vector<SqlValue> &params, sqlite3_int64 &count)
+{
+    count = 0;
+
+    std::string sql = "SELECT COUNT(*) FROM " + SqliteWrap::quote_identifier(table);
+    if (!condition.empty()) sql += " WHERE " + condition;
+    sql += ";";
+
+    std::vector<ShardRow> rows;
+    if (!query(sql, params, rows)) return false;
+
+    for (const ShardRow& row : rows) count += std::get<sqlite3_int64>(row[0]);
+    return true;
+}
+
+
+bool ShardedDb::table_counts(const std::string &table, std::vector<sqlite3_int64> &counts)
+{
+    counts.assign(_shards.size(), 0);
+    if (!is_open()) return error("table_counts", "Database not open.");
+
+    std::string sql = "SELECT COUNT(*) FROM " + SqliteWrap::quote_identifier(table) + ";";
+
+    return run_all("table_counts", [&](int shard, std::string& message)
+    {
+        std::vector<ShardRow> rows;
+        if (!run(shard, false, sql, {}, &rows, message)) return false;
+
+        counts[static_cast<size_t>(shard)] = std::get<sqlite3_int64>(rows[0][0]);
+        return true;
+    });
+}
+
+
+bool ShardedDb::check_placement(const std::string &table, const std::string &key_column, sqlite3_int64 &misplaced)
+{
+    misplaced = 0;
+    if (!is_open()) return error("check_placement", "Database not open.");
+
+    std::vector<sqlite3_int64> counts(_shards.size(), 0);
+    std::string sql = "SELECT COUNT(*) FROM " + SqliteWrap::quote_identifier(table) +
+                      " WHERE sqlitewrap_shard(" + SqliteWrap::quote_identifier(key_column) + ", ?) <> ?;";
+
+    bool ok = run_all("check_placement", [&](int shard, std::string& message)
+    {
+        std::vector<ShardRow> rows;
+        if (!run(shard, false, sql, { sqlite3_int64(_shards.size()), sqlite3_int64(shard) }, &rows, message)) return false;
+
+        counts[static_cast<size_t>(shard)] = std::get<sqlite3_int64>(rows[0][0]);
+        return true;
+    });
+
+    for (sqlite3_int64 count : counts) misplaced += count;
+    return ok;
+}
+
+
+bool ShardedDb::rebalance(int shard_count, const std::vector<ShardKey> &keys)
+{
+    if (!is_open()) return error("rebalance", "Database not open.");
+    if (shard_count < 1) return error("rebalance", "Invalid shard count.");
+
+    int old_count = get_shard_count();
+    if (shard_count == old_count) return true;
+
+    // every table must move with its key
+    std::vector<std::string> tables;
+    std::vector<std::pair<std::string, std::string>> schema;
+    {
+        Shard& s = *_shards[0];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        sqlite3* db = s.db.get_handle();
+
+        sqlite3_stmt* statement = nullptr;
+        if (sqlite3_prepare_v2(db, "SELECT type, name, sql FROM sqlite_master WHERE sql IS NOT NULL "
+                                   "AND name NOT LIKE 'sqlite\\_%' ESCAPE '\\' AND name <> 'sqlitewrap_shards' ORDER BY rowid;",
+                               -1, &statement, nullptr) != SQLITE_OK)
+        {
+            sqlite3_finalize(statement);
+            return error("rebalance", sqlite3_errmsg(db));
+        }
+
+        while (sqlite3_step(statement) == SQLITE_ROW)
+        {
+            std::string type = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
+            std::string name = reinterpret_cast<const char*>(sqlite3_column_text(statement, 1));
+            if (type == "table") tables.push_back(name);
+            schema.emplace_back(name, reinterpret_cast<const char*>(sqlite3_column_text(statement, 2)));
+        }
+        sqlite3_finalize(statement);
+    }
+
+    for (const std::string& table : tables)
+    {
+        auto listed = std::find_if(keys.begin(), keys.end(), [&](const ShardKey& key) { return sqlite3_stricmp(key.table.c_str(), table.c_str()) == 0; });
+        if (listed == keys.end()) return error("rebalance", "No shard key for table " + table + ".");
+    }
+
+    stop_pool();
+
+    // new shards : missing schema objects copied from shard 0 (a previous run may have created some)
+    for (int i = old_count; i < shard_count; i++)
+    {
+        if (!open_shard(i, shard_count))
+        {
+            close();
+            return false;
+        }
+
+        Shard& s = *_shards[static_cast<size_t>(i)];
+        for (const auto& object : schema)
+        {
+            bool found = false;
+            std::string message;
+            sqlite3_stmt* statement = nullptr;
+            if (sqlite3_prepare_v2(s.db.get_handle(), "SELECT 1 FROM sqlite_master WHERE name = ?;", -1, &statement, nullptr) == SQLITE_OK)
+            {
+                sqlite3_bind_text(statement, 1, object.first.c_str(), -1, SQLITE_STATIC);
+                found = sqlite3_step(statement) == SQLITE_ROW;
+            }
+            sqlite3_finalize(statement);
+
+            if (!found && !exec(s.db.get_handle(), object.second + ";", message))
+            {
+                error("rebalance", "Shard " + std::to_string(i) + ": " + message);
+                close();
+                return false;
+            }
+        }
+    }
+
+    // jump hashing : growing moves rows to the new shards only, shrinking moves the rows
+    // of the removed shards only
+    int first_source = shard_count > old_count ? 0 : shard_count;
+    int last_source = old_count;
+    int first_target = shard_count > old_count ? old_count : 0;
+    int last_target = shard_count;
+
+    for (int i = first_source; i < last_source; i++)
+    {
+        for (int j = first_target; j < last_target; j++)
+        {
+            Shard& source = *_shards[static_cast<size_t>(i)];
+            Shard& target = *_shards[static_cast<size_t>(j)];
+            std::scoped_lock lock(source.mutex, target.mutex);
+            auto start = std::chrono::steady_clock::now();
+
+            std::string condition = ", " + std::to_string(shard_count) + ") = " + std::to_string(j);
+            std::string script = "ATTACH DATABASE " + SqliteWrap::quote_literal(target.path) + " AS sqlitewrap_target;"
+                                 "SAVEPOINT sqlitewrap_rebalance;";
+            for (const ShardKey& key : keys)
+            {
+                std::string table = SqliteWrap::quote_identifier(key.table);
+                std::string where = " WHERE sqlitewrap_shard(" + SqliteWrap::quote_identifier(key.column) + condition;
+                script += "INSERT OR REPLACE INTO sqlitewrap_target." + table + " SELECT * FROM main." + table + where + ";"
+                          "DELETE FROM main." + table + where + ";";
+            }
+            script += "RELEASE sqlitewrap_rebalance;";
+
+            sqlite3* db = source.db.get_handle();
+            std::string message;
+            std::string ignored;
+            bool ok = exec(db, script, message);
+            if (!ok) exec(db, "ROLLBACK TO sqlitewrap_rebalance; RELEASE sqlitewrap_rebalance;", ignored);
+            exec(db, "DETACH DATABASE sqlitewrap_target;", ignored);
+
+            source.metrics.writes++;
+            source.metrics.busy_ms += elapsed_ms(start);
+
+            if (!ok)
+            {
+                error("rebalance", "Shard " + std::to_string(i) + " to " + std::to_string(j) + ": " + message);
+                close();
+                return false;
+            }
+        }
+    }
+
+    for (int i = 0; i < std::min(old_count, shard_count); i++)
+    {
+        std::string message;
+        if (!exec(_shards[static_cast<size_t>(i)]->db.get_handle(), "UPDATE sqlitewrap_shards SET shard_count = " + std::to_string(shard_count) + ";", message))
+        {
+            error("rebalance", "Shard " + std::to_string(i) + ": " + message);
+            close();
+            return false;
+        }
+    }
+
+    // removed shards are empty now
+    while (get_shard_count() > shard_count)
+    {
+        std::string path = _shards.back()->path;
+        _shards.back()->db.disconnect();
+        _shards.pop_back();
+
+        std::error_code ignored;
+        std::filesystem::remove(path, ignored);
+    }
+
+    start_pool();
+    return true;
+}
+
+
+bool ShardedDb::get_metrics(std::vector<ShardMetrics> &metrics)
+{
+    metrics.clear();
+    if (!is_open()) return error("get_metrics", "Database not open.");
+
+    for (auto& shard : _shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        ShardMetrics m = shard->metrics;
+
+        sqlite3_stmt* statement = nullptr;
+        if (sqlite3_prepare_v2(shard->db.get_handle(), "SELECT page_count * page_size FROM pragma_page_count(), pragma_page_size();",
+                               -1, &statement, nullptr) == SQLITE_OK && sqlite3_step(statement) == SQLITE_ROW)
+            m.size_bytes = sqlite3_column_int64(statement, 0);
+        sqlite3_finalize(statement);
+
+        metrics.push_back(m);
+    }
+
+    return true;
+}
+
+
+void ShardedDb::reset_metrics()
+{
+    for (auto& shard : _shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->metrics = ShardMetrics();
+        shard->metrics.path = shard->path;
+    }
+}
+
+
+bool ShardedDb::open_shard(int shard, int shard_count)
+{
+    auto s = std::make_unique<Shard>();
+    s->path = shard_path(shard);
+    s->metrics.path = s->path;
+
+    bool ok = std::filesystem::exists(s->path) ? s->db.connect(s->path) : s->db.create_db(s->path);
+    if (!ok) return error("open", "Cannot open " + s->path);
+
+    ok = s->db.register_function("sqlitewrap_shard", [](sqlite3_value* key, int count) -> int
+    {
+        uint64_t hash;
+        if (count <= 1 || !hash_value(key, hash)) return 0;
+        return jump_consistent_hash(hash, count);
+    });
+
+    // placement record : opening with another shard count would route keys elsewhere
+    std::string message;
+    sqlite3* db = s->db.get_handle();
+    ok = ok && exec(db, "CREATE TABLE IF NOT EXISTS sqlitewrap_shards (shard INTEGER NOT NULL, shard_count INTEGER NOT NULL);"
+                        "INSERT INTO sqlitewrap_shards SELECT " + std::to_string(shard) + ", " + std::to_string(shard_count) +
+                        " WHERE NOT EXISTS (SELECT 1 FROM sqlitewrap_shards);", message);
+
+    sqlite3_stmt* statement = nullptr;
+    if (ok && sqlite3_prepare_v2(db, "SELECT shard, shard_count FROM sqlitewrap_shards;", -1, &statement, nullptr) == SQLITE_OK
+        && sqlite3_step(statement) == SQLITE_ROW)
+    {
+        int recorded = sqlite3_column_int(statement, 0);
+        int recorded_count = sqlite3_column_int(statement, 1);
+        if (recorded != shard || recorded_count != shard_count)
+        {
+            ok = false;
+            message = "File of shard " + std::to_string(recorded) + " of " + std::to_string(recorded_count) +
+                      ", opened as shard " + std::to_string(shard) + " of " + std::to_string(shard_count) + ".";
+        }
+    }
+    else if (ok)
+    {
+        ok = false;
+        message = sqlite3_errmsg(db);
+    }
+    sqlite3_finalize(statement);
+
+    if (!ok)
+    {
+        s->db.disconnect();
+        return error("open", s->path + ": " + message);
+    }
+
+    _shards.push_back(std::move(s));
+    return true;
+}
+
+
+void ShardedDb::close_shards()
+{
+    for (auto& shard : _shards) shard->db.disconnect();
+    _shards.clear();
+}
+
+
+void ShardedDb::start_pool()
+{
+    unsigned int cores = std::thread::hardware_concurrency();
+    size_t count = std::min(_shards.size(), static_cast<size_t>(cores > 0 ? cores : 1));
+    if (count < 2) return;              // run_all runs the tasks itself
+
+    _stop = false;
+    for (size_t i = 0; i < count; i++)
+    {
+        _workers.emplace_back([this]
+        {
+            std::unique_lock<std::mutex> lock(_pool_mutex);
+            for (;;)
+            {
+                _pool_signal.wait(lock, [this] { return _stop || !_tasks.empty(); });
+                if (_tasks.empty()) return;
+
+                std::function<void()> task = std::move(_tasks.front());
+                _tasks.pop_front();
+
+                lock.unlock();
+                task();
+                lock.lock();
+            }
+        });
+    }
+}
+
+
+void ShardedDb::stop_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_pool_mutex);
+        _stop = true;
+    }
+    _pool_signal.notify_all();
+
+    for (std::thread& worker : _workers) worker.join();
+    _workers.clear();
+}
+
+
+bool ShardedDb::run_all(const char *function, const std::function<bool(int, std::string &)> &task)
+{
+    int count = get_shard_count();
+    std::vector<std::string> messages(static_cast<size_t>(count));
+    std::vector<char> results(static_cast<size_t>(count), 1);
+
+    if (_workers.empty())
+    {
+        for (int i = 0; i < count; i++) results[static_cast<size_t>(i)] = task(i, messages[static_cast<size_t>(i)]);
+    }
+    else
+    {
+        std::mutex done_mutex;
+        std::condition_variable done_signal;
+        int remaining = count;
+
+        {
+            std::lock_guard<std::mutex> lock(_pool_mutex);
+            for (int i = 0; i < count; i++)
+            {
+                _tasks.emplace_back([&, i]
+                {
+                    bool ok = task(i, messages[static_cast<size_t>(i)]);
+
+                    std::lock_guard<std::mutex> done_lock(done_mutex);
+                    results[static_cast<size_t>(i)] = ok;
+                    if (--remaining == 0) done_signal.notify_one();
+                });
+            }
+        }
+        _pool_signal.notify_all();
+
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done_signal.wait(lock, [&] { return remaining == 0; });
+    }
+
+    for (int i = 0; i < count; i++)
+        if (!results[static_cast<size_t>(i)]) return error(function, "Shard " + std::to_string(i) + ": " + messages[static_cast<size_t>(i)]);
+
+    return true;
+}
+
+
+bool ShardedDb::run(int shard, bool write, const std::string &sql, const std::vector<SqlValue> &params, std::vector<ShardRow> *rows, std::string &error)
+{
+    Shard& s = *_shards[static_cast<size_t>(shard)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto start = std::chrono::steady_clock::now();
+
+    sqlite3* db = s.db.get_handle();
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK || !SqliteWrap::bind_values(statement, params))
+    {
+        error = sqlite3_errmsg(db);
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    int column_count = sqlite3_column_count(statement);
+    unsigned long long count = 0;
+
+    int rc;
+    while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+    {
+        if (rows) rows->push_back(read_row(statement, column_count));
+        count++;
+    }
+
+    bool ok = rc == SQLITE_DONE;
+    if (!ok) error = sqlite3_errmsg(db);
+    sqlite3_finalize(statement);
+
+    if (write)
+    {
+        s.metrics.writes++;
+        if (ok) s.metrics.rows_written += static_cast<unsigned long long>(sqlite3_changes(db));
+    }
+    else
+    {
+        s.metrics.reads++;
+        s.metrics.rows_read += count;
+    }
+    s.metrics.busy_ms += elapsed_ms(start);
+
+    return ok;
+}
+
+
+bool ShardedDb::error(const char *function, const std::string &message)
+{
+    _last_error = message;
+    SQLITEWRAP_LOG_ERROR("ShardedDb::" << function << "(...) - Error: " << message);
+    return false;
+}
+
+
+SqliteWrap *ShardedDb::get_shard(int shard)
+{
+    if (shard < 0 || shard >= get_shard_count()) return nullptr;
+    return &_shards[static_cast<size_t>(shard)]->db;
+}
@@ -0,0 +1,147 @@
+#ifndef SHARDEDDB_H
+#define SHARDEDDB_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlitewrap.h"
+
+using ShardRow = std::vector<SqlValue>;
+
+struct ShardSortKey
+{
+    int column = 0;                      // index in the result row
+    bool descending = false;
+};
+
+// how the rows of the shards are combined : ordered (SQLite order of values, BINARY
+// collation), then offset / limit applied to the whole result
+struct ShardMerge
+{
+    std::vector<ShardSortKey> order_by;
+    sqlite3_int64 limit = -1;            // -1 : no limit
+    sqlite3_int64 offset = 0;
+};
+
+struct ShardMetrics
+{
+    std::string path;
+    unsigned long long reads = 0;        // statements run
+    unsigned long long writes = 0;
+    unsigned long long rows_read = 0;
+    unsigned long long rows_written = 0;
+    double busy_ms = 0;                  // time spent running statements on the shard
+    sqlite3_int64 size_bytes = 0;        // page_count * page_size
+};
+
+// table moved by rebalance() and the column its rows are routed by
+struct ShardKey
+{
+    std::string table;
+    std::string column;
+};
+
+// A logical database split across N files ("<prefix>-<i>.db"), one SqliteWrap writer
+// each : writes to different shards never wait on each other.
+//
+// Rows are routed by key : a 64-bit FNV-1a hash of the value (integral reals hash as
+// integers, as 1 = 1.0 in SQL) mapped to a shard by jump consistent hashing, so going
+// from N to M shards only moves the rows that must move. Pass keys with the type of
+// their column : 5 and '5' go to different shards. The function sqlitewrap_shard(key,
+// shard_count) is available in SQL on every shard.
+//
+//     ShardedDb db;
+//     db.open("data/events", 8);
+//     db.execute_all("CREATE TABLE IF NOT EXISTS event(id INTEGER PRIMARY KEY, user TEXT, at INTEGER);");
+//     db.insert("event", { "id", "user", "at" }, 0, rows);
+//     db.query("SELECT * FROM event WHERE at > ? ORDER BY at DESC LIMIT 100;", { since }, result, { { { 2, true } }, 100 });
+//
+// Reads run on every shard in parallel (thread pool, one task per shard) and the rows
+// are merged here; put the same ORDER BY / LIMIT (limit + offset rows) in the SQL so
+// each shard only returns its candidates. Aggregates are per shard : recombine them
+// (count() sums COUNT(*)). Cross-shard writes are not atomic.
+//
+// The shard count is recorded in each file (table sqlitewrap_shards) and checked by open().
+class SQLITEWRAP_EXPORT ShardedDb
+{
+public:
+    ShardedDb();
+    ~ShardedDb();
+
+    ShardedDb(const ShardedDb&) = delete;
+    ShardedDb& operator=(const ShardedDb&) = delete;
+
+    // opens (creates if missing) the shard files
+    bool open(const std::string& prefix, int shard_count);
+    bool close();
+    bool is_open() const { return !_shards.empty(); }
+
+    int shard_of(const SqlValue& key) const;
+    static int shard_of(const SqlValue& key, int shard_count);
+    std::string shard_path(int shard) const;
+
+    // every shard (schema, pragmas)
+    bool execute_all(const std::string& sql);
+
+    // routed writes : one statement on the shard of the key, or rows grouped by shard and
+    // inserted in one transaction per shard, shards in parallel
+    bool execute(const SqlValue& key, const std::string& sql, const std::vector<SqlValue>& params = {});
+    bool insert(const std::string& table, const std::vector<std::string>& columns, size_t key_column,
+                const std::vector<ShardRow>& rows);
+
+    // scatter-gather read, or a read on the shard of the key only
+    bool query(const std::string& sql, const std::vector<SqlValue>& params, std::vector<ShardRow>& rows,
+               const ShardMerge& merge = ShardMerge());
+    bool query(const SqlValue& key, const std::string& sql, const std::vector<SqlValue>& params, std::vector<ShardRow>& rows);
+    bool count(const std::string& table, const std::string& condition, const std::vector<SqlValue>& params, sqlite3_int64& count);
+
+    // rebalancing : rows per shard (skew), rows not on the shard of their key, and moving
+    // to a new shard count. Every table must be listed with its key; rows move with
+    // INSERT OR REPLACE then DELETE in one transaction per (source, target) pair, so an
+    // interrupted rebalance can be run again after open() with the old count.
+    bool table_counts(const std::string& table, std::vector<sqlite3_int64>& counts);
+    bool check_placement(const std::string& table, const std::string& key_column, sqlite3_int64& misplaced);
+    bool rebalance(int shard_count, const std::vector<ShardKey>& keys);
+
+    bool get_metrics(std::vector<ShardMetrics>& metrics);
+    void reset_metrics();
+
+private:
+    struct Shard;
+
+    std::string _prefix;
+    std::vector<std::unique_ptr<Shard>> _shards;
+    std::string _last_error;
+
+    // thread pool of the scatter-gather calls
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _tasks;
+    std::mutex _pool_mutex;
+    std::condition_variable _pool_signal;
+    bool _stop = false;
+
+    bool open_shard(int shard, int shard_count);
+    void close_shards();
+    void start_pool();
+    void stop_pool();
+    // runs task(shard) for every shard, waits for all; the first error is reported
+    bool run_all(const char* function, const std::function<bool(int, std::string&)>& task);
+    bool run(int shard, bool write, const std::string& sql, const std::vector<SqlValue>& params,
+             std::vector<ShardRow>* rows, std::string& error);
+    bool error(const char* function, const std::string& message);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+    int get_shard_count() const { return static_cast<int>(_shards.size()); }
+    SqliteWrap* get_shard(int shard);    // direct access : lock-free, not while other calls run
+};
+
+#endif // SHARDEDDB_H
@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "schemacache.h"
+#include "logger.h"
+#include "spatialindex.h"
+#include "sqlitewrap.h"
+
+
+namespace
+{
+    // R*Tree node blob : 2 bytes depth (root only), 2 bytes cell count, then cells of
+    // an 8 bytes rowid and min / max pairs of big-endian 32-bit floats
+    constexpr size_t node_header = 4;
+    constexpr size_t cell_size = 8 + 4 * sizeof(float);
+
+    float read_float(const unsigned char* data)
+    {
+        uint32_t bits = (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | uint32_t(data[3]);
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    double box_distance(const BoundingBox& box, double x, double y)
+    {
+        double dx = std::max({ box.min_x - x, 0.0, x - box.max_x });
+        double dy = std::max({ box.min_y - y, 0.0, y - box.max_y });
+        return std::sqrt(dx * dx + dy * dy);
+    }
+
+    bool contains(const BoundingBox& outer, const BoundingBox& inner)
+    {
+        return outer.min_x <= inner.min_x && outer.max_x >= inner.max_x && outer.min_y <= inner.min_y && outer.max_y >= inner.max_y;
+    }
+}
+
+
+SpatialIndex::SpatialIndex(SqliteWrap &db, const std::string &table, const SpatialColumns &columns, const std::string &index)
+    : _wrap(db), _table(table), _columns(columns), _index(index.empty() ? table + "_rtree" : index)
+{
+}
+
+
+SpatialIndex::~SpatialIndex()
+{
+    release();
+}
+
+
+bool SpatialIndex::create()
+{
+    if (!_wrap.get_handle()) return error("create", "Database not connected.");
+
+    SchemaCache* schema = _wrap.get_schema_cache();
+    const TableInfo* table = schema->find_table(_table);
+    if (!table || table->type != "table") return error("create", "No such table: " + _table);
+    if (table->without_rowid) return error("create", "Table " + _table + " has no rowid, it cannot be indexed.");
+
+    std::vector<std::string> columns;
+    for (const std::string* column : { &_columns.min_x, &_columns.max_x, &_columns.min_y, &_columns.max_y })
+    {
+        if (!table->find_column(*column)) return error("create", "No such column: " + _table + "." + *column);
+        if (std::find(columns.begin(), columns.end(), *column) == columns.end()) columns.push_back(*column);
+    }
+
+    bool found = schema->find_table(_index) != nullptr;
+
+    std::string index = SqliteWrap::quote_identifier(_index);
+    std::string quoted_table = SqliteWrap::quote_identifier(_table);
+
+    std::string not_null, changed = "old.rowid IS NOT new.rowid";
+    for (const std::string& column : columns)
+    {
+        std::string quoted = SqliteWrap::quote_identifier(column);
+        not_null += (not_null.empty() ? "new." : " AND new.") + quoted + " IS NOT NULL";
+        changed += " OR old." + quoted + " IS NOT new." + quoted;
+    }
+
+    std::string values = "new.rowid, new." + SqliteWrap::quote_identifier(_columns.min_x) +
+                         ", new." + SqliteWrap::quote_identifier(_columns.max_x) +
+                         ", new." + SqliteWrap::quote_identifier(_columns.min_y) +
+                         ", new." + SqliteWrap::quote_identifier(_columns.max_y);
+
+    // rows with a NULL coordinate are not indexed
+    std::string insert = "INSERT INTO " + index + " SELECT " + values + " WHERE " + not_null + ";";
+    std::string remove = "DELETE FROM " + index + " WHERE id = old.rowid;";
+
+    std::string sql =
+        "SAVEPOINT sqlitewrap_rtree;"
+        "CREATE VIRTUAL TABLE IF NOT EXISTS " + index + " USING rtree(id, min_x, max_x, min_y, max_y);"
+        "CREATE TRIGGER IF NOT EXISTS " + SqliteWrap::quote_identifier(_index + "_ai") +
+        " AFTER INSERT ON " + quoted_table + " BEGIN " + insert + " END;"
+        "CREATE TRIGGER IF NOT EXISTS " + SqliteWrap::quote_identifier(_index + "_ad") +
+        " AFTER DELETE ON " + quoted_table + " BEGIN " + remove + " END;"
+        "CREATE TRIGGER IF NOT EXISTS " + SqliteWrap::quote_identifier(_index + "_au") +
+        " AFTER UPDATE ON " + quoted_table + " WHEN " + changed + " BEGIN " + remove + " " + insert + " END;";
+
+    if (!found) sql += fill_statement();
+
+    sql += "RELEASE sqlitewrap_rtree;";
+
+    return execute_script("create", sql);
+}
+
+
+bool SpatialIndex::drop()
+{
+    std::string sql =
+        "SAVEPOINT sqlitewrap_rtree;"
+        "DROP TRIGGER IF EXISTS " + SqliteWrap::quote_identifier(_index + "_ai") + ";"
+        "DROP TRIGGER IF EXISTS " + SqliteWrap::quote_identifier(_index + "_ad") + ";"
+        "DROP TRIGGER IF EXISTS " + SqliteWrap::quote_identifier(_index + "_au") + ";"
+        "DROP TABLE IF EXISTS " + SqliteWrap::quote_identifier(_index) + ";"
+        "RELEASE sqlitewrap_rtree;";
+
+    release();
+    return execute_script("drop", sql);
+}
+
+
+bool SpatialIndex::exists(bool &found)
+{
+    if (!_wrap.get_handle()) return error("exists", "Database not connected.");
+
+    found = _wrap.get_schema_cache()->find_table(_index) != nullptr;
+    return true;
+}
+
+
+bool SpatialIndex::rebuild()
+{
+    std::string sql =
+        "SAVEPOINT sqlitewrap_rtree;"
+        "DELETE FROM " + SqliteWrap::quote_identifier(_index) + ";" +
+        fill_statement() +
+        "RELEASE sqlitewrap_rtree;";
+
+    _radius = 0;
+    return execute_script("rebuild", sql);
+}
+
+
+bool SpatialIndex::bounds(BoundingBox &box, bool &empty)
+{
+    if (!prepare("bounds", _root_statement, "SELECT data FROM " + SqliteWrap::quote_identifier(_index + "_node") + " WHERE nodeno = 1;"))
+        return false;
+
+    empty = true;
+    int rc = sqlite3_step(_root_statement);
+
+    if (rc == SQLITE_ROW)
+    {
+        const unsigned char* data = static_cast<const unsigned char*>(sqlite3_column_blob(_root_statement, 0));
+        size_t size = static_cast<size_t>(sqlite3_column_bytes(_root_statement, 0));
+        size_t cells = size >= node_header ? (size_t(data[2]) << 8 | data[3]) : 0;
+
+        // union of the root cells
+        for (size_t i = 0; i < cells && node_header + (i + 1) * cell_size <= size; i++)
+        {
+            const unsigned char* cell = data + node_header + i * cell_size + 8;
+            BoundingBox cell_box { read_float(cell), read_float(cell + 4), read_float(cell + 8), read_float(cell + 12) };
+
+            if (empty) box = cell_box;
+            else
+            {
+                box.min_x = std::min(box.min_x, cell_box.min_x);
+                box.max_x = std::max(box.max_x, cell_box.max_x);
+                box.min_y = std::min(box.min_y, cell_box.min_y);
+                box.max_y = std::max(box.max_y, cell_box.max_y);
+            }
+            empty = false;
+        }
+    }
+
+    sqlite3_reset(_root_statement);
+
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) return error("bounds", sqlite3_errmsg(_wrap.get_handle()));
+
+    return true;
+}
+
+
+bool SpatialIndex::window(const BoundingBox &box, std::vector<sqlite3_int64> &rowids)
+{
+    std::vector<Candidate> candidates;
+    if (!query_window("window", box, candidates)) return false;
+
+    rowids.clear();
+    rowids.reserve(candidates.size());
+    for (const Candidate& candidate : candidates) rowids.push_back(candidate.rowid);
+
+    return true;
+}
+
+
+bool SpatialIndex::window_rows(const BoundingBox &box, void *user_param, bool (*callback)(void *, char **, int))
+{
+    std::string sql =
+        "SELECT t.* FROM " + SqliteWrap::quote_identifier(_index) + " AS r CROSS JOIN " + SqliteWrap::quote_identifier(_table) +
+        " AS t ON t.rowid = r.id WHERE " + where_window() + ";";
+
+    if (!_wrap.query_sync(sql, { box.min_x, box.max_x, box.min_y, box.max_y }, user_param, callback))
+    {
+        _last_error = _wrap.get_last_error();
+        return false;
+    }
+
+    return true;
+}
+
+
+bool SpatialIndex::nearest(double x, double y, size_t k, std::vector<SpatialHit> &hits)
+{
+    hits.clear();
+    // the window would never hold a NaN or infinite point : it would grow forever
+    if (!std::isfinite(x) || !std::isfinite(y)) return error("nearest", "The point must have finite coordinates.");
+    if (k == 0) return true;
+
+    BoundingBox extent;
+    bool empty;
+    if (!bounds(extent, empty)) return false;
+    if (empty) return true;
+
+    // first window : the size that held about 2k rows last time, else 1/64 of the extent
+    double radius = _radius;
+    if (!(radius > 0)) radius = std::max(extent.max_x - extent.min_x, extent.max_y - extent.min_y) / 64;
+    if (!(radius > 0)) radius = 1;
+
+    std::vector<Candidate> candidates;
+    for (;;)
+    {
+        if (!query_window("nearest", { x - radius, x + radius, y - radius, y + radius }, candidates)) return false;
+
+        if (candidates.size() >= k || contains({ x - radius, x + radius, y - radius, y + radius }, extent)) break;
+
+        radius *= candidates.empty() ? 4 : std::max(2.0, std::sqrt(2.0 * static_cast<double>(k) / static_cast<double>(candidates.size())));
+    }
+
+    auto rank = [&]()
+    {
+        hits.clear();
+        hits.reserve(candidates.size());
+        for (const Candidate& candidate : candidates) hits.push_back({ candidate.rowid, box_distance(candidate.box, x, y) });
+
+        size_t n = std::min(k, hits.size());
+        std::partial_sort(hits.begin(), hits.begin() + static_cast<std::ptrdiff_t>(n), hits.end(),
+                          [](const SpatialHit& a, const SpatialHit& b) { return a.distance < b.distance; });
+    };
+
+    rank();
+
+    // the square window holds every row within radius of the point : a k-th distance
+    // beyond it means closer rows may lie outside, one more window of that size settles it
+    if (hits.size() >= k && hits[k - 1].distance > radius)
+    {
+        radius = hits[k - 1].distance;
+        if (!query_window("nearest", { x - radius, x + radius, y - radius, y + radius }, candidates)) return false;
+        rank();
+    }
+
+    if (hits.size() > k) hits.resize(k);
+
+    // density seen by this query, sized for 2k rows
+    if (!candidates.empty()) _radius = radius * std::sqrt(2.0 * static_cast<double>(k) / static_cast<double>(candidates.size()));
+
+    return true;
+}
+
+
+bool SpatialIndex::nearest_rows(double x, double y, size_t k, void *user_param, bool (*callback)(void *, char **, int))
+{
+    if (!std::isfinite(x) || !std::isfinite(y)) return error("nearest_rows", "The point must have finite coordinates.");
+
+    std::vector<SpatialHit> hits;
+    if (!nearest(x, y, k, hits)) return false;
+
+    std::vector<sqlite3_int64> rowids;
+    rowids.reserve(hits.size());
+    for (const SpatialHit& hit : hits) rowids.push_back(hit.rowid);
+
+    // carray rowid is the position in the array : rows come back nearest first
+    std::string sql = "SELECT t.* FROM carray(?) AS k CROSS JOIN " + SqliteWrap::quote_identifier(_table) + " AS t ON t.rowid = k.value ORDER BY k.rowid;";
+
+    if (!_wrap.query_sync(sql, { SqlArray(rowids) }, user_param, callback))
+    {
+        _last_error = _wrap.get_last_error();
+        return false;
+    }
+
+    return true;
+}
+
+
+void SpatialIndex::release()
+{
+    if (_window_statement)
+    {
+        sqlite3_finalize(_window_statement);
+        _window_statement = nullptr;
+    }
+
+    if (_root_statement)
+    {
+        sqlite3_finalize(_root_statement);
+        _root_statement = nullptr;
+    }
+}
+
+
+bool SpatialIndex::prepare(const char *function, sqlite3_stmt *&statement, const std::string &sql)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return error(function, "Database not connected.");
+
+    // kept from a previous connection
+    if (statement && sqlite3_db_handle(statement) != db)
+    {
+        sqlite3_finalize(statement);
+        statement = nullptr;
+    }
+
+    if (statement) return true;
+
+    if (sqlite3_prepare_v3(db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &statement, nullptr) != SQLITE_OK)
+    {
+        sqlite3_finalize(statement);
+        statement = nullptr;
+        return error(function, sqlite3_errmsg(db));
+    }
+
+    return true;
+}
+
+
+bool SpatialIndex::query_window(const char *function, const BoundingBox &box, std::vector<Candidate> &candidates)
+{
+    std::string sql =
+        "SELECT t.rowid, t." + SqliteWrap::quote_identifier(_columns.min_x) + ", t." + SqliteWrap::quote_identifier(_columns.max_x) +
+        ", t." + SqliteWrap::quote_identifier(_columns.min_y) + ", t." + SqliteWrap::quote_identifier(_columns.max_y) +
+        " FROM " + SqliteWrap::quote_identifier(_index) + " AS r CROSS JOIN " + SqliteWrap::quote_identifier(_table) +
+        " AS t ON t.rowid = r.id WHERE " + where_window() + ";";
+
+    if (!prepare(function, _window_statement, sql)) return false;
+
+    sqlite3_bind_double(_window_statement, 1, box.min_x);
+    sqlite3_bind_double(_window_statement, 2, box.max_x);
+    sqlite3_bind_double(_window_statement, 3, box.min_y);
+    sqlite3_bind_double(_window_statement, 4, box.max_y);
+
+    candidates.clear();
+
+    int rc;
+    while ((rc = sqlite3_step(_window_statement)) == SQLITE_ROW)
+    {
+        candidates.push_back({ sqlite3_column_int64(_window_statement, 0),
+                               { sqlite3_column_double(_window_statement, 1), sqlite3_column_double(_window_statement, 2),
+                                 sqlite3_column_double(_window_statement, 3), sqlite3_column_double(_window_statement, 4) } });
+    }
+
+    sqlite3_reset(_window_statement);
+
+    if (rc != SQLITE_DONE) return error(function, sqlite3_errmsg(_wrap.get_handle()));
+
+    return true;
+}
+
+
+std::string SpatialIndex::fill_statement() const
+{
+    std::string columns, not_null;
+    for (const std::string* column : { &_columns.min_x, &_columns.max_x, &_columns.min_y, &_columns.max_y })
+    {
+        std::string quoted = SqliteWrap::quote_identifier(*column);
+        columns += ", " + quoted;
+        not_null += (not_null.empty() ? "" : " AND ") + quoted + " IS NOT NULL";
+    }
+
+    return "INSERT INTO " + SqliteWrap::quote_identifier(_index) + " SELECT rowid" + columns +
+           " FROM " + SqliteWrap::quote_identifier(_table) + " WHERE " + not_null + ";";
+}
+
+
+std::string SpatialIndex::where_window() const
+{
+    // R*Tree boxes first (rounded outward), then the exact values of the row
+    return "r.max_x >= ?1 AND r.min_x <= ?2 AND r.max_y >= ?3 AND r.min_y <= ?4"
+           " AND t." + SqliteWrap::quote_identifier(_columns.max_x) + " >= ?1 AND t." + SqliteWrap::quote_identifier(_columns.min_x) + " <= ?2"
+           " AND t." + SqliteWrap::quote_identifier(_columns.max_y) + " >= ?3 AND t." + SqliteWrap::quote_identifier(_columns.min_y) + " <= ?4";
+}
+
+
+bool SpatialIndex::execute_script(const char *function, const std::string &sql)
+{
+    sqlite3* db = _wrap.get_handle();
+    if (!db) return error(function, "Database not connected.");
+
+    char* errorMessage = nullptr;
+    int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errorMessage);
+
+    if (rc != SQLITE_OK)
+    {
+        error(function, errorMessage ? errorMessage : sqlite3_errstr(rc));
+        sqlite3_free(errorMessage);
+        sqlite3_exec(db, "ROLLBACK TO sqlitewrap_rtree; RELEASE sqlitewrap_rtree;", nullptr, nullptr, nullptr);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool SpatialIndex::error(const char *function, const std::string &message)
+{
+    _last_error = message;
+    SQLITEWRAP_LOG_ERROR("SpatialIndex::" << function << "(...) - Error: " << message);
+    return false;
+}
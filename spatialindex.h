@@ -0,0 +1,111 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <string>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+class SqliteWrap;
+
+struct BoundingBox
+{
+    double min_x = 0;
+    double max_x = 0;
+    double min_y = 0;
+    double max_y = 0;
+};
+
+// columns of the indexed table holding the box of each row; a point uses the same
+// column for min and max
+struct SpatialColumns
+{
+    std::string min_x;
+    std::string max_x;
+    std::string min_y;
+    std::string max_y;
+
+    static SpatialColumns point(const std::string& x, const std::string& y) { return { x, x, y, y }; }
+    static SpatialColumns box(const std::string& min_x, const std::string& max_x, const std::string& min_y, const std::string& max_y)
+    {
+        return { min_x, max_x, min_y, max_y };
+    }
+};
+
+struct SpatialHit
+{
+    sqlite3_int64 rowid = 0;
+    double distance = 0;                 // euclidean, in coordinate units; 0 inside a box
+};
+
+// 2D R*Tree companion index of a table : one (rowid, box) entry per row whose
+// coordinates are not NULL, kept in sync by AFTER INSERT / UPDATE / DELETE triggers.
+//
+//     SpatialIndex index(db, "place", SpatialColumns::point("lon", "lat"));   // "place_rtree"
+//     index.create();
+//     index.window({ 2.2, 2.5, 48.8, 48.9 }, rowids);
+//     index.nearest(2.35, 48.85, 10, hits);
+//
+// The R*Tree stores 32-bit floats rounded outward; results are checked against the
+// exact columns of the table. nearest() grows a window around the point until it holds
+// the k nearest rows; distances are planar (degrees for longitude / latitude columns).
+// The queries are prepared once and kept : call release() before closing the connection.
+class SQLITEWRAP_EXPORT SpatialIndex
+{
+public:
+    SpatialIndex(SqliteWrap& db, const std::string& table, const SpatialColumns& columns, const std::string& index = "");
+    ~SpatialIndex();
+
+    SpatialIndex(const SpatialIndex&) = delete;
+    SpatialIndex& operator=(const SpatialIndex&) = delete;
+
+    // creates the index and its triggers if missing; a new index is filled from the table
+    bool create();
+    bool drop();
+    bool exists(bool& found);
+    bool rebuild();                      // reloads the index from the table
+    bool bounds(BoundingBox& box, bool& empty);             // extent of the whole index (root node)
+
+    // rows intersecting the box
+    bool window(const BoundingBox& box, std::vector<sqlite3_int64>& rowids);
+    bool window_rows(const BoundingBox& box, void* user_param, bool (*callback)(void*, char**, int));
+
+    // k nearest rows, nearest first; false for a NaN or infinite point
+    bool nearest(double x, double y, size_t k, std::vector<SpatialHit>& hits);
+    bool nearest_rows(double x, double y, size_t k, void* user_param, bool (*callback)(void*, char**, int));
+
+    void release();                      // finalize internal statements (before sqlite3_close)
+
+private:
+    struct Candidate
+    {
+        sqlite3_int64 rowid;
+        BoundingBox box;
+    };
+
+    SqliteWrap& _wrap;
+    std::string _table;
+    SpatialColumns _columns;
+    std::string _index;
+    std::string _last_error;
+
+    sqlite3_stmt* _window_statement = nullptr;
+    sqlite3_stmt* _root_statement = nullptr;
+    double _radius = 0;                  // window half size of the last nearest(), starting point of the next
+
+    bool prepare(const char* function, sqlite3_stmt*& statement, const std::string& sql);
+    bool query_window(const char* function, const BoundingBox& box, std::vector<Candidate>& candidates);
+    std::string fill_statement() const;
+    std::string where_window() const;
+    bool execute_script(const char* function, const std::string& sql);
+    bool error(const char* function, const std::string& message);
+
+public:
+    // getter
+    const std::string& get_last_error() const { return _last_error; }
+    const std::string& get_table() const { return _table; }
+    const std::string& get_index() const { return _index; }
+};
+
+#endif // SPATIALINDEX_H
@@ -0,0 +1,186 @@
+#include <cstdint>
+
+#include "sqlitearray.h"
+#include "logger.h"
+
+
+namespace
+{
+    // columns of the declared table
+    enum Column { ValueColumn, PointerColumn };
+
+    struct ArrayCursor : sqlite3_vtab_cursor
+    {
+        ArrayCursor() : sqlite3_vtab_cursor() {}
+
+        const SqlArray* array = nullptr;
+        size_t position = 0;
+    };
+
+    int array_connect(sqlite3* db, void*, int, const char* const*, sqlite3_vtab** vtab, char**)
+    {
+        int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(value, pointer HIDDEN);");
+        if (rc != SQLITE_OK) return rc;
+
+        sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+
+        *vtab = new sqlite3_vtab();
+        return SQLITE_OK;
+    }
+
+    int array_disconnect(sqlite3_vtab* vtab)
+    {
+        delete vtab;
+        return SQLITE_OK;
+    }
+
+    int array_best_index(sqlite3_vtab*, sqlite3_index_info* info)
+    {
+        bool unusable = false;
+
+        for (int i = 0; i < info->nConstraint; i++)
+        {
+            const auto& constraint = info->aConstraint[i];
+            if (constraint.iColumn != PointerColumn || constraint.op != SQLITE_INDEX_CONSTRAINT_EQ) continue;
+
+            if (!constraint.usable)
+            {
+                unusable = true;
+                continue;
+            }
+
+            info->aConstraintUsage[i].argvIndex = 1;
+            info->aConstraintUsage[i].omit = 1;
+            info->idxNum = 1;
+            info->estimatedCost = 1;
+            info->estimatedRows = 100;
+            return SQLITE_OK;
+        }
+
+        // carray() without argument is empty; an unusable argument means another join order
+        if (unusable) return SQLITE_CONSTRAINT;
+
+        info->idxNum = 0;
+        info->estimatedCost = 2147483647;
+        info->estimatedRows = 1;
+        return SQLITE_OK;
+    }
+
+    int array_open(sqlite3_vtab*, sqlite3_vtab_cursor** cursor)
+    {
+        *cursor = new ArrayCursor();
+        return SQLITE_OK;
+    }
+
+    int array_close(sqlite3_vtab_cursor* cursor)
+    {
+        delete static_cast<ArrayCursor*>(cursor);
+        return SQLITE_OK;
+    }
+
+    int array_filter(sqlite3_vtab_cursor* vtab_cursor, int plan, const char*, int, sqlite3_value** argv)
+    {
+        ArrayCursor* cursor = static_cast<ArrayCursor*>(vtab_cursor);
+
+        // anything else than a pointer bound by bind_values (NULL, text...) gives an empty table
+        cursor->array = plan ? static_cast<const SqlArray*>(sqlite3_value_pointer(argv[0], SqlArray::pointer_type())) : nullptr;
+        cursor->position = 0;
+        return SQLITE_OK;
+    }
+
+    int array_next(sqlite3_vtab_cursor* vtab_cursor)
+    {
+        static_cast<ArrayCursor*>(vtab_cursor)->position++;
+        return SQLITE_OK;
+    }
+
+    int array_eof(sqlite3_vtab_cursor* vtab_cursor)
+    {
+        const ArrayCursor* cursor = static_cast<ArrayCursor*>(vtab_cursor);
+        return !cursor->array || cursor->position >= cursor->array->size;
+    }
+
+    int array_column(sqlite3_vtab_cursor* vtab_cursor, sqlite3_context* context, int column)
+    {
+        const ArrayCursor* cursor = static_cast<ArrayCursor*>(vtab_cursor);
+        if (column != ValueColumn)
+        {
+            sqlite3_result_null(context);
+            return SQLITE_OK;
+        }
+
+        const SqlArray& array = *cursor->array;
+        size_t i = cursor->position;
+
+        // values are read in place, text is handed to SQLite without a copy
+        switch (array.type)
+        {
+        case SqlArray::Type::Int32:
+            sqlite3_result_int(context, static_cast<const int32_t*>(array.data)[i]);
+            break;
+        case SqlArray::Type::Int64:
+            sqlite3_result_int64(context, static_cast<const int64_t*>(array.data)[i]);
+            break;
+        case SqlArray::Type::Double:
+            sqlite3_result_double(context, static_cast<const double*>(array.data)[i]);
+            break;
+        case SqlArray::Type::Text:
+        {
+            const std::string_view& text = static_cast<const std::string_view*>(array.data)[i];
+            sqlite3_result_text64(context, text.data(), text.size(), SQLITE_STATIC, SQLITE_UTF8);
+            break;
+        }
+        case SqlArray::Type::String:
+        {
+            const std::string& text = static_cast<const std::string*>(array.data)[i];
+            sqlite3_result_text64(context, text.data(), text.size(), SQLITE_STATIC, SQLITE_UTF8);
+            break;
+        }
+        }
+
+        return SQLITE_OK;
+    }
+
+    int array_rowid(sqlite3_vtab_cursor* vtab_cursor, sqlite3_int64* rowid)
+    {
+        *rowid = static_cast<sqlite3_int64>(static_cast<ArrayCursor*>(vtab_cursor)->position) + 1;
+        return SQLITE_OK;
+    }
+
+    sqlite3_module make_array_module()
+    {
+        sqlite3_module module {};
+        module.xConnect = array_connect;     // no xCreate / xDestroy : eponymous-only
+        module.xBestIndex = array_best_index;
+        module.xDisconnect = array_disconnect;
+        module.xOpen = array_open;
+        module.xClose = array_close;
+        module.xFilter = array_filter;
+        module.xNext = array_next;
+        module.xEof = array_eof;
+        module.xColumn = array_column;
+        module.xRowid = array_rowid;
+        return module;
+    }
+
+    sqlite3_module array_module = make_array_module();
+}
+
+
+const char *SqlArray::pointer_type()
+{
+    return "sqlitewrap-array";
+}
+
+
+bool SqlArray::register_module(sqlite3 *db)
+{
+    int rc = sqlite3_create_module_v2(db, "carray", &array_module, nullptr, nullptr);
+    if (rc != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("SqlArray::register_module(...) - Error: " << sqlite3_errmsg(db));
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef SQLITEARRAY_H
+#define SQLITEARRAY_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "SqliteWrap_global.h"
+#include "sqlite3.h"
+
+// Read-only view of a C++ array, bound as a table-valued parameter (carray) :
+//
+//     std::vector<sqlite3_int64> ids = ...;
+//     db.query_sync("SELECT * FROM person WHERE id IN carray(?);", { SqlArray(ids) }, ...);
+//
+// The SQL text stays the same whatever the number of values, so the statement can be
+// prepared once and cached. Elements are not copied : the array must outlive the
+// execution of the statement. Signed integer (32 / 64 bits), double, std::string_view and
+// std::string elements are supported.
+struct SQLITEWRAP_EXPORT SqlArray
+{
+    enum class Type { Int32, Int64, Double, Text, String };
+
+    Type type = Type::Int64;
+    const void* data = nullptr;
+    size_t size = 0;
+
+    SqlArray() = default;
+
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T> && std::is_signed_v<T> && (sizeof(T) == 4 || sizeof(T) == 8)>>
+    SqlArray(const T* values, size_t count) : type(sizeof(T) == 4 ? Type::Int32 : Type::Int64), data(values), size(count) {}
+    SqlArray(const double* values, size_t count) : type(Type::Double), data(values), size(count) {}
+    SqlArray(const std::string_view* values, size_t count) : type(Type::Text), data(values), size(count) {}
+    SqlArray(const std::string* values, size_t count) : type(Type::String), data(values), size(count) {}
+
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T> && std::is_signed_v<T> && (sizeof(T) == 4 || sizeof(T) == 8)>>
+    SqlArray(const std::vector<T>& values) : SqlArray(values.data(), values.size()) {}
+    SqlArray(const std::vector<double>& values) : SqlArray(values.data(), values.size()) {}
+    SqlArray(const std::vector<std::string_view>& values) : SqlArray(values.data(), values.size()) {}
+    SqlArray(const std::vector<std::string>& values) : SqlArray(values.data(), values.size()) {}
+
+    // the "carray" table-valued function, registered on every connection by SqliteWrap
+    static bool register_module(sqlite3* db);
+    static const char* pointer_type();      // sqlite3_bind_pointer / sqlite3_value_pointer type
+};
+
+#endif // SQLITEARRAY_H
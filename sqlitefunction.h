@@ -0,0 +1,329 @@
+#ifndef SQLITEFUNCTION_H
+#define SQLITEFUNCTION_H
+
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "sqlite3.h"
+
+// Read-only view of a BLOB argument or result : points into SQLite memory, no copy.
+struct BlobView
+{
+    const void* data = nullptr;
+    size_t size = 0;
+};
+
+// Compile-time glue between C++ callables and sqlite3_create_function_v2 :
+// arguments are read from sqlite3_value with the accessor matching the C++
+// parameter type, results are returned through the matching sqlite3_result_*.
+//
+// Argument types : integral types and bool, float / double, std::string,
+// std::string_view and BlobView (views valid during the call only),
+// std::vector<unsigned char>, std::optional<T> (std::nullopt for NULL) and
+// sqlite3_value* for raw access.
+// Result types : the same plus void / std::nullptr_t (NULL).
+//
+// Aggregate and window functions are described by a default-constructible
+// state class, constructed in the sqlite3_aggregate_context of each group :
+//
+//     struct Mean
+//     {
+//         double sum = 0; sqlite3_int64 n = 0;
+//         void step(double x) { sum += x; n++; }              // xStep
+//         void inverse(double x) { sum -= x; n--; }           // xInverse (window functions)
+//         std::optional<double> result() const                // xFinal, and xValue for window functions
+//         { return n ? std::optional<double>(sum / n) : std::nullopt; }
+//     };
+namespace sqlitewrap_detail
+{
+    template <typename T> struct is_optional : std::false_type {};
+    template <typename T> struct is_optional<std::optional<T>> : std::true_type {};
+
+    template <typename T> struct dependent_false : std::false_type {};
+
+    // signature of a callable : lambda, function pointer or functor
+    template <typename T> struct function_traits : function_traits<decltype(&T::operator())> {};
+
+    template <typename R, typename... A> struct function_traits<R (*)(A...)>
+    {
+        using result = R;
+        using arguments = std::tuple<std::decay_t<A>...>;
+        static constexpr int arity = sizeof...(A);
+    };
+    template <typename R, typename... A> struct function_traits<R (*)(A...) noexcept> : function_traits<R (*)(A...)> {};
+    template <typename R, typename... A> struct function_traits<R (A...)> : function_traits<R (*)(A...)> {};
+    template <typename C, typename R, typename... A> struct function_traits<R (C::*)(A...)> : function_traits<R (*)(A...)> {};
+    template <typename C, typename R, typename... A> struct function_traits<R (C::*)(A...) const> : function_traits<R (*)(A...)> {};
+    template <typename C, typename R, typename... A> struct function_traits<R (C::*)(A...) noexcept> : function_traits<R (*)(A...)> {};
+    template <typename C, typename R, typename... A> struct function_traits<R (C::*)(A...) const noexcept> : function_traits<R (*)(A...)> {};
+
+
+    template <typename T>
+    T read_value(sqlite3_value* value)
+    {
+        if constexpr (std::is_same_v<T, sqlite3_value*>)
+            return value;
+        else if constexpr (is_optional<T>::value)
+        {
+            if (sqlite3_value_type(value) == SQLITE_NULL) return std::nullopt;
+            return read_value<typename T::value_type>(value);
+        }
+        else if constexpr (std::is_same_v<T, bool>)
+            return sqlite3_value_int64(value) != 0;
+        else if constexpr (std::is_integral_v<T>)
+            return static_cast<T>(sqlite3_value_int64(value));
+        else if constexpr (std::is_floating_point_v<T>)
+            return static_cast<T>(sqlite3_value_double(value));
+        else if constexpr (std::is_same_v<T, std::string_view>)
+        {
+            // sqlite3_value_text before sqlite3_value_bytes (conversion may change the size)
+            const char* text = reinterpret_cast<const char*>(sqlite3_value_text(value));
+            return text ? std::string_view(text, static_cast<size_t>(sqlite3_value_bytes(value))) : std::string_view();
+        }
+        else if constexpr (std::is_same_v<T, std::string>)
+        {
+            std::string_view text = read_value<std::string_view>(value);
+            return std::string(text.data(), text.size());
+        }
+        else if constexpr (std::is_same_v<T, BlobView>)
+        {
+            const void* data = sqlite3_value_blob(value);
+            return BlobView{data, static_cast<size_t>(sqlite3_value_bytes(value))};
+        }
+        else if constexpr (std::is_same_v<T, std::vector<unsigned char>>)
+        {
+            BlobView blob = read_value<BlobView>(value);
+            const unsigned char* data = static_cast<const unsigned char*>(blob.data);
+            return std::vector<unsigned char>(data, data + blob.size);
+        }
+        else
+            static_assert(dependent_false<T>::value, "unsupported SQL function argument type");
+    }
+
+
+    template <typename T>
+    void set_result(sqlite3_context* context, T&& result)
+    {
+        using R = std::decay_t<T>;
+
+        if constexpr (std::is_same_v<R, std::nullptr_t>)
+            sqlite3_result_null(context);
+        else if constexpr (is_optional<R>::value)
+        {
+            if (result) set_result(context, *std::forward<T>(result));
+            else sqlite3_result_null(context);
+        }
+        else if constexpr (std::is_integral_v<R>)
+            sqlite3_result_int64(context, static_cast<sqlite3_int64>(result));
+        else if constexpr (std::is_floating_point_v<R>)
+            sqlite3_result_double(context, static_cast<double>(result));
+        else if constexpr (std::is_same_v<R, std::string> || std::is_same_v<R, std::string_view>)
+            sqlite3_result_text64(context, result.data(), result.size(), SQLITE_TRANSIENT, SQLITE_UTF8);
+        else if constexpr (std::is_same_v<R, const char*> || std::is_same_v<R, char*>)
+        {
+            if (result) sqlite3_result_text(context, result, -1, SQLITE_TRANSIENT);
+            else sqlite3_result_null(context);
+        }
+        else if constexpr (std::is_same_v<R, BlobView>)
+        {
+            if (result.data) sqlite3_result_blob64(context, result.data, result.size, SQLITE_TRANSIENT);
+            else sqlite3_result_zeroblob(context, 0);
+        }
+        else if constexpr (std::is_same_v<R, std::vector<unsigned char>>)
+        {
+            if (result.empty()) sqlite3_result_zeroblob(context, 0);
+            else sqlite3_result_blob64(context, result.data(), result.size(), SQLITE_TRANSIENT);
+        }
+        else
+            static_assert(dependent_false<R>::value, "unsupported SQL function result type");
+    }
+
+
+    // call function(args...) with args read from argv and report the result (or the exception)
+    template <typename F, typename Arguments, size_t... I>
+    void invoke(sqlite3_context* context, F& function, sqlite3_value** argv, std::index_sequence<I...>)
+    {
+        using R = decltype(function(read_value<std::tuple_element_t<I, Arguments>>(argv[I])...));
+
+        try
+        {
+            if constexpr (std::is_void_v<R>)
+            {
+                function(read_value<std::tuple_element_t<I, Arguments>>(argv[I])...);
+                sqlite3_result_null(context);
+            }
+            else
+                set_result(context, function(read_value<std::tuple_element_t<I, Arguments>>(argv[I])...));
+        }
+        catch (const std::bad_alloc&)
+        {
+            sqlite3_result_error_nomem(context);
+        }
+        catch (const std::exception& e)
+        {
+            sqlite3_result_error(context, e.what(), -1);
+        }
+        catch (...)
+        {
+            sqlite3_result_error(context, "unknown exception in SQL function", -1);
+        }
+    }
+
+    template <typename F>
+    void scalar_function(sqlite3_context* context, int, sqlite3_value** argv)
+    {
+        using traits = function_traits<F>;
+        F* function = static_cast<F*>(sqlite3_user_data(context));
+        invoke<F, typename traits::arguments>(context, *function, argv, std::make_index_sequence<traits::arity>());
+    }
+
+    // per-group state, placement-constructed in the memory of sqlite3_aggregate_context
+    template <typename State>
+    struct AggregateStorage
+    {
+        alignas(State) unsigned char data[sizeof(State)];
+        bool constructed;
+    };
+
+    template <typename State>
+    State* aggregate_state(sqlite3_context* context, bool create)
+    {
+        // sqlite3_aggregate_context returns zeroed memory aligned on 8 bytes
+        static_assert(alignof(State) <= 8, "aggregate state must not be over-aligned");
+
+        auto* storage = static_cast<AggregateStorage<State>*>(sqlite3_aggregate_context(context, create ? sizeof(AggregateStorage<State>) : 0));
+        if (!storage) return nullptr;
+
+        if (!storage->constructed)
+        {
+            if (!create) return nullptr;
+            new (storage->data) State();
+            storage->constructed = true;
+        }
+
+        return std::launder(reinterpret_cast<State*>(storage->data));
+    }
+
+    template <typename State, typename Arguments, size_t... I>
+    void call_step(State& state, sqlite3_value** argv, std::index_sequence<I...>)
+    {
+        state.step(read_value<std::tuple_element_t<I, Arguments>>(argv[I])...);
+    }
+
+    template <typename State, typename Arguments, size_t... I>
+    void call_inverse(State& state, sqlite3_value** argv, std::index_sequence<I...>)
+    {
+        state.inverse(read_value<std::tuple_element_t<I, Arguments>>(argv[I])...);
+    }
+
+    template <typename State, bool Inverse>
+    void aggregate_step(sqlite3_context* context, int, sqlite3_value** argv)
+    {
+        using traits = function_traits<decltype(&State::step)>;
+
+        try
+        {
+            State* state = aggregate_state<State>(context, true);
+            if (!state)
+            {
+                sqlite3_result_error_nomem(context);
+                return;
+            }
+
+            if constexpr (Inverse) call_inverse<State, typename traits::arguments>(*state, argv, std::make_index_sequence<traits::arity>());
+            else call_step<State, typename traits::arguments>(*state, argv, std::make_index_sequence<traits::arity>());
+        }
+        catch (const std::bad_alloc&)
+        {
+            sqlite3_result_error_nomem(context);
+        }
+        catch (const std::exception& e)
+        {
+            sqlite3_result_error(context, e.what(), -1);
+        }
+        catch (...)
+        {
+            sqlite3_result_error(context, "unknown exception in SQL aggregate", -1);
+        }
+    }
+
+    // xFinal (Final = true) destroys the state, xValue keeps it for the next rows of the window
+    template <typename State, bool Final>
+    void aggregate_result(sqlite3_context* context)
+    {
+        State* state = aggregate_state<State>(context, false);
+
+        try
+        {
+            if (state) set_result(context, state->result());
+            else set_result(context, State().result());          // no row in the group
+        }
+        catch (const std::bad_alloc&)
+        {
+            sqlite3_result_error_nomem(context);
+        }
+        catch (const std::exception& e)
+        {
+            sqlite3_result_error(context, e.what(), -1);
+        }
+        catch (...)
+        {
+            sqlite3_result_error(context, "unknown exception in SQL aggregate", -1);
+        }
+
+        if constexpr (Final)
+        {
+            if (state) state->~State();
+        }
+    }
+
+    template <typename State, typename = void> struct has_inverse : std::false_type {};
+    template <typename State> struct has_inverse<State, std::void_t<decltype(&State::inverse)>> : std::true_type {};
+
+    template <typename State>
+    int create_aggregate_function(sqlite3* db, const char* name, int flags)
+    {
+        return sqlite3_create_function_v2(db, name, function_traits<decltype(&State::step)>::arity, flags, nullptr,
+                                          nullptr, &aggregate_step<State, false>, &aggregate_result<State, true>, nullptr);
+    }
+
+    template <typename State>
+    int create_window_function(sqlite3* db, const char* name, int flags)
+    {
+        static_assert(has_inverse<State>::value, "window function state needs an inverse() member");
+        static_assert(function_traits<decltype(&State::step)>::arity == function_traits<decltype(&State::inverse)>::arity,
+                      "step() and inverse() must take the same arguments");
+
+        return sqlite3_create_window_function(db, name, function_traits<decltype(&State::step)>::arity, flags, nullptr,
+                                              &aggregate_step<State, false>, &aggregate_result<State, true>,
+                                              &aggregate_result<State, false>, &aggregate_step<State, true>, nullptr);
+    }
+
+    template <typename T>
+    void destroy(void* object)
+    {
+        delete static_cast<T*>(object);
+    }
+
+    // the callable is moved to the heap and owned by SQLite (destroyed when the function is
+    // replaced or the connection closed, or right away if the registration fails)
+    template <typename F>
+    int create_scalar_function(sqlite3* db, const char* name, F&& function, int flags)
+    {
+        using Function = std::decay_t<F>;
+        Function* copy = new Function(std::forward<F>(function));
+
+        return sqlite3_create_function_v2(db, name, function_traits<Function>::arity, flags, copy,
+                                          &scalar_function<Function>, nullptr, nullptr, &destroy<Function>);
+    }
+}
+
+#endif // SQLITEFUNCTION_H
@@ -0,0 +1,603 @@
+#ifndef SQLITEVTAB_H
+#define SQLITEVTAB_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "sqlite3.h"
+#include "sqlitefunction.h"
+
+// Columns of a C++ container exposed as a read-only SQL table by SqliteWrap::register_vtab :
+//
+//     struct Trade { sqlite3_int64 id; std::string symbol; double price; int quantity; };
+//     std::vector<Trade> trades;                                  // sorted by id
+//
+//     VtabDescriptor<Trade> descriptor;
+//     descriptor.key("id", &Trade::id)                            // sorted key : = < <= > >= by binary search
+//               .column("symbol", &Trade::symbol)                 // members are read in place, no copy
+//               .column("notional", [](const Trade& t) { return t.price * t.quantity; });
+//     db.register_vtab("trades", trades, descriptor);
+//
+//     SELECT * FROM trades t JOIN fills f ON f.trade_id = t.id WHERE t.id BETWEEN ? AND ?;
+//
+// The table is eponymous (no CREATE VIRTUAL TABLE needed) and reads the container in place :
+// strings and blobs returned by reference (members, std::string_view, BlobView) are handed to
+// SQLite without a copy, so the container must outlive the connection and must not be modified
+// while a statement reads the table.
+//
+// Random access containers (std::vector, std::deque, std::array) : the rowid is the position,
+// the key, if any, must be sorted in ascending order. Other sorted containers (std::map,
+// std::set) : the key must be the container key (e.first for a map) and the table is
+// declared WITHOUT ROWID with the key as PRIMARY KEY.
+// Key and rowid constraints only narrow the scan; SQLite still checks them on every row.
+template <typename Row>
+class VtabDescriptor
+{
+public:
+    struct Column
+    {
+        std::string name;
+        std::string type;                                           // declared type (affinity)
+        std::function<void(sqlite3_context*, const Row&)> result;
+    };
+
+    // getter : pointer to member or callable taking const Row&
+    template <typename Getter>
+    VtabDescriptor& column(const std::string& name, Getter getter);
+
+    // sorted key column, used for equality and range constraints
+    template <typename Getter>
+    VtabDescriptor& key(const std::string& name, Getter getter);
+
+    const std::vector<Column>& get_columns() const { return _columns; }
+    int get_key_column() const { return _key_column; }
+    bool is_text_key() const { return _text_key; }
+
+    // -1, 0, 1 : key of the row compared to the SQL value, with SQLite semantics;
+    // incomparable when the value cannot be compared exactly to the key type
+    static constexpr int incomparable = 2;
+    int compare_key(const Row& row, sqlite3_value* value) const { return _compare(row, value); }
+
+private:
+    std::vector<Column> _columns;
+    int _key_column = -1;
+    bool _text_key = false;
+    std::function<int(const Row&, sqlite3_value*)> _compare;
+};
+
+
+namespace sqlitewrap_detail
+{
+    template <typename T>
+    const char* column_type()
+    {
+        using U = std::decay_t<T>;
+
+        if constexpr (is_optional<U>::value) return column_type<typename U::value_type>();
+        else if constexpr (std::is_integral_v<U>) return "INTEGER";
+        else if constexpr (std::is_floating_point_v<U>) return "REAL";
+        else if constexpr (std::is_same_v<U, std::string> || std::is_same_v<U, std::string_view> || std::is_same_v<U, const char*>) return "TEXT";
+        else if constexpr (std::is_same_v<U, BlobView> || std::is_same_v<U, std::vector<unsigned char>>) return "BLOB";
+        else return "";
+    }
+
+    // like set_result, but text and blobs that live in the container are not copied
+    template <typename T>
+    void column_result(sqlite3_context* context, T&& value)
+    {
+        using U = std::decay_t<T>;
+        constexpr bool in_place = std::is_lvalue_reference_v<T&&>;
+
+        if constexpr (is_optional<U>::value)
+        {
+            if (value) column_result(context, *std::forward<T>(value));
+            else sqlite3_result_null(context);
+        }
+        else if constexpr (in_place && std::is_same_v<U, std::string>)
+        {
+            // a length of -1 tells SQLite the text is NUL terminated : sqlite3_column_text won't copy it either
+            if (std::char_traits<char>::length(value.c_str()) == value.size()) sqlite3_result_text(context, value.c_str(), -1, SQLITE_STATIC);
+            else sqlite3_result_text64(context, value.data(), value.size(), SQLITE_STATIC, SQLITE_UTF8);
+        }
+        else if constexpr (std::is_same_v<U, std::string_view>)
+            sqlite3_result_text64(context, value.data(), value.size(), SQLITE_STATIC, SQLITE_UTF8);
+        else if constexpr (std::is_same_v<U, const char*>)
+        {
+            if (value) sqlite3_result_text(context, value, -1, SQLITE_STATIC);
+            else sqlite3_result_null(context);
+        }
+        else if constexpr (std::is_same_v<U, BlobView>)
+        {
+            if (value.data) sqlite3_result_blob64(context, value.data, value.size, SQLITE_STATIC);
+            else sqlite3_result_zeroblob(context, 0);
+        }
+        else if constexpr (in_place && std::is_same_v<U, std::vector<unsigned char>>)
+        {
+            if (value.empty()) sqlite3_result_zeroblob(context, 0);
+            else sqlite3_result_blob64(context, value.data(), value.size(), SQLITE_STATIC);
+        }
+        else
+            set_result(context, std::forward<T>(value));
+    }
+
+    template <typename T>
+    int three_way(const T& a, const T& b)
+    {
+        return a < b ? -1 : (b < a ? 1 : 0);
+    }
+
+    // key compared to an SQL value; integers and reals are compared exactly, text with BINARY
+    template <typename K>
+    int compare_value(const K& key, sqlite3_value* value, int incomparable)
+    {
+        if constexpr (std::is_integral_v<K> && !std::is_same_v<K, bool>)
+        {
+            int type = sqlite3_value_numeric_type(value);
+            if (type == SQLITE_INTEGER)
+            {
+                sqlite3_int64 other = sqlite3_value_int64(value);
+                if constexpr (std::is_unsigned_v<K>)
+                {
+                    if (other < 0) return 1;
+                    return three_way<unsigned long long>(key, static_cast<unsigned long long>(other));
+                }
+                else return three_way<long long>(key, other);
+            }
+            if (type == SQLITE_FLOAT)
+            {
+                double other = sqlite3_value_double(value);
+                if (std::isnan(other)) return incomparable;
+
+                // key < other  <=>  key <= floor(other) for a non integral value
+                double whole = std::floor(other);
+                if (whole >= 9223372036854775808.0) return -1;
+                if (whole < -9223372036854775808.0) return 1;
+                if constexpr (std::is_unsigned_v<K>)
+                {
+                    if (whole < 0) return 1;
+                }
+
+                long long floor_value = static_cast<long long>(whole);
+                int order = std::is_unsigned_v<K> ? three_way<unsigned long long>(key, static_cast<unsigned long long>(floor_value))
+                                                  : three_way<long long>(static_cast<long long>(key), floor_value);
+                if (order != 0) return order;
+                return whole == other ? 0 : -1;
+            }
+            return incomparable;
+        }
+        else if constexpr (std::is_floating_point_v<K>)
+        {
+            int type = sqlite3_value_numeric_type(value);
+            if (type != SQLITE_INTEGER && type != SQLITE_FLOAT) return incomparable;
+            return three_way<double>(static_cast<double>(key), sqlite3_value_double(value));
+        }
+        else if constexpr (std::is_same_v<K, std::string> || std::is_same_v<K, std::string_view>)
+        {
+            if (sqlite3_value_type(value) != SQLITE_TEXT) return incomparable;
+
+            std::string_view other = read_value<std::string_view>(value);
+            int order = std::string_view(key).compare(other);
+            return order < 0 ? -1 : (order > 0 ? 1 : 0);
+        }
+        else
+            return incomparable;
+    }
+
+    // exact conversion of an SQL value to a container key (std::map::lower_bound)
+    template <typename K>
+    bool convert_key(sqlite3_value* value, K& key)
+    {
+        if constexpr (std::is_integral_v<K> && !std::is_same_v<K, bool>)
+        {
+            if (sqlite3_value_numeric_type(value) != SQLITE_INTEGER) return false;
+
+            sqlite3_int64 other = sqlite3_value_int64(value);
+            if constexpr (std::is_unsigned_v<K>)
+            {
+                if (other < 0 || static_cast<unsigned long long>(other) > std::numeric_limits<K>::max()) return false;
+            }
+            else if (other < std::numeric_limits<K>::min() || other > std::numeric_limits<K>::max()) return false;
+
+            key = static_cast<K>(other);
+            return true;
+        }
+        else if constexpr (std::is_same_v<K, std::string>)
+        {
+            if (sqlite3_value_type(value) != SQLITE_TEXT) return false;
+            key = read_value<std::string>(value);
+            return true;
+        }
+        else
+            return false;
+    }
+}
+
+
+template <typename Row>
+template <typename Getter>
+VtabDescriptor<Row>& VtabDescriptor<Row>::column(const std::string &name, Getter getter)
+{
+    using Result = decltype(std::invoke(getter, std::declval<const Row&>()));
+
+    _columns.push_back({ name, sqlitewrap_detail::column_type<Result>(), [getter](sqlite3_context* context, const Row& row)
+    {
+        sqlitewrap_detail::column_result(context, std::invoke(getter, row));
+    }});
+
+    return *this;
+}
+
+
+template <typename Row>
+template <typename Getter>
+VtabDescriptor<Row>& VtabDescriptor<Row>::key(const std::string &name, Getter getter)
+{
+    using Key = std::decay_t<decltype(std::invoke(getter, std::declval<const Row&>()))>;
+
+    column(name, getter);
+    _key_column = static_cast<int>(_columns.size()) - 1;
+    _text_key = std::is_same_v<Key, std::string> || std::is_same_v<Key, std::string_view>;
+    _compare = [getter](const Row& row, sqlite3_value* value)
+    {
+        return sqlitewrap_detail::compare_value<Key>(std::invoke(getter, row), value, incomparable);
+    };
+
+    return *this;
+}
+
+
+namespace sqlitewrap_detail
+{
+    template <typename, typename = void> struct has_key_type : std::false_type {};
+    template <typename C> struct has_key_type<C, std::void_t<typename C::key_type, decltype(std::declval<const C&>().lower_bound(std::declval<const typename C::key_type&>()))>> : std::true_type {};
+
+    template <typename Container>
+    struct ContainerModule
+    {
+        using Row = typename Container::value_type;
+        using Iterator = typename Container::const_iterator;
+        static constexpr bool random_access = std::is_base_of_v<std::random_access_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>;
+
+        const Container* container;
+        VtabDescriptor<Row> descriptor;
+
+        // WITHOUT ROWID (key as PRIMARY KEY) when the position cannot be used as a rowid
+        bool without_rowid() const { return !random_access && descriptor.get_key_column() >= 0; }
+    };
+
+    template <typename Container>
+    struct ContainerTable : sqlite3_vtab
+    {
+        ContainerTable() : sqlite3_vtab() {}
+        ContainerModule<Container>* module = nullptr;
+    };
+
+    template <typename Container>
+    struct ContainerCursor : sqlite3_vtab_cursor
+    {
+        ContainerCursor() : sqlite3_vtab_cursor() {}
+        typename Container::const_iterator current;
+        typename Container::const_iterator end;
+        sqlite3_int64 rowid = 0;
+    };
+
+    // first iterator of [first, last) for which before(iterator) is false (before is monotonic)
+    template <typename Iterator, typename Predicate>
+    Iterator bisect(Iterator first, Iterator last, Predicate before)
+    {
+        auto count = std::distance(first, last);
+        while (count > 0)
+        {
+            auto half = count / 2;
+            Iterator middle = std::next(first, half);
+            if (before(middle))
+            {
+                first = std::next(middle);
+                count -= half + 1;
+            }
+            else count = half;
+        }
+        return first;
+    }
+
+    // xBestIndex op codes, two characters per xFilter argument in idxStr : target ('k' key, 'r' rowid) and op
+    inline char plan_op(unsigned char op)
+    {
+        switch (op)
+        {
+        case SQLITE_INDEX_CONSTRAINT_EQ: return '=';
+        case SQLITE_INDEX_CONSTRAINT_GT: return '>';
+        case SQLITE_INDEX_CONSTRAINT_GE: return 'g';
+        case SQLITE_INDEX_CONSTRAINT_LT: return '<';
+        case SQLITE_INDEX_CONSTRAINT_LE: return 'l';
+        default: return 0;
+        }
+    }
+
+    template <typename Container>
+    int container_connect(sqlite3* db, void* client, int, const char* const*, sqlite3_vtab** vtab, char**)
+    {
+        auto* module = static_cast<ContainerModule<Container>*>(client);
+        const auto& columns = module->descriptor.get_columns();
+
+        std::string sql = "CREATE TABLE x(";
+        for (size_t i = 0; i < columns.size(); i++)
+        {
+            std::string name = "\"";
+            for (char c : columns[i].name) name += c == '"' ? std::string("\"\"") : std::string(1, c);
+            sql += (i ? ", " : "") + name + "\" " + columns[i].type;
+            if (module->without_rowid() && static_cast<int>(i) == module->descriptor.get_key_column()) sql += " PRIMARY KEY NOT NULL";
+        }
+        sql += module->without_rowid() ? ") WITHOUT ROWID;" : ");";
+
+        int rc = sqlite3_declare_vtab(db, sql.c_str());
+        if (rc != SQLITE_OK) return rc;
+
+        sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+
+        auto* table = new ContainerTable<Container>();
+        table->module = module;
+        *vtab = table;
+        return SQLITE_OK;
+    }
+
+    template <typename Container>
+    int container_disconnect(sqlite3_vtab* vtab)
+    {
+        delete static_cast<ContainerTable<Container>*>(vtab);
+        return SQLITE_OK;
+    }
+
+    template <typename Container>
+    int container_best_index(sqlite3_vtab* vtab, sqlite3_index_info* info)
+    {
+        const ContainerModule<Container>* module = static_cast<ContainerTable<Container>*>(vtab)->module;
+        const int key = module->descriptor.get_key_column();
+        const double rows = static_cast<double>(std::max<size_t>(module->container->size(), 1));
+
+        std::string plan;
+        bool equality = false, range = false;
+        int argument = 1;
+
+        for (int i = 0; i < info->nConstraint; i++)
+        {
+            const auto& constraint = info->aConstraint[i];
+            char op = plan_op(constraint.op);
+            if (!constraint.usable || !op) continue;
+
+            char target;
+            if (key >= 0 && constraint.iColumn == key)
+            {
+                // text keys are ordered with memcmp : only BINARY comparisons can use them
+                if (module->descriptor.is_text_key() && sqlite3_stricmp(sqlite3_vtab_collation(info, i), "BINARY") != 0) continue;
+                target = 'k';
+            }
+            else if (constraint.iColumn < 0 && ContainerModule<Container>::random_access) target = 'r';
+            else continue;
+
+            info->aConstraintUsage[i].argvIndex = argument++;
+            plan += target;
+            plan += op;
+
+            if (op == '=') equality = true;
+            else range = true;
+        }
+
+        info->idxNum = argument - 1;
+        info->idxStr = plan.empty() ? nullptr : sqlite3_mprintf("%s", plan.c_str());
+        info->needToFreeIdxStr = info->idxStr != nullptr;
+
+        double search = std::log2(rows) + 1;
+        if (equality)
+        {
+            info->estimatedRows = 1;
+            info->estimatedCost = search;
+        }
+        else if (range)
+        {
+            info->estimatedRows = static_cast<sqlite3_int64>(rows / 4) + 1;
+            info->estimatedCost = search + rows / 4;
+        }
+        else
+        {
+            info->estimatedRows = static_cast<sqlite3_int64>(rows);
+            info->estimatedCost = rows;
+        }
+
+        // rows come in key order, and in rowid order for random access containers
+        if (info->nOrderBy == 1 && !info->aOrderBy[0].desc &&
+            ((key >= 0 && info->aOrderBy[0].iColumn == key) || (info->aOrderBy[0].iColumn < 0 && ContainerModule<Container>::random_access)))
+            info->orderByConsumed = 1;
+
+        return SQLITE_OK;
+    }
+
+    template <typename Container>
+    int container_open(sqlite3_vtab*, sqlite3_vtab_cursor** cursor)
+    {
+        *cursor = new ContainerCursor<Container>();
+        return SQLITE_OK;
+    }
+
+    template <typename Container>
+    int container_close(sqlite3_vtab_cursor* cursor)
+    {
+        delete static_cast<ContainerCursor<Container>*>(cursor);
+        return SQLITE_OK;
+    }
+
+    template <typename Container>
+    int container_filter(sqlite3_vtab_cursor* vtab_cursor, int argc, const char* plan, int, sqlite3_value** argv)     // idxNum is the argument count
+    {
+        using Module = ContainerModule<Container>;
+        using Iterator = typename Module::Iterator;
+
+        auto* cursor = static_cast<ContainerCursor<Container>*>(vtab_cursor);
+        const Module* module = static_cast<ContainerTable<Container>*>(cursor->pVtab)->module;
+        const Container& container = *module->container;
+        const auto& descriptor = module->descriptor;
+        constexpr int incomparable = VtabDescriptor<typename Module::Row>::incomparable;
+
+        Iterator begin = container.begin();
+        Iterator first = begin;
+        Iterator last = container.end();
+        bool empty = false;
+        std::vector<int> remaining;             // constraints applied by binary search on [first, last)
+
+        // sorted associative containers : native lower_bound / upper_bound for exact keys
+        if constexpr (has_key_type<Container>::value)
+        {
+            using Key = typename Container::key_type;
+            std::optional<Key> lower, upper;
+            bool lower_strict = false, upper_strict = false;
+            auto less = container.key_comp();
+
+            for (int i = 0; i < argc; i++)
+            {
+                char op = plan[2 * i + 1];
+                Key value{};
+                if (plan[2 * i] != 'k' || !convert_key(argv[i], value))
+                {
+                    remaining.push_back(i);
+                    continue;
+                }
+
+                if (op == '=' || op == '>' || op == 'g')
+                {
+                    bool strict = op == '>';
+                    if (!lower || less(*lower, value) || (!less(value, *lower) && strict)) { lower = value; lower_strict = strict; }
+                }
+                if (op == '=' || op == '<' || op == 'l')
+                {
+                    bool strict = op == '<';
+                    if (!upper || less(value, *upper) || (!less(*upper, value) && strict)) { upper = value; upper_strict = strict; }
+                }
+            }
+
+            if (lower && upper && (less(*upper, *lower) || (!less(*lower, *upper) && (lower_strict || upper_strict)))) empty = true;
+            else
+            {
+                if (lower) first = lower_strict ? container.upper_bound(*lower) : container.lower_bound(*lower);
+                if (upper) last = upper_strict ? container.lower_bound(*upper) : container.upper_bound(*upper);
+            }
+        }
+        else
+        {
+            for (int i = 0; i < argc; i++) remaining.push_back(i);
+        }
+
+        for (int i : remaining)
+        {
+            if (empty) break;
+
+            sqlite3_value* value = argv[i];
+            if (sqlite3_value_type(value) == SQLITE_NULL)
+            {
+                empty = true;               // no comparison with NULL is true
+                break;
+            }
+
+            auto compare = [&](Iterator it)
+            {
+                if (plan[2 * i] == 'r') return compare_value<sqlite3_int64>(std::distance(begin, it), value, incomparable);
+                return descriptor.compare_key(*it, value);
+            };
+
+            if (first != last && compare(first) == incomparable) continue;      // not narrowed, SQLite filters
+
+            char op = plan[2 * i + 1];
+            if (op == '=' || op == 'g') first = bisect(first, last, [&](Iterator it) { return compare(it) < 0; });
+            else if (op == '>') first = bisect(first, last, [&](Iterator it) { return compare(it) <= 0; });
+            if (op == '=' || op == 'l') last = bisect(first, last, [&](Iterator it) { return compare(it) <= 0; });
+            else if (op == '<') last = bisect(first, last, [&](Iterator it) { return compare(it) < 0; });
+        }
+
+        cursor->current = empty ? last : first;
+        cursor->end = last;
+        cursor->rowid = Module::random_access ? static_cast<sqlite3_int64>(std::distance(begin, cursor->current)) : 0;
+        return SQLITE_OK;
+    }
+
+    template <typename Container>
+    int container_next(sqlite3_vtab_cursor* vtab_cursor)
+    {
+        auto* cursor = static_cast<ContainerCursor<Container>*>(vtab_cursor);
+        ++cursor->current;
+        cursor->rowid++;
+        return SQLITE_OK;
+    }
+
+    template <typename Container>
+    int container_eof(sqlite3_vtab_cursor* vtab_cursor)
+    {
+        auto* cursor = static_cast<ContainerCursor<Container>*>(vtab_cursor);
+        return cursor->current == cursor->end;
+    }
+
+    template <typename Container>
+    int container_column(sqlite3_vtab_cursor* vtab_cursor, sqlite3_context* context, int column)
+    {
+        auto* cursor = static_cast<ContainerCursor<Container>*>(vtab_cursor);
+        const auto* module = static_cast<ContainerTable<Container>*>(cursor->pVtab)->module;
+
+        try
+        {
+            module->descriptor.get_columns()[column].result(context, *cursor->current);
+        }
+        catch (const std::bad_alloc&)
+        {
+            return SQLITE_NOMEM;
+        }
+        catch (const std::exception& e)
+        {
+            sqlite3_result_error(context, e.what(), -1);
+        }
+
+        return SQLITE_OK;
+    }
+
+    template <typename Container>
+    int container_rowid(sqlite3_vtab_cursor* vtab_cursor, sqlite3_int64* rowid)
+    {
+        // position in the container (full scans only for non random access containers without key)
+        *rowid = static_cast<ContainerCursor<Container>*>(vtab_cursor)->rowid;
+        return SQLITE_OK;
+    }
+
+    template <typename Container>
+    sqlite3_module make_container_module()
+    {
+        sqlite3_module module {};
+        module.xConnect = &container_connect<Container>;     // no xCreate / xDestroy : eponymous-only
+        module.xBestIndex = &container_best_index<Container>;
+        module.xDisconnect = &container_disconnect<Container>;
+        module.xOpen = &container_open<Container>;
+        module.xClose = &container_close<Container>;
+        module.xFilter = &container_filter<Container>;
+        module.xNext = &container_next<Container>;
+        module.xEof = &container_eof<Container>;
+        module.xColumn = &container_column<Container>;
+        module.xRowid = &container_rowid<Container>;
+        return module;
+    }
+
+    // eponymous-only, read-only module : the container and the descriptor are owned by SQLite
+    template <typename Container>
+    int create_container_module(sqlite3* db, const char* name, const Container& container, const VtabDescriptor<typename Container::value_type>& descriptor)
+    {
+        static sqlite3_module module = make_container_module<Container>();
+
+        auto* client = new ContainerModule<Container>{ &container, descriptor };
+        return sqlite3_create_module_v2(db, name, &module, client, &destroy<ContainerModule<Container>>);
+    }
+}
+
+#endif // SQLITEVTAB_H
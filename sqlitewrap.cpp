@@ -1,20 +1,53 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <cstring>
 #include <filesystem>
-#include <iostream>
 #include <ostream>
 #include <fstream>
+#include <limits>
 
 #include "sqlitewrap.h"
+#include "arrowbatches.h"
+#include "busyhandler.h"
+#include "logger.h"
+#include "resultcache.h"
+#include "rowcounter.h"
+#include "schemacache.h"
 
 
-SqliteWrap::SqliteWrap() {}
+namespace
+{
+    // DeserializeCallback : the callback owns the values (new char[], as select_sync() always did),
+    // whether they come from a statement or from the result cache
+    bool forward_row(void* user_param, DeserializeCallback callback, char** values, int column_count)
+    {
+        std::vector<char*> owned(static_cast<size_t>(column_count));
+        for (int i = 0; i < column_count; i++)
+        {
+            if (!values[i]) continue;
+
+            size_t size = std::strlen(values[i]);
+            owned[i] = new char[size + 1];
+            std::memcpy(owned[i], values[i], size + 1);
+        }
+
+        return callback(user_param, owned.data(), column_count);
+    }
+}
+
+
+SqliteWrap::SqliteWrap() : _schema_cache(std::make_unique<SchemaCache>(*this)) {}
+
+
+SqliteWrap::~SqliteWrap() {}
 
 
 bool SqliteWrap::connect(const std::string &db_name)
 {
     if (!std::filesystem::exists(db_name))      // database file already exists ?
     {
-        std::cerr << "Error: Database file does not exist: " << db_name << std::endl;
+        SQLITEWRAP_LOG_ERROR("Error: Database file does not exist: " << db_name);
         return false;
     }
 
@@ -22,11 +55,14 @@ bool SqliteWrap::connect(const std::string &db_name)
 
     if (rc != SQLITE_OK)
     {
-        std::cerr << "Error opening database: " << sqlite3_errmsg(_db) << std::endl;
+        SQLITEWRAP_LOG_ERROR("Error opening database: " << sqlite3_errmsg(_db));
         return false;
     }
 
-    std::cout << "Connected to database: " << db_name << std::endl;
+    install_hooks();
+    register_modules();
+
+    SQLITEWRAP_LOG_INFO("Connected to database: " << db_name);
     return true;
 }
 
@@ -52,12 +88,14 @@ void SqliteWrap::connect_(const std::string &db_name)
         else
         {
             // Connection successful
-            std::cout << "Connected to database: " << db_name << std::endl;
+            install_hooks();
+            register_modules();
+            SQLITEWRAP_LOG_INFO("Connected to database: " << db_name);
         }
     }
     catch (const std::exception &e)
     {
-        std::cerr << e.what() << std::endl;
+        SQLITEWRAP_LOG_ERROR(e.what());
         throw std::runtime_error("Error connecting database: " + std::string(e.what()));
     }
 }
@@ -67,15 +105,18 @@ bool SqliteWrap::disconnect()
 {
     if (!_db)
     {
-        std::cerr << "Error: Database not connected." << std::endl;
+        SQLITEWRAP_LOG_ERROR("Error: Database not connected.");
         return false;
     }
 
+    optimize_on_close();
+    release_statements();
+
     int rc = sqlite3_close(_db);
 
     if (rc != SQLITE_OK)
     {
-        std::cerr << "Error closing database: " << sqlite3_errmsg(_db) << std::endl;
+        SQLITEWRAP_LOG_ERROR("Error closing database: " << sqlite3_errmsg(_db));
         return false;
     }
 
@@ -94,6 +135,9 @@ bool SqliteWrap::disconnect_()
             throw std::runtime_error("Error: Database not connected.");
         }
 
+        optimize_on_close();
+        release_statements();
+
         int rc = sqlite3_close(_db);
 
         if (rc != SQLITE_OK)
@@ -105,7 +149,7 @@ bool SqliteWrap::disconnect_()
     }
     catch (const std::exception &e)
     {
-        std::cerr << e.what() << std::endl;
+        SQLITEWRAP_LOG_ERROR(e.what());
         throw std::runtime_error("Error disconnecting database: " + std::string(e.what()));
     }
 
@@ -119,11 +163,49 @@ bool SqliteWrap::exists(const std::string &db_name)
 }
 
 
-bool SqliteWrap::create_db(const std::string &db_name)
+bool SqliteWrap::exists(const std::string &table, const std::string &condition, bool &found)
+{
+    if (!_db)
+    {
+        SQLITEWRAP_LOG_ERROR("Error: Database not connected.");
+        return false;
+    }
+
+    // stops at the first matching row instead of counting them all
+    std::string sql = "SELECT 1 FROM " + table;
+    if (!condition.empty()) sql += " WHERE " + condition;
+    sql += " LIMIT 1;";
+
+    BusyHandler::Scope busy(_busy_handler.get(), sql);
+
+    sqlite3_stmt *statement = nullptr;
+    if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::exists(...) - sql : " << sql << " - SQL error: " << sqlite3_errmsg(_db));
+        _last_error = sqlite3_errmsg(_db);
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    int rc = sqlite3_step(statement);
+    sqlite3_finalize(statement);
+
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+    {
+        _last_error = sqlite3_errmsg(_db);
+        return false;
+    }
+
+    found = (rc == SQLITE_ROW);
+    return true;
+}
+
+
+bool SqliteWrap::create_db(const std::string &db_name, bool incremental_vacuum)
 {
     if (std::filesystem::exists(db_name))   // database file already exists ?
     {
-        std::cerr << "Error: Database file already exist: " << db_name << std::endl;
+        SQLITEWRAP_LOG_ERROR("Error: Database file already exist: " << db_name);
         return false;
     }
 
@@ -132,12 +214,24 @@ bool SqliteWrap::create_db(const std::string &db_name)
 
     if (rc != SQLITE_OK)
     {
-        std::cerr << "Error opening database: " << sqlite3_errmsg(_db) << std::endl;
+        SQLITEWRAP_LOG_ERROR("Error opening database: " << sqlite3_errmsg(_db));
+        return false;
+    }
+
+    // only possible before the first table is created (or with a full VACUUM)
+    if (incremental_vacuum && sqlite3_exec(_db, "PRAGMA auto_vacuum = INCREMENTAL;", nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::create_db(...) - Error: " << sqlite3_errmsg(_db));
+        _last_error = sqlite3_errmsg(_db);
+        sqlite3_close(_db);
+        _db = nullptr;
         return false;
     }
 
     // Connection successful
-    std::cout << "Db Created and connected to : " << db_name << std::endl;
+    install_hooks();
+    register_modules();
+    SQLITEWRAP_LOG_INFO("Db Created and connected to : " << db_name);
 
     return true;
 }
@@ -147,7 +241,7 @@ bool SqliteWrap::delete_db(const std::string &db_name)
 {
     if (!std::filesystem::exists(db_name))   // database file already exists ?
     {
-        std::cerr << "Error: Database file does not exist: " << db_name << std::endl;
+        SQLITEWRAP_LOG_ERROR("Error: Database file does not exist: " << db_name);
         return false;  // Return an error without attempting to connect
     }
 
@@ -161,17 +255,18 @@ bool SqliteWrap::execute_sql(const std::string &sql)
 {
     if (!_db)
     {
-        std::cerr << "Error: Database not connected." << std::endl;
+        SQLITEWRAP_LOG_ERROR("Error: Database not connected.");
         return false;
     }
 
     char* errorMessage = nullptr;
-    
+    BusyHandler::Scope busy(_busy_handler.get(), sql);
+
     int rc = sqlite3_exec(_db, sql.c_str(), nullptr, nullptr, &errorMessage);
 
     if (rc != SQLITE_OK)
     {
-        std::cerr << "SqliteWrap::execute_sql(...) - sql : " << sql << " - SQL error: " << errorMessage << std::endl;
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::execute_sql(...) - sql : " << sql << " - SQL error: " << errorMessage);
         _last_error = errorMessage;
         sqlite3_free(errorMessage);
         return false;
@@ -185,7 +280,7 @@ bool SqliteWrap::select_count_sync (const std::string &table, const std::string
 {
     if (!_db)
     {
-        std::cerr << "Error: Database not connected." << std::endl;
+        SQLITEWRAP_LOG_ERROR("Error: Database not connected.");
         return false;
     }
 
@@ -195,6 +290,38 @@ bool SqliteWrap::select_count_sync (const std::string &table, const std::string
     if (!condition.empty())  sql += " WHERE " + condition;
     sql += ";";
 
+    BusyHandler::Scope busy(_busy_handler.get(), sql);
+
+    if (condition.empty() && _row_counter)
+    {
+        sqlite3_int64 rows = 0;
+        if (!_row_counter->count(table, rows))
+        {
+            count = -1;
+            return false;
+        }
+        if (rows > std::numeric_limits<int>::max())
+        {
+            count = -1;
+            _last_error = "Row count exceeds int : use RowCounter::count().";
+            SQLITEWRAP_LOG_ERROR("SqliteWrap::select_count_sync(...) - Error: " << _last_error);
+            return false;
+        }
+        count = static_cast<int>(rows);
+        return true;
+    }
+
+    if (_result_cache)
+    {
+        count = -1;
+        auto row = [](void* param, int, char** values, char**) -> bool
+        {
+            *static_cast<int*>(param) = values[0] ? std::atoi(values[0]) : -1;
+            return true;
+        };
+        return select_cached(sql, {}, &count, row) && count >= 0;
+    }
+
     sqlite3_stmt *statement = nullptr;
     sqlite3_prepare_v2(_db, sql.c_str(), -1, &statement, 0);        // prepare our query
 
@@ -219,7 +346,7 @@ bool SqliteWrap::select(const std::string &table, const std::string &condition,
 {
     if (!_db)
     {
-        std::cerr << "Error: Database not connected." << std::endl;
+        SQLITEWRAP_LOG_ERROR("Error: Database not connected.");
         return false;
     }
 
@@ -237,11 +364,24 @@ bool SqliteWrap::select(const std::string &table, const std::string &condition,
 
     sql += ";";
 
+    BusyHandler::Scope busy(_busy_handler.get(), sql);
+
+    if (_result_cache)
+    {
+        struct Forward { void* user_param; int (*callback)(void*,int,char**,char**); } forward {user_param, callback};
+        auto row = [](void* param, int column_count, char** values, char** names) -> bool
+        {
+            Forward* f = static_cast<Forward*>(param);
+            return f->callback(f->user_param, column_count, values, names) == 0;   // sqlite3_exec convention
+        };
+        return select_cached(sql, {}, &forward, row);
+    }
+
     int rc = sqlite3_exec(_db, sql.c_str(), callback, user_param, &errorMessage);
 
     if (rc != SQLITE_OK)
     {
-        std::cerr << "SQL error: " << errorMessage << std::endl;
+        SQLITEWRAP_LOG_ERROR("SQL error: " << errorMessage);
         _last_error = errorMessage;
         sqlite3_free(errorMessage);
         return false;
@@ -255,7 +395,7 @@ bool SqliteWrap::select_sync(const std::string &table, const std::string &condit
 {
     if (!_db)
     {
-        std::cerr << "SqliteWrap::select_syn(...) - Error: Database not connected." << std::endl;
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::select_syn(...) - Error: Database not connected.");
         return false;
     }
 
@@ -263,10 +403,23 @@ bool SqliteWrap::select_sync(const std::string &table, const std::string &condit
     if (!condition.empty()) sql += " WHERE " + condition;
     sql += ";";
 
+    BusyHandler::Scope busy(_busy_handler.get(), sql);
+
+    if (_result_cache)
+    {
+        struct Forward { void* user_param; DeserializeCallback callback; } forward {user_param, callback};
+        auto row = [](void* param, int column_count, char** values, char**) -> bool
+        {
+            Forward* f = static_cast<Forward*>(param);
+            return forward_row(f->user_param, f->callback, values, column_count);
+        };
+        return select_cached(sql, {}, &forward, row);
+    }
+
     sqlite3_stmt *statement = nullptr;
     sqlite3_prepare_v2(_db, sql.c_str(), -1, &statement, 0);        // prepare our query
 
-    std::cout << "SqliteWrap::select_syn(...) - SqliteWrap::select_sync - sql = " << sql << std::endl;
+    SQLITEWRAP_LOG_DEBUG("SqliteWrap::select_sync(...) - sql = " << sql);
 
     int rc;
     while ((rc = sqlite3_step(statement)) == SQLITE_ROW)            // execute sqlite3_step while there are rows to be fetched
@@ -302,7 +455,7 @@ bool SqliteWrap::select_sync(const std::string &table, const std::string &condit
 
     if (rc != SQLITE_DONE)
     {
-        std::cerr << "SqliteWrap::select_syn(...) - Error: " << sqlite3_errmsg(_db) << std::endl;
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::select_syn(...) - Error: " << sqlite3_errmsg(_db));
         sqlite3_finalize(statement);                 // free our statement
         return false;
     }
@@ -313,36 +466,555 @@ bool SqliteWrap::select_sync(const std::string &table, const std::string &condit
 }
 
 
-bool SqliteWrap::get_table_list(std::vector<std::string>& table_list)
+bool SqliteWrap::query_sync(const std::string &sql, const std::vector<SqlValue> &params, void *user_param, DeserializeCallback callback)
 {
-    const char* query = "SELECT name FROM sqlite_master WHERE type IN ('table', 'view') ORDER BY name;";
+    if (!_db)
+    {
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::query_sync(...) - Error: Database not connected.");
+        return false;
+    }
 
-    sqlite3_stmt* statement = nullptr;
+    struct Forward { void* user_param; DeserializeCallback callback; } forward {user_param, callback};
+    auto row = [](void* param, int column_count, char** values, char**) -> bool
+    {
+        Forward* f = static_cast<Forward*>(param);
+        return forward_row(f->user_param, f->callback, values, column_count);
+    };
 
-    sqlite3_prepare_v2(_db, query, -1, &statement, 0);
+    BusyHandler::Scope busy(_busy_handler.get(), sql);
+
+    if (_result_cache) return select_cached(sql, params, &forward, row);
+
+    sqlite3_stmt *statement = nullptr;
+    if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::query_sync(...) - Error: " << sqlite3_errmsg(_db));
+        _last_error = sqlite3_errmsg(_db);
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    if (!bind_values(statement, params))
+    {
+        _last_error = sqlite3_errmsg(_db);
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    int column_count = sqlite3_column_count(statement);
+    std::vector<char*> values(static_cast<size_t>(column_count));
 
     int rc;
-    while ((rc = sqlite3_step(statement)) == SQLITE_ROW) {
-        // Retrieve and store the table name
-        const char* t = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
-        //std::cout << "Table Name: " << t << std::endl;
-        table_list.push_back(t);
+    while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+    {
+        for (int i = 0; i < column_count; i++)
+            values[i] = reinterpret_cast<char*>(const_cast<unsigned char*>(sqlite3_column_text(statement, i)));
+
+        if (!row(&forward, column_count, values.data(), nullptr))
+        {
+            sqlite3_finalize(statement);
+            return false;
+        }
     }
 
-    // Check for errors or no tables found
-    if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
-        std::cerr << "Error: " << sqlite3_errmsg(_db) << std::endl;
+    if (rc != SQLITE_DONE)
+    {
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::query_sync(...) - Error: " << sqlite3_errmsg(_db));
+        _last_error = sqlite3_errmsg(_db);
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    sqlite3_finalize(statement);
+
+    return true;
+}
+
+
+bool SqliteWrap::select_count_sync(const std::string &table, const std::string &condition, const std::vector<SqlValue> &params, int &count)
+{
+    std::string sql = "SELECT COUNT(*) FROM " + table;
+    if (!condition.empty()) sql += " WHERE " + condition;
+    sql += ";";
+
+    count = -1;
+    auto row = [](void* param, char** values, int) -> bool
+    {
+        *static_cast<int*>(param) = values[0] ? std::atoi(values[0]) : -1;
+        delete[] values[0];
+        return true;
+    };
+
+    return query_sync(sql, params, &count, row) && count >= 0;
+}
+
+
+bool SqliteWrap::select_sync(const std::string &table, const std::string &condition, const std::vector<SqlValue> &params, void *user_param, DeserializeCallback callback)
+{
+    std::string sql = "SELECT * FROM " + table;
+    if (!condition.empty()) sql += " WHERE " + condition;
+    sql += ";";
+
+    return query_sync(sql, params, user_param, callback);
+}
+
+
+bool SqliteWrap::multi_get(const std::string &table, const std::string &key_column, const SqlArray &keys, void *user_param, DeserializeCallback callback)
+{
+    std::string sql = "SELECT * FROM " + quote_identifier(table) + " WHERE " + quote_identifier(key_column) + " IN carray(?);";
+
+    return query_sync(sql, { keys }, user_param, callback);
+}
+
+
+bool SqliteWrap::query_arrow(const std::string &sql, int batch_rows, ArrowBatches &batches, const std::vector<SqlValue> &params)
+{
+    batches.clear();
+
+    if (!_db)
+    {
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::query_arrow(...) - Error: Database not connected.");
+        return false;
+    }
+
+    BusyHandler::Scope busy(_busy_handler.get(), sql);
+
+    sqlite3_stmt *statement = nullptr;
+    if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK || !bind_values(statement, params))
+    {
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::query_arrow(...) - Error: " << sqlite3_errmsg(_db));
+        _last_error = sqlite3_errmsg(_db);
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    if (!batches.read(statement, batch_rows))
+    {
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::query_arrow(...) - Error: " << sqlite3_errmsg(_db));
+        _last_error = sqlite3_errmsg(_db);
         sqlite3_finalize(statement);
         return false;
     }
 
-    // Don't forget to finalize the statement
     sqlite3_finalize(statement);
 
     return true;
 }
 
 
+bool SqliteWrap::bind_values(sqlite3_stmt *statement, const std::vector<SqlValue> &params)
+{
+    // values are bound SQLITE_STATIC : params must outlive the execution of the statement
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        const SqlValue& value = params[i];
+        int index = static_cast<int>(i) + 1;
+        int rc = SQLITE_OK;
+
+        if (std::holds_alternative<sqlite3_int64>(value))
+            rc = sqlite3_bind_int64(statement, index, std::get<sqlite3_int64>(value));
+        else if (std::holds_alternative<double>(value))
+            rc = sqlite3_bind_double(statement, index, std::get<double>(value));
+        else if (std::holds_alternative<std::string>(value))
+        {
+            const std::string& text = std::get<std::string>(value);
+            rc = sqlite3_bind_text64(statement, index, text.data(), text.size(), SQLITE_STATIC, SQLITE_UTF8);
+        }
+        else if (std::holds_alternative<SqlBlob>(value))
+        {
+            const SqlBlob& blob = std::get<SqlBlob>(value);
+            if (blob.empty()) rc = sqlite3_bind_zeroblob(statement, index, 0);
+            else rc = sqlite3_bind_blob64(statement, index, blob.data(), blob.size(), SQLITE_STATIC);
+        }
+        else if (std::holds_alternative<SqlArray>(value))
+        {
+            // read by carray(?) through sqlite3_value_pointer, the array itself is not copied
+            rc = sqlite3_bind_pointer(statement, index, const_cast<SqlArray*>(&std::get<SqlArray>(value)), SqlArray::pointer_type(), nullptr);
+        }
+        else
+            rc = sqlite3_bind_null(statement, index);
+
+        if (rc != SQLITE_OK)
+        {
+            SQLITEWRAP_LOG_ERROR("SqliteWrap::bind_values(...) - Error binding parameter " << index << ": " << sqlite3_errstr(rc));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool SqliteWrap::select_cached(const std::string &sql, const std::vector<SqlValue> &params, void *user_param, bool (*row)(void *, int, char **, char **))
+{
+    std::string key = ResultCache::make_key(sql, params);
+
+    if (std::shared_ptr<const CachedResult> cached = _result_cache->find(key))
+    {
+        int column_count = cached->column_count;
+        std::vector<char*> names(static_cast<size_t>(column_count));
+        std::vector<char*> values(static_cast<size_t>(column_count));
+
+        for (int i = 0; i < column_count; i++)
+            names[i] = const_cast<char*>(cached->columns[i].c_str());
+
+        for (size_t r = 0; r < cached->row_count; r++)
+        {
+            for (int i = 0; i < column_count; i++)
+            {
+                size_t index = r * column_count + i;
+                values[i] = cached->nulls[index] ? nullptr : const_cast<char*>(cached->values[index].c_str());
+            }
+
+            if (!row(user_param, column_count, values.data(), names.data())) return false;
+        }
+
+        return true;
+    }
+
+    sqlite3_stmt *statement = nullptr;
+    std::unordered_set<std::string> tables;
+    bool cacheable = true;
+
+    if (_result_cache->prepare(sql, &statement, tables, cacheable) != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::select_cached(...) - sql : " << sql << " - SQL error: " << sqlite3_errmsg(_db));
+        _last_error = sqlite3_errmsg(_db);
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    if (!bind_values(statement, params))
+    {
+        _last_error = sqlite3_errmsg(_db);
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    // the rows are captured while being forwarded; results larger than the cache are not kept
+    cacheable = cacheable && sqlite3_stmt_readonly(statement) != 0;
+    size_t captured_bytes = 0;
+
+    CachedResult result;
+    result.column_count = sqlite3_column_count(statement);
+    for (int i = 0; i < result.column_count; i++)
+        result.columns.emplace_back(sqlite3_column_name(statement, i));
+
+    std::vector<char*> names(static_cast<size_t>(result.column_count));
+    std::vector<char*> values(static_cast<size_t>(result.column_count));
+    for (int i = 0; i < result.column_count; i++)
+        names[i] = const_cast<char*>(result.columns[i].c_str());
+
+    int rc;
+    while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+    {
+        size_t first = result.values.size();
+
+        for (int i = 0; i < result.column_count; i++)
+        {
+            const char* text = reinterpret_cast<const char*>(sqlite3_column_text(statement, i));
+            if (text)
+            {
+                result.values.emplace_back(text, static_cast<size_t>(sqlite3_column_bytes(statement, i)));
+                result.nulls.push_back(0);
+            }
+            else
+            {
+                result.values.emplace_back();
+                result.nulls.push_back(1);
+            }
+            captured_bytes += result.values.back().size() + sizeof(std::string) + 1;
+        }
+
+        for (int i = 0; i < result.column_count; i++)
+            values[i] = result.nulls[first + i] ? nullptr : &result.values[first + i][0];
+
+        if (!row(user_param, result.column_count, values.data(), names.data()))
+        {
+            sqlite3_finalize(statement);
+            return false;
+        }
+
+        if (cacheable && captured_bytes > _result_cache->get_max_bytes()) cacheable = false;
+
+        if (cacheable) result.row_count++;
+        else
+        {
+            result.values.clear();
+            result.nulls.clear();
+        }
+    }
+
+    if (rc != SQLITE_DONE)
+    {
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::select_cached(...) - Error: " << sqlite3_errmsg(_db));
+        _last_error = sqlite3_errmsg(_db);
+        sqlite3_finalize(statement);
+        return false;
+    }
+
+    sqlite3_finalize(statement);
+
+    if (cacheable) _result_cache->insert(key, std::move(result), tables);
+
+    return true;
+}
+
+
+bool SqliteWrap::enable_result_cache(size_t max_bytes)
+{
+    if (max_bytes == 0)
+    {
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::enable_result_cache(...) - Error: cache size is 0.");
+        return false;
+    }
+
+    if (_result_cache) _result_cache->set_max_bytes(max_bytes);
+    else _result_cache = std::make_unique<ResultCache>(*this, max_bytes);
+
+    return true;
+}
+
+
+void SqliteWrap::disable_result_cache()
+{
+    _result_cache.reset();
+}
+
+
+bool SqliteWrap::enable_row_counter()
+{
+    if (!_row_counter) _row_counter = std::make_unique<RowCounter>(*this);
+    return true;
+}
+
+
+void SqliteWrap::disable_row_counter()
+{
+    _row_counter.reset();
+}
+
+
+bool SqliteWrap::enable_busy_handler(const BusyOptions &options)
+{
+    if (_busy_handler) _busy_handler->set_options(options);
+    else _busy_handler = std::make_unique<BusyHandler>(options);
+
+    install_hooks();
+
+    return true;
+}
+
+
+void SqliteWrap::disable_busy_handler()
+{
+    if (_busy_handler && _db) sqlite3_busy_handler(_db, nullptr, nullptr);
+    _busy_handler.reset();
+}
+
+
+bool SqliteWrap::add_update_listener(void *user_param, UpdateCallback callback)
+{
+    for (const auto& listener : _update_listeners)
+        if (listener.first == user_param && listener.second == callback) return false;
+
+    _update_listeners.emplace_back(user_param, callback);
+    install_hooks();
+
+    return true;
+}
+
+
+bool SqliteWrap::remove_update_listener(void *user_param, UpdateCallback callback)
+{
+    for (auto it = _update_listeners.begin(); it != _update_listeners.end(); ++it)
+    {
+        if (it->first == user_param && it->second == callback)
+        {
+            _update_listeners.erase(it);
+            install_hooks();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+bool SqliteWrap::add_rollback_listener(void *user_param, RollbackCallback callback)
+{
+    for (const auto& listener : _rollback_listeners)
+        if (listener.first == user_param && listener.second == callback) return false;
+
+    _rollback_listeners.emplace_back(user_param, callback);
+    install_hooks();
+
+    return true;
+}
+
+
+bool SqliteWrap::remove_rollback_listener(void *user_param, RollbackCallback callback)
+{
+    for (auto it = _rollback_listeners.begin(); it != _rollback_listeners.end(); ++it)
+    {
+        if (it->first == user_param && it->second == callback)
+        {
+            _rollback_listeners.erase(it);
+            install_hooks();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void SqliteWrap::set_authorizer(void *user_param, AuthorizerCallback callback)
+{
+    _authorizer = callback;
+    _authorizer_param = user_param;
+
+    if (_db) sqlite3_set_authorizer(_db, _authorizer, _authorizer_param);
+}
+
+
+void SqliteWrap::install_hooks()
+{
+    if (!_db) return;
+
+    sqlite3_update_hook(_db, _update_listeners.empty() ? nullptr : &SqliteWrap::update_hook, this);
+    sqlite3_rollback_hook(_db, _rollback_listeners.empty() ? nullptr : &SqliteWrap::rollback_hook, this);
+
+    // only when enabled : would clear a busy_timeout set by the application
+    if (_busy_handler) sqlite3_busy_handler(_db, &BusyHandler::callback, _busy_handler.get());
+    if (_authorizer) sqlite3_set_authorizer(_db, _authorizer, _authorizer_param);
+}
+
+
+void SqliteWrap::register_modules()
+{
+    if (!_db) return;
+
+    SqlArray::register_module(_db);
+}
+
+
+void SqliteWrap::optimize_on_close()
+{
+    if (!_db || _close_analysis_limit < 0) return;
+
+    // the connection knows which tables its queries found without good statistics
+    std::string sql = "PRAGMA analysis_limit = " + std::to_string(_close_analysis_limit) + "; PRAGMA optimize;";
+    char* errorMessage = nullptr;
+    if (sqlite3_exec(_db, sql.c_str(), nullptr, nullptr, &errorMessage) != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::optimize_on_close(...) - Error: " << errorMessage);
+        sqlite3_free(errorMessage);
+    }
+}
+
+
+void SqliteWrap::release_statements()
+{
+    if (_result_cache) _result_cache->release();
+    if (_row_counter) _row_counter->release();
+    _schema_cache->release();
+}
+
+
+void SqliteWrap::update_hook(void *user_param, int operation, const char *database, const char *table, sqlite3_int64 rowid)
+{
+    SqliteWrap* wrap = static_cast<SqliteWrap*>(user_param);
+
+    for (size_t i = 0; i < wrap->_update_listeners.size(); i++)
+        wrap->_update_listeners[i].second(wrap->_update_listeners[i].first, operation, database, table, rowid);
+}
+
+
+void SqliteWrap::rollback_hook(void *user_param)
+{
+    SqliteWrap* wrap = static_cast<SqliteWrap*>(user_param);
+
+    for (size_t i = 0; i < wrap->_rollback_listeners.size(); i++)
+        wrap->_rollback_listeners[i].second(wrap->_rollback_listeners[i].first);
+}
+
+
+bool SqliteWrap::remove_function(const std::string &name, int arg_count)
+{
+    if (!_db) return function_error("remove_function", name, SQLITE_MISUSE);
+
+    int rc = sqlite3_create_function_v2(_db, name.c_str(), arg_count, SQLITE_UTF8, nullptr, nullptr, nullptr, nullptr, nullptr);
+
+    return rc == SQLITE_OK || function_error("remove_function", name, rc);
+}
+
+
+void SqliteWrap::set_volatile_function(const std::string &name, bool is_volatile)
+{
+    std::string key = name;
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    if (is_volatile) _volatile_functions.insert(key);
+    else _volatile_functions.erase(key);
+}
+
+
+bool SqliteWrap::is_volatile_function(const std::string &name) const
+{
+    if (_volatile_functions.empty()) return false;
+
+    std::string key = name;
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    return _volatile_functions.count(key) > 0;
+}
+
+
+bool SqliteWrap::function_error(const char *function, const std::string &name, int rc)
+{
+    _last_error = _db ? sqlite3_errmsg(_db) : "Database not connected.";
+    SQLITEWRAP_LOG_ERROR("SqliteWrap::" << function << "(...) - Error for " << name << ": " << _last_error << " (" << sqlite3_errstr(rc) << ")");
+
+    return false;
+}
+
+
+std::string SqliteWrap::quote_identifier(const std::string &name)
+{
+    std::string quoted = "\"";
+    for (char c : name)
+    {
+        if (c == '"') quoted += '"';
+        quoted += c;
+    }
+    quoted += '"';
+
+    return quoted;
+}
+
+
+std::string SqliteWrap::quote_literal(const std::string &value)
+{
+    std::string quoted = "'";
+    for (char c : value)
+    {
+        if (c == '\'') quoted += '\'';
+        quoted += c;
+    }
+    quoted += '\'';
+
+    return quoted;
+}
+
+
+bool SqliteWrap::get_table_list(std::vector<std::string>& table_list)
+{
+    // sqlite_master is only read again when PRAGMA schema_version changes
+    return _schema_cache->get_table_list(table_list);
+}
+
+
 bool SqliteWrap::get_sqlite_version(std::string &version)
 {
     const char* pingQuery = "SELECT sqlite_version();";
@@ -353,14 +1025,14 @@ bool SqliteWrap::get_sqlite_version(std::string &version)
     int rc = sqlite3_step(pingStatement);
 
     if (rc != SQLITE_ROW) {
-        std::cerr << "SqliteWrap::get_table_list(...) - Error: " << sqlite3_errmsg(_db) << std::endl;
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::get_table_list(...) - Error: " << sqlite3_errmsg(_db));
         sqlite3_finalize(pingStatement); // Don't forget to finalize the statement
         return false;
     }
 
     // Retrieve and print the SQLite version
     const char* sqliteVersion = reinterpret_cast<const char*>(sqlite3_column_text(pingStatement, 0));
-    std::cout << "SqliteWrap::get_table_list(...) - SQLite Version: " << sqliteVersion << std::endl;
+    SQLITEWRAP_LOG_DEBUG("SqliteWrap::get_table_list(...) - SQLite Version: " << sqliteVersion);
 
     // Don't forget to finalize the statement
     sqlite3_finalize(pingStatement);
@@ -376,12 +1048,12 @@ bool SqliteWrap::get_database_name(std::string &db_name)
     if (sqlite3_prepare_v2(_db, sql, -1, &statement, nullptr) == SQLITE_OK) {
         while (sqlite3_step(statement) == SQLITE_ROW) {
             const char* n = reinterpret_cast<const char*>(sqlite3_column_text(statement, 1));
-            std::cout << "SqliteWrap::get_database_name(...) - Database Name: " << n << std::endl;
+            SQLITEWRAP_LOG_DEBUG("SqliteWrap::get_database_name(...) - Database Name: " << n);
             db_name = n;
         }
         sqlite3_finalize(statement);
     } else {
-        std::cerr << "SqliteWrap::get_database_name(...) - Error executing PRAGMA query." << std::endl;
+        SQLITEWRAP_LOG_ERROR("SqliteWrap::get_database_name(...) - Error executing PRAGMA query.");
     }
 
     return true;
@@ -390,13 +1062,16 @@ bool SqliteWrap::get_database_name(std::string &db_name)
 
 bool SqliteWrap::get_database_schema(const std::string& pathfile)
 {
-    const char* query = "SELECT name, sql FROM sqlite_master WHERE type IN ('table', 'view');";
+    // indexes too : the statistics of export_stats() (AnalyzeScheduler) describe them. Tables first,
+    // automatic indexes have no sql
+    const char* query = "SELECT name, sql FROM sqlite_master WHERE type IN ('table', 'view', 'index', 'trigger') AND sql IS NOT NULL "
+                        "ORDER BY CASE type WHEN 'table' THEN 0 WHEN 'view' THEN 1 WHEN 'index' THEN 2 ELSE 3 END, rowid;";
     sqlite3_stmt* statement = nullptr;
 
     // Open the file for writing
     std::ofstream outputFile(pathfile, std::ios::out);
     if (!outputFile.is_open()) {
-        std::cerr << "get_database_schema(...) - Error: Unable to open the file for writing." << std::endl;
+        SQLITEWRAP_LOG_ERROR("get_database_schema(...) - Error: Unable to open the file for writing.");
         return false;
     }
 
@@ -407,8 +1082,8 @@ bool SqliteWrap::get_database_schema(const std::string& pathfile)
     while ((rc = sqlite3_step(statement)) == SQLITE_ROW) {
         // Retrieve and store the table name and SQL definition
         const char* tableName = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
-        // if table name == sqlite_sequence => continue
-        if (strcmp(tableName, "sqlite_sequence") == 0)
+        // internal tables (sqlite_sequence, sqlite_stat1 ...) cannot be created => continue
+        if (strncmp(tableName, "sqlite_", 7) == 0)
             continue;
         const char* sqlDefinition = reinterpret_cast<const char*>(sqlite3_column_text(statement, 1));
 
@@ -418,7 +1093,7 @@ bool SqliteWrap::get_database_schema(const std::string& pathfile)
 
     // Check for errors or no tables found
     if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
-        std::cerr << "get_database_schema(...) - Error: " << sqlite3_errmsg(_db) << std::endl;
+        SQLITEWRAP_LOG_ERROR("get_database_schema(...) - Error: " << sqlite3_errmsg(_db));
         sqlite3_finalize(statement);
         outputFile.close();
         return false;
@@ -433,12 +1108,12 @@ bool SqliteWrap::get_database_schema(const std::string& pathfile)
 
 bool SqliteWrap::execute_sql_file(const std::string& pathfile)
 {
-    std::cout << "SqliteWrap::execute_sql_file(...) - pathfile = " << pathfile << std::endl;
+    SQLITEWRAP_LOG_DEBUG("SqliteWrap::execute_sql_file(...) - pathfile = " << pathfile);
 
     std::ifstream file(pathfile);
     if (!file.is_open())
     {
-        std::cerr << "Error: Unable to open file " << pathfile << std::endl;
+        SQLITEWRAP_LOG_ERROR("Error: Unable to open file " << pathfile);
         return false;
     }
 
@@ -475,7 +1150,7 @@ bool SqliteWrap::execute_sql_file(const std::string& pathfile)
     {
         if (!execute_sql(sql))
         {
-            std::cerr << "SqliteWrap::execute_sql_file(...) - Error executing SQL command: " << sql << std::endl;
+            SQLITEWRAP_LOG_ERROR("SqliteWrap::execute_sql_file(...) - Error executing SQL command: " << sql);
             return false;
         }
     }
@@ -490,7 +1165,7 @@ bool SqliteWrap::get_table_content(const std::string &table_name, std::vector<st
 
     if (!_db)
     {
-        std::cerr << "get_table_content(...) - Error: Database not connected." << std::endl;
+        SQLITEWRAP_LOG_ERROR("get_table_content(...) - Error: Database not connected.");
         return false;
     }
 
@@ -499,7 +1174,7 @@ bool SqliteWrap::get_table_content(const std::string &table_name, std::vector<st
     sqlite3_stmt *statement = nullptr;
     sqlite3_prepare_v2(_db, sql.c_str(), -1, &statement, 0); // prepare our query
 
-    std::cout << "SqliteWrap::get_table_content (smart pointers) - sql = " << sql << std::endl;
+    SQLITEWRAP_LOG_DEBUG("SqliteWrap::get_table_content (smart pointers) - sql = " << sql);
 
     int rc;
     while ((rc = sqlite3_step(statement)) == SQLITE_ROW) // execute sqlite3_step while there are rows to be fetched
@@ -537,7 +1212,7 @@ bool SqliteWrap::get_table_content(const std::string &table_name, std::vector<st
 
     if (rc != SQLITE_DONE)
     {
-        std::cerr << "get_table_content(...) - Error: " << sqlite3_errmsg(_db) << std::endl;
+        SQLITEWRAP_LOG_ERROR("get_table_content(...) - Error: " << sqlite3_errmsg(_db));
         sqlite3_finalize(statement); // free our statement
         return false;
     }
@@ -553,13 +1228,13 @@ bool SqliteWrap::get_table_content_(const std::string &table_name, std::vector<s
 
     if (table_name.empty())
     {
-        std::cerr << "get_table_content_(...) - Error: Table name is empty." << std::endl;
+        SQLITEWRAP_LOG_ERROR("get_table_content_(...) - Error: Table name is empty.");
         return false;
     }
 
     if (!_db)
     {
-        std::cerr << "get_table_content_(...) - Error: Database not connected." << std::endl;
+        SQLITEWRAP_LOG_ERROR("get_table_content_(...) - Error: Database not connected.");
         return false;
     }
 
@@ -568,7 +1243,7 @@ bool SqliteWrap::get_table_content_(const std::string &table_name, std::vector<s
     sqlite3_stmt *statement = nullptr;
     sqlite3_prepare_v2(_db, sql.c_str(), -1, &statement, 0); // prepare our query
 
-    std::cout << "SqliteWrap::get_table_content_ - sql = " << sql << std::endl;
+    SQLITEWRAP_LOG_DEBUG("SqliteWrap::get_table_content_ - sql = " << sql);
 
     int rc;
     while ((rc = sqlite3_step(statement)) == SQLITE_ROW) // execute sqlite3_step while there are rows to be fetched
@@ -601,7 +1276,7 @@ bool SqliteWrap::get_table_content_(const std::string &table_name, std::vector<s
 
     if (rc != SQLITE_DONE)
     {
-        std::cerr << "get_table_content_(...) - Error: " << sqlite3_errmsg(_db) << std::endl;
+        SQLITEWRAP_LOG_ERROR("get_table_content_(...) - Error: " << sqlite3_errmsg(_db));
         sqlite3_finalize(statement); // free our statement
         return false;
     }
@@ -2,18 +2,40 @@
 #define SQLITEWRAP_H
 
 #include <string>
+#include <unordered_set>
 #include <vector>
 #include <memory>
+#include <variant>
 
 #include "SqliteWrap_global.h"
 #include "sqlite3.h"
+#include "sqlitearray.h"
+#include "sqlitefunction.h"
+#include "sqlitevtab.h"
 
+// values : one new char[] per column (nullptr for NULL), owned by the callback which delete[]s them;
+// the array itself is freed by the caller. Same rule with or without the result cache
 using DeserializeCallback = bool (*)(void*, char**, int);
+using UpdateCallback = void (*)(void* user_param, int operation, const char* database, const char* table, sqlite3_int64 rowid);
+using RollbackCallback = void (*)(void* user_param);
+using AuthorizerCallback = int (*)(void* user_param, int action, const char* arg1, const char* arg2, const char* database, const char* trigger);
+
+// Bound parameter value : NULL, INTEGER, REAL, TEXT, BLOB or an array for carray(?)
+using SqlBlob = std::vector<unsigned char>;
+using SqlValue = std::variant<std::nullptr_t, sqlite3_int64, double, std::string, SqlBlob, SqlArray>;
+
+class ArrowBatches;
+class BusyHandler;
+struct BusyOptions;
+class ResultCache;
+class RowCounter;
+class SchemaCache;
 
 class SQLITEWRAP_EXPORT SqliteWrap
 {
 public:
     SqliteWrap();
+    ~SqliteWrap();
 
     bool is_connected() const { return _db != nullptr; }
 
@@ -22,16 +44,111 @@ public:
     bool disconnect();
     bool disconnect_();                          // version with try catch throw
     bool exists(const std::string& db_name);
-    bool create_db(const std::string& db_name);
+    bool exists(const std::string& table, const std::string& condition, bool& found);   // SELECT 1 ... LIMIT 1
+    // incremental_vacuum : auto_vacuum = INCREMENTAL, freed pages are given back by IncrementalVacuum
+    bool create_db(const std::string& db_name, bool incremental_vacuum = false);
     bool delete_db(const std::string& db_name);
 
     bool execute_sql(const std::string& sql);
 
     // select command
     bool select_count_sync (const std::string &table, const std::string &condition, int &count);
+    // callback as for sqlite3_exec() : values and names are only valid during the call
     bool select(const std::string &table, const std::string &condition, void* user_param, int (*callback)(void*,int,char**,char**), int &count);
 
     bool select_sync(const std::string &table, const std::string &condition, void* user_param, DeserializeCallback callback );
+    // same with bound parameters in the condition, e.g. "id IN carray(?)" and { SqlArray(ids) }
+    bool select_count_sync(const std::string &table, const std::string &condition, const std::vector<SqlValue> &params, int &count);
+    bool select_sync(const std::string &table, const std::string &condition, const std::vector<SqlValue> &params, void* user_param, DeserializeCallback callback);
+    // any read statement, with bound parameters
+    bool query_sync(const std::string &sql, const std::vector<SqlValue> &params, void* user_param, DeserializeCallback callback);
+    // point lookups : SELECT * FROM table WHERE key_column IN carray(keys), one statement whatever the number of keys
+    bool multi_get(const std::string &table, const std::string &key_column, const SqlArray &keys, void* user_param, DeserializeCallback callback);
+    static bool bind_values(sqlite3_stmt* statement, const std::vector<SqlValue> &params);
+    // result as Arrow record batches of at most batch_rows rows (see arrowbatches.h)
+    bool query_arrow(const std::string &sql, int batch_rows, ArrowBatches &batches, const std::vector<SqlValue> &params = {});
+
+    // result cache (opt-in), invalidated per table by the update hook and by PRAGMA data_version
+    bool enable_result_cache(size_t max_bytes);
+    void disable_result_cache();
+
+    // maintained row counts, used by select_count_sync when there is no condition
+    bool enable_row_counter();
+    void disable_row_counter();
+
+    // PRAGMA optimize before sqlite3_close (analysis_limit rows per index), -1 : off
+    void set_optimize_on_close(int analysis_limit) { _close_analysis_limit = analysis_limit; }
+
+    // lock waits : jittered exponential backoff, deadline per kind of statement, waits per statement (see busyhandler.h)
+    bool enable_busy_handler(const BusyOptions &options);
+    void disable_busy_handler();
+
+    // sqlite3_update_hook / sqlite3_rollback_hook fan-out : several listeners can observe this connection
+    bool add_update_listener(void* user_param, UpdateCallback callback);
+    bool remove_update_listener(void* user_param, UpdateCallback callback);
+    bool add_rollback_listener(void* user_param, RollbackCallback callback);
+    bool remove_rollback_listener(void* user_param, RollbackCallback callback);
+    // sqlite3_set_authorizer through the wrapper : the result cache installs its own while it
+    // prepares a statement, calls this one first and restores it afterwards. An authorizer set
+    // with sqlite3_set_authorizer() on get_handle() is removed by the result cache
+    void set_authorizer(void* user_param, AuthorizerCallback callback);
+
+    // application-defined SQL functions, typed from the C++ signature (see sqlitefunction.h);
+    // they belong to the connection : register them again after connect
+    template <typename F>
+    bool register_function(const std::string& name, F&& function, bool deterministic = true, bool innocuous = true)
+    {
+        if (!_db) return function_error("register_function", name, SQLITE_MISUSE);
+
+        // DETERMINISTIC allows use in indexes and CHECK constraints, INNOCUOUS in schema when trusted_schema is OFF
+        int flags = SQLITE_UTF8 | (deterministic ? SQLITE_DETERMINISTIC : 0) | (innocuous ? SQLITE_INNOCUOUS : 0);
+        int rc = sqlitewrap_detail::create_scalar_function(_db, name.c_str(), std::forward<F>(function), flags);
+        if (rc == SQLITE_OK) set_volatile_function(name, !deterministic);
+
+        return rc == SQLITE_OK || function_error("register_function", name, rc);
+    }
+    // aggregate (step / result) and window (step / inverse / result) functions from a state class
+    template <typename State>
+    bool register_aggregate(const std::string& name, bool deterministic = true, bool innocuous = true)
+    {
+        if (!_db) return function_error("register_aggregate", name, SQLITE_MISUSE);
+
+        int flags = SQLITE_UTF8 | (deterministic ? SQLITE_DETERMINISTIC : 0) | (innocuous ? SQLITE_INNOCUOUS : 0);
+        int rc = sqlitewrap_detail::create_aggregate_function<State>(_db, name.c_str(), flags);
+        if (rc == SQLITE_OK) set_volatile_function(name, !deterministic);
+
+        return rc == SQLITE_OK || function_error("register_aggregate", name, rc);
+    }
+    template <typename State>
+    bool register_window_function(const std::string& name, bool deterministic = true, bool innocuous = true)
+    {
+        if (!_db) return function_error("register_window_function", name, SQLITE_MISUSE);
+
+        int flags = SQLITE_UTF8 | (deterministic ? SQLITE_DETERMINISTIC : 0) | (innocuous ? SQLITE_INNOCUOUS : 0);
+        int rc = sqlitewrap_detail::create_window_function<State>(_db, name.c_str(), flags);
+        if (rc == SQLITE_OK) set_volatile_function(name, !deterministic);
+
+        return rc == SQLITE_OK || function_error("register_window_function", name, rc);
+    }
+    bool remove_function(const std::string& name, int arg_count);
+
+    // read-only table over an in-process container, read in place (see sqlitevtab.h);
+    // the container must outlive the connection
+    template <typename Container>
+    bool register_vtab(const std::string& name, const Container& container, const VtabDescriptor<typename Container::value_type>& descriptor)
+    {
+        if (!_db) return function_error("register_vtab", name, SQLITE_MISUSE);
+
+        int rc = sqlitewrap_detail::create_container_module(_db, name.c_str(), container, descriptor);
+
+        return rc == SQLITE_OK || function_error("register_vtab", name, rc);
+    }
+    template <typename Container>
+    bool register_vtab(const std::string& name, const Container&& container, const VtabDescriptor<typename Container::value_type>& descriptor) = delete;
+
+    // SQL quoting : "identifier" and 'literal'
+    static std::string quote_identifier(const std::string& name);
+    static std::string quote_literal(const std::string& value);
 
     bool get_sqlite_version (std::string &version);
     bool get_database_name (std::string &db_name);
@@ -49,9 +166,40 @@ private:
     sqlite3* _db = nullptr;
     std::string _last_error;
 
+    std::vector<std::pair<void*, UpdateCallback>> _update_listeners;
+    std::vector<std::pair<void*, RollbackCallback>> _rollback_listeners;
+    AuthorizerCallback _authorizer = nullptr;
+    void* _authorizer_param = nullptr;
+    std::unordered_set<std::string> _volatile_functions;     // registered without deterministic, lowercase
+    std::unique_ptr<ResultCache> _result_cache;
+    std::unique_ptr<RowCounter> _row_counter;
+    std::unique_ptr<SchemaCache> _schema_cache;
+    std::unique_ptr<BusyHandler> _busy_handler;
+    int _close_analysis_limit = -1;
+
+    void install_hooks();
+    void register_modules();            // table-valued functions available on every connection (carray)
+    bool function_error(const char* function, const std::string& name, int rc);
+    void set_volatile_function(const std::string& name, bool is_volatile);
+    void release_statements();          // statements kept prepared by the helpers, finalized before sqlite3_close
+    void optimize_on_close();
+    static void update_hook(void* user_param, int operation, const char* database, const char* table, sqlite3_int64 rowid);
+    static void rollback_hook(void* user_param);
+
+    // run a read statement through the result cache, row by row
+    bool select_cached(const std::string &sql, const std::vector<SqlValue> &params, void* user_param, bool (*row)(void*, int, char**, char**));
+
 public:
     // getter
     const std::string& get_last_error() const { return _last_error; }
+    sqlite3* get_handle() const { return _db; }
+    ResultCache* get_result_cache() const { return _result_cache.get(); }
+    RowCounter* get_row_counter() const { return _row_counter.get(); }
+    SchemaCache* get_schema_cache() const { return _schema_cache.get(); }   // tables, views, columns, indexes
+    BusyHandler* get_busy_handler() const { return _busy_handler.get(); }
+    AuthorizerCallback get_authorizer() const { return _authorizer; }
+    void* get_authorizer_param() const { return _authorizer_param; }
+    bool is_volatile_function(const std::string& name) const;
 };
 
 #endif // SQLITEWRAP_H
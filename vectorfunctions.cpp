@@ -0,0 +1,521 @@
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+
+#include "vectorfunctions.h"
+#include "logger.h"
+#include "sqlitewrap.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SQLITEWRAP_X86 1
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wuninitialized"        // false positives inside the GCC 12 AVX-512 headers
+#endif
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define SQLITEWRAP_TARGET_AVX2
+#define SQLITEWRAP_TARGET_AVX512
+#else
+#define SQLITEWRAP_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define SQLITEWRAP_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define SQLITEWRAP_NEON 1
+#include <arm_neon.h>
+#endif
+
+
+namespace
+{
+    struct Kernels
+    {
+        const char* name;
+        float (*dot)(const void*, const void*, size_t);
+        float (*l2_squared)(const void*, const void*, size_t);
+        void (*dot_norms)(const void*, const void*, size_t, float&, float&, float&);   // a.b, a.a, b.b in one pass
+    };
+
+    inline float load(const void* p, size_t i)
+    {
+        float value;
+        std::memcpy(&value, static_cast<const char*>(p) + i * sizeof(float), sizeof(float));
+        return value;
+    }
+
+
+    // scalar fallback : 4 independent accumulators so the compiler can pipeline / vectorize
+
+    float dot_scalar(const void* a, const void* b, size_t n)
+    {
+        float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            s0 += load(a, i) * load(b, i);
+            s1 += load(a, i + 1) * load(b, i + 1);
+            s2 += load(a, i + 2) * load(b, i + 2);
+            s3 += load(a, i + 3) * load(b, i + 3);
+        }
+        for (; i < n; i++) s0 += load(a, i) * load(b, i);
+        return (s0 + s1) + (s2 + s3);
+    }
+
+    float l2_squared_scalar(const void* a, const void* b, size_t n)
+    {
+        float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            float d0 = load(a, i) - load(b, i);
+            float d1 = load(a, i + 1) - load(b, i + 1);
+            float d2 = load(a, i + 2) - load(b, i + 2);
+            float d3 = load(a, i + 3) - load(b, i + 3);
+            s0 += d0 * d0; s1 += d1 * d1; s2 += d2 * d2; s3 += d3 * d3;
+        }
+        for (; i < n; i++)
+        {
+            float d = load(a, i) - load(b, i);
+            s0 += d * d;
+        }
+        return (s0 + s1) + (s2 + s3);
+    }
+
+    void dot_norms_scalar(const void* a, const void* b, size_t n, float& ab, float& aa, float& bb)
+    {
+        float sab = 0, saa = 0, sbb = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            float x = load(a, i), y = load(b, i);
+            sab += x * y; saa += x * x; sbb += y * y;
+        }
+        ab = sab; aa = saa; bb = sbb;
+    }
+
+    const Kernels scalar_kernels = {"scalar", &dot_scalar, &l2_squared_scalar, &dot_norms_scalar};
+
+
+#if defined(SQLITEWRAP_X86)
+
+    SQLITEWRAP_TARGET_AVX2 inline float hsum_avx2(__m256 v)
+    {
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+    }
+
+    SQLITEWRAP_TARGET_AVX2 float dot_avx2(const void* a, const void* b, size_t n)
+    {
+        const float* x = static_cast<const float*>(a);
+        const float* y = static_cast<const float*>(b);
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), s0);
+            s1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), s1);
+        }
+        for (; i + 8 <= n; i += 8)
+            s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), s0);
+
+        float sum = hsum_avx2(_mm256_add_ps(s0, s1));
+        for (; i < n; i++) sum += load(a, i) * load(b, i);
+        return sum;
+    }
+
+    SQLITEWRAP_TARGET_AVX2 float l2_squared_avx2(const void* a, const void* b, size_t n)
+    {
+        const float* x = static_cast<const float*>(a);
+        const float* y = static_cast<const float*>(b);
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8));
+            s0 = _mm256_fmadd_ps(d0, d0, s0);
+            s1 = _mm256_fmadd_ps(d1, d1, s1);
+        }
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 d = _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+            s0 = _mm256_fmadd_ps(d, d, s0);
+        }
+
+        float sum = hsum_avx2(_mm256_add_ps(s0, s1));
+        for (; i < n; i++)
+        {
+            float d = load(a, i) - load(b, i);
+            sum += d * d;
+        }
+        return sum;
+    }
+
+    SQLITEWRAP_TARGET_AVX2 void dot_norms_avx2(const void* a, const void* b, size_t n, float& ab, float& aa, float& bb)
+    {
+        const float* x = static_cast<const float*>(a);
+        const float* y = static_cast<const float*>(b);
+        __m256 sab = _mm256_setzero_ps(), saa = _mm256_setzero_ps(), sbb = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i);
+            sab = _mm256_fmadd_ps(vx, vy, sab);
+            saa = _mm256_fmadd_ps(vx, vx, saa);
+            sbb = _mm256_fmadd_ps(vy, vy, sbb);
+        }
+
+        ab = hsum_avx2(sab); aa = hsum_avx2(saa); bb = hsum_avx2(sbb);
+        for (; i < n; i++)
+        {
+            float vx = load(a, i), vy = load(b, i);
+            ab += vx * vy; aa += vx * vx; bb += vy * vy;
+        }
+    }
+
+    const Kernels avx2_kernels = {"avx2", &dot_avx2, &l2_squared_avx2, &dot_norms_avx2};
+
+
+    // AVX-512 : the tail is handled with masked loads, no scalar loop
+
+    SQLITEWRAP_TARGET_AVX512 inline float hsum_avx512(__m512 v)
+    {
+        // fold 512 -> 128 bits with lane shuffles, then finish in SSE
+        __m512 sum = _mm512_add_ps(v, _mm512_shuffle_f32x4(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm512_add_ps(sum, _mm512_shuffle_f32x4(sum, sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        __m128 low = _mm512_castps512_ps128(sum);
+        low = _mm_add_ps(low, _mm_movehl_ps(low, low));
+        low = _mm_add_ss(low, _mm_shuffle_ps(low, low, 1));
+        return _mm_cvtss_f32(low);
+    }
+
+    SQLITEWRAP_TARGET_AVX512 float dot_avx512(const void* a, const void* b, size_t n)
+    {
+        const float* x = static_cast<const float*>(a);
+        const float* y = static_cast<const float*>(b);
+        __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            s0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), s0);
+            s1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), s1);
+        }
+        for (; i + 16 <= n; i += 16)
+            s0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), s0);
+        if (i < n)
+        {
+            __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+            s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i), s1);
+        }
+        return hsum_avx512(_mm512_add_ps(s0, s1));
+    }
+
+    SQLITEWRAP_TARGET_AVX512 float l2_squared_avx512(const void* a, const void* b, size_t n)
+    {
+        const float* x = static_cast<const float*>(a);
+        const float* y = static_cast<const float*>(b);
+        __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i));
+            __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16));
+            s0 = _mm512_fmadd_ps(d0, d0, s0);
+            s1 = _mm512_fmadd_ps(d1, d1, s1);
+        }
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512 d = _mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i));
+            s0 = _mm512_fmadd_ps(d, d, s0);
+        }
+        if (i < n)
+        {
+            __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+            __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i));
+            s1 = _mm512_fmadd_ps(d, d, s1);
+        }
+        return hsum_avx512(_mm512_add_ps(s0, s1));
+    }
+
+    SQLITEWRAP_TARGET_AVX512 void dot_norms_avx512(const void* a, const void* b, size_t n, float& ab, float& aa, float& bb)
+    {
+        const float* x = static_cast<const float*>(a);
+        const float* y = static_cast<const float*>(b);
+        __m512 sab = _mm512_setzero_ps(), saa = _mm512_setzero_ps(), sbb = _mm512_setzero_ps();
+        for (size_t i = 0; i < n; i += 16)
+        {
+            __mmask16 mask = n - i >= 16 ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << (n - i)) - 1);
+            __m512 vx = _mm512_maskz_loadu_ps(mask, x + i), vy = _mm512_maskz_loadu_ps(mask, y + i);
+            sab = _mm512_fmadd_ps(vx, vy, sab);
+            saa = _mm512_fmadd_ps(vx, vx, saa);
+            sbb = _mm512_fmadd_ps(vy, vy, sbb);
+        }
+        ab = hsum_avx512(sab); aa = hsum_avx512(saa); bb = hsum_avx512(sbb);
+    }
+
+    const Kernels avx512_kernels = {"avx512", &dot_avx512, &l2_squared_avx512, &dot_norms_avx512};
+
+
+    bool cpu_has_avx2()
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0, fma = (info[2] & (1 << 12)) != 0;
+        if (!osxsave || !fma || (_xgetbv(0) & 0x6) != 0x6) return false;      // OS saves YMM state
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    }
+
+    bool cpu_has_avx512()
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 0xE6) != 0xE6) return false;   // OS saves ZMM / opmask state
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 16)) != 0;
+#else
+        return __builtin_cpu_supports("avx512f");
+#endif
+    }
+
+#endif // SQLITEWRAP_X86
+
+
+#if defined(SQLITEWRAP_NEON)
+
+    float dot_neon(const void* a, const void* b, size_t n)
+    {
+        const float* x = static_cast<const float*>(a);
+        const float* y = static_cast<const float*>(b);
+        float32x4_t s0 = vdupq_n_f32(0), s1 = vdupq_n_f32(0);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            s0 = vfmaq_f32(s0, vld1q_f32(x + i), vld1q_f32(y + i));
+            s1 = vfmaq_f32(s1, vld1q_f32(x + i + 4), vld1q_f32(y + i + 4));
+        }
+        float sum = vaddvq_f32(vaddq_f32(s0, s1));
+        for (; i < n; i++) sum += load(a, i) * load(b, i);
+        return sum;
+    }
+
+    float l2_squared_neon(const void* a, const void* b, size_t n)
+    {
+        const float* x = static_cast<const float*>(a);
+        const float* y = static_cast<const float*>(b);
+        float32x4_t s0 = vdupq_n_f32(0), s1 = vdupq_n_f32(0);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            float32x4_t d0 = vsubq_f32(vld1q_f32(x + i), vld1q_f32(y + i));
+            float32x4_t d1 = vsubq_f32(vld1q_f32(x + i + 4), vld1q_f32(y + i + 4));
+            s0 = vfmaq_f32(s0, d0, d0);
+            s1 = vfmaq_f32(s1, d1, d1);
+        }
+        float sum = vaddvq_f32(vaddq_f32(s0, s1));
+        for (; i < n; i++)
+        {
+            float d = load(a, i) - load(b, i);
+            sum += d * d;
+        }
+        return sum;
+    }
+
+    void dot_norms_neon(const void* a, const void* b, size_t n, float& ab, float& aa, float& bb)
+    {
+        const float* x = static_cast<const float*>(a);
+        const float* y = static_cast<const float*>(b);
+        float32x4_t sab = vdupq_n_f32(0), saa = vdupq_n_f32(0), sbb = vdupq_n_f32(0);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            float32x4_t vx = vld1q_f32(x + i), vy = vld1q_f32(y + i);
+            sab = vfmaq_f32(sab, vx, vy);
+            saa = vfmaq_f32(saa, vx, vx);
+            sbb = vfmaq_f32(sbb, vy, vy);
+        }
+        ab = vaddvq_f32(sab); aa = vaddvq_f32(saa); bb = vaddvq_f32(sbb);
+        for (; i < n; i++)
+        {
+            float vx = load(a, i), vy = load(b, i);
+            ab += vx * vy; aa += vx * vx; bb += vy * vy;
+        }
+    }
+
+    const Kernels neon_kernels = {"neon", &dot_neon, &l2_squared_neon, &dot_norms_neon};
+
+#endif // SQLITEWRAP_NEON
+
+
+    const Kernels* best_kernels()
+    {
+#if defined(SQLITEWRAP_X86)
+        if (cpu_has_avx512()) return &avx512_kernels;
+        if (cpu_has_avx2()) return &avx2_kernels;
+#endif
+#if defined(SQLITEWRAP_NEON)
+        return &neon_kernels;
+#endif
+        return &scalar_kernels;
+    }
+
+    std::atomic<const Kernels*>& kernels()
+    {
+        static std::atomic<const Kernels*> selected {best_kernels()};
+        return selected;
+    }
+
+    const Kernels& active()
+    {
+        return *kernels().load(std::memory_order_relaxed);
+    }
+
+
+    // SQL side : arguments are BLOBs of the same size, a multiple of 4 bytes
+
+    size_t dimension(const BlobView& a, const BlobView& b)
+    {
+        if (a.size % sizeof(float) != 0 || a.size != b.size)
+            throw std::invalid_argument("vector arguments must be float32 blobs of the same dimension");
+        return a.size / sizeof(float);
+    }
+
+    void vec_normalize(sqlite3_context* context, int, sqlite3_value** argv)
+    {
+        if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+        {
+            sqlite3_result_null(context);
+            return;
+        }
+
+        const void* data = sqlite3_value_blob(argv[0]);
+        int bytes = sqlite3_value_bytes(argv[0]);
+        if (bytes % sizeof(float) != 0)
+        {
+            sqlite3_result_error(context, "vector argument must be a float32 blob", -1);
+            return;
+        }
+
+        // written directly into the result buffer, handed over to SQLite
+        float* out = static_cast<float*>(sqlite3_malloc64(bytes > 0 ? bytes : 1));
+        if (!out)
+        {
+            sqlite3_result_error_nomem(context);
+            return;
+        }
+
+        VectorFunctions::normalize(data, out, static_cast<size_t>(bytes) / sizeof(float));
+        sqlite3_result_blob64(context, out, static_cast<sqlite3_uint64>(bytes), sqlite3_free);
+    }
+}
+
+
+float VectorFunctions::dot(const void *a, const void *b, size_t n)
+{
+    return active().dot(a, b, n);
+}
+
+
+float VectorFunctions::l2_squared(const void *a, const void *b, size_t n)
+{
+    return active().l2_squared(a, b, n);
+}
+
+
+float VectorFunctions::cosine_distance(const void *a, const void *b, size_t n)
+{
+    float ab, aa, bb;
+    active().dot_norms(a, b, n, ab, aa, bb);
+
+    if (aa == 0.0f || bb == 0.0f) return std::numeric_limits<float>::quiet_NaN();
+    return 1.0f - ab / std::sqrt(aa * bb);
+}
+
+
+void VectorFunctions::normalize(const void *a, float *out, size_t n)
+{
+    float norm = std::sqrt(active().dot(a, a, n));
+    float scale = norm > 0.0f ? 1.0f / norm : 0.0f;
+
+    for (size_t i = 0; i < n; i++) out[i] = load(a, i) * scale;
+}
+
+
+const char *VectorFunctions::get_kernel_name()
+{
+    return active().name;
+}
+
+
+bool VectorFunctions::select_kernel(const std::string &name)
+{
+    const Kernels* selected = nullptr;
+
+    if (name == "scalar") selected = &scalar_kernels;
+#if defined(SQLITEWRAP_X86)
+    else if (name == "avx2" && cpu_has_avx2()) selected = &avx2_kernels;
+    else if (name == "avx512" && cpu_has_avx512()) selected = &avx512_kernels;
+#endif
+#if defined(SQLITEWRAP_NEON)
+    else if (name == "neon") selected = &neon_kernels;
+#endif
+
+    if (!selected)
+    {
+        SQLITEWRAP_LOG_ERROR("VectorFunctions::select_kernel(...) - Error: kernel not available: " << name);
+        return false;
+    }
+
+    kernels().store(selected, std::memory_order_relaxed);
+    return true;
+}
+
+
+bool VectorFunctions::register_functions(SqliteWrap &db)
+{
+    using Vector = std::optional<BlobView>;
+
+    bool ok = db.register_function("vec_dot", [](Vector a, Vector b) -> std::optional<double>
+    {
+        if (!a || !b) return std::nullopt;
+        return dot(a->data, b->data, dimension(*a, *b));
+    });
+
+    ok = ok && db.register_function("vec_l2", [](Vector a, Vector b) -> std::optional<double>
+    {
+        if (!a || !b) return std::nullopt;
+        return std::sqrt(l2_squared(a->data, b->data, dimension(*a, *b)));
+    });
+
+    ok = ok && db.register_function("vec_cosine", [](Vector a, Vector b) -> std::optional<double>
+    {
+        if (!a || !b) return std::nullopt;
+        float distance = cosine_distance(a->data, b->data, dimension(*a, *b));
+        if (std::isnan(distance)) return std::nullopt;
+        return distance;
+    });
+
+    if (!ok) return false;
+
+    int rc = sqlite3_create_function_v2(db.get_handle(), "vec_normalize", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS,
+                                        nullptr, &vec_normalize, nullptr, nullptr, nullptr);
+    if (rc != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("VectorFunctions::register_functions(...) - Error: " << sqlite3_errmsg(db.get_handle()));
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef VECTORFUNCTIONS_H
+#define VECTORFUNCTIONS_H
+
+#include <cstddef>
+#include <string>
+
+#include "SqliteWrap_global.h"
+
+class SqliteWrap;
+
+// Distance functions over float32 vectors stored as BLOBs (little endian,
+// 4 bytes per component, no header).
+//
+// The kernels are chosen once at runtime : AVX-512F, AVX2+FMA, NEON or a
+// portable scalar fallback. They read the vectors in place with unaligned
+// loads, so blob memory handed out by SQLite is never copied.
+//
+// SQL functions registered by register_functions() :
+//     vec_dot(a, b)       dot product
+//     vec_l2(a, b)        euclidean distance
+//     vec_cosine(a, b)    cosine distance, 1 - cos(a, b) (NULL for a zero vector)
+//     vec_normalize(a)    a / |a|
+// so that top-k ranking stays inside SQLite's bounded sorter :
+//     SELECT id FROM items ORDER BY vec_l2(embedding, ?) LIMIT 10;
+class SQLITEWRAP_EXPORT VectorFunctions
+{
+public:
+    static bool register_functions(SqliteWrap& db);
+
+    // pointers may be unaligned; n is the number of float components
+    static float dot(const void* a, const void* b, size_t n);
+    static float l2_squared(const void* a, const void* b, size_t n);
+    static float cosine_distance(const void* a, const void* b, size_t n);   // NaN for a zero vector
+    static void normalize(const void* a, float* out, size_t n);
+
+    // "avx512", "avx2", "neon" or "scalar"
+    static const char* get_kernel_name();
+    // force a kernel (benchmarks, tests); false if not supported by this CPU
+    static bool select_kernel(const std::string& name);
+};
+
+#endif // VECTORFUNCTIONS_H
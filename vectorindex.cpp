@@ -0,0 +1,1116 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "vectorindex.h"
+#include "logger.h"
+#include "vectorfunctions.h"
+#include "sqlitewrap.h"
+
+
+namespace
+{
+    enum class Metric { L2, Cosine, Dot };
+
+    const int unassigned = -1;               // list of the vectors stored before training
+    const int default_lists = 256;
+    const int default_probes = 16;
+    const int train_per_list = 64;           // default train_size = lists * train_per_list
+    const int sample_per_list = 256;         // k-means sample size
+    const int kmeans_iterations = 16;
+    const int reassign_batch = 1024;
+
+    // columns of the declared table
+    enum Column { VectorColumn, DistanceColumn, CommandColumn, KColumn, ProbesColumn };
+
+    // idxNum bits, the arguments of xFilter follow the same order
+    enum Plan { MatchPlan = 1, KPlan = 2, ProbesPlan = 4, LimitPlan = 8, OffsetPlan = 16, RowidPlan = 32 };
+
+    struct IndexTable : sqlite3_vtab
+    {
+        IndexTable() : sqlite3_vtab() {}
+
+        sqlite3* db = nullptr;
+        std::string schema;
+        std::string name;
+
+        int dimension = 0;
+        int lists = default_lists;
+        int probes = default_probes;
+        Metric metric = Metric::L2;
+        sqlite3_int64 train_size = 0;        // 0 : lists * train_per_list
+
+        std::vector<float> centroids;        // lists * dimension, empty until trained
+        sqlite3_int64 version = -1;          // centroid version in memory, 0 untrained, -1 unknown
+
+        sqlite3_stmt* version_statement = nullptr;
+        sqlite3_stmt* insert_statement = nullptr;
+        sqlite3_stmt* delete_statement = nullptr;
+        sqlite3_stmt* rowid_statement = nullptr;
+        sqlite3_stmt* vector_statement = nullptr;
+        sqlite3_stmt* list_statement = nullptr;
+    };
+
+    struct Candidate
+    {
+        float distance;
+        sqlite3_int64 rowid;
+
+        bool operator<(const Candidate& other) const
+        {
+            return distance < other.distance || (distance == other.distance && rowid < other.rowid);
+        }
+    };
+
+    struct IndexCursor : sqlite3_vtab_cursor
+    {
+        IndexCursor() : sqlite3_vtab_cursor() {}
+
+        std::vector<Candidate> results;      // MATCH plan, ordered by distance
+        size_t position = 0;
+        sqlite3_stmt* scan = nullptr;        // plans without MATCH
+        bool eof = true;
+        sqlite3_int64 k = 0;
+        sqlite3_int64 probes = 0;
+    };
+
+
+    int set_error(sqlite3_vtab* vtab, const std::string& message)
+    {
+        sqlite3_free(vtab->zErrMsg);
+        vtab->zErrMsg = sqlite3_mprintf("vec_ivf: %s", message.c_str());
+        return SQLITE_ERROR;
+    }
+
+    std::string shadow(const IndexTable* table, const char* suffix)
+    {
+        return SqliteWrap::quote_identifier(table->schema) + "." + SqliteWrap::quote_identifier(table->name + "_" + suffix);
+    }
+
+    int prepare(IndexTable* table, sqlite3_stmt*& statement, const std::string& sql)
+    {
+        if (statement) return SQLITE_OK;
+
+        int rc = sqlite3_prepare_v3(table->db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &statement, nullptr);
+        if (rc != SQLITE_OK)
+        {
+            set_error(table, sqlite3_errmsg(table->db));
+            statement = nullptr;
+        }
+        return rc;
+    }
+
+    void finalize_statements(IndexTable* table)
+    {
+        for (sqlite3_stmt** statement : { &table->version_statement, &table->insert_statement, &table->delete_statement,
+                                          &table->rowid_statement, &table->vector_statement, &table->list_statement })
+        {
+            sqlite3_finalize(*statement);
+            *statement = nullptr;
+        }
+    }
+
+    int execute(IndexTable* table, const std::string& sql)
+    {
+        char* error = nullptr;
+        int rc = sqlite3_exec(table->db, sql.c_str(), nullptr, nullptr, &error);
+        if (rc != SQLITE_OK) set_error(table, error ? error : sqlite3_errstr(rc));
+        sqlite3_free(error);
+        return rc;
+    }
+
+    const char* metric_name(Metric metric)
+    {
+        switch (metric)
+        {
+        case Metric::Cosine: return "cosine";
+        case Metric::Dot: return "dot";
+        default: return "l2";
+        }
+    }
+
+    bool parse_metric(const std::string& value, Metric& metric)
+    {
+        if (value == "l2") metric = Metric::L2;
+        else if (value == "cosine") metric = Metric::Cosine;
+        else if (value == "dot") metric = Metric::Dot;
+        else return false;
+        return true;
+    }
+
+    bool parse_integer(const std::string& value, sqlite3_int64 min, sqlite3_int64 max, sqlite3_int64& result)
+    {
+        char* end = nullptr;
+        long long parsed = std::strtoll(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || parsed < min || parsed > max) return false;
+
+        result = parsed;
+        return true;
+    }
+
+    std::string trim(const std::string& text)
+    {
+        size_t begin = 0, end = text.size();
+        while (begin < end && std::isspace(static_cast<unsigned char>(text[begin]))) begin++;
+        while (end > begin && std::isspace(static_cast<unsigned char>(text[end - 1]))) end--;
+
+        std::string result = text.substr(begin, end - begin);
+        if (result.size() >= 2 && (result.front() == '\'' || result.front() == '"') && result.back() == result.front())
+            result = result.substr(1, result.size() - 2);
+        return result;
+    }
+
+    // "key=value" argument of CREATE VIRTUAL TABLE
+    bool parse_option(IndexTable* table, const std::string& argument, std::string& error)
+    {
+        size_t equal = argument.find('=');
+        std::string key = trim(argument.substr(0, equal));
+        std::string value = equal == std::string::npos ? "" : trim(argument.substr(equal + 1));
+        std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+        sqlite3_int64 number = 0;
+        if (key == "dim" || key == "dimension")
+        {
+            if (!parse_integer(value, 1, 65536, number)) { error = "dim must be between 1 and 65536"; return false; }
+            table->dimension = static_cast<int>(number);
+        }
+        else if (key == "lists")
+        {
+            if (!parse_integer(value, 1, 65536, number)) { error = "lists must be between 1 and 65536"; return false; }
+            table->lists = static_cast<int>(number);
+        }
+        else if (key == "probes")
+        {
+            if (!parse_integer(value, 1, 65536, number)) { error = "probes must be between 1 and 65536"; return false; }
+            table->probes = static_cast<int>(number);
+        }
+        else if (key == "train_size")
+        {
+            if (!parse_integer(value, 0, std::numeric_limits<sqlite3_int64>::max(), number)) { error = "invalid train_size"; return false; }
+            table->train_size = number;
+        }
+        else if (key == "metric")
+        {
+            if (!parse_metric(value, table->metric)) { error = "metric must be l2, cosine or dot"; return false; }
+        }
+        else
+        {
+            error = "unknown option: " + key;
+            return false;
+        }
+
+        return true;
+    }
+
+
+    // distance used for ranking : squared for l2 (same order, no sqrt), +inf when undefined
+    float rank_distance(Metric metric, const void* a, const void* b, size_t n)
+    {
+        switch (metric)
+        {
+        case Metric::Cosine:
+        {
+            float distance = VectorFunctions::cosine_distance(a, b, n);
+            return std::isnan(distance) ? std::numeric_limits<float>::infinity() : distance;
+        }
+        case Metric::Dot:
+            return -VectorFunctions::dot(a, b, n);
+        default:
+            return VectorFunctions::l2_squared(a, b, n);
+        }
+    }
+
+    bool valid_vector(const IndexTable* table, sqlite3_value* value)
+    {
+        return sqlite3_value_type(value) == SQLITE_BLOB &&
+               sqlite3_value_bytes(value) == table->dimension * static_cast<int>(sizeof(float));
+    }
+
+    std::string vector_error(const IndexTable* table)
+    {
+        return "vector must be a float32 blob of " + std::to_string(table->dimension) + " components";
+    }
+
+    sqlite3_int64 train_threshold(const IndexTable* table)
+    {
+        return table->train_size > 0 ? table->train_size : static_cast<sqlite3_int64>(table->lists) * train_per_list;
+    }
+
+
+    // reload the centroids when another statement / connection trained the index
+    int check_version(IndexTable* table)
+    {
+        int rc = prepare(table, table->version_statement, "SELECT value FROM " + shadow(table, "config") + " WHERE key = 'version';");
+        if (rc != SQLITE_OK) return rc;
+
+        rc = sqlite3_step(table->version_statement);
+        sqlite3_int64 version = rc == SQLITE_ROW ? sqlite3_column_int64(table->version_statement, 0) : 0;
+        sqlite3_reset(table->version_statement);
+        if (rc != SQLITE_ROW) return set_error(table, rc == SQLITE_DONE ? "missing version in " + shadow(table, "config") : sqlite3_errmsg(table->db));
+
+        if (version == table->version) return SQLITE_OK;
+
+        table->centroids.clear();
+        table->version = -1;
+
+        if (version > 0)
+        {
+            sqlite3_stmt* statement = nullptr;
+            std::string sql = "SELECT id, vector FROM " + shadow(table, "centroids") + " ORDER BY id;";
+            if (sqlite3_prepare_v2(table->db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK)
+            {
+                sqlite3_finalize(statement);
+                return set_error(table, sqlite3_errmsg(table->db));
+            }
+
+            size_t dimension = static_cast<size_t>(table->dimension);
+            std::vector<float> centroids(static_cast<size_t>(table->lists) * dimension);
+            int count = 0;
+
+            while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+            {
+                sqlite3_int64 id = sqlite3_column_int64(statement, 0);
+                const void* data = sqlite3_column_blob(statement, 1);
+                if (id < 0 || id >= table->lists || !data ||
+                    sqlite3_column_bytes(statement, 1) != static_cast<int>(dimension * sizeof(float)))
+                {
+                    rc = SQLITE_CORRUPT_VTAB;
+                    break;
+                }
+
+                std::memcpy(&centroids[static_cast<size_t>(id) * dimension], data, dimension * sizeof(float));
+                count++;
+            }
+
+            sqlite3_finalize(statement);
+
+            if (rc != SQLITE_DONE || count != table->lists)
+                return set_error(table, "corrupt centroids in " + shadow(table, "centroids"));
+
+            table->centroids = std::move(centroids);
+        }
+
+        table->version = version;
+        return SQLITE_OK;
+    }
+
+    bool is_trained(const IndexTable* table)
+    {
+        return !table->centroids.empty();
+    }
+
+    int nearest_list(const IndexTable* table, const void* vector)
+    {
+        if (!is_trained(table)) return unassigned;
+
+        size_t dimension = static_cast<size_t>(table->dimension);
+        int best = 0;
+        float best_distance = std::numeric_limits<float>::infinity();
+
+        for (int list = 0; list < table->lists; list++)
+        {
+            float distance = rank_distance(table->metric, vector, &table->centroids[list * dimension], dimension);
+            if (distance < best_distance)
+            {
+                best_distance = distance;
+                best = list;
+            }
+        }
+
+        return best;
+    }
+
+    void nearest_lists(const IndexTable* table, const void* vector, int count, std::vector<int>& result)
+    {
+        result.clear();
+        if (!is_trained(table)) return;
+
+        size_t dimension = static_cast<size_t>(table->dimension);
+        std::vector<std::pair<float, int>> distances(static_cast<size_t>(table->lists));
+        for (int list = 0; list < table->lists; list++)
+            distances[list] = { rank_distance(table->metric, vector, &table->centroids[list * dimension], dimension), list };
+
+        count = std::min(count, table->lists);
+        std::partial_sort(distances.begin(), distances.begin() + count, distances.end());
+        for (int i = 0; i < count; i++) result.push_back(distances[i].second);
+    }
+
+
+    // Lloyd's k-means on the sample (n x dimension), random initialisation, l2 assignment.
+    // spherical : the sample is normalized and so are the centroids (cosine metric).
+    void kmeans(const std::vector<float>& sample, size_t n, size_t dimension, int lists, bool spherical, std::vector<float>& centroids)
+    {
+        std::mt19937_64 random(0x5157a1e5);      // deterministic : same data, same index
+        size_t k = static_cast<size_t>(lists);
+
+        std::vector<size_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        centroids.assign(k * dimension, 0.0f);
+        for (size_t c = 0; c < k; c++)
+        {
+            std::swap(order[c], order[c + random() % (n - c)]);
+            std::copy_n(&sample[order[c] * dimension], dimension, &centroids[c * dimension]);
+        }
+
+        std::vector<int> assignment(n, unassigned);
+        std::vector<double> sums(k * dimension);
+        std::vector<size_t> counts(k);
+
+        for (int iteration = 0; iteration < kmeans_iterations; iteration++)
+        {
+            size_t changed = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                const float* vector = &sample[i * dimension];
+                int best = 0;
+                float best_distance = std::numeric_limits<float>::infinity();
+                for (size_t c = 0; c < k; c++)
+                {
+                    float distance = VectorFunctions::l2_squared(vector, &centroids[c * dimension], dimension);
+                    if (distance < best_distance)
+                    {
+                        best_distance = distance;
+                        best = static_cast<int>(c);
+                    }
+                }
+
+                if (assignment[i] != best) changed++;
+                assignment[i] = best;
+            }
+
+            if (changed == 0) break;
+
+            std::fill(sums.begin(), sums.end(), 0.0);
+            std::fill(counts.begin(), counts.end(), 0);
+            for (size_t i = 0; i < n; i++)
+            {
+                size_t c = static_cast<size_t>(assignment[i]);
+                counts[c]++;
+                for (size_t d = 0; d < dimension; d++) sums[c * dimension + d] += sample[i * dimension + d];
+            }
+
+            for (size_t c = 0; c < k; c++)
+            {
+                float* centroid = &centroids[c * dimension];
+
+                if (counts[c] == 0)
+                {
+                    // empty list : restart from a random sample vector
+                    std::copy_n(&sample[(random() % n) * dimension], dimension, centroid);
+                    continue;
+                }
+
+                for (size_t d = 0; d < dimension; d++) centroid[d] = static_cast<float>(sums[c * dimension + d] / counts[c]);
+                if (spherical) VectorFunctions::normalize(centroid, centroid, dimension);
+            }
+        }
+    }
+
+    // move every stored vector to the list of its nearest centroid, by batches of ids
+    int reassign(IndexTable* table)
+    {
+        sqlite3_stmt* select = nullptr;
+        sqlite3_stmt* update = nullptr;
+        std::string select_sql = "SELECT id, list, vector FROM " + shadow(table, "vectors") + " WHERE id >= ? ORDER BY id LIMIT " + std::to_string(reassign_batch) + ";";
+        std::string update_sql = "UPDATE " + shadow(table, "vectors") + " SET list = ? WHERE id = ?;";
+
+        if (sqlite3_prepare_v2(table->db, select_sql.c_str(), -1, &select, nullptr) != SQLITE_OK ||
+            sqlite3_prepare_v2(table->db, update_sql.c_str(), -1, &update, nullptr) != SQLITE_OK)
+        {
+            set_error(table, sqlite3_errmsg(table->db));
+            sqlite3_finalize(select);
+            sqlite3_finalize(update);
+            return SQLITE_ERROR;
+        }
+
+        std::vector<std::pair<sqlite3_int64, int>> moves;
+        sqlite3_int64 next = std::numeric_limits<sqlite3_int64>::min();
+        bool done = false;
+        int rc = SQLITE_OK;
+
+        while (!done && rc == SQLITE_OK)
+        {
+            moves.clear();
+            int rows = 0;
+
+            sqlite3_bind_int64(select, 1, next);
+            while ((rc = sqlite3_step(select)) == SQLITE_ROW)
+            {
+                sqlite3_int64 id = sqlite3_column_int64(select, 0);
+                int list = sqlite3_column_int(select, 1);
+                const void* data = sqlite3_column_blob(select, 2);
+                rows++;
+
+                if (id == std::numeric_limits<sqlite3_int64>::max()) done = true;
+                else next = id + 1;
+
+                if (!data || sqlite3_column_bytes(select, 2) != table->dimension * static_cast<int>(sizeof(float))) continue;
+
+                int nearest = nearest_list(table, data);
+                if (nearest != list) moves.emplace_back(id, nearest);
+            }
+            sqlite3_reset(select);
+
+            if (rc != SQLITE_DONE)
+            {
+                set_error(table, sqlite3_errmsg(table->db));
+                break;
+            }
+            rc = SQLITE_OK;
+            if (rows < reassign_batch) done = true;
+
+            for (const auto& move : moves)
+            {
+                sqlite3_bind_int(update, 1, move.second);
+                sqlite3_bind_int64(update, 2, move.first);
+                int step = sqlite3_step(update);
+                sqlite3_reset(update);
+
+                if (step != SQLITE_DONE)
+                {
+                    rc = set_error(table, sqlite3_errmsg(table->db));
+                    break;
+                }
+            }
+        }
+
+        sqlite3_finalize(select);
+        sqlite3_finalize(update);
+        return rc;
+    }
+
+    int train(IndexTable* table)
+    {
+        size_t dimension = static_cast<size_t>(table->dimension);
+        sqlite3_int64 sample_size = static_cast<sqlite3_int64>(table->lists) * sample_per_list;
+
+        // random sample of the stored vectors
+        sqlite3_stmt* statement = nullptr;
+        std::string sql = "SELECT vector FROM " + shadow(table, "vectors") + " ORDER BY random() LIMIT ?;";
+        if (sqlite3_prepare_v2(table->db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK)
+        {
+            sqlite3_finalize(statement);
+            return set_error(table, sqlite3_errmsg(table->db));
+        }
+
+        sqlite3_bind_int64(statement, 1, sample_size);
+
+        std::vector<float> sample;
+        int rc;
+        while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+        {
+            const void* data = sqlite3_column_blob(statement, 0);
+            if (!data || sqlite3_column_bytes(statement, 0) != static_cast<int>(dimension * sizeof(float))) continue;
+
+            size_t offset = sample.size();
+            sample.resize(offset + dimension);
+            if (table->metric == Metric::Cosine) VectorFunctions::normalize(data, &sample[offset], dimension);
+            else std::memcpy(&sample[offset], data, dimension * sizeof(float));
+        }
+
+        sqlite3_finalize(statement);
+        if (rc != SQLITE_DONE) return set_error(table, sqlite3_errmsg(table->db));
+
+        size_t n = sample.size() / dimension;
+        if (n < static_cast<size_t>(table->lists))
+            return set_error(table, "at least " + std::to_string(table->lists) + " vectors are needed to train the index");
+
+        std::vector<float> centroids;
+        kmeans(sample, n, dimension, table->lists, table->metric == Metric::Cosine, centroids);
+
+        // store the centroids and bump the version, then move the vectors to their lists
+        rc = execute(table, "DELETE FROM " + shadow(table, "centroids") + ";");
+        if (rc != SQLITE_OK) return rc;
+
+        sql = "INSERT INTO " + shadow(table, "centroids") + "(id, vector) VALUES (?, ?);";
+        if (sqlite3_prepare_v2(table->db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK)
+        {
+            sqlite3_finalize(statement);
+            return set_error(table, sqlite3_errmsg(table->db));
+        }
+
+        for (int list = 0; list < table->lists && rc == SQLITE_OK; list++)
+        {
+            sqlite3_bind_int(statement, 1, list);
+            sqlite3_bind_blob(statement, 2, &centroids[list * dimension], static_cast<int>(dimension * sizeof(float)), SQLITE_STATIC);
+            if (sqlite3_step(statement) != SQLITE_DONE) rc = set_error(table, sqlite3_errmsg(table->db));
+            sqlite3_reset(statement);
+        }
+
+        sqlite3_finalize(statement);
+        if (rc != SQLITE_OK) return rc;
+
+        rc = execute(table, "UPDATE " + shadow(table, "config") + " SET value = value + 1 WHERE key = 'version';");
+        if (rc == SQLITE_OK) rc = check_version(table);
+        if (rc == SQLITE_OK) rc = reassign(table);
+
+        return rc;
+    }
+
+    // 'autotrain' : only once train_size vectors wait in the unassigned list
+    int train_if_due(IndexTable* table)
+    {
+        int rc = check_version(table);
+        if (rc != SQLITE_OK) return rc;
+
+        sqlite3_stmt* statement = nullptr;
+        std::string sql = "SELECT count(*) FROM " + shadow(table, "vectors") + " WHERE list = " + std::to_string(unassigned) + ";";
+        if (sqlite3_prepare_v2(table->db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK || sqlite3_step(statement) != SQLITE_ROW)
+        {
+            sqlite3_finalize(statement);
+            return set_error(table, sqlite3_errmsg(table->db));
+        }
+
+        sqlite3_int64 waiting = sqlite3_column_int64(statement, 0);
+        sqlite3_finalize(statement);
+
+        return waiting >= train_threshold(table) ? train(table) : SQLITE_OK;
+    }
+
+
+    int insert_vector(IndexTable* table, sqlite3_int64 rowid, sqlite3_value* value)
+    {
+        if (!valid_vector(table, value)) return set_error(table, vector_error(table));
+
+        int rc = check_version(table);
+        if (rc != SQLITE_OK) return rc;
+
+        rc = prepare(table, table->insert_statement, "INSERT INTO " + shadow(table, "vectors") + "(list, id, vector) VALUES (?, ?, ?);");
+        if (rc != SQLITE_OK) return rc;
+
+        const void* data = sqlite3_value_blob(value);
+        int list = nearest_list(table, data);
+
+        sqlite3_bind_int(table->insert_statement, 1, list);
+        sqlite3_bind_int64(table->insert_statement, 2, rowid);
+        sqlite3_bind_blob(table->insert_statement, 3, data, sqlite3_value_bytes(value), SQLITE_STATIC);
+        rc = sqlite3_step(table->insert_statement);
+        sqlite3_reset(table->insert_statement);
+
+        if (rc != SQLITE_DONE)
+        {
+            set_error(table, sqlite3_errmsg(table->db));
+            return rc == SQLITE_CONSTRAINT ? SQLITE_CONSTRAINT : SQLITE_ERROR;
+        }
+
+        // not trained yet : the vector stays in the unassigned list until 'train' or 'autotrain'
+        return SQLITE_OK;
+    }
+
+    int delete_vector(IndexTable* table, sqlite3_int64 rowid)
+    {
+        int rc = prepare(table, table->delete_statement, "DELETE FROM " + shadow(table, "vectors") + " WHERE id = ?;");
+        if (rc != SQLITE_OK) return rc;
+
+        sqlite3_bind_int64(table->delete_statement, 1, rowid);
+        rc = sqlite3_step(table->delete_statement);
+        sqlite3_reset(table->delete_statement);
+
+        if (rc != SQLITE_DONE) return set_error(table, sqlite3_errmsg(table->db));
+
+        return SQLITE_OK;
+    }
+
+    int next_rowid(IndexTable* table, sqlite3_int64& rowid)
+    {
+        int rc = prepare(table, table->rowid_statement, "SELECT coalesce(max(id), 0) + 1 FROM " + shadow(table, "vectors") + ";");
+        if (rc != SQLITE_OK) return rc;
+
+        rc = sqlite3_step(table->rowid_statement);
+        rowid = sqlite3_column_int64(table->rowid_statement, 0);
+        sqlite3_reset(table->rowid_statement);
+
+        return rc == SQLITE_ROW ? SQLITE_OK : set_error(table, sqlite3_errmsg(table->db));
+    }
+
+
+    // xCreate / xConnect
+    int index_init(sqlite3* db, int argc, const char* const* argv, sqlite3_vtab** vtab, char** error, bool create)
+    {
+        auto* table = new IndexTable();
+        table->db = db;
+        table->schema = argv[1];
+        table->name = argv[2];
+
+        std::string message;
+        int rc = SQLITE_OK;
+
+        if (create)
+        {
+            for (int i = 3; i < argc && message.empty(); i++) parse_option(table, argv[i], message);
+            if (message.empty() && table->dimension == 0) message = "dim option is required, e.g. vec_ivf(dim=128)";
+            table->probes = std::min(table->probes, table->lists);
+
+            if (message.empty())
+            {
+                std::string sql =
+                    "CREATE TABLE " + shadow(table, "config") + "(key TEXT PRIMARY KEY, value) WITHOUT ROWID;"
+                    "CREATE TABLE " + shadow(table, "centroids") + "(id INTEGER PRIMARY KEY, vector BLOB NOT NULL);"
+                    "CREATE TABLE " + shadow(table, "vectors") + "(list INTEGER NOT NULL, id INTEGER NOT NULL UNIQUE, vector BLOB NOT NULL, PRIMARY KEY(list, id)) WITHOUT ROWID;"
+                    "INSERT INTO " + shadow(table, "config") + "(key, value) VALUES "
+                    "('dim', " + std::to_string(table->dimension) + "), "
+                    "('lists', " + std::to_string(table->lists) + "), "
+                    "('probes', " + std::to_string(table->probes) + "), "
+                    "('metric', '" + metric_name(table->metric) + "'), "
+                    "('train_size', " + std::to_string(table->train_size) + "), "
+                    "('version', 0);";
+
+                if ((rc = execute(table, sql)) != SQLITE_OK) message = table->zErrMsg ? table->zErrMsg : "cannot create the shadow tables";
+            }
+        }
+        else
+        {
+            sqlite3_stmt* statement = nullptr;
+            std::string sql = "SELECT key, value FROM " + shadow(table, "config") + ";";
+            rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr);
+            if (rc != SQLITE_OK) message = sqlite3_errmsg(db);
+
+            while (rc == SQLITE_OK && sqlite3_step(statement) == SQLITE_ROW)
+            {
+                std::string key = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
+                const unsigned char* value = sqlite3_column_text(statement, 1);
+
+                if (key != "version" && value && !parse_option(table, key + "=" + reinterpret_cast<const char*>(value), message))
+                    break;
+            }
+
+            sqlite3_finalize(statement);
+            if (message.empty() && table->dimension == 0) message = "corrupt " + shadow(table, "config");
+        }
+
+        if (message.empty())
+        {
+            std::string declaration = "CREATE TABLE x(vector, distance, " + SqliteWrap::quote_identifier(table->name) + " HIDDEN, k HIDDEN, probes HIDDEN);";
+            if ((rc = sqlite3_declare_vtab(db, declaration.c_str())) != SQLITE_OK) message = sqlite3_errmsg(db);
+        }
+
+        if (!message.empty())
+        {
+            *error = sqlite3_mprintf("vec_ivf: %s", message.c_str());
+            sqlite3_free(table->zErrMsg);
+            delete table;
+            return rc == SQLITE_OK ? SQLITE_ERROR : rc;
+        }
+
+        *vtab = table;
+        return SQLITE_OK;
+    }
+
+    int index_create(sqlite3* db, void*, int argc, const char* const* argv, sqlite3_vtab** vtab, char** error)
+    {
+        return index_init(db, argc, argv, vtab, error, true);
+    }
+
+    int index_connect(sqlite3* db, void*, int argc, const char* const* argv, sqlite3_vtab** vtab, char** error)
+    {
+        return index_init(db, argc, argv, vtab, error, false);
+    }
+
+    int index_disconnect(sqlite3_vtab* vtab)
+    {
+        IndexTable* table = static_cast<IndexTable*>(vtab);
+        finalize_statements(table);
+        sqlite3_free(table->zErrMsg);
+        delete table;
+        return SQLITE_OK;
+    }
+
+    int index_destroy(sqlite3_vtab* vtab)
+    {
+        IndexTable* table = static_cast<IndexTable*>(vtab);
+        finalize_statements(table);
+
+        int rc = execute(table, "DROP TABLE IF EXISTS " + shadow(table, "config") + ";"
+                                "DROP TABLE IF EXISTS " + shadow(table, "centroids") + ";"
+                                "DROP TABLE IF EXISTS " + shadow(table, "vectors") + ";");
+        if (rc != SQLITE_OK) return rc;
+
+        return index_disconnect(vtab);
+    }
+
+    int index_rename(sqlite3_vtab* vtab, const char* name)
+    {
+        IndexTable* table = static_cast<IndexTable*>(vtab);
+        finalize_statements(table);
+
+        std::string sql;
+        for (const char* suffix : { "config", "centroids", "vectors" })
+            sql += "ALTER TABLE " + shadow(table, suffix) + " RENAME TO " + SqliteWrap::quote_identifier(std::string(name) + "_" + suffix) + ";";
+
+        int rc = execute(table, sql);
+        if (rc == SQLITE_OK) table->name = name;
+        return rc;
+    }
+
+    int index_shadow_name(const char* suffix)
+    {
+        for (const char* name : { "config", "centroids", "vectors" })
+            if (sqlite3_stricmp(suffix, name) == 0) return 1;
+        return 0;
+    }
+
+    int index_begin(sqlite3_vtab*)
+    {
+        return SQLITE_OK;
+    }
+
+    int index_rollback(sqlite3_vtab* vtab)
+    {
+        // the in-memory centroids may describe a rolled back training
+        IndexTable* table = static_cast<IndexTable*>(vtab);
+        table->version = -1;
+        return SQLITE_OK;
+    }
+
+    int index_rollback_to(sqlite3_vtab* vtab, int)
+    {
+        return index_rollback(vtab);
+    }
+
+
+    int index_best_index(sqlite3_vtab*, sqlite3_index_info* info)
+    {
+        int match = -1, k = -1, probes = -1, limit = -1, offset = -1, rowid = -1;
+        bool unusable_match = false;
+
+        for (int i = 0; i < info->nConstraint; i++)
+        {
+            const auto& constraint = info->aConstraint[i];
+
+            if (constraint.iColumn == CommandColumn && constraint.op == SQLITE_INDEX_CONSTRAINT_MATCH)
+            {
+                if (constraint.usable) match = i;
+                else unusable_match = true;
+            }
+            else if (!constraint.usable) continue;
+            else if (constraint.op == SQLITE_INDEX_CONSTRAINT_EQ)
+            {
+                if (constraint.iColumn == KColumn) k = i;
+                else if (constraint.iColumn == ProbesColumn) probes = i;
+                else if (constraint.iColumn < 0) rowid = i;
+            }
+            else if (constraint.op == SQLITE_INDEX_CONSTRAINT_LIMIT) limit = i;
+            else if (constraint.op == SQLITE_INDEX_CONSTRAINT_OFFSET) offset = i;
+        }
+
+        // MATCH has no SQL function behind it : this plan must not be chosen
+        if (match < 0 && unusable_match) return SQLITE_CONSTRAINT;
+
+        int argument = 1;
+        auto use = [&](int constraint, int plan, bool omit)
+        {
+            info->aConstraintUsage[constraint].argvIndex = argument++;
+            info->aConstraintUsage[constraint].omit = omit;
+            info->idxNum |= plan;
+        };
+
+        info->idxNum = 0;
+
+        if (match >= 0)
+        {
+            use(match, MatchPlan, true);
+            if (k >= 0) use(k, KPlan, true);
+            if (probes >= 0) use(probes, ProbesPlan, true);
+            if (limit >= 0)
+            {
+                use(limit, LimitPlan, false);
+                if (offset >= 0) use(offset, OffsetPlan, false);
+            }
+
+            info->estimatedCost = 1000.0;
+            info->estimatedRows = 10;
+            if (info->nOrderBy == 1 && info->aOrderBy[0].iColumn == DistanceColumn && !info->aOrderBy[0].desc)
+                info->orderByConsumed = 1;
+        }
+        else if (rowid >= 0)
+        {
+            use(rowid, RowidPlan, true);
+            info->estimatedCost = 10.0;
+            info->estimatedRows = 1;
+            info->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+        }
+        else
+        {
+            info->estimatedCost = 1000000.0;
+            if (info->nOrderBy == 1 && info->aOrderBy[0].iColumn < 0 && !info->aOrderBy[0].desc)
+                info->orderByConsumed = 1;
+        }
+
+        return SQLITE_OK;
+    }
+
+    int index_open(sqlite3_vtab*, sqlite3_vtab_cursor** cursor)
+    {
+        *cursor = new IndexCursor();
+        return SQLITE_OK;
+    }
+
+    int index_close(sqlite3_vtab_cursor* vtab_cursor)
+    {
+        IndexCursor* cursor = static_cast<IndexCursor*>(vtab_cursor);
+        sqlite3_finalize(cursor->scan);
+        delete cursor;
+        return SQLITE_OK;
+    }
+
+    int index_filter(sqlite3_vtab_cursor* vtab_cursor, int plan, const char*, int, sqlite3_value** argv)
+    {
+        IndexCursor* cursor = static_cast<IndexCursor*>(vtab_cursor);
+        IndexTable* table = static_cast<IndexTable*>(cursor->pVtab);
+
+        cursor->results.clear();
+        cursor->position = 0;
+        cursor->eof = true;
+        sqlite3_finalize(cursor->scan);
+        cursor->scan = nullptr;
+
+        // no MATCH : rowid lookup or full scan of the stored vectors
+        if (!(plan & MatchPlan))
+        {
+            std::string sql = "SELECT id, vector FROM " + shadow(table, "vectors") + ((plan & RowidPlan) ? " WHERE id = ?;" : " ORDER BY id;");
+            if (sqlite3_prepare_v2(table->db, sql.c_str(), -1, &cursor->scan, nullptr) != SQLITE_OK)
+                return set_error(table, sqlite3_errmsg(table->db));
+            if (plan & RowidPlan) sqlite3_bind_value(cursor->scan, 1, argv[0]);
+
+            int rc = sqlite3_step(cursor->scan);
+            if (rc != SQLITE_ROW && rc != SQLITE_DONE) return set_error(table, sqlite3_errmsg(table->db));
+            cursor->eof = rc == SQLITE_DONE;
+            return SQLITE_OK;
+        }
+
+        int argument = 0;
+        sqlite3_value* query = argv[argument++];
+        sqlite3_int64 k = 0, probes = table->probes, limit = -1, offset = 0;
+        if (plan & KPlan) k = sqlite3_value_int64(argv[argument++]);
+        if (plan & ProbesPlan) probes = sqlite3_value_int64(argv[argument++]);
+        if (plan & LimitPlan) limit = sqlite3_value_int64(argv[argument++]);
+        if (plan & OffsetPlan) offset = sqlite3_value_int64(argv[argument++]);
+
+        if (!valid_vector(table, query)) return set_error(table, "query " + vector_error(table));
+        if (k < 0) return set_error(table, "k must be positive");
+        if (probes < 1) return set_error(table, "probes must be positive");
+        if (k == 0 && limit >= 0) k = limit + std::max<sqlite3_int64>(offset, 0);     // top-k from LIMIT / OFFSET
+
+        int rc = check_version(table);
+        if (rc != SQLITE_OK) return rc;
+
+        const void* vector = sqlite3_value_blob(query);
+        size_t dimension = static_cast<size_t>(table->dimension);
+
+        std::vector<int> lists;
+        nearest_lists(table, vector, static_cast<int>(std::min<sqlite3_int64>(probes, table->lists)), lists);
+        lists.push_back(unassigned);
+
+        rc = prepare(table, table->list_statement, "SELECT id, vector FROM " + shadow(table, "vectors") + " WHERE list = ?;");
+        if (rc != SQLITE_OK) return rc;
+
+        // bounded max-heap on the distance : the k best candidates of the probed lists
+        std::vector<Candidate>& heap = cursor->results;
+        for (int list : lists)
+        {
+            sqlite3_bind_int(table->list_statement, 1, list);
+
+            while ((rc = sqlite3_step(table->list_statement)) == SQLITE_ROW)
+            {
+                const void* data = sqlite3_column_blob(table->list_statement, 1);
+                if (!data || sqlite3_column_bytes(table->list_statement, 1) != static_cast<int>(dimension * sizeof(float))) continue;
+
+                Candidate candidate{ rank_distance(table->metric, vector, data, dimension), sqlite3_column_int64(table->list_statement, 0) };
+                if (k > 0 && static_cast<sqlite3_int64>(heap.size()) >= k)
+                {
+                    if (!(candidate < heap.front())) continue;
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.back() = candidate;
+                }
+                else heap.push_back(candidate);
+                std::push_heap(heap.begin(), heap.end());
+            }
+
+            sqlite3_reset(table->list_statement);
+            if (rc != SQLITE_DONE) return set_error(table, sqlite3_errmsg(table->db));
+        }
+
+        std::sort_heap(heap.begin(), heap.end());
+
+        cursor->k = k;
+        cursor->probes = probes;
+        cursor->eof = heap.empty();
+        return SQLITE_OK;
+    }
+
+    int index_next(sqlite3_vtab_cursor* vtab_cursor)
+    {
+        IndexCursor* cursor = static_cast<IndexCursor*>(vtab_cursor);
+
+        if (cursor->scan)
+        {
+            int rc = sqlite3_step(cursor->scan);
+            if (rc != SQLITE_ROW && rc != SQLITE_DONE) return set_error(cursor->pVtab, sqlite3_errmsg(sqlite3_db_handle(cursor->scan)));
+            cursor->eof = rc == SQLITE_DONE;
+            return SQLITE_OK;
+        }
+
+        cursor->position++;
+        cursor->eof = cursor->position >= cursor->results.size();
+        return SQLITE_OK;
+    }
+
+    int index_eof(sqlite3_vtab_cursor* vtab_cursor)
+    {
+        return static_cast<IndexCursor*>(vtab_cursor)->eof;
+    }
+
+    int index_rowid(sqlite3_vtab_cursor* vtab_cursor, sqlite3_int64* rowid)
+    {
+        IndexCursor* cursor = static_cast<IndexCursor*>(vtab_cursor);
+        *rowid = cursor->scan ? sqlite3_column_int64(cursor->scan, 0) : cursor->results[cursor->position].rowid;
+        return SQLITE_OK;
+    }
+
+    int index_column(sqlite3_vtab_cursor* vtab_cursor, sqlite3_context* context, int column)
+    {
+        IndexCursor* cursor = static_cast<IndexCursor*>(vtab_cursor);
+        IndexTable* table = static_cast<IndexTable*>(cursor->pVtab);
+
+        switch (column)
+        {
+        case VectorColumn:
+        {
+            if (cursor->scan)
+            {
+                sqlite3_result_value(context, sqlite3_column_value(cursor->scan, 1));
+                return SQLITE_OK;
+            }
+
+            int rc = prepare(table, table->vector_statement, "SELECT vector FROM " + shadow(table, "vectors") + " WHERE id = ?;");
+            if (rc != SQLITE_OK) return rc;
+
+            sqlite3_bind_int64(table->vector_statement, 1, cursor->results[cursor->position].rowid);
+            if (sqlite3_step(table->vector_statement) == SQLITE_ROW) sqlite3_result_value(context, sqlite3_column_value(table->vector_statement, 0));
+            sqlite3_reset(table->vector_statement);
+            return SQLITE_OK;
+        }
+        case DistanceColumn:
+            if (!cursor->scan)
+            {
+                float distance = cursor->results[cursor->position].distance;
+                if (std::isinf(distance)) break;
+                sqlite3_result_double(context, table->metric == Metric::L2 ? std::sqrt(distance) : distance);
+                return SQLITE_OK;
+            }
+            break;
+        case KColumn:
+            if (!cursor->scan && cursor->k > 0)
+            {
+                sqlite3_result_int64(context, cursor->k);
+                return SQLITE_OK;
+            }
+            break;
+        case ProbesColumn:
+            if (!cursor->scan)
+            {
+                sqlite3_result_int64(context, cursor->probes);
+                return SQLITE_OK;
+            }
+            break;
+        default:
+            break;
+        }
+
+        sqlite3_result_null(context);
+        return SQLITE_OK;
+    }
+
+    int index_update(sqlite3_vtab* vtab, int argc, sqlite3_value** argv, sqlite3_int64* rowid)
+    {
+        IndexTable* table = static_cast<IndexTable*>(vtab);
+
+        // DELETE
+        if (argc == 1) return delete_vector(table, sqlite3_value_int64(argv[0]));
+
+        // INSERT INTO vec_idx(vec_idx) VALUES ('train') / ('autotrain')
+        sqlite3_value* command = argv[2 + CommandColumn];
+        if (sqlite3_value_type(command) != SQLITE_NULL)
+        {
+            const char* text = reinterpret_cast<const char*>(sqlite3_value_text(command));
+            bool insert = sqlite3_value_type(argv[0]) == SQLITE_NULL;
+            if (insert && text && sqlite3_stricmp(text, "train") == 0) return train(table);
+            if (insert && text && sqlite3_stricmp(text, "autotrain") == 0) return train_if_due(table);
+            return set_error(table, std::string("unknown command: ") + (text ? text : ""));
+        }
+
+        sqlite3_int64 new_rowid = 0;
+        if (sqlite3_value_type(argv[1]) != SQLITE_NULL) new_rowid = sqlite3_value_int64(argv[1]);
+        else
+        {
+            int rc = next_rowid(table, new_rowid);
+            if (rc != SQLITE_OK) return rc;
+        }
+
+        // UPDATE : remove the old row, then insert it again (possibly in another list)
+        if (sqlite3_value_type(argv[0]) != SQLITE_NULL)
+        {
+            int rc = delete_vector(table, sqlite3_value_int64(argv[0]));
+            if (rc != SQLITE_OK) return rc;
+        }
+
+        int rc = insert_vector(table, new_rowid, argv[2 + VectorColumn]);
+        if (rc == SQLITE_OK) *rowid = new_rowid;
+        return rc;
+    }
+
+
+    sqlite3_module make_index_module()
+    {
+        sqlite3_module module {};
+        module.iVersion = 3;                 // xShadowName
+        module.xCreate = index_create;
+        module.xConnect = index_connect;
+        module.xBestIndex = index_best_index;
+        module.xDisconnect = index_disconnect;
+        module.xDestroy = index_destroy;
+        module.xOpen = index_open;
+        module.xClose = index_close;
+        module.xFilter = index_filter;
+        module.xNext = index_next;
+        module.xEof = index_eof;
+        module.xColumn = index_column;
+        module.xRowid = index_rowid;
+        module.xUpdate = index_update;
+        module.xBegin = index_begin;
+        module.xRollback = index_rollback;
+        module.xRename = index_rename;
+        module.xRollbackTo = index_rollback_to;
+        module.xShadowName = index_shadow_name;
+        return module;
+    }
+
+    sqlite3_module index_module = make_index_module();
+}
+
+
+bool VectorIndex::register_module(SqliteWrap &db)
+{
+    sqlite3* handle = db.get_handle();
+    if (!handle)
+    {
+        SQLITEWRAP_LOG_ERROR("VectorIndex::register_module(...) - Error: Database not connected.");
+        return false;
+    }
+
+    int rc = sqlite3_create_module_v2(handle, "vec_ivf", &index_module, nullptr, nullptr);
+    if (rc != SQLITE_OK)
+    {
+        SQLITEWRAP_LOG_ERROR("VectorIndex::register_module(...) - Error: " << sqlite3_errmsg(handle));
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef VECTORINDEX_H
+#define VECTORINDEX_H
+
+#include "SqliteWrap_global.h"
+
+class SqliteWrap;
+
+// Approximate nearest neighbour index (IVF : inverted file of k-means lists) over
+// float32 vectors, exposed as the "vec_ivf" virtual table module. The index lives
+// in shadow tables of the same database file :
+//     <name>_config     dimension, metric, lists, probes, centroid version
+//     <name>_centroids  one float32 centroid per list
+//     <name>_vectors    (list, id, vector) clustered by list, probing a list is a range scan
+//
+//     CREATE VIRTUAL TABLE vec_idx USING vec_ivf(dim=128, lists=256, probes=16, metric=l2);
+//     INSERT INTO vec_idx(rowid, vector) VALUES (?, ?);
+//     SELECT rowid, distance FROM vec_idx WHERE vec_idx MATCH ? LIMIT 10;
+//     SELECT rowid, distance FROM vec_idx WHERE vec_idx MATCH ? AND k = 10 AND probes = 32;
+//     INSERT INTO vec_idx(vec_idx) VALUES ('train');
+//     INSERT INTO vec_idx(vec_idx) VALUES ('autotrain');      // only when train_size vectors wait
+//
+// Results come ordered by distance. The LIMIT bounds the search only when SQLite hands it
+// to the virtual table (recent versions); k = ? does it with any version.
+//
+// Until the index is trained, vectors are kept in an unassigned list scanned by every
+// query (exact search). Training (k-means on a sample, SIMD distances) never runs inside
+// an ordinary INSERT : 'autotrain' trains once train_size vectors are unassigned, default
+// 64 per list (e.g. after each batch of inserts), 'train' forces it and should be run
+// again when the data distribution has drifted. Once trained, inserts and updates are
+// assigned to the nearest centroid and deletes remove the row.
+//
+// metric : l2 (euclidean distance), cosine (1 - cos) or dot (negated inner product).
+class SQLITEWRAP_EXPORT VectorIndex
+{
+public:
+    static bool register_module(SqliteWrap& db);
+};
+
+#endif // VECTORINDEX_H